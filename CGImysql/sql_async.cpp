@@ -0,0 +1,571 @@
+#include <unistd.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/socket.h>
+#include <mysql/errmsg.h>
+
+#include "sql_async.h"
+
+static const int QUERY_TIMEOUT_MS = 5000;   // 查询或重连从开始到完成的最长时间
+static const int RECONNECT_MS = 1000;       // 连接断开后重连的间隔
+static const unsigned int IO_TIMEOUT_S = 5; // 客户端库单次读写的超时
+
+static long long now_ms()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+Async_sql::Async_sql() : m_lock("sql_async.queue")
+{
+    m_enabled = false;
+    m_epollfd = -1;
+    m_eventfd = -1;
+    m_timerfd = -1;
+    m_timer_ms = 0;
+    m_close_log = 0;
+    m_port = 0;
+}
+
+Async_sql::~Async_sql()
+{
+    stop();
+    if(m_eventfd != -1) {
+        close(m_eventfd);
+    }
+    if(m_timerfd != -1) {
+        close(m_timerfd);
+    }
+}
+
+void Async_sql::stop()
+{
+    m_lock.lock();
+    m_enabled = false;
+    m_pending.clear();
+    m_lock.unlock();
+
+    for(size_t i = 0; i < m_conns.size(); ++i) {
+        if(m_conns[i].res) {
+            mysql_free_result(m_conns[i].res);
+        }
+        if(m_conns[i].mysql) {
+            mysql_close(m_conns[i].mysql);
+        }
+    }
+    m_conns.clear();
+    m_fd_conn.clear();
+}
+
+Async_sql *Async_sql::GetInstance()
+{
+    static Async_sql async_sql;
+    return &async_sql;
+}
+
+void Async_sql::set_options(MYSQL *mysql)
+{
+#ifdef MYSQL_WAIT_READ
+    mysql_options(mysql, MYSQL_OPT_NONBLOCK, 0);
+#endif
+    // 非阻塞模式下库通过 MYSQL_WAIT_TIMEOUT 报告这些超时
+    unsigned int timeout = IO_TIMEOUT_S;
+    mysql_options(mysql, MYSQL_OPT_CONNECT_TIMEOUT, &timeout);
+    mysql_options(mysql, MYSQL_OPT_READ_TIMEOUT, &timeout);
+    mysql_options(mysql, MYSQL_OPT_WRITE_TIMEOUT, &timeout);
+}
+
+bool Async_sql::init(std::string url, std::string User, std::string PassWord,
+    std::string DBName, int port, int conn_num, int close_log)
+{
+    m_close_log = close_log;
+    m_url = url;
+    m_user = User;
+    m_password = PassWord;
+    m_dbname = DBName;
+    m_port = port;
+
+#ifdef MYSQL_WAIT_READ
+    if(conn_num <= 0) {
+        return false;
+    }
+
+    // 建立连接阶段在启动时完成，允许阻塞
+    for(int i = 0; i < conn_num; i++) {
+        MYSQL *conn = mysql_init(NULL);
+        if(conn == NULL) {
+            LOG_ERROR("MySQL async init error");
+            return false;
+        }
+        set_options(conn);
+
+        if(mysql_real_connect(conn, url.c_str(), User.c_str(), PassWord.c_str(),
+            DBName.c_str(), port, NULL, 0) == NULL) {
+            LOG_ERROR("MySQL async connect error: %s", mysql_error(conn));
+            mysql_close(conn);
+            return false;
+        }
+
+        async_conn c;
+        c.mysql = conn;
+        c.fd = mysql_get_socket(conn);
+        c.state = CONN_IDLE;
+        c.deadline_ms = 0;
+        c.wait_ms = 0;
+        c.res = NULL;
+        m_conns.push_back(c);
+    }
+
+    m_eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(m_eventfd == -1) {
+        return false;
+    }
+    m_timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if(m_timerfd == -1) {
+        return false;
+    }
+
+    // vector 不再扩容后再记录指针
+    for(size_t i = 0; i < m_conns.size(); ++i) {
+        m_fd_conn[m_conns[i].fd] = &m_conns[i];
+    }
+
+    m_enabled = true;
+    return true;
+#else
+    LOG_WARN("%s", "MySQL client library has no non-blocking API, fall back to blocking queries");
+    return false;
+#endif
+}
+
+void Async_sql::add_to_epoll(int epollfd)
+{
+    if(!m_enabled) {
+        return;
+    }
+    m_epollfd = epollfd;
+
+    // 数据库 socket 使用水平触发，每一步按库返回的等待状态修改关注事件
+    epoll_event event;
+    for(size_t i = 0; i < m_conns.size(); ++i) {
+        event.data.fd = m_conns[i].fd;
+        event.events = 0;
+        epoll_ctl(m_epollfd, EPOLL_CTL_ADD, m_conns[i].fd, &event);
+    }
+
+    event.data.fd = m_eventfd;
+    event.events = EPOLLIN;
+    epoll_ctl(m_epollfd, EPOLL_CTL_ADD, m_eventfd, &event);
+
+    event.data.fd = m_timerfd;
+    event.events = EPOLLIN;
+    epoll_ctl(m_epollfd, EPOLL_CTL_ADD, m_timerfd, &event);
+}
+
+bool Async_sql::submit(const std::string &sql, async_cb cb, void *arg, uint32_t token)
+{
+    if(!m_enabled) {
+        return false;
+    }
+
+    async_task task;
+    task.sql = sql;
+    task.cb = cb;
+    task.arg = arg;
+    task.token = token;
+
+    m_lock.lock();
+    if(!m_enabled) {
+        m_lock.unlock();
+        return false;
+    }
+    m_pending.push_back(task);
+    m_lock.unlock();
+
+    // 唤醒主线程分配连接
+    uint64_t one = 1;
+    ::write(m_eventfd, &one, sizeof(one));
+    return true;
+}
+
+bool Async_sql::owns(int fd)
+{
+    if(!m_enabled) {
+        return false;
+    }
+    return fd == m_eventfd || fd == m_timerfd || m_fd_conn.count(fd) > 0;
+}
+
+// 与 mysql_real_escape_string 在 utf8/utf8mb4/latin1 等字符集下的结果相同。
+// 不读取连接，避免与主线程驱动中的连接并发；GBK、SJIS 等尾字节可能为 '\\' 的字符集不适用
+std::string Async_sql::escape(const char *str)
+{
+    std::string out;
+    out.reserve(strlen(str) + 8);
+    for(const char *p = str; *p; ++p) {
+        switch(*p) {
+        case '\n':
+            out += "\\n";
+            break;
+        case '\r':
+            out += "\\r";
+            break;
+        case '\\':
+            out += "\\\\";
+            break;
+        case '\'':
+            out += "\\'";
+            break;
+        case '"':
+            out += "\\\"";
+            break;
+        case '\032':
+            out += "\\Z";
+            break;
+        default:
+            out += *p;
+            break;
+        }
+    }
+    return out;
+}
+
+int Async_sql::GetPending()
+{
+    m_lock.lock();
+    int n = m_pending.size();
+    m_lock.unlock();
+    return n;
+}
+
+void Async_sql::handle_event(int fd, unsigned int events)
+{
+#ifdef MYSQL_WAIT_READ
+    if(fd == m_eventfd) {
+        uint64_t cnt;
+        ::read(m_eventfd, &cnt, sizeof(cnt));
+        dispatch();
+        return;
+    }
+    if(fd == m_timerfd) {
+        uint64_t cnt;
+        ::read(m_timerfd, &cnt, sizeof(cnt));
+        check_timeouts();
+        return;
+    }
+
+    std::map<int, async_conn *>::iterator it = m_fd_conn.find(fd);
+    if(it == m_fd_conn.end()) {
+        return;
+    }
+    async_conn *conn = it->second;
+
+    if(conn->state == CONN_IDLE) {
+        // 空闲连接出错说明服务器已关闭连接，提前重连
+        if(events & (EPOLLERR | EPOLLHUP)) {
+            LOG_WARN("%s", "async connection closed by server, reconnect");
+            drop(conn);
+        }
+        return;
+    }
+
+    int status = 0;
+    if(events & EPOLLIN) {
+        status |= MYSQL_WAIT_READ;
+    }
+    if(events & EPOLLOUT) {
+        status |= MYSQL_WAIT_WRITE;
+    }
+    if(events & (EPOLLERR | EPOLLHUP)) {
+        status |= MYSQL_WAIT_EXCEPT;
+    }
+    step(conn, status);
+#endif
+}
+
+void Async_sql::dispatch()
+{
+    for(size_t i = 0; i < m_conns.size(); ++i) {
+        if(m_conns[i].state != CONN_IDLE) {
+            continue;
+        }
+
+        m_lock.lock();
+        if(m_pending.empty()) {
+            m_lock.unlock();
+            return;
+        }
+        m_conns[i].task = m_pending.front();
+        m_pending.pop_front();
+        m_lock.unlock();
+
+        start(&m_conns[i]);
+    }
+}
+
+void Async_sql::start(async_conn *conn)
+{
+#ifdef MYSQL_WAIT_READ
+    conn->state = CONN_QUERY;
+    conn->deadline_ms = now_ms() + QUERY_TIMEOUT_MS;
+
+    int err = 0;
+    int status = mysql_real_query_start(&err, conn->mysql, conn->task.sql.c_str(), conn->task.sql.size());
+    advance(conn, status, err);
+#endif
+}
+
+void Async_sql::step(async_conn *conn, int status)
+{
+#ifdef MYSQL_WAIT_READ
+    int err = 0;
+    if(conn->state == CONN_QUERY) {
+        status = mysql_real_query_cont(&err, conn->mysql, status);
+    }
+    else if(conn->state == CONN_RESULT) {
+        status = mysql_store_result_cont(&conn->res, conn->mysql, status);
+    }
+    else if(conn->state == CONN_CONNECT) {
+        MYSQL *ret = NULL;
+        status = mysql_real_connect_cont(&ret, conn->mysql, status);
+        err = ret == NULL;
+    }
+    else {
+        return;
+    }
+    advance(conn, status, err);
+#endif
+}
+
+void Async_sql::advance(async_conn *conn, int status, int err)
+{
+#ifdef MYSQL_WAIT_READ
+    if(status) {
+        wait_for(conn, status);
+        return;
+    }
+
+    if(conn->state == CONN_QUERY) {
+        if(!err && mysql_field_count(conn->mysql) > 0) {
+            // 只支持不返回结果集的语句，非阻塞地读完并丢弃意外的结果集
+            conn->state = CONN_RESULT;
+            status = mysql_store_result_start(&conn->res, conn->mysql);
+            advance(conn, status, 0);
+            return;
+        }
+        int result = 0;
+        if(err) {
+            result = mysql_errno(conn->mysql);
+            if(result == 0) {
+                result = -1;
+            }
+            LOG_ERROR("async query error: %s", mysql_error(conn->mysql));
+        }
+        finish(conn, result);
+    }
+    else if(conn->state == CONN_RESULT) {
+        int result = 0;
+        if(conn->res) {
+            mysql_free_result(conn->res);
+            conn->res = NULL;
+        }
+        else if(mysql_errno(conn->mysql)) {
+            result = mysql_errno(conn->mysql);
+            LOG_ERROR("async store result error: %s", mysql_error(conn->mysql));
+        }
+        finish(conn, result);
+    }
+    else if(conn->state == CONN_CONNECT) {
+        if(err) {
+            LOG_ERROR("MySQL async reconnect error: %s", mysql_error(conn->mysql));
+            drop(conn);
+            return;
+        }
+        LOG_INFO("%s", "MySQL async reconnected");
+        wait_for(conn, 0);
+        conn->state = CONN_IDLE;
+        dispatch();
+    }
+#endif
+}
+
+void Async_sql::wait_for(async_conn *conn, int status)
+{
+#ifdef MYSQL_WAIT_READ
+    // 重连时 socket 在 mysql_real_connect_start 中才创建
+    int fd = mysql_get_socket(conn->mysql);
+    if(fd != conn->fd) {
+        if(conn->fd != -1) {
+            epoll_ctl(m_epollfd, EPOLL_CTL_DEL, conn->fd, 0);
+            m_fd_conn.erase(conn->fd);
+        }
+        conn->fd = -1;
+        if(fd != -1) {
+            epoll_event event;
+            event.data.fd = fd;
+            event.events = 0;
+            epoll_ctl(m_epollfd, EPOLL_CTL_ADD, fd, &event);
+            m_fd_conn[fd] = conn;
+            conn->fd = fd;
+        }
+    }
+
+    if(conn->fd != -1) {
+        epoll_event event;
+        event.data.fd = conn->fd;
+        event.events = 0;
+        if(status & MYSQL_WAIT_READ) {
+            event.events |= EPOLLIN;
+        }
+        if(status & MYSQL_WAIT_WRITE) {
+            event.events |= EPOLLOUT;
+        }
+        if(status & MYSQL_WAIT_EXCEPT) {
+            event.events |= EPOLLPRI;
+        }
+        epoll_ctl(m_epollfd, EPOLL_CTL_MOD, conn->fd, &event);
+    }
+
+    conn->wait_ms = 0;
+    if(status & MYSQL_WAIT_TIMEOUT) {
+        conn->wait_ms = now_ms() + mysql_get_timeout_value_ms(conn->mysql);
+        arm_timer(conn->wait_ms);
+    }
+    if(status) {
+        arm_timer(conn->deadline_ms);
+    }
+#endif
+}
+
+void Async_sql::finish(async_conn *conn, int result)
+{
+    // 完成后不再关注该 socket 的事件
+    epoll_event event;
+    event.data.fd = conn->fd;
+    event.events = 0;
+    epoll_ctl(m_epollfd, EPOLL_CTL_MOD, conn->fd, &event);
+
+    async_task task = conn->task;
+    conn->task.sql.clear();
+    conn->state = CONN_IDLE;
+    conn->wait_ms = 0;
+
+    // 连接已不可用，先断开再回调，避免后续任务分配到这条连接
+    if(result == CR_SERVER_GONE_ERROR || result == CR_SERVER_LOST) {
+        drop(conn);
+    }
+
+    if(task.cb) {
+        task.cb(task.arg, task.token, result);
+    }
+
+    dispatch();
+}
+
+void Async_sql::drop(async_conn *conn)
+{
+    if(conn->fd != -1) {
+        epoll_ctl(m_epollfd, EPOLL_CTL_DEL, conn->fd, 0);
+        m_fd_conn.erase(conn->fd);
+        // mysql_close 会发送 COM_QUIT，先关闭 socket 读写，避免阻塞在无响应的服务器上
+        shutdown(conn->fd, SHUT_RDWR);
+        conn->fd = -1;
+    }
+    if(conn->res) {
+        mysql_free_result(conn->res);
+        conn->res = NULL;
+    }
+    mysql_close(conn->mysql);
+    conn->mysql = NULL;
+
+    conn->state = CONN_DOWN;
+    conn->wait_ms = 0;
+    conn->deadline_ms = now_ms() + RECONNECT_MS;
+    arm_timer(conn->deadline_ms);
+}
+
+void Async_sql::connect(async_conn *conn)
+{
+#ifdef MYSQL_WAIT_READ
+    conn->mysql = mysql_init(NULL);
+    if(conn->mysql == NULL) {
+        LOG_ERROR("MySQL async init error");
+        conn->deadline_ms = now_ms() + RECONNECT_MS;
+        arm_timer(conn->deadline_ms);
+        return;
+    }
+    set_options(conn->mysql);
+
+    conn->state = CONN_CONNECT;
+    conn->deadline_ms = now_ms() + QUERY_TIMEOUT_MS;
+
+    MYSQL *ret = NULL;
+    int status = mysql_real_connect_start(&ret, conn->mysql, m_url.c_str(), m_user.c_str(),
+        m_password.c_str(), m_dbname.c_str(), m_port, NULL, 0);
+    advance(conn, status, ret == NULL);
+#endif
+}
+
+void Async_sql::check_timeouts()
+{
+#ifdef MYSQL_WAIT_READ
+    long long now = now_ms();
+    m_timer_ms = 0;
+
+    for(size_t i = 0; i < m_conns.size(); ++i) {
+        async_conn *conn = &m_conns[i];
+        if(conn->state == CONN_IDLE) {
+            continue;
+        }
+
+        if(now >= conn->deadline_ms) {
+            if(conn->state == CONN_DOWN) {
+                connect(conn);
+            }
+            else if(conn->state == CONN_CONNECT) {
+                LOG_ERROR("MySQL async reconnect timeout (%dms)", QUERY_TIMEOUT_MS);
+                drop(conn);
+            }
+            else {
+                // 服务器无响应，查询以连接丢失结束，连接随后重建
+                LOG_ERROR("async query timeout (%dms)", QUERY_TIMEOUT_MS);
+                finish(conn, CR_SERVER_LOST);
+            }
+        }
+        else if(conn->wait_ms && now >= conn->wait_ms) {
+            conn->wait_ms = 0;
+            step(conn, MYSQL_WAIT_TIMEOUT);
+        }
+    }
+
+    // 重新设置为剩余的最早时间
+    for(size_t i = 0; i < m_conns.size(); ++i) {
+        async_conn *conn = &m_conns[i];
+        if(conn->state == CONN_IDLE) {
+            continue;
+        }
+        arm_timer(conn->deadline_ms);
+        if(conn->wait_ms) {
+            arm_timer(conn->wait_ms);
+        }
+    }
+#endif
+}
+
+void Async_sql::arm_timer(long long when_ms)
+{
+    // 只会提前，多余的到期由 check_timeouts 重新计算
+    if(m_timer_ms != 0 && m_timer_ms <= when_ms) {
+        return;
+    }
+    m_timer_ms = when_ms;
+
+    itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = when_ms / 1000;
+    its.it_value.tv_nsec = (when_ms % 1000) * 1000000;
+    timerfd_settime(m_timerfd, TFD_TIMER_ABSTIME, &its, NULL);
+}
@@ -0,0 +1,126 @@
+/**非阻塞数据库客户端
+ * 基于 MariaDB 非阻塞 API（mysql_real_query_start/_cont），将数据库 socket 注册到服务器的 epoll 中
+ * - 工作线程提交 SQL 后立即返回，不再阻塞等待一次完整的网络往返
+ * - 主线程在 epoll 事件到来时推进查询状态机，查询完成后通过回调恢复 HTTP 请求的处理
+ * - 少量连接即可承载大量排队中的请求，连接忙时请求在队列中等待
+ * - 每条查询有截止时间，超时或连接断开时以 CR_SERVER_LOST 结束，连接在后台非阻塞地重建
+ * 只用于注册的 INSERT，且只在注册组提交关闭（-b 0）时启用；登录缓存未命中时的查询仍由工作线程通过连接池同步执行
+ * 客户端库不支持非阻塞 API 时 init() 返回 false，调用者退回同步查询
+ */
+
+#ifndef SQL_ASYNC_H
+#define SQL_ASYNC_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+#include <mysql/mysql.h>
+
+#include "../lock/locker.h"
+#include "../log/log.h"
+
+// 查询完成回调：token 为提交时传入的值，result 为 0 表示成功，否则为 mysql_errno
+typedef void (*async_cb)(void *arg, uint32_t token, int result);
+
+class Async_sql
+{
+public:
+    // 单例模式
+    static Async_sql *GetInstance();
+
+    // 建立 conn_num 条非阻塞连接，客户端库不支持或连接失败时返回 false
+    bool init(std::string url, std::string User, std::string PassWord,
+        std::string DBName, int port, int conn_num, int close_log);
+
+    // 将数据库 socket 和唤醒用的 eventfd 注册到 epoll，由主线程调用
+    void add_to_epoll(int epollfd);
+
+    // 提交一条不返回结果集的语句，可在任意线程调用
+    bool submit(const std::string &sql, async_cb cb, void *arg, uint32_t token);
+
+    // 转义字符串，用于拼接 SQL 语句；不访问连接，可在任意线程调用
+    static std::string escape(const char *str);
+
+    bool enabled() { return m_enabled; }
+
+    // 事件循环结束后调用：丢弃未完成的查询，不再回调，关闭连接；之后 submit() 返回 false
+    void stop();
+
+    // 判断 fd 是否属于异步客户端（数据库 socket、eventfd 或 timerfd）
+    bool owns(int fd);
+
+    // 处理 epoll 事件，推进查询状态机，由主线程调用
+    void handle_event(int fd, unsigned int events);
+
+    int GetPending();   // 排队等待连接的请求数
+
+private:
+    Async_sql();
+    ~Async_sql();
+
+    struct async_task {
+        std::string sql;
+        async_cb cb;
+        void *arg;
+        uint32_t token;
+    };
+
+    enum CONN_STATE {
+        CONN_IDLE = 0,  // 空闲，可以执行查询
+        CONN_QUERY,     // 正在执行查询
+        CONN_RESULT,    // 正在读取意外返回的结果集
+        CONN_CONNECT,   // 正在重新连接
+        CONN_DOWN       // 已断开，等待重新连接
+    };
+
+    struct async_conn {
+        MYSQL *mysql;
+        int fd;                 // 当前注册到 epoll 的 socket，未注册时为 -1
+        CONN_STATE state;
+        long long deadline_ms;  // 查询或连接的截止时间；CONN_DOWN 时为下次重连时间
+        long long wait_ms;      // 客户端库要求的超时时间（MYSQL_WAIT_TIMEOUT），0 表示没有
+        MYSQL_RES *res;
+        async_task task;
+    };
+
+    void set_options(MYSQL *mysql);             // 非阻塞模式和读写超时
+    void dispatch();                            // 为空闲连接分配排队的任务
+    void start(async_conn *conn);               // 开始执行查询
+    void step(async_conn *conn, int status);    // 以就绪的事件继续当前步骤
+    void advance(async_conn *conn, int status, int err);  // 根据当前步骤的返回值等待或进入下一步
+    void wait_for(async_conn *conn, int status);// 根据等待状态设置关注的事件和超时
+    void finish(async_conn *conn, int result);  // 查询结束，回调并继续分配任务
+    void drop(async_conn *conn);                // 关闭连接，稍后重连
+    void connect(async_conn *conn);             // 开始非阻塞地重新连接
+    void check_timeouts();                      // timerfd 到期，处理超时的查询和待重连的连接
+    void arm_timer(long long when_ms);          // 保证 timerfd 不晚于 when_ms 到期
+
+private:
+    bool m_enabled;
+    int m_epollfd;
+    int m_eventfd;      // 工作线程提交任务后唤醒主线程
+    int m_timerfd;      // 查询截止时间和重连时间
+    long long m_timer_ms;   // timerfd 当前的到期时间，0 表示未设置
+    int m_close_log;
+
+    // 重连使用的参数
+    std::string m_url;
+    std::string m_user;
+    std::string m_password;
+    std::string m_dbname;
+    int m_port;
+
+    std::vector<async_conn> m_conns;
+    std::map<int, async_conn *> m_fd_conn;  // socket -> 连接
+
+    locker m_lock;                          // 保护排队队列
+    std::list<async_task> m_pending;        // 等待空闲连接的任务
+};
+
+#endif
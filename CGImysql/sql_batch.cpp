@@ -0,0 +1,283 @@
+#include <time.h>
+#include <sys/time.h>
+#include <set>
+
+#include "sql_batch.h"
+
+static long long now_us()
+{
+    struct timeval now = {0, 0};
+    gettimeofday(&now, NULL);
+    return now.tv_sec * 1000000LL + now.tv_usec;
+}
+
+// 返回 v 所在的 2 的幂次桶
+static int log2_bucket(long long v, int buckets)
+{
+    int b = 0;
+    while(v > 1 && b < buckets - 1) {
+        v >>= 1;
+        ++b;
+    }
+    return b;
+}
+
+Register_writer::Register_writer() : m_lock("sql_batch.queue"), m_cond("sql_batch.queue"), m_stats_lock("sql_batch.stats")
+{
+    m_enabled = false;
+    m_max_batch = 0;
+    m_window_ms = 0;
+    m_close_log = 0;
+    m_conn_pool = NULL;
+    m_stop = false;
+    memset(&m_stats, 0, sizeof(m_stats));
+    m_logged_batches = 0;
+}
+
+// 正常退出时已由 stop() 停止，这里只防止销毁仍有线程等待的条件变量
+Register_writer::~Register_writer()
+{
+    stop();
+}
+
+// 通知写入线程写完剩余的用户后退出；回调可能引用的连接对象此时仍然有效
+void Register_writer::stop()
+{
+    m_lock.lock();
+    if(!m_enabled || m_stop) {
+        m_lock.unlock();
+        return;
+    }
+    m_stop = true;
+    m_cond.broadcast();
+    m_lock.unlock();
+    pthread_join(m_tid, NULL);
+}
+
+Register_writer *Register_writer::GetInstance()
+{
+    static Register_writer writer;
+    return &writer;
+}
+
+bool Register_writer::init(Connection_pool *conn_pool, int max_batch, int window_ms, int close_log)
+{
+    m_close_log = close_log;
+    if(max_batch <= 0 || conn_pool == NULL) {
+        return false;
+    }
+
+    m_conn_pool = conn_pool;
+    m_max_batch = max_batch;
+    m_window_ms = window_ms < 0 ? 0 : window_ms;
+
+    if(pthread_create(&m_tid, NULL, worker, this) != 0) {
+        return false;
+    }
+
+    m_enabled = true;
+    return true;
+}
+
+bool Register_writer::submit(const char *name, const char *password, async_cb cb, void *arg, uint32_t token)
+{
+    if(!m_enabled) {
+        return false;
+    }
+
+    reg_task task;
+    task.name = name;
+    task.password = password;
+    task.cb = cb;
+    task.arg = arg;
+    task.token = token;
+    task.result = 0;
+
+    m_lock.lock();
+    if(m_stop) {
+        m_lock.unlock();
+        return false;
+    }
+    m_pending.push_back(task);
+    m_cond.signal();
+    m_lock.unlock();
+    return true;
+}
+
+void Register_writer::get_stats(batch_stats *stats)
+{
+    m_stats_lock.lock();
+    *stats = m_stats;
+    m_stats_lock.unlock();
+}
+
+void Register_writer::log_stats()
+{
+    if(!m_enabled) {
+        return;
+    }
+
+    batch_stats stats;
+    get_stats(&stats);
+    if(stats.batches == m_logged_batches) {
+        return;
+    }
+    m_logged_batches = stats.batches;
+
+    LOG_INFO("register batches: %lld, rows: %lld, retry rows: %lld, avg size: %.1f, max size: %lld, avg latency: %lldus, max latency: %lldus",
+        stats.batches, stats.rows, stats.retry_rows, (double)stats.rows / stats.batches, stats.max_batch,
+        stats.latency_us_sum / stats.batches, stats.latency_us_max);
+}
+
+void *Register_writer::worker(void *arg)
+{
+    pthread_setname_np(pthread_self(), "sql_batch");
+    Register_writer *writer = (Register_writer *)arg;
+    writer->run();
+    return writer;
+}
+
+void Register_writer::run()
+{
+    std::vector<reg_task> batch;
+
+    while(true) {
+        m_lock.lock();
+        while(m_pending.empty() && !m_stop) {
+            m_cond.wait(m_lock);
+        }
+        if(m_pending.empty()) {
+            m_lock.unlock();
+            break;
+        }
+
+        // 第一个用户到达后，最多再等待 m_window_ms 毫秒或攒够 m_max_batch 行
+        if(m_window_ms > 0 && (int)m_pending.size() < m_max_batch && !m_stop) {
+            struct timeval now = {0, 0};
+            gettimeofday(&now, NULL);
+            long long deadline_us = now.tv_sec * 1000000LL + now.tv_usec + m_window_ms * 1000LL;
+            struct timespec t;
+            t.tv_sec = deadline_us / 1000000;
+            t.tv_nsec = (deadline_us % 1000000) * 1000;
+
+            while((int)m_pending.size() < m_max_batch) {
+                if(!m_cond.timewait(m_lock, t)) {
+                    break;
+                }
+            }
+        }
+
+        // 上一批写入期间到达的用户自然地组成下一批
+        while(!m_pending.empty() && (int)batch.size() < m_max_batch) {
+            batch.push_back(m_pending.front());
+            m_pending.pop_front();
+        }
+        m_lock.unlock();
+
+        write_batch(batch);
+
+        // 回调在释放数据库连接后进行
+        for(size_t i = 0; i < batch.size(); ++i) {
+            if(batch[i].cb) {
+                batch[i].cb(batch[i].arg, batch[i].token, batch[i].result);
+            }
+        }
+        batch.clear();
+    }
+}
+
+void Register_writer::write_batch(std::vector<reg_task> &batch)
+{
+    long long start = now_us();
+
+    MYSQL *mysql = NULL;
+    connectionRAII mysql_conn(&mysql, m_conn_pool);
+    if(mysql == NULL) {
+        for(size_t i = 0; i < batch.size(); ++i) {
+            batch[i].result = -1;
+        }
+        return;
+    }
+
+    // 同一批中重复的用户名只保留第一个
+    std::set<std::string> names;
+    std::vector<reg_task *> rows;
+    for(size_t i = 0; i < batch.size(); ++i) {
+        if(names.insert(batch[i].name).second) {
+            rows.push_back(&batch[i]);
+        }
+        else {
+            batch[i].result = ER_DUP_ENTRY;
+        }
+    }
+
+    // 多行 INSERT 在一个事务中提交
+    size_t retry_rows = 0;
+    bool ok = mysql_query(mysql, "START TRANSACTION") == 0;
+    if(ok) {
+        std::string sql = "INSERT INTO user(username, password) VALUES";
+        std::vector<char> buf;
+        for(size_t i = 0; i < rows.size(); ++i) {
+            const std::string &name = rows[i]->name;
+            const std::string &password = rows[i]->password;
+            buf.resize((name.size() + password.size()) * 2 + 2);
+
+            sql += (i == 0) ? "('" : ", ('";
+            mysql_real_escape_string(mysql, &buf[0], name.c_str(), name.size());
+            sql += &buf[0];
+            sql += "', '";
+            mysql_real_escape_string(mysql, &buf[0], password.c_str(), password.size());
+            sql += &buf[0];
+            sql += "')";
+        }
+        ok = mysql_real_query(mysql, sql.c_str(), sql.size()) == 0
+            && mysql_query(mysql, "COMMIT") == 0;
+        if(!ok) {
+            LOG_ERROR("batch insert error: %s", mysql_error(mysql));
+            mysql_query(mysql, "ROLLBACK");
+        }
+    }
+
+    // 整批失败时逐行重试，得到每一行各自的结果
+    if(!ok) {
+        std::vector<char> buf;
+        for(size_t i = 0; i < rows.size(); ++i) {
+            const std::string &name = rows[i]->name;
+            const std::string &password = rows[i]->password;
+            buf.resize((name.size() + password.size()) * 2 + 2);
+
+            std::string sql = "INSERT INTO user(username, password) VALUES('";
+            mysql_real_escape_string(mysql, &buf[0], name.c_str(), name.size());
+            sql += &buf[0];
+            sql += "', '";
+            mysql_real_escape_string(mysql, &buf[0], password.c_str(), password.size());
+            sql += &buf[0];
+            sql += "')";
+
+            if(mysql_real_query(mysql, sql.c_str(), sql.size())) {
+                rows[i]->result = mysql_errno(mysql) ? mysql_errno(mysql) : -1;
+            }
+        }
+        retry_rows = rows.size();
+    }
+
+    record(batch.size(), now_us() - start, retry_rows);
+}
+
+void Register_writer::record(size_t rows, long long latency_us, size_t retry_rows)
+{
+    m_stats_lock.lock();
+    m_stats.batches++;
+    m_stats.rows += rows;
+    m_stats.retry_rows += retry_rows;
+    if((long long)rows > m_stats.max_batch) {
+        m_stats.max_batch = rows;
+    }
+    m_stats.size_hist[log2_bucket(rows, batch_stats::BUCKETS)]++;
+    m_stats.latency_us_sum += latency_us;
+    if(latency_us > m_stats.latency_us_max) {
+        m_stats.latency_us_max = latency_us;
+    }
+    m_stats.latency_hist[log2_bucket(latency_us, batch_stats::BUCKETS)]++;
+    m_stats_lock.unlock();
+}
@@ -0,0 +1,98 @@
+/**注册写入器，组提交注册用户的 INSERT
+ * - 工作线程提交待插入的用户后立即返回，由写入线程在短时间窗口内或攒够 N 行后统一写入
+ * - 一批用户合并为一条多行 INSERT，在同一个事务中提交，减少网络往返和提交次数
+ * - 批量写入失败时回滚，并逐行重试，保证每个请求得到各自的结果
+ * - 记录批大小和批写入延迟，作为运行指标
+ */
+
+#ifndef SQL_BATCH_H
+#define SQL_BATCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <list>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <mysql/mysql.h>
+#include <mysql/mysqld_error.h>
+
+#include "../lock/locker.h"
+#include "../log/log.h"
+#include "sql_conn_pool.h"
+#include "sql_async.h"
+
+// 批写入指标
+struct batch_stats {
+    static const int BUCKETS = 16;
+
+    long long batches;          // 写入的批数
+    long long rows;             // 写入的总行数
+    long long retry_rows;       // 批量失败后逐行重试的行数
+    long long max_batch;        // 最大批大小
+    long long size_hist[BUCKETS];       // 批大小分布，第 i 个桶统计 [2^i, 2^(i+1)) 行
+    long long latency_us_sum;           // 批写入总耗时（微秒）
+    long long latency_us_max;           // 批写入最大耗时（微秒）
+    long long latency_hist[BUCKETS];    // 批写入耗时分布，第 i 个桶统计 [2^i, 2^(i+1)) 微秒
+};
+
+class Register_writer
+{
+public:
+    // 单例模式
+    static Register_writer *GetInstance();
+
+    // 启动写入线程，max_batch 为每批最大行数，window_ms 为攒批的等待时间
+    bool init(Connection_pool *conn_pool, int max_batch, int window_ms, int close_log);
+
+    // 提交一个待注册的用户，写入完成后在写入线程中回调，result 为 0 表示成功
+    bool submit(const char *name, const char *password, async_cb cb, void *arg, uint32_t token);
+
+    bool enabled() { return m_enabled; }
+
+    // 写完已提交的用户后停止写入线程，之后 submit() 返回 false；可重复调用
+    void stop();
+
+    void get_stats(batch_stats *stats);
+
+    // 有新的写入时输出一行批写入指标
+    void log_stats();
+
+private:
+    Register_writer();
+    ~Register_writer();
+
+    struct reg_task {
+        std::string name;
+        std::string password;
+        async_cb cb;
+        void *arg;
+        uint32_t token;
+        int result;
+    };
+
+    static void *worker(void *arg);
+    void run();
+    void write_batch(std::vector<reg_task> &batch);
+    void record(size_t rows, long long latency_us, size_t retry_rows);
+
+private:
+    bool m_enabled;
+    int m_max_batch;
+    int m_window_ms;
+    int m_close_log;
+    Connection_pool *m_conn_pool;
+    pthread_t m_tid;            // 写入线程
+    bool m_stop;                // 通知写入线程退出
+
+    locker m_lock;              // 保护待写入队列
+    cond m_cond;                // 有新的待写入用户
+    std::list<reg_task> m_pending;
+
+    locker m_stats_lock;        // 保护指标
+    batch_stats m_stats;
+    long long m_logged_batches; // 上次输出指标时的批数
+};
+
+#endif
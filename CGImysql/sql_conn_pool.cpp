@@ -1,9 +1,40 @@
+#include <type_traits>
+#include <unistd.h>
+#include <sys/time.h>
+#include <mysql/errmsg.h>
+
 #include "sql_conn_pool.h"
+#include "../metrics/metrics.h"
+#include "../trace/trace.h"
+#include "../trace/probes.h"
+
+// 预处理语句的文本，下标与 SQL_STMT 对应
+static const char *stmt_sql[STMT_NUM] = {
+    "SELECT password FROM user WHERE username = ?",
+    "INSERT INTO user(username, password) VALUES(?, ?)"
+};
+
+static long long now_us()
+{
+    struct timeval now = {0, 0};
+    gettimeofday(&now, NULL);
+    return now.tv_sec * 1000000LL + now.tv_usec;
+}
 
-Connection_pool::Connection_pool()
+Connection_pool::Connection_pool() : lock("sql_pool"), m_cond("sql_pool"), m_stop_cond("sql_pool.stop")
 {
+    m_MinConn = 0;
+    m_MaxConn = 0;
     m_CurConn = 0;
     m_FreeConn = 0;
+    m_TotalConn = 0;
+    m_WaitTimeout = 1000;
+    m_PingInterval = 30;
+    m_IdleTimeout = 60;
+    m_stop = false;
+    m_joinable = false;
+    memset(&m_stats, 0, sizeof(m_stats));
+    m_logged_acquired = 0;
 }
 
 Connection_pool *Connection_pool::GetInstance()
@@ -13,8 +44,9 @@ Connection_pool *Connection_pool::GetInstance()
 }
 
 // 构造初始化
-void Connection_pool::init(std::string url, std::string User, std::string PassWord,
-    std::string DBName, int port, int MaxConn, int close_log)
+bool Connection_pool::init(std::string url, std::string User, std::string PassWord,
+    std::string DBName, int port, int MinConn, int MaxConn, int close_log, int wait_timeout_ms,
+    int ping_interval, int idle_timeout)
 {
     m_url = url;
     m_Port = port;
@@ -23,49 +55,104 @@ void Connection_pool::init(std::string url, std::string User, std::string PassWo
     m_DataBaseName = DBName;
     m_close_log = close_log;
 
-    for(int i = 0; i < MaxConn; i++) {
-        MYSQL *conn = NULL;
+    m_MaxConn = MaxConn > 0 ? MaxConn : 1;
+    m_MinConn = MinConn < 0 ? 0 : (MinConn > m_MaxConn ? m_MaxConn : MinConn);
+    m_WaitTimeout = wait_timeout_ms;
+    m_PingInterval = ping_interval;
+    m_IdleTimeout = idle_timeout;
 
-        conn = mysql_init(conn);
+    // 预先建立最小数量的连接，失败的连接不再导致进程退出，使用时按需重建
+    for(int i = 0; i < m_MinConn; i++) {
+        MYSQL *conn = NewConnection();
         if(conn == NULL) {
-            LOG_ERROR("MySQL Error");
-            exit(1);
-        }
-
-        conn = mysql_real_connect(conn, url.c_str(), User.c_str(), PassWord.c_str(), DBName.c_str(), port, NULL, 0);
-        if(conn == NULL) {
-            LOG_ERROR("MySQL Error");
-            exit(1);
+            break;
         }
 
+        lock.lock();
         connList.push_back(conn);
         ++m_FreeConn;
+        ++m_TotalConn;
+        lock.unlock();
     }
 
-    reserve = sem(m_FreeConn);
+    // 后台线程定期检查空闲连接，DestroyPool 时 join
+    m_joinable = pthread_create(&m_tid, NULL, worker, this) == 0;
 
-    m_MaxConn = m_FreeConn;
+    if(m_MinConn > 0 && m_TotalConn == 0) {
+        LOG_ERROR("%s", "MySQL pool: no connection could be established");
+        return false;
+    }
+    return true;
 }
 
 // 有请求时，从数据库连接池中返回一个可用连接，更新使用和空闲连接数
+// 没有空闲连接时，未达到最大连接数则新建连接，否则最多等待 m_WaitTimeout 毫秒
 MYSQL *Connection_pool::Getconnection()
 {
+    long long start = now_us();
+    WS_PROBE1(pool_get, this);
+    long long deadline_us = start + m_WaitTimeout * 1000LL;
+    struct timespec t;
+    t.tv_sec = deadline_us / 1000000;
+    t.tv_nsec = (deadline_us % 1000000) * 1000;
+
     MYSQL *conn = NULL;
+    lock.lock();
+    while(true) {
+        if(!connList.empty()) {
+            conn = connList.front();
+            connList.pop_front();
+            --m_FreeConn;
+            ++m_CurConn;
+            lock.unlock();
 
-    if(0 == connList.size()) {
-        return NULL;
-    }
+            // 检查在锁外进行，失败时连接已被释放，继续尝试下一个空闲连接或新建连接
+            if(CheckConnection(conn)) {
+                break;
+            }
+            conn = NULL;
+            lock.lock();
+            --m_CurConn;
+            m_cond.broadcast();
+            continue;
+        }
 
-    reserve.wait();
-    lock.lock();
+        // 按需增长
+        if(m_TotalConn < m_MaxConn) {
+            ++m_TotalConn;
+            ++m_CurConn;
+            lock.unlock();
 
-    conn = connList.front();
-    connList.pop_front();
+            conn = NewConnection();
+            if(conn == NULL) {
+                // 数据库不可用，快速失败
+                lock.lock();
+                --m_TotalConn;
+                --m_CurConn;
+                m_cond.broadcast();
+                lock.unlock();
+                return NULL;
+            }
+            break;
+        }
 
-    --m_FreeConn;
-    ++m_CurConn;
+        if(!m_cond.timewait(lock, t) && now_us() >= deadline_us) {
+            // 超时前再检查一次是否有连接归还
+            if(!connList.empty()) {
+                continue;
+            }
+            m_stats.timeouts++;
+            lock.unlock();
+            WS_PROBE2(pool_timeout, this, now_us() - start);
+            LOG_WARN("MySQL pool: wait for connection timeout (%dms)", m_WaitTimeout);
+            return NULL;
+        }
+    }
 
-    lock.unlock();
+    long long wait_us = now_us() - start;
+    WS_PROBE3(pool_acquired, this, conn, wait_us);
+    RecordWait(wait_us);
+    tracer::stamp_current(T_DB_ACQUIRED);
     return conn;
 }
 
@@ -78,36 +165,425 @@ bool Connection_pool::ReleaseConnection(MYSQL *conn)
 
     lock.lock();
 
-    connList.push_back(conn);
+    m_conns[conn].last_used = time(NULL);
+    connList.push_front(conn);
     ++m_FreeConn;
     --m_CurConn;
 
+    int free_conn = m_FreeConn;
+    m_cond.signal();
     lock.unlock();
-
-    reserve.post();
+    WS_PROBE3(pool_release, this, conn, free_conn);
     return true;
 }
 
 // 销毁数据库连接池
 void Connection_pool::DestroyPool()
 {
+    // 先停止后台线程：它检查的连接不在空闲队列中，检查完成前不能释放连接池
+    lock.lock();
+    m_stop = true;
+    m_stop_cond.broadcast();
+    lock.unlock();
+    if(m_joinable) {
+        pthread_join(m_tid, NULL);
+        m_joinable = false;
+    }
+
+    lock.lock();
+    std::list<MYSQL *> closing;
+    closing.swap(connList);
+    m_TotalConn -= m_FreeConn;
+    m_FreeConn = 0;
+    lock.unlock();
+
+    std::list<MYSQL *>::iterator it;
+    for(it = closing.begin(); it != closing.end(); ++it) {
+        CloseConnection(*it);
+    }
+}
+
+void *Connection_pool::worker(void *arg)
+{
+    pthread_setname_np(pthread_self(), "sql_pool");
+    Connection_pool *pool = (Connection_pool *)arg;
+    pool->lock.lock();
+    while(!pool->m_stop) {
+        // 每 5 秒检查一次，DestroyPool 时立即退出
+        long long deadline_us = now_us() + 5000000LL;
+        struct timespec t;
+        t.tv_sec = deadline_us / 1000000;
+        t.tv_nsec = (deadline_us % 1000000) * 1000;
+        while(!pool->m_stop && now_us() < deadline_us) {
+            pool->m_stop_cond.timewait(pool->lock, t);
+        }
+        if(pool->m_stop) {
+            break;
+        }
+        pool->lock.unlock();
+        pool->Maintain();
+        pool->lock.lock();
+    }
+    pool->lock.unlock();
+    return pool;
+}
+
+// 空闲超过 m_IdleTimeout 且连接数多于最小值时关闭，空闲时间只按归还时间计算，ping 不刷新
+// 其余超过 m_PingInterval 未确认可用的连接先 ping，失效则重连；队尾是最久未使用的连接
+void Connection_pool::Maintain()
+{
+    time_t cur = time(NULL);
+    std::list<MYSQL *> checking;
+    std::list<MYSQL *> closing;
+
+    lock.lock();
+    std::list<MYSQL *>::iterator it = connList.end();
+    while(it != connList.begin()) {
+        --it;
+        MYSQL *conn = *it;
+        const conn_info &info = m_conns[conn];
+        time_t idle = cur - info.last_used;
+        // 队列按归还时间排序，更靠前的连接空闲时间更短
+        if(idle < m_PingInterval && !info.broken) {
+            break;
+        }
+        bool close = idle >= m_IdleTimeout && m_TotalConn > m_MinConn;
+        bool check = info.broken || cur - info.last_ping >= m_PingInterval;
+        if(!close && !check) {
+            continue;
+        }
+        // erase 返回已检查过的后一个元素，下一轮继续向队首移动
+        it = connList.erase(it);
+        --m_FreeConn;
+        if(close) {
+            --m_TotalConn;
+            closing.push_back(conn);
+        }
+        else {
+            ++m_CurConn;
+            checking.push_back(conn);
+        }
+    }
+    lock.unlock();
+
+    for(std::list<MYSQL *>::iterator it = closing.begin(); it != closing.end(); ++it) {
+        CloseConnection(*it);
+    }
+
+    for(std::list<MYSQL *>::iterator it = checking.begin(); it != checking.end(); ++it) {
+        if(CheckConnection(*it)) {
+            // 检查通过，放回空闲队列尾部；空闲时间不变，继续空闲到 m_IdleTimeout 时关闭
+            lock.lock();
+            connList.push_back(*it);
+            ++m_FreeConn;
+            --m_CurConn;
+            m_cond.signal();
+            lock.unlock();
+        }
+        else {
+            lock.lock();
+            --m_CurConn;
+            m_cond.broadcast();
+            lock.unlock();
+        }
+    }
+}
+
+MYSQL *Connection_pool::NewConnection()
+{
+    // 自行分配句柄，重连时可以在同一地址上重建连接
+    pool_conn *pc = new pool_conn;
+    memset(pc->stmts, 0, sizeof(pc->stmts));
+    MYSQL *conn = &pc->mysql;
+    if(!Connect(conn)) {
+        delete pc;
+        return NULL;
+    }
+
+    lock.lock();
+    m_conns[conn].last_used = time(NULL);
+    m_conns[conn].last_ping = m_conns[conn].last_used;
+    m_conns[conn].broken = false;
+    m_stats.created++;
+    lock.unlock();
+    return conn;
+}
+
+bool Connection_pool::Connect(MYSQL *conn)
+{
+    if(mysql_init(conn) == NULL) {
+        LOG_ERROR("%s", "MySQL init error");
+        return false;
+    }
+
+    unsigned int timeout = 3;
+    mysql_options(conn, MYSQL_OPT_CONNECT_TIMEOUT, &timeout);
+
+    if(mysql_real_connect(conn, m_url.c_str(), m_User.c_str(), m_PassWord.c_str(),
+        m_DataBaseName.c_str(), m_Port, NULL, 0) == NULL) {
+        LOG_ERROR("MySQL connect error: %s", mysql_error(conn));
+        mysql_close(conn);
+        return false;
+    }
+
+    if(!PrepareStmts(conn)) {
+        LOG_ERROR("MySQL prepare error: %s", mysql_error(conn));
+        mysql_close(conn);
+        return false;
+    }
+    return true;
+}
+
+bool Connection_pool::Reconnect(MYSQL *conn)
+{
+    CloseStmts(conn);
+
+    lock.lock();
+    bool broken = m_conns[conn].broken;
+    m_stats.reconnects++;
+    lock.unlock();
+
+    if(!broken) {
+        mysql_close(conn);
+    }
+
+    bool ok = Connect(conn);
+
+    lock.lock();
+    m_conns[conn].broken = !ok;
+    if(ok) {
+        m_conns[conn].last_ping = time(NULL);
+    }
+    lock.unlock();
+
+    LOG_WARN("MySQL reconnect %s", ok ? "succeeded" : "failed");
+    return ok;
+}
+
+// 检查取出的连接，不可用时关闭连接并返回 false
+bool Connection_pool::CheckConnection(MYSQL *conn)
+{
+    time_t cur = time(NULL);
     lock.lock();
-    
-    if(connList.size() > 0) {
-        std::list<MYSQL *>::iterator it;
-        for(it = connList.begin(); it != connList.end(); ++it) {
-            MYSQL *conn = *it;
-            mysql_close(conn);
+    const conn_info &info = m_conns[conn];
+    bool broken = info.broken;
+    // 归还后或最近一次确认可用后不久的连接直接使用
+    bool stale = cur - info.last_used >= m_PingInterval && cur - info.last_ping >= m_PingInterval;
+    lock.unlock();
+
+    if(!broken && !stale) {
+        return true;
+    }
+    if(!broken) {
+        if(mysql_ping(conn) == 0) {
+            lock.lock();
+            m_conns[conn].last_ping = cur;
+            lock.unlock();
+            return true;
         }
+        lock.lock();
+        m_stats.ping_failures++;
+        lock.unlock();
+    }
+    if(Reconnect(conn)) {
+        return true;
+    }
 
-        m_CurConn = 0;
-        m_FreeConn = 0;
-        connList.clear();
+    // 重连失败，数据库可能不可用，关闭连接让调用者快速失败
+    lock.lock();
+    --m_TotalConn;
+    lock.unlock();
+    CloseConnection(conn);
+    return false;
+}
+
+void Connection_pool::CloseConnection(MYSQL *conn)
+{
+    CloseStmts(conn);
+
+    lock.lock();
+    bool broken = m_conns[conn].broken;
+    m_conns.erase(conn);
+    m_stats.closed++;
+    lock.unlock();
+
+    if(!broken) {
+        mysql_close(conn);
+    }
+    delete handle(conn);
+}
+
+void Connection_pool::RecordWait(long long wait_us)
+{
+    int b = 0;
+    for(long long v = wait_us; v > 1 && b < pool_stats::BUCKETS - 1; v >>= 1) {
+        ++b;
+    }
+
+    lock.lock();
+    m_stats.acquired++;
+    m_stats.wait_us_sum += wait_us;
+    if(wait_us > m_stats.wait_us_max) {
+        m_stats.wait_us_max = wait_us;
     }
+    m_stats.wait_hist[b]++;
+    lock.unlock();
 
+    metrics::get_instance()->record(H_DB_WAIT, wait_us);
+}
+
+void Connection_pool::GetStats(pool_stats *stats)
+{
+    lock.lock();
+    *stats = m_stats;
+    stats->total = m_TotalConn;
+    stats->in_use = m_CurConn;
+    stats->free = m_FreeConn;
     lock.unlock();
 }
 
+void Connection_pool::LogStats()
+{
+    pool_stats stats;
+    GetStats(&stats);
+    if(stats.acquired == m_logged_acquired && stats.timeouts == 0) {
+        return;
+    }
+    m_logged_acquired = stats.acquired;
+
+    LOG_INFO("sql pool: total %d, in use %d, free %d, acquired %lld, timeouts %lld, created %lld, closed %lld, reconnects %lld, avg wait %lldus, max wait %lldus",
+        stats.total, stats.in_use, stats.free, stats.acquired, stats.timeouts, stats.created, stats.closed,
+        stats.reconnects, stats.acquired ? stats.wait_us_sum / stats.acquired : 0, stats.wait_us_max);
+}
+
+// 在连接上预处理所有语句，语句随连接一起复用，避免每次请求重新解析 SQL
+bool Connection_pool::PrepareStmts(MYSQL *conn)
+{
+    MYSQL_STMT **stmts = handle(conn)->stmts;
+    for(int i = 0; i < STMT_NUM; i++) {
+        stmts[i] = mysql_stmt_init(conn);
+        if(stmts[i] == NULL || mysql_stmt_prepare(stmts[i], stmt_sql[i], strlen(stmt_sql[i]))) {
+            CloseStmts(conn);
+            return false;
+        }
+    }
+    return true;
+}
+
+// 由持有连接的线程调用，关闭后语句为 NULL，执行时返回错误
+void Connection_pool::CloseStmts(MYSQL *conn)
+{
+    MYSQL_STMT **stmts = handle(conn)->stmts;
+    for(int i = 0; i < STMT_NUM; i++) {
+        if(stmts[i]) {
+            mysql_stmt_close(stmts[i]);
+            stmts[i] = NULL;
+        }
+    }
+}
+
+int Connection_pool::ExecInsert(MYSQL *conn, const char *name, const char *password)
+{
+    if(conn == NULL) {
+        return -1;
+    }
+    int ret = ExecInsertOnce(conn, name, password);
+    // 语句未发出时连接已断开，重连后重试一次；CR_SERVER_LOST 时插入可能已生效，不重试
+    if(ret == CR_SERVER_GONE_ERROR && Reconnect(conn)) {
+        ret = ExecInsertOnce(conn, name, password);
+    }
+    return ret;
+}
+
+int Connection_pool::ExecLogin(MYSQL *conn, const char *name, std::string &password)
+{
+    if(conn == NULL) {
+        return -1;
+    }
+    int err = 0;
+    int ret = ExecLoginOnce(conn, name, password, err);
+    // 查询是只读的，连接断开时重连后重试一次
+    if(ret < 0 && (err == CR_SERVER_GONE_ERROR || err == CR_SERVER_LOST) && Reconnect(conn)) {
+        ret = ExecLoginOnce(conn, name, password, err);
+    }
+    return ret;
+}
+
+int Connection_pool::ExecInsertOnce(MYSQL *conn, const char *name, const char *password)
+{
+    MYSQL_STMT *stmt = GetStmt(conn, STMT_INSERT);
+    if(stmt == NULL) {
+        return -1;
+    }
+
+    // 参数以二进制协议发送，不再拼接 SQL 文本
+    unsigned long name_len = strlen(name);
+    unsigned long password_len = strlen(password);
+    MYSQL_BIND bind[2];
+    memset(bind, 0, sizeof(bind));
+    bind[0].buffer_type = MYSQL_TYPE_STRING;
+    bind[0].buffer = (void *)name;
+    bind[0].buffer_length = name_len;
+    bind[0].length = &name_len;
+    bind[1].buffer_type = MYSQL_TYPE_STRING;
+    bind[1].buffer = (void *)password;
+    bind[1].buffer_length = password_len;
+    bind[1].length = &password_len;
+
+    if(mysql_stmt_bind_param(stmt, bind) || mysql_stmt_execute(stmt)) {
+        LOG_ERROR("INSERT error: %s", mysql_stmt_error(stmt));
+        int err = mysql_stmt_errno(stmt);
+        return err ? err : -1;
+    }
+    return 0;
+}
+
+int Connection_pool::ExecLoginOnce(MYSQL *conn, const char *name, std::string &password, int &err)
+{
+    err = 0;
+    MYSQL_STMT *stmt = GetStmt(conn, STMT_LOGIN);
+    if(stmt == NULL) {
+        return -1;
+    }
+
+    unsigned long name_len = strlen(name);
+    MYSQL_BIND param;
+    memset(&param, 0, sizeof(param));
+    param.buffer_type = MYSQL_TYPE_STRING;
+    param.buffer = (void *)name;
+    param.buffer_length = name_len;
+    param.length = &name_len;
+
+    MYSQL_BIND result;
+    memset(&result, 0, sizeof(result));
+    char buf[128];
+    unsigned long buf_len = 0;
+    // MySQL 8.0 中 is_null 为 bool *，MariaDB 中为 my_bool *
+    std::remove_pointer<decltype(result.is_null)>::type is_null = 0;
+    result.buffer_type = MYSQL_TYPE_STRING;
+    result.buffer = buf;
+    result.buffer_length = sizeof(buf);
+    result.length = &buf_len;
+    result.is_null = &is_null;
+
+    if(mysql_stmt_bind_param(stmt, &param) || mysql_stmt_execute(stmt)
+        || mysql_stmt_bind_result(stmt, &result) || mysql_stmt_store_result(stmt)) {
+        LOG_ERROR("SELECT error: %s", mysql_stmt_error(stmt));
+        err = mysql_stmt_errno(stmt);
+        return -1;
+    }
+
+    int found = 0;
+    int ret = mysql_stmt_fetch(stmt);
+    if((ret == 0 || ret == MYSQL_DATA_TRUNCATED) && !is_null) {
+        password.assign(buf, buf_len < sizeof(buf) ? buf_len : sizeof(buf));
+        found = 1;
+    }
+    mysql_stmt_free_result(stmt);
+    return found;
+}
+
+
 // 当前空闲的连接数
 int Connection_pool::GetFreeConn()
 {
@@ -132,4 +608,4 @@ connectionRAII::connectionRAII(MYSQL **SQL, Connection_pool *conn_pool)
 connectionRAII::~connectionRAII()
 {
     poolRAII->ReleaseConnection(connRAII);
-}
+}
\ No newline at end of file
@@ -7,31 +7,68 @@
 #include <string.h>
 #include <errno.h>
 #include <list>
+#include <map>
 #include <string>
+#include <time.h>
 #include <pthread.h>
 #include <mysql/mysql.h>
 
 #include "../lock/locker.h"
 #include "../log/log.h"
 
+// 每个连接上预处理的语句
+enum SQL_STMT {
+    STMT_LOGIN = 0,     // 按用户名查询密码
+    STMT_INSERT,        // 插入注册用户
+    STMT_NUM
+};
+
+// 连接池指标
+struct pool_stats {
+    static const int BUCKETS = 24;
+
+    int total;                  // 当前连接总数
+    int in_use;                 // 正在使用的连接数
+    int free;                   // 空闲连接数
+    long long acquired;         // 成功获取连接的次数
+    long long timeouts;         // 等待超时的次数
+    long long created;          // 新建的连接数
+    long long closed;           // 因空闲或失效关闭的连接数
+    long long reconnects;       // 重连次数
+    long long ping_failures;    // 健康检查失败次数
+    long long wait_us_sum;      // 获取连接的总等待时间（微秒）
+    long long wait_us_max;      // 获取连接的最大等待时间（微秒）
+    long long wait_hist[BUCKETS];   // 等待时间分布，第 i 个桶统计 [2^i, 2^(i+1)) 微秒
+};
+
 class Connection_pool
 {
 public:
-    MYSQL *Getconnection();                 // 获取数据库连接
+    MYSQL *Getconnection();                 // 获取数据库连接，超时返回NULL
     bool ReleaseConnection(MYSQL *conn);    // 释放连接
     int GetFreeConn();                      // 获取连接
-    void DestroyPool();                     // 销毁所有的连接
+    void DestroyPool();                     // 停止后台线程，销毁所有空闲的连接
+    void GetStats(pool_stats *stats);       // 获取连接池指标
+    void LogStats();                        // 输出一行连接池指标
+
+    // 使用连接上预处理的语句插入用户，成功返回0，否则返回错误码
+    int ExecInsert(MYSQL *conn, const char *name, const char *password);
+    // 使用连接上预处理的语句查询用户密码，找到返回1，不存在返回0，出错返回-1
+    int ExecLogin(MYSQL *conn, const char *name, std::string &password);
 
     // 单例模式
     static Connection_pool *GetInstance();
 
-    // 构造初始化
-    void init(std::string url, std::string User, std::string PassWord,
-        std::string DBName, int port, int MaxConn, int close_log);
+    // 构造初始化，预先建立 MinConn 个连接，需要时增长到 MaxConn 个
+    // 获取连接最多等待 wait_timeout_ms 毫秒；空闲超过 ping_interval 秒的连接使用前先 ping，
+    // 空闲超过 idle_timeout 秒且多于最小连接数时关闭；一个连接都无法建立时返回 false
+    bool init(std::string url, std::string User, std::string PassWord,
+        std::string DBName, int port, int MinConn, int MaxConn, int close_log,
+        int wait_timeout_ms = 1000, int ping_interval = 30, int idle_timeout = 60);
 
 public:
     std::string m_url;          // 主机地址
-    std::string m_Port;         // 数据库端口号
+    int m_Port;                 // 数据库端口号
     std::string m_User;         // 登录数据库用户名
     std::string m_PassWord;     // 登录数据库密码
     std::string m_DataBaseName; // 使用数据库名
@@ -41,13 +78,56 @@ private:
     Connection_pool();
     ~Connection_pool();
 
+    // 连接句柄，MYSQL 是第一个成员，Getconnection 返回的指针可以直接转换回来。
+    // 预处理语句随句柄保存，只由持有连接的线程访问，执行语句时不加锁也不查表
+    struct pool_conn {
+        MYSQL mysql;
+        MYSQL_STMT *stmts[STMT_NUM];
+    };
+    static pool_conn *handle(MYSQL *conn) { return (pool_conn *)conn; }
+
+    // 每个连接的状态
+    struct conn_info {
+        time_t last_used;                   // 最后一次归还的时间，即开始空闲的时间，决定是否关闭
+        time_t last_ping;                   // 最后一次确认连接可用的时间（建立、重连或 ping 通过），决定是否 ping
+        bool broken;                        // 重连失败，连接已关闭
+    };
+
+    static void *worker(void *arg);
+    void Maintain();                        // 后台线程：检查空闲连接，关闭多余的空闲连接
+
+    MYSQL *NewConnection();                 // 新建连接，失败返回NULL
+    bool Connect(MYSQL *conn);              // 在已分配的句柄上建立连接并预处理语句，失败时句柄处于关闭状态
+    bool Reconnect(MYSQL *conn);            // 在原句柄上重连，连接指针保持不变
+    bool CheckConnection(MYSQL *conn);      // 空闲过久或已失效的连接先检查或重连
+    void CloseConnection(MYSQL *conn);      // 关闭并释放连接
+    void RecordWait(long long wait_us);
+
+    bool PrepareStmts(MYSQL *conn);         // 在连接上预处理所有语句，连接建立和重连后调用
+    void CloseStmts(MYSQL *conn);           // 释放连接上的预处理语句
+    MYSQL_STMT *GetStmt(MYSQL *conn, SQL_STMT id) { return conn ? handle(conn)->stmts[id] : NULL; }
+    int ExecInsertOnce(MYSQL *conn, const char *name, const char *password);
+    int ExecLoginOnce(MYSQL *conn, const char *name, std::string &password, int &err);
+
+    int m_MinConn;  // 最小连接数
     int m_MaxConn;  // 最大连接数
     int m_CurConn;  // 当前已使用的连接数
     int m_FreeConn; // 当前空闲的连接数
+    int m_TotalConn;    // 连接总数，包括正在建立和正在检查的连接
+    int m_WaitTimeout;  // 获取连接的最长等待时间（毫秒）
+    int m_PingInterval; // 空闲超过该时间（秒）的连接使用前先 ping
+    int m_IdleTimeout;  // 空闲超过该时间（秒）且多于最小连接数时关闭
 
     locker lock;
-    sem reserve;
-    std::list<MYSQL *> connList;    // 连接池   
+    cond m_cond;                    // 有连接归还或可以新建连接
+    cond m_stop_cond;               // 通知后台线程退出，与 m_cond 分开，避免后台线程消耗归还连接的 signal
+    bool m_stop;                    // 后台线程是否应退出
+    pthread_t m_tid;                // 后台线程
+    bool m_joinable;                // 后台线程已启动且尚未 join
+    std::list<MYSQL *> connList;    // 空闲连接，最近归还的在队首
+    std::map<MYSQL *, conn_info> m_conns;   // 所有连接的状态
+    pool_stats m_stats;
+    long long m_logged_acquired;    // 上次输出指标时的获取次数
 };
 
 class connectionRAII {
@@ -0,0 +1,165 @@
+#include <stdlib.h>
+
+#include "sql_user_loader.h"
+
+// 用户名区间的分界字符，数字和字母在二进制与不区分大小写的排序规则下都是递增的
+static const char RANGE_CHARS[] = "0123456789abcdefghijklmnopqrstuvwxyz";
+
+User_loader::User_loader(Connection_pool *conn_pool, User_table *table)
+{
+    m_conn_pool = conn_pool;
+    m_table = table;
+    m_close_log = conn_pool->m_close_log;
+}
+
+long long User_loader::load_all(int threads)
+{
+    int chars = sizeof(RANGE_CHARS) - 1;
+    if(threads < 1) {
+        threads = 1;
+    }
+    if(threads > chars) {
+        threads = chars;
+    }
+
+    // 第 i 段为 [bounds[i], bounds[i+1])，首段没有下界，末段没有上界
+    std::vector<std::string> bounds(threads + 1);
+    for(int i = 1; i < threads; ++i) {
+        bounds[i] = std::string(1, RANGE_CHARS[chars * i / threads]);
+    }
+
+    std::vector<range_task> tasks(threads);
+    std::vector<pthread_t> tids(threads);
+    for(int i = 0; i < threads; ++i) {
+        tasks[i].loader = this;
+        tasks[i].sql = range_sql(bounds[i], bounds[i + 1]);
+        tasks[i].rows = -1;
+    }
+
+    // 第一段在当前线程读取，其余各段各起一个线程
+    std::vector<bool> started(threads, false);
+    for(int i = 1; i < threads; ++i) {
+        started[i] = pthread_create(&tids[i], NULL, worker, &tasks[i]) == 0;
+    }
+    worker(&tasks[0]);
+
+    for(int i = 1; i < threads; ++i) {
+        if(started[i]) {
+            pthread_join(tids[i], NULL);
+        }
+        else {
+            // 线程创建失败时在当前线程补读
+            worker(&tasks[i]);
+        }
+    }
+
+    long long total = 0;
+    for(int i = 0; i < threads; ++i) {
+        if(tasks[i].rows < 0) {
+            return -1;
+        }
+        total += tasks[i].rows;
+    }
+    return total;
+}
+
+long long User_loader::load_since(uint64_t min_id, uint64_t *max_id)
+{
+    char sql[128];
+    snprintf(sql, sizeof(sql), "SELECT id, username, password FROM user WHERE id > %llu",
+        (unsigned long long)min_id);
+    *max_id = min_id;
+    return stream(sql, true, max_id);
+}
+
+bool User_loader::query_max_id(uint64_t *max_id)
+{
+    MYSQL *mysql = NULL;
+    connectionRAII mysql_conn(&mysql, m_conn_pool);
+    if(mysql == NULL) {
+        return false;
+    }
+    if(mysql_query(mysql, "SELECT MAX(id) FROM user")) {
+        LOG_WARN("SELECT MAX(id) error: %s", mysql_error(mysql));
+        return false;
+    }
+    MYSQL_RES *result = mysql_store_result(mysql);
+    if(result == NULL) {
+        return false;
+    }
+    MYSQL_ROW row = mysql_fetch_row(result);
+    *max_id = (row && row[0]) ? strtoull(row[0], NULL, 10) : 0;
+    mysql_free_result(result);
+    return true;
+}
+
+void *User_loader::worker(void *arg)
+{
+    range_task *task = (range_task *)arg;
+    task->rows = task->loader->stream(task->sql, false, NULL);
+    return task;
+}
+
+std::string User_loader::range_sql(const std::string &lo, const std::string &hi)
+{
+    // 分界字符是字母数字，无需转义
+    std::string sql = "SELECT username, password FROM user";
+    if(!lo.empty()) {
+        sql += " WHERE username >= '" + lo + "'";
+    }
+    if(!hi.empty()) {
+        sql += lo.empty() ? " WHERE " : " AND ";
+        sql += "username < '" + hi + "'";
+    }
+    return sql;
+}
+
+long long User_loader::stream(const std::string &sql, bool with_id, uint64_t *max_id)
+{
+    MYSQL *mysql = NULL;
+    connectionRAII mysql_conn(&mysql, m_conn_pool);
+    if(mysql == NULL) {
+        LOG_ERROR("%s", "load users error: no MySQL connection");
+        return -1;
+    }
+
+    if(mysql_real_query(mysql, sql.c_str(), sql.size())) {
+        LOG_ERROR("SELECT error: %s", mysql_error(mysql));
+        return -1;
+    }
+
+    // 逐行从服务器读取，必须读完所有行后才能在该连接上执行下一条语句
+    MYSQL_RES *result = mysql_use_result(mysql);
+    if(result == NULL) {
+        LOG_ERROR("SELECT error: %s", mysql_error(mysql));
+        return -1;
+    }
+
+    int base = with_id ? 1 : 0;
+    long long rows = 0;
+    std::string name, password;
+    while(MYSQL_ROW row = mysql_fetch_row(result)) {
+        unsigned long *lengths = mysql_fetch_lengths(result);
+        if(row[base] == NULL || row[base + 1] == NULL) {
+            continue;
+        }
+        if(with_id && row[0]) {
+            uint64_t id = strtoull(row[0], NULL, 10);
+            if(id > *max_id) {
+                *max_id = id;
+            }
+        }
+        name.assign(row[base], lengths[base]);
+        password.assign(row[base + 1], lengths[base + 1]);
+        m_table->upsert(name, password);
+        ++rows;
+    }
+
+    // 读取中途出错时 mysql_fetch_row 也返回 NULL
+    bool failed = mysql_errno(mysql) != 0;
+    if(failed) {
+        LOG_ERROR("load users error: %s", mysql_error(mysql));
+    }
+    mysql_free_result(result);
+    return failed ? -1 : rows;
+}
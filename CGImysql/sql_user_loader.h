@@ -0,0 +1,52 @@
+/**启动时加载用户表
+ * - 使用 mysql_use_result 逐行流式读取，不在客户端缓存整个结果集，内存峰值不再是用户表的两倍
+ * - 按用户名区间划分为多个分片，每个分片使用一条连接并行读取，插入分片的并发用户表
+ * - 增量加载：只读取 id 大于给定值的用户，配合快照文件使用（需要 user 表有自增 id 列）
+ */
+
+#ifndef SQL_USER_LOADER_H
+#define SQL_USER_LOADER_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <mysql/mysql.h>
+
+#include "../log/log.h"
+#include "../storage/user_table.h"
+#include "sql_conn_pool.h"
+
+class User_loader
+{
+public:
+    User_loader(Connection_pool *conn_pool, User_table *table);
+
+    // 全量加载，按用户名区间分为 threads 段并行读取，返回加载的行数，出错返回 -1
+    long long load_all(int threads);
+
+    // 加载 id 大于 min_id 的用户，max_id 返回读到的最大 id；user 表没有 id 列时返回 -1
+    long long load_since(uint64_t min_id, uint64_t *max_id);
+
+    // 查询当前最大的用户 id，user 表没有 id 列时返回 false
+    bool query_max_id(uint64_t *max_id);
+
+private:
+    struct range_task {
+        User_loader *loader;
+        std::string sql;
+        long long rows;
+    };
+
+    static void *worker(void *arg);
+    // 流式执行查询，结果的最后两列为用户名和密码；有 id 列时为第一列
+    long long stream(const std::string &sql, bool with_id, uint64_t *max_id);
+    std::string range_sql(const std::string &lo, const std::string &hi);
+
+private:
+    Connection_pool *m_conn_pool;
+    User_table *m_table;
+    int m_close_log;
+};
+
+#endif
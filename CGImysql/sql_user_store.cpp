@@ -0,0 +1,200 @@
+#include "sql_user_store.h"
+#include "../metrics/metrics.h"
+
+Mysql_store::Mysql_store()
+{
+    m_conn_pool = Connection_pool::GetInstance();
+    m_async_sql = Async_sql::GetInstance();
+    m_writer = Register_writer::GetInstance();
+    m_load_num = 1;
+    m_close_log = 0;
+    m_table = NULL;
+    m_snapshot_id = 0;
+    m_snapshot_joinable = false;
+}
+
+Mysql_store::~Mysql_store()
+{
+    if(m_snapshot_joinable) {
+        pthread_join(m_snapshot_tid, NULL);
+    }
+}
+
+bool Mysql_store::init(std::string url, std::string User, std::string PassWord, std::string DBName,
+    int port, int sql_min, int sql_num, int async_num, int batch_num,
+    int load_num, std::string snapshot, int close_log)
+{
+    m_close_log = close_log;
+    // 并行加载的线程数不超过连接池的最大连接数
+    m_load_num = load_num < sql_num ? load_num : sql_num;
+    m_snapshot_path = snapshot;
+
+    // 初始化数据库连接池
+    bool ok = m_conn_pool->init(url, User, PassWord, DBName, port, sql_min, sql_num, close_log);
+    if(!ok) {
+        // 数据库暂不可用时继续提供静态资源，连接在使用时重建
+        LOG_ERROR("%s", "MySQL unavailable at startup");
+    }
+
+    // 初始化注册写入器，合并注册用户的 INSERT，攒批窗口 1ms
+    if(batch_num > 0 && !m_writer->init(m_conn_pool, batch_num, 1, close_log)) {
+        LOG_WARN("%s", "register batching disabled");
+    }
+
+    // 注册写入器优先，开启时非阻塞客户端不会执行任何查询，不建立连接
+    // 否则初始化非阻塞数据库客户端，不可用时注册请求退回同步查询
+    if(async_num > 0 && !m_writer->enabled()
+        && !m_async_sql->init(url, User, PassWord, DBName, port, async_num, close_log)) {
+        LOG_WARN("%s", "async sql disabled");
+    }
+    return ok;
+}
+
+bool Mysql_store::load(User_table *table)
+{
+    m_table = table;
+    User_loader loader(m_conn_pool, table);
+
+    // 有快照时立即使用，只增量加载快照之后注册的用户
+    if(!m_snapshot_path.empty() && m_snapshot.open(m_snapshot_path.c_str())) {
+        uint64_t max_id = m_snapshot.max_id();
+        long long rows = loader.load_since(max_id, &max_id);
+        if(rows >= 0) {
+            table->attach(&m_snapshot);
+            table->reclaim();
+            LOG_INFO("loaded %llu users from snapshot, %lld newer from MySQL",
+                (unsigned long long)m_snapshot.size(), rows);
+
+            // 有新用户时在后台刷新快照，下次启动时需要增量加载的行更少
+            if(rows > 0) {
+                start_write_snapshot(max_id);
+            }
+            return true;
+        }
+        LOG_WARN("%s", "incremental load failed, fall back to full load");
+        m_snapshot.close();
+    }
+
+    // 先记录最大 id，加载期间新注册的用户下次启动时会被增量加载
+    uint64_t max_id = 0;
+    bool has_id = !m_snapshot_path.empty() && loader.query_max_id(&max_id);
+
+    long long rows = loader.load_all(m_load_num);
+    if(rows < 0) {
+        return false;
+    }
+    // 还没有开始服务，没有并发读者，可以释放扩容留下的旧槽数组
+    table->reclaim();
+    LOG_INFO("loaded %lld users from MySQL", rows);
+
+    if(has_id) {
+        start_write_snapshot(max_id);
+    }
+    return true;
+}
+
+int Mysql_store::lookup(const char *name, std::string &password)
+{
+    MYSQL *mysql = NULL;
+    connectionRAII mysql_conn(&mysql, m_conn_pool);
+    if(mysql == NULL) {
+        return -1;
+    }
+    return m_conn_pool->ExecLogin(mysql, name, password);
+}
+
+int Mysql_store::insert(const char *name, const char *password)
+{
+    // 只在需要时从连接池获取连接，静态资源请求不占用数据库连接
+    MYSQL *mysql = NULL;
+    connectionRAII mysql_conn(&mysql, m_conn_pool);
+    if(mysql == NULL) {
+        return -1;
+    }
+    return m_conn_pool->ExecInsert(mysql, name, password);
+}
+
+bool Mysql_store::submit(const char *name, const char *password, store_cb cb, void *arg, uint32_t token)
+{
+    // 开启组提交时，交给注册写入器合并写入
+    if(m_writer->enabled()) {
+        return m_writer->submit(name, password, cb, arg, token);
+    }
+
+    // 支持非阻塞查询时，提交插入语句后立即返回
+    if(m_async_sql->enabled()) {
+        std::string sql_insert = "INSERT INTO user(username, password) VALUES('";
+        sql_insert += m_async_sql->escape(name);
+        sql_insert += "', '";
+        sql_insert += m_async_sql->escape(password);
+        sql_insert += "')";
+        return m_async_sql->submit(sql_insert, cb, arg, token);
+    }
+    return false;
+}
+
+void Mysql_store::stop()
+{
+    m_writer->stop();
+    m_async_sql->stop();
+}
+
+void Mysql_store::log_stats()
+{
+    m_writer->log_stats();
+    m_conn_pool->LogStats();
+}
+
+void Mysql_store::export_metrics(std::string &out)
+{
+    pool_stats pool;
+    m_conn_pool->GetStats(&pool);
+    metrics_gauge(out, "webserver_db_pool_connections", "Connections in the MySQL pool.", pool.total);
+    metrics_gauge(out, "webserver_db_pool_in_use", "Pool connections in use.", pool.in_use);
+    metrics_gauge(out, "webserver_db_pool_free", "Idle pool connections.", pool.free);
+    metrics_counter(out, "webserver_db_pool_acquired_total", "Connections handed out by the pool.", pool.acquired);
+    metrics_counter(out, "webserver_db_pool_timeouts_total", "Pool acquisitions that timed out.", pool.timeouts);
+    metrics_counter(out, "webserver_db_pool_reconnects_total", "Pool reconnects.", pool.reconnects);
+
+    if(m_async_sql->enabled()) {
+        metrics_gauge(out, "webserver_db_async_pending", "Asynchronous queries waiting for a connection.",
+            m_async_sql->GetPending());
+    }
+    if(m_writer->enabled()) {
+        batch_stats batch;
+        m_writer->get_stats(&batch);
+        metrics_counter(out, "webserver_db_batches_total", "Register batches written.", batch.batches);
+        metrics_counter(out, "webserver_db_batch_rows_total", "Rows written by register batches.", batch.rows);
+        metrics_counter(out, "webserver_db_batch_retry_rows_total", "Rows retried one by one after a failed batch.",
+            batch.retry_rows);
+        metrics_log2_histogram(out, "webserver_db_batch_rows", "Rows per register batch.", batch.size_hist,
+            batch_stats::BUCKETS, batch.rows, 1);
+        metrics_log2_histogram(out, "webserver_db_batch_seconds", "Time to write a register batch.", batch.latency_hist,
+            batch_stats::BUCKETS, batch.latency_us_sum, 1e-6);
+    }
+}
+
+// 在后台线程中将当前用户表与快照合并写入新快照，不阻塞启动
+void Mysql_store::start_write_snapshot(uint64_t max_id)
+{
+    m_snapshot_id = max_id;
+    m_snapshot_joinable = pthread_create(&m_snapshot_tid, NULL, snapshot_worker, this) == 0;
+}
+
+void *Mysql_store::snapshot_worker(void *arg)
+{
+    Mysql_store *store = (Mysql_store *)arg;
+    store->write_snapshot();
+    return store;
+}
+
+void Mysql_store::write_snapshot()
+{
+    const User_snapshot *base = m_snapshot.loaded() ? &m_snapshot : NULL;
+    if(User_snapshot::write(m_snapshot_path.c_str(), base, *m_table, m_snapshot_id)) {
+        LOG_INFO("snapshot %s written", m_snapshot_path.c_str());
+    }
+    else {
+        LOG_ERROR("write snapshot %s error", m_snapshot_path.c_str());
+    }
+}
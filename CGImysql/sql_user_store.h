@@ -0,0 +1,70 @@
+/**MySQL 凭据存储
+ * 组合连接池、非阻塞客户端、注册写入器和用户表加载器：
+ * - 注册优先交给注册写入器组提交；写入器关闭或启动失败时才建立非阻塞连接并使用非阻塞查询；
+ *   都不可用时同步执行预处理语句
+ * - 登录在缓存未命中时在工作线程中同步执行预处理语句查询，不使用非阻塞客户端
+ * - 启动时流式并行加载用户表，可选使用快照文件并增量刷新
+ */
+
+#ifndef SQL_USER_STORE_H
+#define SQL_USER_STORE_H
+
+#include <string>
+#include <pthread.h>
+
+#include "../log/log.h"
+#include "../storage/user_store.h"
+#include "../storage/user_snapshot.h"
+#include "sql_conn_pool.h"
+#include "sql_async.h"
+#include "sql_batch.h"
+#include "sql_user_loader.h"
+
+class Mysql_store : public User_store
+{
+public:
+    Mysql_store();
+    ~Mysql_store();
+
+    // 连接数据库，初始化连接池、非阻塞客户端和注册写入器
+    // async_num、batch_num 为 0 时关闭对应功能，注册写入器开启时不使用非阻塞客户端，snapshot 为空时不使用快照
+    bool init(std::string url, std::string User, std::string PassWord, std::string DBName,
+        int port, int sql_min, int sql_num, int async_num, int batch_num,
+        int load_num, std::string snapshot, int close_log);
+
+    const char *name() const { return "mysql"; }
+
+    bool load(User_table *table);
+    int lookup(const char *name, std::string &password);
+    int insert(const char *name, const char *password);
+    bool submit(const char *name, const char *password, store_cb cb, void *arg, uint32_t token);
+    void stop();
+
+    void add_to_epoll(int epollfd) { m_async_sql->add_to_epoll(epollfd); }
+    bool owns(int fd) { return m_async_sql->owns(fd); }
+    void handle_event(int fd, unsigned int events) { m_async_sql->handle_event(fd, events); }
+
+    void log_stats();
+    void export_metrics(std::string &out);
+
+private:
+    void start_write_snapshot(uint64_t max_id);
+    static void *snapshot_worker(void *arg);
+    void write_snapshot();
+
+private:
+    Connection_pool *m_conn_pool;
+    Async_sql *m_async_sql;
+    Register_writer *m_writer;
+    int m_load_num;             // 并行加载用户表的线程数
+    std::string m_snapshot_path;
+    int m_close_log;
+
+    User_table *m_table;
+    User_snapshot m_snapshot;   // 启动时映射的快照
+    uint64_t m_snapshot_id;     // 待写入快照的最大用户 id
+    pthread_t m_snapshot_tid;   // 后台写快照的线程
+    bool m_snapshot_joinable;
+};
+
+#endif
@@ -0,0 +1,857 @@
+/**HTTP 压测工具
+ * 多线程，每个线程一个 epoll，各自管理一部分连接：
+ * - 支持长连接（keep-alive）和短连接，每条连接可流水线发送多个请求（-P）
+ * - 闭环模式（默认）：每条连接收到响应后立即发送下一个请求，测量服务器的最大吞吐
+ * - 开环模式（-r）：按固定总速率发送，每个请求有计划发送时间，延迟从计划时间算起，
+ *   服务器变慢时排队等待的时间也计入延迟，避免协调遗漏（coordinated omission），
+ *   同时给出从实际发送时间算起的未校正延迟作为对比
+ * - 延迟记录在 HDR 风格的对数线性直方图中（纳秒，每个 2 的幂区间 128 个子桶，相对误差小于 1%），
+ *   -H 输出 HdrHistogram 格式的完整分位数分布，可直接用 HdrHistogram 的绘图工具查看
+ * 请求来自场景文件（bench/scenarios/），每行 "权重 方法 路径 [请求体]"，按权重轮流发送
+ * 响应按 Content-Length 读取，不支持分块传输
+ * 用法：./loadgen [-h 主机] [-p 端口] [-t 线程数] [-c 连接数] [-d 秒] [-w 预热秒] [-P 流水线深度]
+ *       [-k 0|1] [-r 每秒请求数] [-T 超时毫秒] [-s 场景文件] [-H 分布文件]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <math.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <deque>
+#include <string>
+#include <vector>
+
+static long long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* 命令行参数 */
+struct options {
+    std::string host;
+    int port;
+    int threads;
+    int connections;
+    int duration;       // 秒
+    int warmup;         // 秒，预热期间的响应不计入结果
+    int pipeline;       // 每条连接上同时未完成的请求数
+    bool keepalive;
+    double rate;        // 总的每秒请求数，0 为闭环
+    int timeout_ms;     // 连接上超过该时间没有进展视为超时
+    std::string scenario;
+    std::string hdr_file;
+};
+
+static options g_opt;
+static sockaddr_in g_addr;
+static std::vector<std::string> g_requests;     // 构造好的请求报文
+static std::vector<std::string> g_names;
+static std::vector<int> g_sequence;             // 按权重展开的请求顺序
+
+/* 对数线性直方图：小于 256 纳秒的值各占一个桶，之后每个 2 的幂区间等分为 128 个子桶 */
+class histogram {
+public:
+    static const int SUB_BITS = 7;
+    static const int SUB_COUNT = 1 << SUB_BITS;
+    static const int BUCKETS = (40 - SUB_BITS + 1) * SUB_COUNT;     // 最大约 18 分钟
+
+    histogram() : m_counts(BUCKETS, 0), m_total(0), m_max(0), m_sum(0), m_sumsq(0) {}
+
+    static int bucket(unsigned long long v)
+    {
+        if(v < 2 * SUB_COUNT) {
+            return v;
+        }
+        int msb = 63 - __builtin_clzll(v);
+        int shift = msb - SUB_BITS;
+        int b = (shift + 1) * SUB_COUNT + (int)((v >> shift) - SUB_COUNT);
+        return b < BUCKETS ? b : BUCKETS - 1;
+    }
+    static unsigned long long bucket_low(int b)
+    {
+        if(b < 2 * SUB_COUNT) {
+            return b;
+        }
+        int shift = b / SUB_COUNT - 1;
+        return (unsigned long long)(b % SUB_COUNT + SUB_COUNT) << shift;
+    }
+    // 与桶内的值等价的最大值
+    static unsigned long long bucket_high(int b)
+    {
+        return b + 1 < BUCKETS ? bucket_low(b + 1) - 1 : bucket_low(b);
+    }
+
+    void record(long long ns)
+    {
+        if(ns < 0) {
+            ns = 0;
+        }
+        m_counts[bucket(ns)]++;
+        m_total++;
+        if((unsigned long long)ns > m_max) {
+            m_max = ns;
+        }
+        m_sum += ns;
+        m_sumsq += (double)ns * ns;
+    }
+
+    void merge(const histogram &other)
+    {
+        for(int i = 0; i < BUCKETS; ++i) {
+            m_counts[i] += other.m_counts[i];
+        }
+        m_total += other.m_total;
+        if(other.m_max > m_max) {
+            m_max = other.m_max;
+        }
+        m_sum += other.m_sum;
+        m_sumsq += other.m_sumsq;
+    }
+
+    unsigned long long total() const { return m_total; }
+    unsigned long long max() const { return m_max; }
+    double mean() const { return m_total ? m_sum / m_total : 0; }
+    double stddev() const
+    {
+        if(m_total == 0) {
+            return 0;
+        }
+        double m = mean();
+        double v = m_sumsq / m_total - m * m;
+        return v > 0 ? sqrt(v) : 0;
+    }
+
+    // 百分位（0 ~ 100）对应的值
+    unsigned long long percentile(double p) const
+    {
+        if(m_total == 0) {
+            return 0;
+        }
+        unsigned long long rank = (unsigned long long)ceil(p / 100.0 * m_total);
+        if(rank == 0) {
+            rank = 1;
+        }
+        unsigned long long seen = 0;
+        for(int i = 0; i < BUCKETS; ++i) {
+            seen += m_counts[i];
+            if(seen >= rank) {
+                unsigned long long v = bucket_high(i);
+                return v < m_max ? v : m_max;
+            }
+        }
+        return m_max;
+    }
+
+    // HdrHistogram 的分位数分布格式，值以毫秒输出，每个对半区间 5 个刻度
+    void write_distribution(FILE *fp) const
+    {
+        fprintf(fp, "%12s %14s %10s %14s\n\n", "Value", "Percentile", "TotalCount", "1/(1-Percentile)");
+        double p = 0;
+        while(m_total > 0) {
+            unsigned long long v = percentile(p);
+            unsigned long long count = 0;
+            for(int i = 0; i <= bucket(v) && i < BUCKETS; ++i) {
+                count += m_counts[i];
+            }
+            if(p >= 100.0) {
+                fprintf(fp, "%12.3f %14.12f %10llu\n", v / 1e6, 1.0, m_total);
+                break;
+            }
+            fprintf(fp, "%12.3f %14.12f %10llu %14.2f\n", v / 1e6, p / 100.0, count, 1.0 / (1.0 - p / 100.0));
+            double half = pow(2.0, floor(log2(100.0 / (100.0 - p))) + 1);
+            p += 100.0 / (half * 5);
+            if(count >= m_total || 100.0 - p < 1e-9) {
+                p = 100.0;
+            }
+        }
+        fprintf(fp, "#[Mean    = %12.3f, StdDeviation   = %12.3f]\n", mean() / 1e6, stddev() / 1e6);
+        fprintf(fp, "#[Max     = %12.3f, Total count    = %12llu]\n", m_max / 1e6, m_total);
+        fprintf(fp, "#[Buckets = %12d, SubBuckets     = %12d]\n", BUCKETS / SUB_COUNT, SUB_COUNT);
+    }
+
+private:
+    std::vector<unsigned long long> m_counts;
+    unsigned long long m_total;
+    unsigned long long m_max;
+    double m_sum;
+    double m_sumsq;
+};
+
+/* 一个线程的结果 */
+struct result {
+    histogram corrected;        // 从计划发送时间算起
+    histogram uncorrected;      // 从实际发送时间算起
+    long long requests;
+    long long bytes;
+    long long status_2xx;
+    long long status_other;
+    long long connect_errors;
+    long long read_errors;      // 连接在响应完成前被关闭或读写出错
+    long long timeouts;
+
+    result() : requests(0), bytes(0), status_2xx(0), status_other(0), connect_errors(0), read_errors(0), timeouts(0) {}
+};
+
+struct connection {
+    int fd;
+    bool connected;
+    std::string out;                // 待发送的请求
+    size_t out_off;
+    std::deque<long long> intended; // 未完成请求的计划发送时间
+    std::deque<long long> sent;     // 未完成请求的实际发送时间
+    std::string head;               // 未读完的响应头
+    bool in_body;
+    long long body_left;
+    int status;
+    bool close_after;               // 响应带有 Connection: close
+    long long next_time;            // 开环模式下一个请求的计划发送时间
+    unsigned seq;                   // 场景中下一个请求的位置
+    long long last_active;
+};
+
+class worker {
+public:
+    worker(int conn_begin, int conn_end, long long start, long long warm, long long end);
+    static void *run_thread(void *arg);
+    void run();
+
+    result m_res;
+
+private:
+    void open_conn(connection &c, long long now);
+    void close_conn(connection &c);
+    void fail_conn(connection &c, long long now, long long *counter);
+    void fill(connection &c, long long now);
+    bool flush(connection &c, long long now);
+    bool on_read(connection &c, long long now);
+    bool complete(connection &c, long long now);
+    void arm_timer(long long now);
+
+    int m_epfd;
+    int m_tfd;
+    long long m_start;
+    long long m_warm;               // 预热结束
+    long long m_end;
+    long long m_interval;           // 开环模式每条连接的请求间隔
+    std::vector<connection> m_conns;
+};
+
+worker::worker(int conn_begin, int conn_end, long long start, long long warm, long long end)
+    : m_epfd(-1), m_tfd(-1), m_start(start), m_warm(warm), m_end(end), m_interval(0)
+{
+    m_conns.resize(conn_end - conn_begin);
+    if(g_opt.rate > 0) {
+        m_interval = (long long)(1e9 * g_opt.connections / g_opt.rate);
+    }
+    for(size_t i = 0; i < m_conns.size(); ++i) {
+        connection &c = m_conns[i];
+        c.fd = -1;
+        c.connected = false;
+        c.out_off = 0;
+        c.in_body = false;
+        c.body_left = 0;
+        c.status = 0;
+        c.close_after = false;
+        // 各连接的计划发送时间错开，总体上均匀分布
+        c.next_time = start + m_interval * (conn_begin + (long long)i) / g_opt.connections;
+        c.seq = conn_begin + i;
+        c.last_active = start;
+    }
+}
+
+void *worker::run_thread(void *arg)
+{
+    ((worker *)arg)->run();
+    return NULL;
+}
+
+void worker::open_conn(connection &c, long long now)
+{
+    c.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(c.fd < 0) {
+        m_res.connect_errors++;
+        return;
+    }
+    int one = 1;
+    setsockopt(c.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if(connect(c.fd, (sockaddr *)&g_addr, sizeof(g_addr)) < 0 && errno != EINPROGRESS) {
+        close(c.fd);
+        c.fd = -1;
+        m_res.connect_errors++;
+        return;
+    }
+    epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLET | EPOLLRDHUP;
+    ev.data.u32 = &c - &m_conns[0];
+    epoll_ctl(m_epfd, EPOLL_CTL_ADD, c.fd, &ev);
+    c.connected = false;
+    c.last_active = now;
+}
+
+void worker::close_conn(connection &c)
+{
+    if(c.fd >= 0) {
+        close(c.fd);
+    }
+    c.fd = -1;
+    c.connected = false;
+    c.out.clear();
+    c.out_off = 0;
+    c.intended.clear();
+    c.sent.clear();
+    c.head.clear();
+    c.in_body = false;
+    c.body_left = 0;
+    c.close_after = false;
+}
+
+// 连接出错：未完成的请求计为失败，开环模式下这些请求不再重发
+void worker::fail_conn(connection &c, long long now, long long *counter)
+{
+    if(now >= m_warm && now < m_end) {
+        *counter += c.intended.empty() ? 1 : c.intended.size();
+    }
+    close_conn(c);
+}
+
+// 补足流水线中的请求，需要时建立连接
+void worker::fill(connection &c, long long now)
+{
+    if(now >= m_end) {
+        return;
+    }
+    if(c.fd < 0) {
+        if(g_opt.rate <= 0 || c.next_time <= now) {
+            open_conn(c, now);
+        }
+        return;
+    }
+    if(!c.connected) {
+        return;
+    }
+    bool added = false;
+    while((int)c.intended.size() < g_opt.pipeline) {
+        long long t = now;
+        if(g_opt.rate > 0) {
+            if(c.next_time > now) {
+                break;
+            }
+            t = c.next_time;
+            c.next_time += m_interval;
+        }
+        const std::string &req = g_requests[g_sequence[c.seq++ % g_sequence.size()]];
+        if(c.out_off == c.out.size()) {
+            c.out.clear();
+            c.out_off = 0;
+        }
+        c.out += req;
+        c.intended.push_back(t);
+        c.sent.push_back(now);
+        added = true;
+        // 短连接每条连接只发一个请求
+        if(!g_opt.keepalive) {
+            break;
+        }
+    }
+    if(added) {
+        flush(c, now);
+    }
+}
+
+bool worker::flush(connection &c, long long now)
+{
+    while(c.out_off < c.out.size()) {
+        ssize_t n = write(c.fd, c.out.data() + c.out_off, c.out.size() - c.out_off);
+        if(n < 0) {
+            if(errno == EAGAIN || errno == EWOULDBLOCK) {
+                return true;
+            }
+            fail_conn(c, now, &m_res.read_errors);
+            return false;
+        }
+        c.out_off += n;
+        c.last_active = now;
+    }
+    return true;
+}
+
+// 一个响应读完
+bool worker::complete(connection &c, long long now)
+{
+    long long intended = c.intended.front();
+    long long sent = c.sent.front();
+    c.intended.pop_front();
+    c.sent.pop_front();
+    c.in_body = false;
+
+    if(now >= m_warm && now < m_end) {
+        m_res.requests++;
+        m_res.corrected.record(now - intended);
+        m_res.uncorrected.record(now - sent);
+        if(c.status >= 200 && c.status < 300) {
+            m_res.status_2xx++;
+        }
+        else {
+            m_res.status_other++;
+        }
+    }
+
+    if(c.close_after || !g_opt.keepalive) {
+        if(!c.intended.empty()) {
+            fail_conn(c, now, &m_res.read_errors);
+        }
+        else {
+            close_conn(c);
+        }
+        fill(c, now);
+        return false;
+    }
+    fill(c, now);
+    return true;
+}
+
+static long long header_value(const std::string &head, const char *name)
+{
+    size_t len = strlen(name);
+    for(size_t pos = head.find("\r\n"); pos != std::string::npos; pos = head.find("\r\n", pos + 2)) {
+        if(strncasecmp(head.c_str() + pos + 2, name, len) == 0) {
+            return pos + 2 + len;
+        }
+    }
+    return -1;
+}
+
+bool worker::on_read(connection &c, long long now)
+{
+    char buf[65536];
+    while(true) {
+        ssize_t n = read(c.fd, buf, sizeof(buf));
+        if(n < 0) {
+            if(errno == EAGAIN || errno == EWOULDBLOCK) {
+                return true;
+            }
+            fail_conn(c, now, &m_res.read_errors);
+            return false;
+        }
+        if(n == 0) {
+            // 服务器关闭连接，没有未完成的请求时不算错误
+            if(c.intended.empty() && !c.in_body && c.head.empty()) {
+                close_conn(c);
+            }
+            else {
+                fail_conn(c, now, &m_res.read_errors);
+            }
+            fill(c, now);
+            return false;
+        }
+        c.last_active = now;
+        if(now >= m_warm && now < m_end) {
+            m_res.bytes += n;
+        }
+
+        const char *p = buf;
+        size_t left = n;
+        while(left > 0) {
+            if(c.intended.empty()) {
+                // 没有请求却收到数据
+                fail_conn(c, now, &m_res.read_errors);
+                fill(c, now);
+                return false;
+            }
+            if(c.in_body) {
+                size_t k = left < (size_t)c.body_left ? left : (size_t)c.body_left;
+                c.body_left -= k;
+                p += k;
+                left -= k;
+                if(c.body_left == 0 && !complete(c, now)) {
+                    return false;
+                }
+                continue;
+            }
+
+            size_t old = c.head.size();
+            c.head.append(p, left);
+            size_t end = c.head.find("\r\n\r\n", old >= 3 ? old - 3 : 0);
+            if(end == std::string::npos) {
+                if(c.head.size() > 65536) {
+                    fail_conn(c, now, &m_res.read_errors);
+                    fill(c, now);
+                    return false;
+                }
+                break;
+            }
+            size_t used = end + 4 - old;
+            c.head.resize(end + 2);
+            c.status = atoi(c.head.c_str() + 9);
+            long long pos = header_value(c.head, "Content-Length:");
+            c.body_left = pos >= 0 ? atoll(c.head.c_str() + pos) : 0;
+            pos = header_value(c.head, "Connection:");
+            c.close_after = pos >= 0 && strncasecmp(c.head.c_str() + pos + strspn(c.head.c_str() + pos, " \t"), "close", 5) == 0;
+            c.head.clear();
+            c.in_body = true;
+            p += used;
+            left -= used;
+            if(c.body_left == 0 && !complete(c, now)) {
+                return false;
+            }
+        }
+    }
+}
+
+void worker::arm_timer(long long now)
+{
+    // 最近的计划发送时间，最长 100 毫秒检查一次超时
+    long long next = now + 100000000LL;
+    if(g_opt.rate > 0) {
+        for(size_t i = 0; i < m_conns.size(); ++i) {
+            connection &c = m_conns[i];
+            if((c.fd < 0 || (c.connected && (int)c.intended.size() < g_opt.pipeline)) && c.next_time < next) {
+                next = c.next_time;
+            }
+        }
+    }
+    if(next > m_end) {
+        next = m_end;
+    }
+    if(next <= now) {
+        next = now + 1;
+    }
+    itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = next / 1000000000LL;
+    its.it_value.tv_nsec = next % 1000000000LL;
+    timerfd_settime(m_tfd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+void worker::run()
+{
+    m_epfd = epoll_create1(EPOLL_CLOEXEC);
+    m_tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u32 = (uint32_t)-1;
+    epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_tfd, &ev);
+
+    while(now_ns() < m_start) {
+        usleep(1000);
+    }
+    long long now = now_ns();
+    for(size_t i = 0; i < m_conns.size(); ++i) {
+        fill(m_conns[i], now);
+    }
+
+    std::vector<epoll_event> events(1024);
+    long long last_check = now;
+    while(now < m_end) {
+        arm_timer(now);
+        int n = epoll_wait(m_epfd, &events[0], events.size(), -1);
+        now = now_ns();
+        for(int i = 0; i < n; ++i) {
+            uint32_t id = events[i].data.u32;
+            if(id == (uint32_t)-1) {
+                uint64_t ticks;
+                ssize_t r = read(m_tfd, &ticks, sizeof(ticks));
+                (void)r;
+                continue;
+            }
+            connection &c = m_conns[id];
+            if(c.fd < 0) {
+                continue;
+            }
+            if(!c.connected) {
+                if(!(events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+                    continue;
+                }
+                int err = 0;
+                socklen_t len = sizeof(err);
+                getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+                if(err != 0) {
+                    if(now >= m_warm) {
+                        m_res.connect_errors++;
+                    }
+                    close_conn(c);
+                    // 开环模式下连接失败的请求计划时间不变，下次建立连接后发送
+                    continue;
+                }
+                c.connected = true;
+                fill(c, now);
+                continue;
+            }
+            if(events[i].events & EPOLLIN) {
+                if(!on_read(c, now)) {
+                    continue;
+                }
+            }
+            if(c.fd >= 0 && (events[i].events & (EPOLLERR | EPOLLHUP))) {
+                fail_conn(c, now, &m_res.read_errors);
+                fill(c, now);
+                continue;
+            }
+            if(c.fd >= 0 && (events[i].events & EPOLLOUT)) {
+                flush(c, now);
+            }
+        }
+
+        // 到了计划时间的请求、断开后需要重连的连接
+        for(size_t i = 0; i < m_conns.size(); ++i) {
+            connection &c = m_conns[i];
+            if(c.fd < 0 || (int)c.intended.size() < g_opt.pipeline) {
+                fill(c, now);
+            }
+        }
+
+        if(now - last_check >= 100000000LL) {
+            last_check = now;
+            for(size_t i = 0; i < m_conns.size(); ++i) {
+                connection &c = m_conns[i];
+                if(c.fd >= 0 && (!c.connected || !c.intended.empty()) &&
+                    now - c.last_active > g_opt.timeout_ms * 1000000LL) {
+                    fail_conn(c, now, &m_res.timeouts);
+                    fill(c, now);
+                }
+            }
+        }
+    }
+
+    for(size_t i = 0; i < m_conns.size(); ++i) {
+        close_conn(m_conns[i]);
+    }
+    close(m_tfd);
+    close(m_epfd);
+}
+
+// 读取场景文件：每行 "权重 方法 路径 [请求体]"，# 开头为注释
+static bool load_scenario(const std::string &path)
+{
+    std::vector<std::string> lines;
+    if(path.empty()) {
+        lines.push_back("1 GET /");
+    }
+    else {
+        FILE *fp = fopen(path.c_str(), "r");
+        if(!fp) {
+            fprintf(stderr, "loadgen: cannot open %s\n", path.c_str());
+            return false;
+        }
+        char line[4096];
+        while(fgets(line, sizeof(line), fp)) {
+            line[strcspn(line, "\r\n")] = '\0';
+            const char *p = line + strspn(line, " \t");
+            if(*p == '\0' || *p == '#') {
+                continue;
+            }
+            lines.push_back(p);
+        }
+        fclose(fp);
+    }
+
+    char host[300];
+    snprintf(host, sizeof(host), "%s:%d", g_opt.host.c_str(), g_opt.port);
+    for(size_t i = 0; i < lines.size(); ++i) {
+        int weight = 0;
+        char method[16], target[2048];
+        int used = 0;
+        if(sscanf(lines[i].c_str(), "%d %15s %2047s %n", &weight, method, target, &used) < 3 || weight <= 0) {
+            fprintf(stderr, "loadgen: bad scenario line: %s\n", lines[i].c_str());
+            return false;
+        }
+        std::string body = used > 0 ? lines[i].substr(used) : "";
+
+        std::string req = std::string(method) + " " + target + " HTTP/1.1\r\nHost: " + host + "\r\n";
+        req += g_opt.keepalive ? "Connection: keep-alive\r\n" : "Connection: close\r\n";
+        if(!body.empty() || strcmp(method, "POST") == 0) {
+            char len[64];
+            snprintf(len, sizeof(len), "Content-Length: %zu\r\n", body.size());
+            req += "Content-Type: application/x-www-form-urlencoded\r\n";
+            req += len;
+        }
+        req += "\r\n" + body;
+
+        for(int w = 0; w < weight; ++w) {
+            g_sequence.push_back(g_requests.size());
+        }
+        g_requests.push_back(req);
+        g_names.push_back(std::string(method) + " " + target);
+    }
+    if(g_requests.empty()) {
+        fprintf(stderr, "loadgen: empty scenario\n");
+        return false;
+    }
+    return true;
+}
+
+static void print_latency(const char *title, const histogram &h)
+{
+    static const double points[] = {50, 75, 90, 99, 99.9, 99.99, 99.999, 100};
+    printf("  %s (mean %.3fms, stdev %.3fms)\n", title, h.mean() / 1e6, h.stddev() / 1e6);
+    for(size_t i = 0; i < sizeof(points) / sizeof(points[0]); ++i) {
+        printf("    %8.3f%%  %10.3fms\n", points[i], h.percentile(points[i]) / 1e6);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    g_opt.host = "127.0.0.1";
+    g_opt.port = 9190;
+    g_opt.threads = 2;
+    g_opt.connections = 50;
+    g_opt.duration = 10;
+    g_opt.warmup = 0;
+    g_opt.pipeline = 1;
+    g_opt.keepalive = true;
+    g_opt.rate = 0;
+    g_opt.timeout_ms = 5000;
+
+    int opt;
+    while((opt = getopt(argc, argv, "h:p:t:c:d:w:P:k:r:T:s:H:")) != -1) {
+        switch(opt) {
+        case 'h':
+            g_opt.host = optarg;
+            break;
+        case 'p':
+            g_opt.port = atoi(optarg);
+            break;
+        case 't':
+            g_opt.threads = atoi(optarg);
+            break;
+        case 'c':
+            g_opt.connections = atoi(optarg);
+            break;
+        case 'd':
+            g_opt.duration = atoi(optarg);
+            break;
+        case 'w':
+            g_opt.warmup = atoi(optarg);
+            break;
+        case 'P':
+            g_opt.pipeline = atoi(optarg);
+            break;
+        case 'k':
+            g_opt.keepalive = atoi(optarg) != 0;
+            break;
+        case 'r':
+            g_opt.rate = atof(optarg);
+            break;
+        case 'T':
+            g_opt.timeout_ms = atoi(optarg);
+            break;
+        case 's':
+            g_opt.scenario = optarg;
+            break;
+        case 'H':
+            g_opt.hdr_file = optarg;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-h host] [-p port] [-t threads] [-c connections] [-d seconds] [-w warmup]"
+                " [-P pipeline] [-k 0|1] [-r rate] [-T timeout_ms] [-s scenario] [-H hdr_file]\n", argv[0]);
+            return 1;
+        }
+    }
+    if(g_opt.threads <= 0 || g_opt.connections <= 0 || g_opt.duration <= 0 || g_opt.pipeline <= 0) {
+        fprintf(stderr, "loadgen: threads, connections, duration and pipeline must be positive\n");
+        return 1;
+    }
+    if(g_opt.threads > g_opt.connections) {
+        g_opt.threads = g_opt.connections;
+    }
+    if(!g_opt.keepalive) {
+        g_opt.pipeline = 1;
+    }
+
+    memset(&g_addr, 0, sizeof(g_addr));
+    g_addr.sin_family = AF_INET;
+    g_addr.sin_port = htons(g_opt.port);
+    if(inet_pton(AF_INET, g_opt.host.c_str(), &g_addr.sin_addr) != 1) {
+        addrinfo hints, *res = NULL;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_INET;
+        if(getaddrinfo(g_opt.host.c_str(), NULL, &hints, &res) != 0 || !res) {
+            fprintf(stderr, "loadgen: cannot resolve %s\n", g_opt.host.c_str());
+            return 1;
+        }
+        g_addr.sin_addr = ((sockaddr_in *)res->ai_addr)->sin_addr;
+        freeaddrinfo(res);
+    }
+    if(!load_scenario(g_opt.scenario)) {
+        return 1;
+    }
+
+    printf("Running %ds test @ %s:%d, %d threads, %d connections, pipeline %d, %s, %s\n",
+        g_opt.duration, g_opt.host.c_str(), g_opt.port, g_opt.threads, g_opt.connections, g_opt.pipeline,
+        g_opt.keepalive ? "keep-alive" : "one request per connection",
+        g_opt.rate > 0 ? "open loop" : "closed loop");
+    if(g_opt.rate > 0) {
+        printf("  target rate %.0f req/s\n", g_opt.rate);
+    }
+    for(size_t i = 0; i < g_names.size(); ++i) {
+        printf("  %s\n", g_names[i].c_str());
+    }
+    fflush(stdout);
+
+    long long start = now_ns() + 10000000LL;
+    long long warm = start + g_opt.warmup * 1000000000LL;
+    long long end = warm + g_opt.duration * 1000000000LL;
+    std::vector<worker *> workers;
+    std::vector<pthread_t> tids(g_opt.threads);
+    for(int i = 0; i < g_opt.threads; ++i) {
+        int begin = (long long)g_opt.connections * i / g_opt.threads;
+        int stop = (long long)g_opt.connections * (i + 1) / g_opt.threads;
+        workers.push_back(new worker(begin, stop, start, warm, end));
+        pthread_create(&tids[i], NULL, worker::run_thread, workers[i]);
+    }
+
+    result total;
+    for(int i = 0; i < g_opt.threads; ++i) {
+        pthread_join(tids[i], NULL);
+        const result &r = workers[i]->m_res;
+        total.corrected.merge(r.corrected);
+        total.uncorrected.merge(r.uncorrected);
+        total.requests += r.requests;
+        total.bytes += r.bytes;
+        total.status_2xx += r.status_2xx;
+        total.status_other += r.status_other;
+        total.connect_errors += r.connect_errors;
+        total.read_errors += r.read_errors;
+        total.timeouts += r.timeouts;
+        delete workers[i];
+    }
+
+    double secs = g_opt.duration;
+    printf("  %lld requests in %.1fs, %.2fMB read\n", total.requests, secs, total.bytes / 1048576.0);
+    printf("  Requests/sec: %.2f\n", total.requests / secs);
+    printf("  Transfer/sec: %.2fMB\n", total.bytes / 1048576.0 / secs);
+    printf("  Non-2xx responses: %lld, errors: connect %lld, read %lld, timeout %lld\n",
+        total.status_other, total.connect_errors, total.read_errors, total.timeouts);
+    if(g_opt.rate > 0) {
+        print_latency("Latency, corrected for coordinated omission", total.corrected);
+        print_latency("Latency, uncorrected (from actual send)", total.uncorrected);
+    }
+    else {
+        print_latency("Latency", total.corrected);
+    }
+
+    if(!g_opt.hdr_file.empty()) {
+        FILE *fp = fopen(g_opt.hdr_file.c_str(), "w");
+        if(!fp) {
+            fprintf(stderr, "loadgen: cannot write %s\n", g_opt.hdr_file.c_str());
+            return 1;
+        }
+        total.corrected.write_distribution(fp);
+        fclose(fp);
+    }
+    return total.requests > 0 ? 0 : 1;
+}
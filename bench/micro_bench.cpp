@@ -0,0 +1,438 @@
+/**组件微基准测试
+ * 使用 Google Benchmark 测量请求处理路径上的热点组件：
+ * - http_conn 的 parse_line、process_read（GET 静态页面、404、登录 POST）、process_write、add_response
+ * - sort_timer_lst 在 N 个定时器下的 add、adjust、tick
+ * - threadpool 多个生产者竞争时的入队、出队吞吐
+ * - block_queue 的 push、pop
+ * - Log::write_log，以及被运行时级别过滤掉的日志调用
+ * 用法：在仓库根目录运行（静态页面从 ./root 读取）
+ *   ./micro_bench [--log=async|sync|binary] [Google Benchmark 参数]
+ *   --benchmark_format=json 或 --benchmark_out=结果文件 --benchmark_out_format=json 输出机器可读的结果
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "../http/http_conn.h"
+#include "../timer/lst_timer.h"
+#include "../threadpool/threadpool.h"
+#include "../log/block_queue.h"
+#include "../log/log.h"
+
+extern User_table users;
+
+static std::string root_dir;    // 静态页面目录
+static std::string log_dir;     // 日志写入的临时目录，运行日志用例时创建
+static std::string log_mode = "async";
+
+/* 典型的请求报文，与 bench/scenarios 中的场景一致 */
+static const char get_request[] =
+    "GET / HTTP/1.1\r\n"
+    "Host: 127.0.0.1:9190\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:128.0) Gecko/20100101 Firefox/128.0\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+    "Accept-Language: zh-CN,zh;q=0.8,en-US;q=0.5,en;q=0.3\r\n"
+    "Accept-Encoding: gzip, deflate\r\n"
+    "Connection: keep-alive\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "\r\n";
+
+static const char missing_request[] =
+    "GET /missing.html HTTP/1.1\r\n"
+    "Host: 127.0.0.1:9190\r\n"
+    "User-Agent: loadgen\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n";
+
+static const char login_request[] =
+    "POST /2CGISQL.cgi HTTP/1.1\r\n"
+    "Host: 127.0.0.1:9190\r\n"
+    "User-Agent: loadgen\r\n"
+    "Content-Type: application/x-www-form-urlencoded\r\n"
+    "Content-Length: 29\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n"
+    "user=bench&password=bench1234";
+
+/* 访问 http_conn 的私有成员 */
+class http_conn_bench {
+public:
+    // 模拟一次 read() 读入完整的请求
+    static void load(http_conn &conn, const char *request, size_t len)
+    {
+        conn.init();
+        conn.doc_root = (char *)root_dir.c_str();
+        conn.m_close_log = 1;
+        conn.m_file_address = NULL;
+        memcpy(conn.m_read_buf, request, len);
+        conn.m_read_idx = len;
+    }
+
+    // 逐行切分，返回完整的行数
+    static int parse_lines(http_conn &conn)
+    {
+        int lines = 0;
+        while(conn.parse_line() == http_conn::LINE_OK) {
+            conn.m_start_line = conn.m_checked_idx;
+            ++lines;
+        }
+        return lines;
+    }
+
+    static http_conn::HTTP_CODE process_read(http_conn &conn) { return conn.process_read(); }
+    static bool process_write(http_conn &conn, http_conn::HTTP_CODE ret) { return conn.process_write(ret); }
+    static void unmap(http_conn &conn) { conn.unmap(); }
+
+    static bool add_headers(http_conn &conn, int content_length)
+    {
+        conn.m_write_idx = 0;
+        conn.m_linger = true;
+        return conn.add_status_line(200, "OK") && conn.add_headers(content_length);
+    }
+
+    // 为 process_write 准备已定位的文件，不包含 stat、mmap 的开销
+    static void prepare_file(http_conn &conn, const char *file)
+    {
+        std::string path = root_dir + file;
+        stat(path.c_str(), &conn.m_file_stat);
+        conn.m_file_address = NULL;
+    }
+
+    static void reset_write(http_conn &conn) { conn.m_write_idx = 0; }
+};
+
+static void BM_http_parse_line(benchmark::State &state)
+{
+    http_conn *conn = new http_conn;
+    int lines = 0;
+    for(auto _ : state) {
+        http_conn_bench::load(*conn, get_request, sizeof(get_request) - 1);
+        lines = http_conn_bench::parse_lines(*conn);
+        benchmark::DoNotOptimize(lines);
+    }
+    state.SetBytesProcessed(state.iterations() * (sizeof(get_request) - 1));
+    state.counters["lines"] = lines;
+    delete conn;
+}
+BENCHMARK(BM_http_parse_line);
+
+// 完整的解析和资源定位，参数选择请求：0 GET 静态页面，1 GET 不存在的文件，2 登录 POST（缓存命中）
+static void BM_http_process_read(benchmark::State &state)
+{
+    static const struct {
+        const char *request;
+        size_t len;
+        const char *label;
+    } cases[] = {
+        {get_request, sizeof(get_request) - 1, "GET /judge.html"},
+        {missing_request, sizeof(missing_request) - 1, "GET 404"},
+        {login_request, sizeof(login_request) - 1, "POST login"},
+    };
+    const int c = state.range(0);
+    users.insert("bench", "bench1234");
+
+    http_conn *conn = new http_conn;
+    for(auto _ : state) {
+        http_conn_bench::load(*conn, cases[c].request, cases[c].len);
+        http_conn::HTTP_CODE ret = http_conn_bench::process_read(*conn);
+        benchmark::DoNotOptimize(ret);
+        http_conn_bench::unmap(*conn);
+    }
+    state.SetLabel(cases[c].label);
+    state.SetBytesProcessed(state.iterations() * cases[c].len);
+    delete conn;
+}
+BENCHMARK(BM_http_process_read)->DenseRange(0, 2);
+
+// 生成响应头，参数选择结果：0 静态文件（头部 + 文件两段），1 404 错误页面
+static void BM_http_process_write(benchmark::State &state)
+{
+    http_conn::HTTP_CODE ret = state.range(0) == 0 ? http_conn::FILE_REQUEST : http_conn::NO_RESOURCE;
+    http_conn *conn = new http_conn;
+    http_conn_bench::load(*conn, get_request, sizeof(get_request) - 1);
+    http_conn_bench::prepare_file(*conn, "/judge.html");
+    for(auto _ : state) {
+        http_conn_bench::reset_write(*conn);
+        bool ok = http_conn_bench::process_write(*conn, ret);
+        benchmark::DoNotOptimize(ok);
+    }
+    state.SetLabel(state.range(0) == 0 ? "200 file" : "404");
+    delete conn;
+}
+BENCHMARK(BM_http_process_write)->DenseRange(0, 1);
+
+// add_response 的可变参数格式化：状态行和全部头部
+static void BM_http_add_response(benchmark::State &state)
+{
+    http_conn *conn = new http_conn;
+    http_conn_bench::load(*conn, get_request, sizeof(get_request) - 1);
+    for(auto _ : state) {
+        bool ok = http_conn_bench::add_headers(*conn, 927);
+        benchmark::DoNotOptimize(ok);
+    }
+    delete conn;
+}
+BENCHMARK(BM_http_add_response);
+
+/* 定时器链表，到期回调只计数，不关闭连接 */
+static long timer_fired = 0;
+
+static void bench_cb(client_data *user_data)
+{
+    ++timer_fired;
+}
+
+static util_timer *make_timer(time_t expire)
+{
+    util_timer *timer = new util_timer;
+    timer->expire = expire;
+    timer->cb_func = bench_cb;
+    timer->user_data = NULL;
+    return timer;
+}
+
+// 与服务器相同，按到达顺序添加超时时间递增的定时器，每个新定时器都要遍历到链表尾部
+static void BM_timer_add(benchmark::State &state)
+{
+    const int n = state.range(0);
+    time_t base = time(NULL) + 3600;
+    for(auto _ : state) {
+        sort_timer_lst *lst = new sort_timer_lst;
+        for(int i = 0; i < n; ++i) {
+            lst->add_timer(make_timer(base + i));
+        }
+        state.PauseTiming();
+        delete lst;
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK(BM_timer_add)->RangeMultiplier(4)->Range(256, 16384)->Unit(benchmark::kMicrosecond);
+
+// 连接有数据时延长超时时间，被调整的定时器移到链表尾部
+static void BM_timer_adjust(benchmark::State &state)
+{
+    const int n = state.range(0);
+    time_t base = time(NULL) + 3600;
+    sort_timer_lst lst;
+    std::vector<util_timer *> timers(n);
+    for(int i = 0; i < n; ++i) {
+        timers[i] = make_timer(base + i);
+        lst.add_timer(timers[i]);
+    }
+    time_t expire = base + n;
+    unsigned seed = 1;
+    for(auto _ : state) {
+        util_timer *timer = timers[rand_r(&seed) % n];
+        timer->expire = ++expire;
+        lst.adjust_timer(timer);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_timer_adjust)->RangeMultiplier(4)->Range(256, 16384);
+
+// 每次 tick 有 1/8 的定时器到期
+static void BM_timer_tick(benchmark::State &state)
+{
+    const int n = state.range(0);
+    const int expired = n / 8;
+    time_t future = time(NULL) + 3600;
+    sort_timer_lst lst;
+    for(int i = expired; i < n; ++i) {
+        lst.add_timer(make_timer(future + i));
+    }
+    timer_fired = 0;
+    for(auto _ : state) {
+        state.PauseTiming();
+        for(int i = 0; i < expired; ++i) {
+            lst.add_timer(make_timer(i));
+        }
+        state.ResumeTiming();
+        lst.tick();
+    }
+    state.SetItemsProcessed(timer_fired);
+}
+BENCHMARK(BM_timer_tick)->RangeMultiplier(4)->Range(256, 16384)->Unit(benchmark::kMicrosecond);
+
+/* 线程池：任务只计数，衡量队列本身的开销 */
+struct bench_task {
+    static std::atomic<long> done;
+    void process() { done.fetch_add(1, std::memory_order_relaxed); }
+};
+std::atomic<long> bench_task::done(0);
+
+static std::atomic<long> tasks_submitted(0);
+
+// 线程池的工作线程不会退出，所有用例共用一个线程池
+static threadpool<bench_task> *bench_pool()
+{
+    static threadpool<bench_task> *pool = new threadpool<bench_task>(8, 1 << 20);
+    return pool;
+}
+
+// 多个生产者（主线程）同时投递任务，8 个工作线程竞争取出
+static void BM_threadpool(benchmark::State &state)
+{
+    threadpool<bench_task> *pool = bench_pool();
+    bench_task task;
+    long submitted = 0;
+    for(auto _ : state) {
+        while(!pool->append_p(&task)) {
+            sched_yield();
+        }
+        ++submitted;
+    }
+    tasks_submitted.fetch_add(submitted);
+
+    // 等待所有任务执行完，吞吐包含出队和执行
+    while(bench_task::done.load() < tasks_submitted.load()) {
+        sched_yield();
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_threadpool)->ThreadRange(1, 8)->UseRealTime();
+
+/* 阻塞队列 */
+static void BM_block_queue_push_pop(benchmark::State &state)
+{
+    block_queue<std::string> queue(1024);
+    std::string line(state.range(0), 'x');
+    std::string item;
+    for(auto _ : state) {
+        queue.push(line);
+        queue.pop(item);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_block_queue_push_pop)->Arg(64)->Arg(256);
+
+static void *queue_consumer(void *arg)
+{
+    block_queue<long> *queue = (block_queue<long> *)arg;
+    long item;
+    while(queue->pop(item) && item >= 0) {
+    }
+    return NULL;
+}
+
+// 一个生产者、一个消费者，队列满时生产者让出 CPU 重试
+static void BM_block_queue_pipe(benchmark::State &state)
+{
+    block_queue<long> queue(state.range(0));
+    pthread_t tid;
+    pthread_create(&tid, NULL, queue_consumer, &queue);
+    long i = 0;
+    for(auto _ : state) {
+        while(!queue.push(i)) {
+            sched_yield();
+        }
+        ++i;
+    }
+    while(!queue.push(-1)) {
+        sched_yield();
+    }
+    pthread_join(tid, NULL);
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_block_queue_pipe)->Arg(64)->Arg(1024)->UseRealTime();
+
+/* 日志，模式由 --log 选择，缓冲区满时等待写入线程，衡量持续写入的吞吐 */
+static void init_log()
+{
+    static bool inited = false;
+    if(inited) {
+        return;
+    }
+    inited = true;
+    char dir[] = "/tmp/micro_bench.XXXXXX";
+    if(!mkdtemp(dir)) {
+        perror("mkdtemp");
+        exit(1);
+    }
+    log_dir = dir;
+    std::string file = log_dir + "/bench";
+    int thread_buf_kb = log_mode == "sync" ? 0 : 1024;
+    Log::get_instance()->init(file.c_str(), 0, 2000, 800000, thread_buf_kb, 1000, log_mode == "binary",
+        Log::OVERFLOW_BLOCK, 0);
+    Log::set_level(1);
+}
+
+// 与服务器中 LOG_INFO 的典型调用相同
+static void BM_log_write(benchmark::State &state)
+{
+    init_log();
+    int m_close_log = 0;
+    int fd = 42;
+    for(auto _ : state) {
+        LOG_INFO("client(%s) fd %d: %s", "127.0.0.1", fd, "GET /judge.html HTTP/1.1");
+    }
+    if(state.thread_index() == 0) {
+        Log::get_instance()->flush();
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.SetLabel(log_mode);
+}
+BENCHMARK(BM_log_write)->ThreadRange(1, 4)->UseRealTime();
+
+// 低于运行时级别的调用只有一次判断
+static void BM_log_filtered(benchmark::State &state)
+{
+    init_log();
+    int m_close_log = 0;
+    int fd = 42;
+    for(auto _ : state) {
+        LOG_DEBUG("client(%s) fd %d: %s", "127.0.0.1", fd, "GET /judge.html HTTP/1.1");
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_log_filtered);
+
+int main(int argc, char *argv[])
+{
+    // 取出本程序的参数，其余交给 Google Benchmark
+    int n = 1;
+    for(int i = 1; i < argc; ++i) {
+        if(strncmp(argv[i], "--log=", 6) == 0) {
+            log_mode = argv[i] + 6;
+        }
+        else {
+            argv[n++] = argv[i];
+        }
+    }
+    argc = n;
+    if(log_mode != "async" && log_mode != "sync" && log_mode != "binary") {
+        fprintf(stderr, "usage: %s [--log=async|sync|binary] [benchmark options]\n", argv[0]);
+        return 1;
+    }
+
+    char cwd[256];
+    if(!getcwd(cwd, sizeof(cwd))) {
+        return 1;
+    }
+    root_dir = std::string(cwd) + "/root";
+
+    benchmark::Initialize(&argc, argv);
+    if(benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+
+    // 删除临时日志
+    if(!log_dir.empty()) {
+        Log::get_instance()->flush();
+        std::string cmd = "rm -rf " + log_dir;
+        if(system(cmd.c_str()) != 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
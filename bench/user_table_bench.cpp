@@ -0,0 +1,205 @@
+/**用户表基准测试
+ * 在 N 个用户下测量 User_table 与 std::map 的查找延迟和常驻内存（RSS）
+ * 每个用例在独立的子进程中运行，保证 RSS 互不影响
+ * 用法：./user_table_bench [-m] [-t 读线程数] [用户数 ...]，默认 1000000 10000000，-m 同时测试 std::map
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include <map>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "../storage/user_table.h"
+
+static const int LOOKUPS = 2000000;     // 每个线程的查找次数
+static const int SAMPLES = 200000;      // 逐次计时的采样次数
+
+static long long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static long rss_kb()
+{
+    long pages = 0, resident = 0;
+    FILE *fp = fopen("/proc/self/statm", "r");
+    if(fp) {
+        if(fscanf(fp, "%ld %ld", &pages, &resident) != 2) {
+            resident = 0;
+        }
+        fclose(fp);
+    }
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static void make_name(char *buf, unsigned long i)
+{
+    snprintf(buf, 32, "user_%010lu", i);
+}
+
+// 预先生成待查找的用户名，计时中不包含格式化的开销
+static std::vector<std::string> make_keys(size_t users, int n, unsigned seed)
+{
+    std::vector<std::string> keys(n);
+    char name[32];
+    for(int i = 0; i < n; ++i) {
+        make_name(name, rand_r(&seed) % users);
+        keys[i] = name;
+    }
+    return keys;
+}
+
+static long lookup(const User_table *table, const std::map<std::string, std::string> *map,
+    const std::string &key, std::string &password)
+{
+    if(table) {
+        return table->find(key, password);
+    }
+    std::map<std::string, std::string>::const_iterator it = map->find(key);
+    if(it == map->end()) {
+        return 0;
+    }
+    password = it->second;
+    return 1;
+}
+
+struct lookup_arg {
+    const User_table *table;
+    const std::map<std::string, std::string> *map;
+    const std::vector<std::string> *keys;
+    long long ns;
+    long found;
+};
+
+static void *lookup_worker(void *p)
+{
+    lookup_arg *arg = (lookup_arg *)p;
+    std::string password;
+
+    long long start = now_ns();
+    for(size_t i = 0; i < arg->keys->size(); ++i) {
+        arg->found += lookup(arg->table, arg->map, (*arg->keys)[i], password);
+    }
+    arg->ns = now_ns() - start;
+    return NULL;
+}
+
+static void run_case(size_t users, bool use_map, int threads)
+{
+    User_table *table = NULL;
+    std::map<std::string, std::string> *map = NULL;
+    char name[32], password[32];
+
+    long rss_before = rss_kb();
+    long long start = now_ns();
+    if(use_map) {
+        map = new std::map<std::string, std::string>();
+    }
+    else {
+        table = new User_table();
+    }
+    for(size_t i = 0; i < users; ++i) {
+        make_name(name, i);
+        snprintf(password, sizeof(password), "pw_%010lu", (unsigned long)i);
+        if(map) {
+            (*map)[name] = password;
+        }
+        else {
+            table->insert(name, password);
+        }
+    }
+    if(table) {
+        table->reclaim();
+    }
+    long long load_ns = now_ns() - start;
+    long rss = rss_kb() - rss_before;
+
+    // 多线程吞吐
+    std::vector<std::vector<std::string> > keys(threads);
+    std::vector<pthread_t> tids(threads);
+    std::vector<lookup_arg> args(threads);
+    for(int i = 0; i < threads; ++i) {
+        keys[i] = make_keys(users, LOOKUPS, (unsigned)(i + 1) * 7919);
+    }
+    for(int i = 0; i < threads; ++i) {
+        lookup_arg a = {table, map, &keys[i], 0, 0};
+        args[i] = a;
+        pthread_create(&tids[i], NULL, lookup_worker, &args[i]);
+    }
+    long long total_ns = 0;
+    long found = 0;
+    for(int i = 0; i < threads; ++i) {
+        pthread_join(tids[i], NULL);
+        total_ns += args[i].ns;
+        found += args[i].found;
+    }
+
+    // 单次查找延迟分布
+    std::vector<std::string> sample_keys = make_keys(users, SAMPLES, 12345);
+    std::vector<long long> samples(SAMPLES);
+    std::string found_password;
+    for(int i = 0; i < SAMPLES; ++i) {
+        long long t0 = now_ns();
+        found += lookup(table, map, sample_keys[i], found_password);
+        samples[i] = now_ns() - t0;
+    }
+    std::sort(samples.begin(), samples.end());
+
+    if(found != (long)threads * LOOKUPS + SAMPLES) {
+        printf("lookup mismatch: %ld\n", found);
+    }
+    printf("%-10s users=%-9zu threads=%d load=%.2fs rss=%.1fMB bytes/user=%.1f avg=%.1fns p50=%lldns p99=%lldns p999=%lldns\n",
+        use_map ? "std::map" : "User_table", users, threads, load_ns / 1e9, rss / 1024.0,
+        rss * 1024.0 / users, (double)total_ns / threads / LOOKUPS,
+        samples[SAMPLES / 2], samples[SAMPLES * 99 / 100], samples[SAMPLES * 999 / 1000]);
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[])
+{
+    bool with_map = false;
+    int threads = 1;
+    int opt;
+    while((opt = getopt(argc, argv, "mt:")) != -1) {
+        switch(opt) {
+        case 'm':
+            with_map = true;
+            break;
+        case 't':
+            threads = atoi(optarg);
+            break;
+        default:
+            break;
+        }
+    }
+
+    std::vector<size_t> sizes;
+    for(int i = optind; i < argc; ++i) {
+        sizes.push_back(strtoul(argv[i], NULL, 10));
+    }
+    if(sizes.empty()) {
+        sizes.push_back(1000000);
+        sizes.push_back(10000000);
+    }
+
+    for(size_t i = 0; i < sizes.size(); ++i) {
+        for(int m = 0; m <= (with_map ? 1 : 0); ++m) {
+            pid_t pid = fork();
+            if(pid == 0) {
+                run_case(sizes[i], m == 1, threads);
+                _exit(0);
+            }
+            waitpid(pid, NULL, 0);
+        }
+    }
+    return 0;
+}
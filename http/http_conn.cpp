@@ -1,4 +1,8 @@
+#include <sys/eventfd.h>
+
 #include "http_conn.h"
+#include "../threadpool/threadpool.h"
+#include "../trace/profiler.h"
 
 /* 定义一些HTTP响应的状态信息 */
 const char *ok_200_tile = "OK";
@@ -11,34 +15,34 @@ const char *error_404_form = "The requested file was not found on this server.\n
 const char *error_500_title = "Internal Error";
 const char *error_500_form = "There was an unusual problem serving the requested file.\n";
 
-std::map<std::string, std::string> users;
+// 用户名到密码的缓存，登录线程无锁读取，注册线程并发插入
+User_table users;
 
-void http_conn::init_mysql_res(Connection_pool *conn_pool)
+// 单调时钟的纳秒数，用于指标和访问日志中的各段耗时
+static long long mono_ns()
 {
-    // 从数据库连接池取一个连接
-    MYSQL *mysql = NULL;
-    connectionRAII mysql_conn(&mysql, conn_pool);
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
 
-    // 在user表中检索浏览器端输入username，password数据
-    if(mysql_query(mysql, "SELECT username, password FROM user")) {
-        LOG_ERROR("SELECT error: %s\n", mysql_error(mysql));
+// 缓存未命中时到存储中查询，记录查询耗时
+static int store_lookup(User_store *store, const char *name, std::string &password)
+{
+    long long start = mono_ns();
+    int ret = store->lookup(name, password);
+    long long now = mono_ns();
+    metrics::get_instance()->record(H_DB_QUERY, (now - start) / 1000);
+    if(trace_span::current) {
+        trace_span::current->set(T_DB_DONE, now);
     }
+    return ret;
+}
 
-    // 从表中检索完整的结果集
-    MYSQL_RES *result = mysql_store_result(mysql);
-
-    // 返回结果集中的列数
-    int num_fields = mysql_num_fields(result);
-
-    // 返回所有字段结构的数组
-    MYSQL_FIELD *fields = mysql_fetch_fields(result);
-
-    // 从结果集中获取下一行，将对应的用户名和密码存入map中
-    while(MYSQL_ROW row = mysql_fetch_row(result)) {
-        std::string temp1(row[0]);
-        std::string temp2(row[1]);
-        users[temp1] = temp2;
-    }
+bool http_conn::init_store(User_store *store)
+{
+    m_store = store;
+    return store->load(&users);
 }
 
 /* 对文件描述符设置非阻塞 */
@@ -53,6 +57,10 @@ int setnonblocking(int fd)
 /* 向内核事件表注册读事件，ET模式，选择开启EPOLLONESHOT */
 void addfd(int epollfd, int fd, bool one_shot)
 {
+    // io_uring 后端由主线程提交接收请求
+    if(uring::active()) {
+        return;
+    }
     epoll_event event;
     event.data.fd = fd;
     event.events = EPOLLIN | EPOLLET | EPOLLRDHUP;
@@ -60,40 +68,69 @@ void addfd(int epollfd, int fd, bool one_shot)
     if(one_shot) {
         event.events |= EPOLLONESHOT;
     }
+    // 连接在 accept 时已设置非阻塞（SOCK_NONBLOCK），不再需要两次 fcntl
     epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event);
-    
-    // 设置文件描述符非阻塞
-    setnonblocking(fd);
+    metrics::get_instance()->add(M_SYS_EPOLL_CTL);
 }
 
 
 /* 从内核事件表移除监听的文件描述符 */
 void removefd(int epollfd, int fd)
 {
+    // io_uring 后端交给主线程关闭，环中可能还有该 socket 上未完成的请求
+    if(uring::active()) {
+        uring::get_instance()->post(fd, 0);
+        return;
+    }
     epoll_ctl(epollfd, EPOLL_CTL_DEL, fd, 0);
     close(fd);
+    metrics::get_instance()->add(M_SYS_EPOLL_CTL);
+    metrics::get_instance()->add(M_SYS_CLOSE);
 }
 
 /* 重置EPOLLONESHOT事件，确保下一次可读时能触发EPOLLIN事件 */
 void modfd(int epollfd, int fd, int ev)
 {
+    // io_uring 后端：EPOLLIN 表示可以处理下一批数据，EPOLLOUT 表示响应就绪，由主线程提交发送
+    if(uring::active()) {
+        uring::get_instance()->post(fd, ev);
+        return;
+    }
     epoll_event event;
     event.data.fd = fd;
     event.events = ev | EPOLLET | EPOLLONESHOT | EPOLLRDHUP;
     epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &event);
+    metrics::get_instance()->add(M_SYS_EPOLL_CTL);
 }
 
-int http_conn::m_user_count = 0;    // 初始化连接的客户数
+std::atomic<int> http_conn::m_user_count(0);    // 初始化连接的客户数
 int http_conn::m_epollfd = -1;      // 初始化内核事件表
+threadpool<http_conn> *http_conn::m_threadpool = NULL;
+User_store *http_conn::m_store = NULL;
+int http_conn::m_db_done_fd = -1;
+locker http_conn::m_db_done_lock("http_conn.db_done");
+std::vector<http_conn::db_done> http_conn::m_db_done;
+locker http_conn::m_stalled_lock("http_conn.stalled");
+std::vector<int> http_conn::m_stalled_fds;
 
 /* 关闭连接，关闭一个连接，客户总数减一 */
 void http_conn::close_conn()
 {
     if(m_sockfd != -1) {
+        release();
         printf("close %d\n", m_sockfd);
         removefd(m_epollfd, m_sockfd);
         m_sockfd = -1;
-        m_user_count--;
+        m_user_count.fetch_sub(1, std::memory_order_relaxed);
+    }
+}
+
+/* 连接关闭，代数由奇数变为偶数；工作线程和主线程可能先后关闭同一连接，只加一次 */
+void http_conn::release()
+{
+    uint32_t gen = m_conn_gen.load(std::memory_order_acquire);
+    if(gen & 1) {
+        m_conn_gen.compare_exchange_strong(gen, gen + 1, std::memory_order_acq_rel);
     }
 }
 
@@ -103,9 +140,14 @@ void http_conn::init(int sockfd, const sockaddr_in &addr, char *root, int close_
 {
     m_sockfd = sockfd;
     m_address = addr;
+    // 新连接取下一个奇数代数，旧连接上未完成的异步数据库操作的结果随之失效
+    uint32_t gen = m_conn_gen.load(std::memory_order_relaxed);
+    m_conn_gen.store((gen + 1) | 1, std::memory_order_release);
 
     addfd(m_epollfd, sockfd, true);
-    m_user_count++;
+    m_user_count.fetch_add(1, std::memory_order_relaxed);
+    m_tcp_sampled_ns = 0;
+    m_tcp_retrans = 0;
 
     // 当服务器出现连接重置时，可能时网站根目录出错或者HTTP响应格式出错或者访问的文件内容完全为空
     doc_root = root;
@@ -116,6 +158,7 @@ void http_conn::init(int sockfd, const sockaddr_in &addr, char *root, int close_
     strcpy(sql_dbname, dbname.c_str());
 
     init();
+    m_span.stamp(T_ACCEPT);
 }
 
 void http_conn::init()
@@ -138,8 +181,21 @@ void http_conn::init()
 
 
     cgi = 0;
-    mysql = NULL;
     m_state = 0;
+    m_db_state = DB_NONE;
+    m_db_result = 0;
+
+    m_status = 0;
+    m_start_ns = 0;
+    m_queued_ns = 0;
+    m_queue_ns = 0;
+    m_ready_ns = 0;
+    m_write_stalled = false;
+    m_syscalls = 0;
+    m_db_ns = 0;
+    m_path[0] = '\0';
+    m_span.clear();
+    m_body = 0;
 
     timer_flag = 0;
     improv = 0;
@@ -157,25 +213,68 @@ bool http_conn::read()
         return false;
     }
     int bytes_read = 0;
+
+    // 请求开始时间和排队开始时间
+    long long now = mono_ns();
+    if(m_start_ns == 0) {
+        m_start_ns = now;
+    }
+    m_queued_ns = now;
     
+    int calls = 0;
     while(true) {
         // 从m_read_buf+m_read_idx索引处开始保存数据，大小是READ_BUF_SIZE-m_read-idx
-        bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0);
+        int space = READ_BUFFER_SIZE - m_read_idx;
+        bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, space, 0);
+        ++calls;
         if(bytes_read == -1) {
             // 非阻塞ET模式下，需要一次性将数据读完
             if(errno == EAGAIN || errno == EWOULDBLOCK) {   // 没有数据可读
                 break;
             }
+            count_syscalls(M_SYS_RECV, calls);
             return false;
         }
         else if(bytes_read == 0) {  // 对方关闭连接
+            count_syscalls(M_SYS_RECV, calls);
             return false;
         }
         m_read_idx += bytes_read;
+        // 没有读满说明内核中已经没有数据，省去一次返回 EAGAIN 的 recv；
+        // EPOLLONESHOT 下之后到达的数据会在重新注册读事件时报告
+        if(bytes_read < space) {
+            break;
+        }
+    }
+    count_syscalls(M_SYS_RECV, calls);
+    // 请求分几次到达时记录最后一次读到数据的时间
+    if(tracer::enabled()) {
+        m_span.ns[T_READ] = mono_ns();
     }
     return true;
 }
 
+/* io_uring 后端：主线程将接收到的数据复制到读缓冲，返回复制的字节数，读缓冲已满时返回 -1 */
+int http_conn::feed(const char *data, int len)
+{
+    if(m_read_idx >= READ_BUFFER_SIZE) {
+        return -1;
+    }
+    long long now = mono_ns();
+    if(m_start_ns == 0) {
+        m_start_ns = now;
+    }
+    m_queued_ns = now;
+
+    int n = len < READ_BUFFER_SIZE - m_read_idx ? len : READ_BUFFER_SIZE - m_read_idx;
+    memcpy(m_read_buf + m_read_idx, data, n);
+    m_read_idx += n;
+    if(tracer::enabled()) {
+        m_span.ns[T_READ] = now;
+    }
+    return n;
+}
+
 /**从状态机，用于解析一行的内容
  * 返回值为行的读取状态：LINE_OK、LINE_BAD、LINE_OPEN
  * 判断依据："\r\n"字符
@@ -256,6 +355,10 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char *text)
     if(!m_url || m_url[0] != '/') {
         return BAD_REQUEST;
     }
+    // 访问日志和请求追踪记录改写前的路径
+    if(access_log::get_instance()->enabled() || tracer::enabled()) {
+        snprintf(m_path, sizeof(m_path), "%s", m_url);
+    }
     // 当url为/时，显示静态页面judge.html
     if(strlen(m_url) == 1) {
         strcat(m_url, "judge.html");
@@ -294,7 +397,7 @@ http_conn::HTTP_CODE http_conn::parse_headers(char *text)
         m_host = text;
     }
     else {
-        LOG_INFO("oop! unknow header: %s", text);
+        LOG_DEBUG_RATE(LOG_REQUEST_RATE, "oop! unknow header: %s", text);
     }
     return NO_REQUEST;
 }
@@ -323,7 +426,7 @@ http_conn::HTTP_CODE http_conn::process_read()
         // 获取一行信息
         text = get_line();
         m_start_line = m_checked_idx;
-        LOG_INFO("got 1 http line: %s\n", text);
+        LOG_DEBUG_RATE(LOG_REQUEST_RATE, "got 1 http line: %s\n", text);
 
         // 主状态机的三种状态转移逻辑
         switch(m_check_state) {
@@ -337,14 +440,18 @@ http_conn::HTTP_CODE http_conn::process_read()
                 ret = parse_headers(text);
                 if(ret == BAD_REQUEST)
                     return BAD_REQUEST;
-                else if(ret == GET_REQUEST)
+                else if(ret == GET_REQUEST) {
+                    m_span.stamp(T_PARSE);
                     return do_request();
+                }
                 break;
             }
             case CHECK_STATE_CONTENT: {
                 ret = parse_content(text);
-                if(ret == GET_REQUEST)
+                if(ret == GET_REQUEST) {
+                    m_span.stamp(T_PARSE);
                     return do_request();
+                }
                 line_status = LINE_OPEN;
                 break;
             }
@@ -407,37 +514,60 @@ http_conn::HTTP_CODE http_conn::do_request()
         // 如果是注册检测，先检测数据库中是否有重名
         // 没有重名的，增加数据
         if(*(p + 1) == '3') {
-            char *sql_insert = (char *)malloc(sizeof(char) * 200);
-            strcpy(sql_insert, "INSERT INTO user(username, password) VALUES(");
-            strcat(sql_insert, "'");
-            strcat(sql_insert, name);
-            strcat(sql_insert, "', '");
-            strcat(sql_insert, password);
-            strcat(sql_insert, "')");
-
-            if(users.find(name) == users.end()) {
-                m_lock.lock();
-
-                int res = mysql_query(mysql, sql_insert);
-                users.insert(std::pair<std::string, std::string>(name, password));
-                
-                m_lock.unlock();
-
-                if(!res) {
+            // 异步插入完成后重新进入，根据结果选择返回的页面
+            if(m_db_state == DB_DONE) {
+                m_db_state = DB_NONE;
+                if(!m_db_result) {
+                    users.insert(name, password);
                     strcpy(m_url, "/login.html");
                 }
                 else {
                     strcpy(m_url, "/registerError.html");
                 }
             }
-            else {
+            else if(users.contains(name)) {
                 strcpy(m_url, "/registerError.html");
             }
+            // 支持异步插入的存储（组提交、非阻塞查询）提交后立即释放工作线程，由回调重新投递请求
+            else {
+                m_db_state = DB_WAIT;
+                m_db_ns = mono_ns();
+                // 提交成功后请求可能立即在其他工作线程中恢复，提交之后不再修改连接的状态
+                m_span.set(T_DB_ACQUIRED, m_db_ns);
+                if(m_store->submit(name, password, async_callback, this,
+                    m_conn_gen.load(std::memory_order_acquire))) {
+                    return DB_REQUEST;
+                }
+                m_db_state = DB_NONE;
+                // 同步插入时由连接池记录获得连接的时间
+                m_span.ns[T_DB_ACQUIRED] = 0;
+
+                // 同步插入
+                int ret = m_store->insert(name, password);
+                long long now = mono_ns();
+                metrics::get_instance()->record(H_DB_QUERY, (now - m_db_ns) / 1000);
+                m_span.set(T_DB_DONE, now);
+                if(!ret) {
+                    users.insert(name, password);
+                    strcpy(m_url, "/login.html");
+                }
+                else {
+                    strcpy(m_url, "/registerError.html");
+                }
+            }
         }
         // 如果是登录，直接判断
         // 如果浏览器端输入的用户名和密码可查到返回1，否则返回0
         else if(*(p + 1) == '2') {
-            if(users.find(name) != users.end() && users[name] == password) {
+            std::string cached_password, db_password;
+            bool cached = users.find(name, cached_password);
+            if(cached && cached_password == password) {
+                strcpy(m_url, "/welcome.html");
+            }
+            // 缓存中没有的用户（如由其他服务器注册）再到存储中查询。
+            // 用户表在启动时已全部加载，未命中很少见，查询在工作线程中同步执行，不经过非阻塞客户端
+            else if(!cached && store_lookup(m_store, name, db_password) == 1 && db_password == password) {
+                users.insert(name, db_password);
                 strcpy(m_url, "/welcome.html");
             }
             else {
@@ -496,6 +626,9 @@ http_conn::HTTP_CODE http_conn::do_request()
         strncpy(m_real_file + len, m_url, FILENAME_LEN - len -1);
     }
     
+    // 路由后的页面和文件路径
+    WS_PROBE3(do_request, this, m_url, m_real_file);
+
     // 获取m_real_file文件的相关状态信息：-1失败，0成功
     if(stat(m_real_file, &m_file_stat) < 0) {
         return NO_RESOURCE;
@@ -535,54 +668,154 @@ bool http_conn::write()
 
     // 待发送字节为0，响应结束
     if(bytes_to_send == 0) {    
-        modfd(m_epollfd, m_sockfd, EPOLLIN);
         init();
+        rearm(EPOLLIN);
         return true;
     }
 
+    if(bytes_have_send == 0) {
+        m_span.stamp(T_FIRST_BYTE);
+    }
     while(true) {
         temp = writev(m_sockfd, m_iv, m_iv_count);
+        count_syscalls(M_SYS_WRITEV, 1);
         
         if(temp < 0) {
             // 如果TCP写缓冲没有空间，等待下一轮EPOLLOUT事件
             // 虽然服务器此时无法立即接收同一客户的下一个请求，但可以保证连接的完整性
             if(errno == EAGAIN) {
-                modfd(m_epollfd, m_sockfd, EPOLLOUT);
+                metrics::get_instance()->add(M_WRITE_STALLS);
+                m_write_stalled = true;
+                if(tcp_stats::enabled()) {
+                    sample_tcp(mono_ns());
+                }
+                rearm(EPOLLOUT);
                 return true;
             }
-            unmap();
+            send_failed();
             return false;
         }
 
-        bytes_have_send += temp;
-        bytes_to_send -= temp;
-
-        if(bytes_have_send >= m_iv[0].iov_len) {
-            m_iv[0].iov_len = 0;
-            m_iv[1].iov_base = m_file_address + (bytes_have_send - m_write_idx);
-            m_iv[1].iov_len = bytes_to_send;
-        }
-        else {
-            m_iv[0].iov_base = m_write_buf + bytes_have_send;
-            m_iv[0].iov_len = m_iv[0].iov_len - bytes_have_send;
+        bool done;
+        bool ret = sent(temp, done);
+        if(done) {
+            return ret;
         }
+    }
+}
 
-        if(bytes_to_send <= 0) {
-            // 没有数据待发送
-            unmap();
-            modfd(m_epollfd, m_sockfd, EPOLLIN);
+/* 已发送 temp 字节，调整待发送的内存块；全部发完时结束响应，done 置为 true，返回 false 表示关闭连接 */
+bool http_conn::sent(int temp, bool &done)
+{
+    bytes_have_send += temp;
+    bytes_to_send -= temp;
 
-            if(m_linger) {
-                init();
-                return true;
-            }
-            else {
-                return false;
+    if(bytes_have_send >= m_iv[0].iov_len) {
+        m_iv[0].iov_len = 0;
+        m_iv[1].iov_base = m_body + (bytes_have_send - m_write_idx);
+        m_iv[1].iov_len = bytes_to_send;
+    }
+    else {
+        m_iv[0].iov_base = m_write_buf + bytes_have_send;
+        m_iv[0].iov_len = m_iv[0].iov_len - bytes_have_send;
+    }
+
+    done = bytes_to_send <= 0;
+    if(!done) {
+        return true;
+    }
+    // 没有数据待发送
+    m_write_stalled = false;
+    m_span.stamp(T_LAST_BYTE);
+    unmap();
+    record_response(true);
+
+    if(m_linger) {
+        init();
+        // 最后才重新注册读事件：先写时在工作线程中执行，注册后主线程随时可能读入下一个请求
+        rearm(EPOLLIN);
+        return true;
+    }
+    return false;
+}
+
+/* 先写：工作线程生成长连接的响应后直接发送，发完只需重新注册读事件；
+ * 写到 EAGAIN 时才注册写事件，由主线程继续发送。TCP_INFO 采样只在主线程中进行 */
+void http_conn::write_first()
+{
+    m_span.stamp(T_FIRST_BYTE);
+    while(true) {
+        int temp = writev(m_sockfd, m_iv, m_iv_count);
+        count_syscalls(M_SYS_WRITEV, 1);
+        if(temp < 0) {
+            if(errno == EAGAIN) {
+                metrics::get_instance()->add(M_WRITE_STALLS);
+                // 发送窗口为 0 的客户端可能一直没有 EPOLLOUT，交给主线程在定时器中采样；
+                // 连接在重新注册写事件后才交还主线程，此前的状态对主线程可见
+                m_write_stalled.store(true, std::memory_order_release);
+                if(tcp_stats::enabled()) {
+                    m_stalled_lock.lock();
+                    m_stalled_fds.push_back(m_sockfd);
+                    m_stalled_lock.unlock();
+                }
+                rearm(EPOLLOUT);
+                return;
             }
+            // 出错时关闭读写，由主线程在 EPOLLRDHUP 事件中关闭连接
+            send_failed();
+            shutdown(m_sockfd, SHUT_RDWR);
+            count_syscalls(M_SYS_SHUTDOWN, 1);
+            rearm(EPOLLIN);
+            return;
+        }
+
+        bool done;
+        sent(temp, done);
+        if(done) {
+            return;
         }
     }
 }
 
+/* 重新注册该连接的事件，计入本次请求的系统调用 */
+void http_conn::rearm(int ev)
+{
+    if(!uring::active()) {
+        ++m_syscalls;
+    }
+    modfd(m_epollfd, m_sockfd, ev);
+}
+
+/* 发送出错，响应中止 */
+void http_conn::send_failed()
+{
+    unmap();
+    record_response(false);
+}
+
+/* io_uring 后端：待发送的内存块，没有待发送数据时返回 0 */
+int http_conn::send_iov(struct iovec **iov)
+{
+    if(bytes_to_send == 0) {
+        return 0;
+    }
+    if(bytes_have_send == 0) {
+        m_span.stamp(T_FIRST_BYTE);
+    }
+    *iov = m_iv;
+    return m_iv_count;
+}
+
+void http_conn::sample_tcp(long long now)
+{
+    if(now - m_tcp_sampled_ns < tcp_stats::interval_ns()) {
+        return;
+    }
+    m_tcp_sampled_ns = now;
+    tcp_stats::get_instance()->sample(m_sockfd, m_address, bytes_have_send, bytes_to_send,
+        m_ready_ns != 0 ? now - m_ready_ns : 0, m_tcp_retrans);
+}
+
 /* 往写缓冲中写入待发送数据 */
 bool http_conn::add_response(const char *format, ...)
 {
@@ -600,12 +833,13 @@ bool http_conn::add_response(const char *format, ...)
     m_write_idx += len;
     va_end(arg_list);
 
-    LOG_INFO("request: %s", m_write_buf);
+    LOG_DEBUG_RATE(LOG_REQUEST_RATE, "request: %s", m_write_buf);
     return true;
 }
 
 bool http_conn::add_status_line(int status, const char *title)
 {
+    m_status = status;
     return add_response("%s %d %s\r\n", "HTTP/1.1", status, title);
 }
 
@@ -683,8 +917,9 @@ bool http_conn::process_write(HTTP_CODE ret)
                 add_headers(m_file_stat.st_size);
                 m_iv[0].iov_base = m_write_buf;
                 m_iv[0].iov_len = m_write_idx;
-                m_iv[1].iov_base = m_file_address;
-                m_iv[1].iov_len - m_file_stat.st_size;
+                m_body = m_file_address;
+                m_iv[1].iov_base = m_body;
+                m_iv[1].iov_len = m_file_stat.st_size;
                 m_iv_count = 2;
 
                 bytes_to_send = m_write_idx + m_file_stat.st_size;
@@ -709,15 +944,85 @@ bool http_conn::process_write(HTTP_CODE ret)
     return true;
 }
 
+void http_conn::record_response(bool complete)
+{
+    long long now = mono_ns();
+    metrics *m = metrics::get_instance();
+    m->add(M_BYTES_SENT, bytes_have_send);
+    client_tracker::get_instance()->on_request(m_address.sin_addr.s_addr, bytes_have_send);
+    if(!complete) {
+        m->add(M_WRITE_ERRORS);
+    }
+    else if(m_status >= 500) {
+        m->add(M_RESPONSES_5XX);
+    }
+    else if(m_status >= 400) {
+        m->add(M_RESPONSES_4XX);
+    }
+    else {
+        m->add(M_RESPONSES_2XX);
+    }
+    if(complete && m_ready_ns != 0) {
+        m->record(H_WRITE, (now - m_ready_ns) / 1000);
+    }
+    if(complete && m_start_ns != 0) {
+        m->record(H_REQUEST, (now - m_start_ns) / 1000);
+    }
+    m->record(H_SYSCALLS, m_syscalls);
+    tracer::get_instance()->commit(m_span, m_sockfd, m_method, m_status, complete, bytes_have_send, m_path);
+
+    access_log *log = access_log::get_instance();
+    if(!log->enabled()) {
+        return;
+    }
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    access_rec rec;
+    rec.time_us = ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+    rec.addr = m_address.sin_addr.s_addr;
+    rec.port = m_address.sin_port;
+    rec.method = m_method;
+    rec.complete = complete ? 1 : 0;
+    rec.status = m_status;
+    rec.path_len = 0;
+    rec.bytes = bytes_have_send;
+    rec.latency_us = m_start_ns != 0 ? (now - m_start_ns) / 1000 : 0;
+    rec.queue_us = m_queue_ns / 1000;
+    log->write(rec, m_path[0] ? m_path : "-");
+}
+
 /* 处理HTTP请求的入口函数，由线程池中的工作线程调用 */
 void http_conn::process()
 {
-    // 解析HTTP请求报文
-    HTTP_CODE read_ret = process_read();
+    long long start = mono_ns();
+    trace_scope scope(&m_span);
+    m_span.set(T_DEQUEUE, start);
+    if(m_queued_ns != 0) {
+        metrics::get_instance()->record(H_QUEUE, (start - m_queued_ns) / 1000);
+        m_queue_ns += start - m_queued_ns;
+        m_queued_ns = 0;
+    }
+
+    // 解析HTTP请求报文；异步数据库操作完成后重新投递的请求直接继续处理
+    HTTP_CODE read_ret;
+    if(m_db_state == DB_DONE) {
+        read_ret = do_request();
+    }
+    else {
+        read_ret = process_read();
+        if(read_ret != NO_REQUEST) {
+            metrics::get_instance()->record(H_PARSE, (mono_ns() - start) / 1000);
+        }
+    }
     // NO_REQUEST，表示请求不完整，需要继续接收请求数据
     if(read_ret == NO_REQUEST) {
         // 注册并监听读事件
-        modfd(m_epollfd, m_sockfd, EPOLLIN);
+        rearm(EPOLLIN);
+        return;
+    }
+    // DB_REQUEST，等待异步数据库操作完成，此时不注册任何事件
+    if(read_ret == DB_REQUEST) {
         return;
     }
 
@@ -726,10 +1031,255 @@ void http_conn::process()
     if(!write_ret) {
         close_conn();
     }
+    m_ready_ns = mono_ns();
+    // 长连接先直接发送；io_uring 后端由主线程提交发送
+    if(write_ret && m_linger && !uring::active()) {
+        write_first();
+        return;
+    }
     // 注册并监听写事件
-    modfd(m_epollfd, m_sockfd, EPOLLOUT);
+    rearm(EPOLLOUT);
+}
+
+/* 异步数据库操作完成，放入完成队列；连接状态只由主线程在 take_db_done() 中检查和修改 */
+void http_conn::async_callback(void *arg, uint32_t token, int result)
+{
+    db_done done;
+    done.conn = (http_conn *)arg;
+    done.token = token;
+    done.result = result;
+
+    m_db_done_lock.lock();
+    bool wake = m_db_done.empty();
+    m_db_done.push_back(done);
+    m_db_done_lock.unlock();
+
+    // 队列由空变为非空时唤醒主线程，主线程先读 eventfd 再取队列，不会漏掉
+    if(wake) {
+        uint64_t one = 1;
+        ::write(m_db_done_fd, &one, sizeof(one));
+    }
+}
+
+void http_conn::take_stalled(std::vector<int> &out)
+{
+    m_stalled_lock.lock();
+    out.insert(out.end(), m_stalled_fds.begin(), m_stalled_fds.end());
+    m_stalled_fds.clear();
+    m_stalled_lock.unlock();
 }
 
+int http_conn::init_db_done()
+{
+    m_db_done_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    return m_db_done_fd;
+}
 
+void http_conn::take_db_done(std::vector<http_conn *> &out)
+{
+    uint64_t cnt;
+    ::read(m_db_done_fd, &cnt, sizeof(cnt));
+
+    std::vector<db_done> done;
+    m_db_done_lock.lock();
+    done.swap(m_db_done);
+    m_db_done_lock.unlock();
+
+    long long now = mono_ns();
+    for(size_t i = 0; i < done.size(); ++i) {
+        http_conn *conn = done[i].conn;
+        // 等待期间连接已超时关闭或被复用：代数已变，或提交时连接已经关闭（偶数）
+        if(!(done[i].token & 1) || conn->m_conn_gen.load(std::memory_order_acquire) != done[i].token
+            || conn->m_db_state != DB_WAIT) {
+            continue;
+        }
+        conn->m_db_result = done[i].result;
+        conn->m_db_state = DB_DONE;
+        metrics::get_instance()->record(H_DB_QUERY, (now - conn->m_db_ns) / 1000);
+        conn->m_queued_ns = now;
+        conn->m_span.set(T_DB_DONE, now);
+        out.push_back(conn);
+    }
+}
 
+// 内部路由，path 之后为空格（请求行）、'\0'（已解析的 m_url）或查询参数
+enum INTERNAL_ROUTE {
+    ROUTE_NONE = 0,
+    ROUTE_METRICS,      // 运行指标
+    ROUTE_TRACE,        // 请求追踪，只在开启时提供
+    ROUTE_PROFILE,      // 开始 CPU 采样，只在开启时提供
+    ROUTE_LOCKS,        // 锁竞争报告，只在以 LOCK_PROF=1 编译时提供
+    ROUTE_TCP,          // 最慢的客户端，只在开启 TCP_INFO 采样时提供
+    ROUTE_CLIENTS       // 连接数、请求数、字节数最多的客户端
+};
+
+static int internal_route(const char *path)
+{
+    if(strncmp(path, "/metrics", 8) == 0 && (path[8] == ' ' || path[8] == '?' || path[8] == '\0')) {
+        return ROUTE_METRICS;
+    }
+    if(tracer::enabled() && strncmp(path, "/trace", 6) == 0 &&
+        (path[6] == ' ' || path[6] == '?' || path[6] == '\0')) {
+        return ROUTE_TRACE;
+    }
+    if(cpu_profiler::get_instance()->enabled() && strncmp(path, "/profile", 8) == 0 &&
+        (path[8] == ' ' || path[8] == '?' || path[8] == '\0')) {
+        return ROUTE_PROFILE;
+    }
+    if(strncmp(path, "/clients", 8) == 0 && (path[8] == ' ' || path[8] == '?' || path[8] == '\0')) {
+        return ROUTE_CLIENTS;
+    }
+    if(tcp_stats::enabled() && strncmp(path, "/tcp", 4) == 0 &&
+        (path[4] == ' ' || path[4] == '?' || path[4] == '\0')) {
+        return ROUTE_TCP;
+    }
+#ifdef LOCK_PROFILE
+    if(strncmp(path, "/locks", 6) == 0 && (path[6] == ' ' || path[6] == '?' || path[6] == '\0')) {
+        return ROUTE_LOCKS;
+    }
+#endif
+    return ROUTE_NONE;
+}
 
+/* 内部路由：请求行为 "GET /metrics"、"GET /clients"、"GET /trace"、"GET /profile"、"GET /tcp"、"GET /locks" 时由主线程解析请求头并生成响应，不占用工作线程 */
+bool http_conn::process_internal()
+{
+    metrics *m = metrics::get_instance();
+    if(!m->allowed(m_address)) {
+        return false;
+    }
+    if(m_check_state == CHECK_STATE_REQUESTLINE) {
+        if(strncmp(m_read_buf, "GET ", 4) != 0 || internal_route(m_read_buf + 4) == ROUTE_NONE) {
+            return false;
+        }
+    }
+    // 请求头分几次到达时，之前已解析出请求行
+    else if(!m_url || internal_route(m_url) == ROUTE_NONE) {
+        return false;
+    }
+    m_queued_ns = 0;
+
+    // 只解析请求行和请求头，忽略请求体
+    HTTP_CODE ret = NO_REQUEST;
+    LINE_STATUS line_status = LINE_OK;
+    while(ret == NO_REQUEST && m_check_state != CHECK_STATE_CONTENT && (line_status = parse_line()) == LINE_OK) {
+        char *text = get_line();
+        m_start_line = m_checked_idx;
+        ret = m_check_state == CHECK_STATE_REQUESTLINE ? parse_request_line(text) : parse_headers(text);
+    }
+    if(line_status == LINE_BAD) {
+        ret = BAD_REQUEST;
+    }
+    if(ret == NO_REQUEST && m_check_state != CHECK_STATE_CONTENT) {
+        rearm(EPOLLIN);
+        return true;
+    }
+
+    bool write_ret;
+    if(ret == BAD_REQUEST) {
+        write_ret = process_write(BAD_REQUEST);
+    }
+    else if(internal_route(m_url) == ROUTE_TRACE) {
+        m_internal.clear();
+        tracer::get_instance()->render(m_internal);
+        write_ret = write_internal(200, ok_200_tile, "application/json");
+    }
+    else if(internal_route(m_url) == ROUTE_PROFILE) {
+        write_ret = write_profile();
+    }
+    else if(internal_route(m_url) == ROUTE_CLIENTS) {
+        m_internal.clear();
+        client_tracker::get_instance()->render(m_internal);
+        write_ret = write_internal(200, ok_200_tile, "text/plain");
+    }
+    else if(internal_route(m_url) == ROUTE_TCP) {
+        m_internal.clear();
+        tcp_stats::get_instance()->render(m_internal);
+        write_ret = write_internal(200, ok_200_tile, "text/plain");
+    }
+#ifdef LOCK_PROFILE
+    else if(internal_route(m_url) == ROUTE_LOCKS) {
+        m_internal.clear();
+        lock_profile_report(m_internal);
+        write_ret = write_internal(200, ok_200_tile, "text/plain");
+    }
+#endif
+    else {
+        write_ret = write_metrics();
+    }
+    if(!write_ret) {
+        close_conn();
+        return true;
+    }
+    m_ready_ns = mono_ns();
+    rearm(EPOLLOUT);
+    return true;
+}
+
+bool http_conn::write_metrics()
+{
+    m_internal.clear();
+    metrics::get_instance()->render(m_internal);
+
+    metrics_gauge(m_internal, "webserver_connections", "Open client connections.",
+        m_user_count.load(std::memory_order_relaxed));
+    if(m_threadpool) {
+        metrics_gauge(m_internal, "webserver_threadpool_threads", "Worker threads.", m_threadpool->thread_num());
+        metrics_gauge(m_internal, "webserver_threadpool_busy", "Worker threads processing a request.",
+            m_threadpool->busy());
+        metrics_gauge(m_internal, "webserver_threadpool_queue_length", "Requests waiting in the thread pool queue.",
+            m_threadpool->queue_size());
+    }
+
+    // 日志缓冲区满时丢弃的条数
+    static const char *levels[] = {"debug", "info", "warn", "error"};
+    char buf[128];
+    m_internal += "# HELP webserver_log_dropped_total Log messages dropped because the buffer was full.\n"
+        "# TYPE webserver_log_dropped_total counter\n";
+    for(int i = 0; i < 4; ++i) {
+        int n = snprintf(buf, sizeof(buf), "webserver_log_dropped_total{level=\"%s\"} %lld\n",
+            levels[i], Log::get_instance()->dropped(i));
+        m_internal.append(buf, n);
+    }
+    metrics_counter(m_internal, "webserver_access_log_dropped_total",
+        "Access log records dropped because the buffer was full.", access_log::get_instance()->dropped());
+
+    if(m_store) {
+        m_store->export_metrics(m_internal);
+    }
+    return write_internal(200, ok_200_tile, "text/plain; version=0.0.4");
+}
+
+// /profile?seconds=N 在后台采样 N 秒（默认 10 秒），立即返回输出文件名
+bool http_conn::write_profile()
+{
+    const char *query = strstr(m_url, "seconds=");
+    int seconds = query ? atoi(query + 8) : 10;
+    std::string file;
+    cpu_profiler *profiler = cpu_profiler::get_instance();
+    if(!profiler->start(seconds, file)) {
+        m_internal = "a profile is already running\n";
+        return write_internal(409, "Conflict", "text/plain");
+    }
+    char buf[256];
+    snprintf(buf, sizeof(buf), "profiling %ds at %dHz, folded stacks will be written to %s\n",
+        seconds, profiler->hz(), file.c_str());
+    m_internal = buf;
+    return write_internal(200, ok_200_tile, "text/plain");
+}
+
+bool http_conn::write_internal(int status, const char *title, const char *content_type)
+{
+    if(!add_status_line(status, title) || !add_response("Content-Type:%s\r\n", content_type) ||
+        !add_headers(m_internal.size())) {
+        return false;
+    }
+    m_body = &m_internal[0];
+    m_iv[0].iov_base = m_write_buf;
+    m_iv[0].iov_len = m_write_idx;
+    m_iv[1].iov_base = m_body;
+    m_iv[1].iov_len = m_internal.size();
+    m_iv_count = 2;
+    bytes_to_send = m_write_idx + m_internal.size();
+    return true;
+}
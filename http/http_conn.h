@@ -27,14 +27,30 @@
 #include <stdarg.h>
 #include <fstream>
 #include <map>
+#include <atomic>
+#include <string>
+#include <vector>
 
 #include "../lock/locker.h"
 #include "../timer/lst_timer.h"
 #include "../log/log.h"
-#include "../CGImysql/sql_conn_pool.h"
+#include "../log/access_log.h"
+#include "../metrics/metrics.h"
+#include "../metrics/tcp_stats.h"
+#include "../metrics/client_tracker.h"
+#include "../trace/trace.h"
+#include "../trace/probes.h"
+#include "../storage/user_table.h"
+#include "../storage/user_store.h"
+#include "../uring/uring.h"
+
+template <typename T>
+class threadpool;
 
 class http_conn
 {
+    friend class http_conn_bench;   // 组件微基准测试直接调用解析、响应函数
+
 public:
     static const int FILENAME_LEN = 200;        // 文件名的最大长度
     static const int READ_BUFFER_SIZE = 2048;   // 读缓冲区的大小
@@ -70,7 +86,8 @@ public:
         FORBIDDEN_REQUEST,  // 客户对资源没有足够的访问权限
         FILE_REQUEST,       // 文件请求,获取文件成功
         INTERNAL_ERROR,     // 服务器内部错误
-        CLOSED_CONNECTION   // 客户端关闭连接
+        CLOSED_CONNECTION,  // 客户端关闭连接
+        DB_REQUEST          // 已提交异步数据库操作，等待结果
     };
 
     /* 从状态机状态，行的读取状态 */
@@ -80,22 +97,52 @@ public:
         LINE_OPEN       // 行数据不完整
     };
 
+    /* 异步数据库操作的状态 */
+    enum DB_STATE {
+        DB_NONE = 0,    // 没有进行中的数据库操作
+        DB_WAIT,        // 已提交，等待结果
+        DB_DONE         // 结果已返回，等待重新处理请求
+    };
+
 public:
-    http_conn(){}
+    http_conn() : m_conn_gen(0), m_write_stalled(false) {}
     ~http_conn(){}
 
 public:
     // 初始化新接受的连接
     void init(int sockfd, const sockaddr_in &addr, char *root, int close_log, std::string user, std::string password, std::string dbname);
     void close_conn();  // 关闭连接
+    // 连接已关闭（工作线程关闭或定时器关闭），使未完成的异步数据库操作的结果失效，可重复调用
+    void release();
     void process();     // 处理客户端请求
     bool read();        // 读取客户端发来的全部数据 
     bool write();       // 写入响应报文
+    // io_uring 后端：复制主线程接收到的数据，发送由主线程提交的内存块并处理发送结果
+    int feed(const char *data, int len);
+    int send_iov(struct iovec **iov);
+    bool sent(int temp, bool &done);
+    void send_failed();
+    // 由主线程直接处理内部路由（/metrics、/trace 等），不进入线程池；不是内部路由时返回 false
+    bool process_internal();
     sockaddr_in *get_address()
     {
         return &m_address;
     }
-    void init_mysql_res(Connection_pool *conn_pool);
+    // 响应是否因发送缓冲区已满而在等待 EPOLLOUT；主线程发送或工作线程先写时设置，主线程读取
+    bool write_stalled() const { return m_write_stalled.load(std::memory_order_acquire) && m_sockfd != -1; }
+    // 取出工作线程先写时发送受阻的连接，由主线程在定时器中调用，之后与主线程发送受阻的连接一起采样
+    static void take_stalled(std::vector<int> &out);
+    // 采样连接的 TCP_INFO，距上次采样不足设定的间隔时跳过
+    void sample_tcp(long long now);
+    // 设置凭据存储，并将已有用户加载到缓存
+    static bool init_store(User_store *store);
+    // 异步数据库操作完成回调，在写入线程或主线程中调用：只将结果放入完成队列，经 eventfd 唤醒主线程
+    static void async_callback(void *arg, uint32_t token, int result);
+    // 创建完成队列的 eventfd，由主线程注册到 epoll，失败时返回 -1
+    static int init_db_done();
+    // 由主线程调用：取出完成的异步数据库操作，丢弃代数不一致的旧结果，
+    // 记录结果后将需要重新处理的连接放入 out，由调用者投递到线程池
+    static void take_db_done(std::vector<http_conn *> &out);
 
     int timer_flag;
     int improv;
@@ -125,12 +172,47 @@ private:
     bool add_content_length(int content_length);
     bool add_linger();
     bool add_blank_line();
+    // 响应结束时记录指标和访问日志
+    void record_response(bool complete);
+    // 工作线程中直接发送长连接的响应
+    void write_first();
+    // 重新注册 EPOLLIN 或 EPOLLOUT
+    void rearm(int ev);
+    // 记录连接上的 n 次系统调用
+    void count_syscalls(int counter, int n)
+    {
+        m_syscalls += n;
+        metrics::get_instance()->add(counter, n);
+    }
+    // 生成 /metrics 的响应
+    bool write_metrics();
+    // 以 m_internal 为响应体生成内部路由的响应
+    bool write_internal(int status, const char *title, const char *content_type);
+    // 生成 /profile 的响应
+    bool write_profile();
 
 public:
     static int m_epollfd;       // 所有socket上的事件注册到同一个epoll内核事件中，因此设置成静态的
-    static int m_user_count;    // 统计用户数量
-    MYSQL *mysql;               // 数据库连接
+    static std::atomic<int> m_user_count;   // 统计用户数量，主线程和工作线程都会修改
+    static threadpool<http_conn> *m_threadpool; // 线程池，/metrics 输出其运行指标
+    static User_store *m_store;                 // 凭据存储
+
+private:
+    // 完成队列中的一项
+    struct db_done {
+        http_conn *conn;
+        uint32_t token;
+        int result;
+    };
+    static int m_db_done_fd;                    // 完成队列非空时唤醒主线程
+    static locker m_db_done_lock;               // 保护 m_db_done
+    static std::vector<db_done> m_db_done;      // 写入线程等投递、主线程取出的完成事件
+    static locker m_stalled_lock;               // 保护 m_stalled_fds
+    static std::vector<int> m_stalled_fds;      // 先写时发送受阻的连接，等待主线程采样
+
+public:
     int m_state;                // 读为0，写为1
+    trace_span m_span;          // 请求各阶段的时间戳，主线程和工作线程在不同阶段写入
 
 private:
     int m_sockfd;                       // 该HTTP连接的socket
@@ -154,6 +236,8 @@ private:
     char m_write_buf[WRITE_BUFFER_SIZE];// 写缓冲区
     int m_write_idx;                    // 写缓冲区中待发送的字节数
     char *m_file_address;               // 客户端请求的目标文件被mmap到内存中的起始位置
+    char *m_body;                       // m_iv[1] 发送的内容：映射的文件或 m_internal
+    std::string m_internal;             // 主线程生成的内部路由响应体
     struct stat m_file_stat;            // 目标文件的状态，可判断文件是否存在、是否为目录、是否可读，并获取文件大小等信息
     struct iovec m_iv[2];               // 采用writev执行写操作
     int m_iv_count;                     // 被写内存块的数量
@@ -164,13 +248,28 @@ private:
     char *m_string;                     // 存储请求头数据
     char *doc_root;                     // 资源文件路径
     int m_close_log;                    // 是否关闭日志
+    DB_STATE m_db_state;                // 异步数据库操作的状态，工作线程提交前设为 DB_WAIT，主线程取出结果后设为 DB_DONE
+    // 连接的代数：接受连接时变为奇数，关闭时加一变为偶数；提交异步数据库操作时作为 token 传出，
+    // 完成时与当前值比较，丢弃已关闭或已被新连接复用的槽位上的旧结果
+    std::atomic<uint32_t> m_conn_gen;
+    int m_db_result;                    // 异步数据库操作的结果，0为成功
+
+    int m_status;                       // 响应状态码
+    long long m_start_ns;               // 读到请求的时间，单调时钟
+    long long m_queued_ns;              // 最近一次放入线程池队列的时间
+    long long m_queue_ns;               // 在线程池队列中等待的总时间
+    long long m_ready_ns;               // 响应就绪的时间
+    long long m_db_ns;                  // 提交异步数据库操作的时间
+    char m_path[256];                   // 请求的原始路径，只在开启访问日志或请求追踪时记录
+
+    std::atomic<bool> m_write_stalled;  // 写到 EAGAIN，等待 EPOLLOUT
+    long long m_tcp_sampled_ns;         // 上次采样 TCP_INFO 的时间，按连接保留
+    uint32_t m_tcp_retrans;             // 上次采样时的累计重传段数
+    int m_syscalls;                     // 本次请求在连接上的系统调用次数
 
     char sql_user[100];                  // 数据库登录用户名
     char sql_password[100];             // 数据库登录密码
     char sql_dbname[100];               // 数据库名称
-    std::map<std::string, std::string> m_uers;
-
-    locker m_lock;
 };
 
 #endif
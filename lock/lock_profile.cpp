@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <algorithm>
+#include <vector>
+
+#include "lock_profile.h"
+
+static const int MAX_SITES = 128;
+
+// 静态存储，计数器初始为 0
+static lock_site s_sites[MAX_SITES];
+static int s_count = 0;
+static pthread_mutex_t s_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static const char *kind_names[] = {"mutex", "sem", "cond"};
+
+lock_site *lock_profile_site(const char *name, int kind)
+{
+    if(name == NULL) {
+        name = "unnamed";
+    }
+    // 只在构造锁时调用，不在热路径上
+    pthread_mutex_lock(&s_mutex);
+    lock_site *site = NULL;
+    for(int i = 0; i < s_count; ++i) {
+        if(s_sites[i].kind == kind && strcmp(s_sites[i].name, name) == 0) {
+            site = &s_sites[i];
+            break;
+        }
+    }
+    if(site == NULL) {
+        if(s_count < MAX_SITES - 1) {
+            site = &s_sites[s_count++];
+            site->name = name;
+            site->kind = kind;
+        }
+        else {
+            site = &s_sites[MAX_SITES - 1];
+            site->name = "overflow";
+            site->kind = kind;
+        }
+    }
+    pthread_mutex_unlock(&s_mutex);
+    return site;
+}
+
+static bool by_wait(const lock_site *a, const lock_site *b)
+{
+    return a->wait_ns.load(std::memory_order_relaxed) > b->wait_ns.load(std::memory_order_relaxed);
+}
+
+static void render_sites(std::string &out, std::vector<lock_site *> &sites, bool mutex)
+{
+    std::sort(sites.begin(), sites.end(), by_wait);
+    unsigned long long total_wait = 0;
+    for(size_t i = 0; i < sites.size(); ++i) {
+        total_wait += sites[i]->wait_ns.load(std::memory_order_relaxed);
+    }
+
+    char line[512];
+    if(mutex) {
+        snprintf(line, sizeof(line), "%-24s %12s %10s %8s %10s %10s %7s %12s %12s %10s %12s %12s\n",
+            "mutex", "acquires", "contended", "cont%", "spun", "wait_ms", "wait%", "avg_wait_us", "max_wait_us",
+            "hold_ms", "avg_hold_us", "max_hold_us");
+    }
+    else {
+        snprintf(line, sizeof(line), "%-24s %12s %10s %8s %10s %7s %12s %12s\n",
+            "wait", "waits", "blocked", "block%", "wait_ms", "wait%", "avg_wait_us", "max_wait_us");
+    }
+    out += line;
+
+    for(size_t i = 0; i < sites.size(); ++i) {
+        const lock_site *s = sites[i];
+        unsigned long long acquires = s->acquires.load(std::memory_order_relaxed);
+        unsigned long long contended = s->contended.load(std::memory_order_relaxed);
+        unsigned long long wait = s->wait_ns.load(std::memory_order_relaxed);
+        unsigned long long hold = s->hold_ns.load(std::memory_order_relaxed);
+        double cont_pct = acquires ? 100.0 * contended / acquires : 0;
+        double wait_pct = total_wait ? 100.0 * wait / total_wait : 0;
+        double avg_wait_us = contended ? wait / 1000.0 / contended : 0;
+        char name[64];
+        snprintf(name, sizeof(name), "%s(%s)", s->name, kind_names[s->kind]);
+        if(mutex) {
+            snprintf(line, sizeof(line), "%-24s %12llu %10llu %7.2f%% %10llu %10.1f %6.1f%% %12.2f %12.1f %10.1f %12.3f %12.1f\n",
+                name, acquires, contended, cont_pct, s->spun.load(std::memory_order_relaxed), wait / 1e6, wait_pct,
+                avg_wait_us, s->max_wait_ns.load(std::memory_order_relaxed) / 1000.0, hold / 1e6,
+                acquires ? hold / 1000.0 / acquires : 0, s->max_hold_ns.load(std::memory_order_relaxed) / 1000.0);
+        }
+        else {
+            snprintf(line, sizeof(line), "%-24s %12llu %10llu %7.2f%% %10.1f %6.1f%% %12.2f %12.1f\n",
+                name, acquires, contended, cont_pct, wait / 1e6, wait_pct, avg_wait_us,
+                s->max_wait_ns.load(std::memory_order_relaxed) / 1000.0);
+        }
+        out += line;
+    }
+}
+
+void lock_profile_report(std::string &out)
+{
+    std::vector<lock_site *> mutexes;
+    std::vector<lock_site *> waits;
+    pthread_mutex_lock(&s_mutex);
+    for(int i = 0; i < MAX_SITES; ++i) {
+        lock_site *s = &s_sites[i];
+        if(s->name == NULL || s->acquires.load(std::memory_order_relaxed) == 0) {
+            continue;
+        }
+        if(s->kind == LOCK_MUTEX) {
+            mutexes.push_back(s);
+        }
+        else {
+            waits.push_back(s);
+        }
+    }
+    pthread_mutex_unlock(&s_mutex);
+
+    // 互斥锁的等待时间直接限制扩展性；信号量、条件变量的阻塞多为等待任务，单独列出
+    out += "# lock contention, ranked by total wait time\n";
+    render_sites(out, mutexes, true);
+    out += "\n";
+    render_sites(out, waits, false);
+}
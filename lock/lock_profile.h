@@ -0,0 +1,72 @@
+/**锁竞争分析
+ * 以 make LOCK_PROF=1 编译时，locker、sem、cond 按构造时传入的名字（锁的位置）汇总：
+ * - 互斥锁：加锁次数、未能立即获得的次数、自旋期间获得的次数、等待时间、持有时间
+ * - 信号量、条件变量：等待次数、需要阻塞的次数、阻塞时间（多为空闲等待，单独列出）
+ * 同名的锁（如用户表的各个分片）合并为一项；未命名的锁合并为 unnamed
+ * 报告按总等待时间降序排列，由 /locks 导出
+ */
+
+#ifndef LOCK_PROFILE_H
+#define LOCK_PROFILE_H
+
+#include <time.h>
+#include <atomic>
+#include <string>
+
+// 锁的种类
+enum LOCK_KIND
+{
+    LOCK_MUTEX = 0,
+    LOCK_SEM,
+    LOCK_COND
+};
+
+struct lock_site {
+    const char *name;
+    int kind;
+    std::atomic<unsigned long long> acquires;   // 加锁或等待次数
+    std::atomic<unsigned long long> contended;  // 未能立即获得（需要自旋或阻塞）的次数
+    std::atomic<unsigned long long> spun;       // 自旋期间获得的次数
+    std::atomic<unsigned long long> wait_ns;
+    std::atomic<unsigned long long> max_wait_ns;
+    std::atomic<unsigned long long> hold_ns;
+    std::atomic<unsigned long long> max_hold_ns;
+
+    void acquire() { acquires.fetch_add(1, std::memory_order_relaxed); }
+    void wait(long long ns, bool by_spin)
+    {
+        contended.fetch_add(1, std::memory_order_relaxed);
+        if(by_spin) {
+            spun.fetch_add(1, std::memory_order_relaxed);
+        }
+        wait_ns.fetch_add(ns, std::memory_order_relaxed);
+        update_max(max_wait_ns, ns);
+    }
+    void hold(long long ns)
+    {
+        hold_ns.fetch_add(ns, std::memory_order_relaxed);
+        update_max(max_hold_ns, ns);
+    }
+
+    static void update_max(std::atomic<unsigned long long> &max, unsigned long long v)
+    {
+        unsigned long long cur = max.load(std::memory_order_relaxed);
+        while(v > cur && !max.compare_exchange_weak(cur, v, std::memory_order_relaxed)) {
+        }
+    }
+};
+
+inline long long lock_profile_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// 返回名字和种类对应的统计项，name 为 NULL 时为 unnamed；统计项用完时返回 overflow 项
+lock_site *lock_profile_site(const char *name, int kind);
+
+// 按总等待时间降序输出文本报告
+void lock_profile_report(std::string &out);
+
+#endif
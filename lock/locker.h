@@ -1,7 +1,10 @@
-/**线程同步机制包装类 
+/**线程同步机制包装类
  * - 信号量（sem）
  * - 互斥锁（locker）
  * - 条件变量（cond）
+ * 构造时的名字用于锁竞争分析（见 lock_profile.h），编译选项：
+ * - LOCK_PROFILE，统计每个名字的等待时间、持有时间和竞争次数
+ * - LOCK_SPIN，互斥锁先自旋再阻塞（futex），自旋次数按最近获得锁所需的次数自适应
  */
 
 #ifndef LOCKER_H
@@ -10,22 +13,42 @@
 #include <pthread.h>
 #include <semaphore.h>
 #include <exception>
+#ifdef LOCK_SPIN
+#include <atomic>
+#endif
+#ifdef LOCK_PROFILE
+#include "lock_profile.h"
+#endif
+
+// 自旋上限，与 glibc 自适应互斥锁的默认值相同
+const int LOCK_SPIN_MAX = 100;
+
+inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield" ::: "memory");
+#endif
+}
 
 // 信号量类
 class sem
 {
 public:
-    sem()
+    sem(const char *name = NULL)
     {
         if(sem_init(&m_sem, 0, 0) != 0) {
             throw std::exception();
         }
+        profile_init(name);
     }
-    sem(int num)
+    sem(int num, const char *name = NULL)
     {
         if(sem_init(&m_sem, 0, num) != 0) {
             throw std::exception();
         }
+        profile_init(name);
     }
     ~sem()
     {
@@ -34,7 +57,18 @@ public:
     // 等待信号量
     bool wait()
     {
+#ifdef LOCK_PROFILE
+        m_site->acquire();
+        if(sem_trywait(&m_sem) == 0) {
+            return true;
+        }
+        long long start = lock_profile_now();
+        bool ret = sem_wait(&m_sem) == 0;
+        m_site->wait(lock_profile_now() - start, false);
+        return ret;
+#else
         return sem_wait(&m_sem) == 0;
+#endif
     }
     // 增加信号量
     bool post()
@@ -42,30 +76,61 @@ public:
         return sem_post(&m_sem) == 0;
     }
 
+private:
+    void profile_init(const char *name)
+    {
+#ifdef LOCK_PROFILE
+        m_site = lock_profile_site(name, LOCK_SEM);
+#else
+        (void)name;
+#endif
+    }
+
 private:
     sem_t m_sem;
+#ifdef LOCK_PROFILE
+    lock_site *m_site;
+#endif
 };
 
 // 互斥锁类
 class locker
 {
 public:
-    locker()
+    locker(const char *name = NULL)
     {
         if(pthread_mutex_init(&m_mutex, NULL) != 0) {
             throw std::exception();
         }
-    }   
+#ifdef LOCK_SPIN
+        m_spins.store(0, std::memory_order_relaxed);
+#endif
+#ifdef LOCK_PROFILE
+        m_site = lock_profile_site(name, LOCK_MUTEX);
+        m_locked_ns = 0;
+#else
+        (void)name;
+#endif
+    }
     ~locker()
     {
         pthread_mutex_destroy(&m_mutex);
     }
     bool lock()
     {
+#if defined(LOCK_PROFILE) || defined(LOCK_SPIN)
+        if(pthread_mutex_trylock(&m_mutex) != 0 && !lock_slow()) {
+            return false;
+        }
+        acquired();
+        return true;
+#else
         return pthread_mutex_lock(&m_mutex) == 0;
+#endif
     }
     bool unlock()
     {
+        released();
         return pthread_mutex_unlock(&m_mutex) == 0;
     }
     pthread_mutex_t *get()
@@ -73,20 +138,83 @@ public:
         return &m_mutex;
     }
 
+private:
+    friend class cond;
+
+#if defined(LOCK_PROFILE) || defined(LOCK_SPIN)
+    // 未能立即获得锁：先自旋（LOCK_SPIN），再阻塞
+    bool lock_slow()
+    {
+#ifdef LOCK_PROFILE
+        long long start = lock_profile_now();
+#endif
+        bool by_spin = false;
+#ifdef LOCK_SPIN
+        // 与 glibc PTHREAD_MUTEX_ADAPTIVE_NP 相同：上限为最近自旋次数的 2 倍 + 10，自旋次数取 1/8 的滑动平均
+        int spins = m_spins.load(std::memory_order_relaxed);
+        int limit = spins * 2 + 10 < LOCK_SPIN_MAX ? spins * 2 + 10 : LOCK_SPIN_MAX;
+        int count = 0;
+        while(count < limit) {
+            ++count;
+            cpu_relax();
+            if(pthread_mutex_trylock(&m_mutex) == 0) {
+                by_spin = true;
+                break;
+            }
+        }
+        m_spins.store(spins + (count - spins) / 8, std::memory_order_relaxed);
+#endif
+        if(!by_spin && pthread_mutex_lock(&m_mutex) != 0) {
+            return false;
+        }
+#ifdef LOCK_PROFILE
+        m_site->wait(lock_profile_now() - start, by_spin);
+#endif
+        return true;
+    }
+#endif
+
+    // 获得锁之后、释放锁之前调用，统计持有时间；cond 等待期间锁被释放，不计入持有时间
+    void acquired()
+    {
+#ifdef LOCK_PROFILE
+        m_site->acquire();
+        m_locked_ns = lock_profile_now();
+#endif
+    }
+    void released()
+    {
+#ifdef LOCK_PROFILE
+        m_site->hold(lock_profile_now() - m_locked_ns);
+#endif
+    }
+
 private:
     pthread_mutex_t m_mutex;
+#ifdef LOCK_SPIN
+    std::atomic<int> m_spins;       // 最近获得锁所需的自旋次数
+#endif
+#ifdef LOCK_PROFILE
+    lock_site *m_site;
+    long long m_locked_ns;          // 当前持有者获得锁的时间，只由持有者读写
+#endif
 };
 
 // 条件变量类
 class cond
 {
 public:
-    cond()
+    cond(const char *name = NULL)
     {
         if(pthread_cond_init(&m_cond, NULL) != 0) {
             // pthread_mutex_destroy(&m_mutex);
             throw std::exception();
         }
+#ifdef LOCK_PROFILE
+        m_site = lock_profile_site(name, LOCK_COND);
+#else
+        (void)name;
+#endif
     }
     ~cond()
     {
@@ -108,18 +236,61 @@ public:
         // pthread_mutex_unlock(m_mutex);
         return ret == 0;
     }
+    // 传入 locker 时，等待期间不计入锁的持有时间
+    bool wait(locker &m)
+    {
+#ifdef LOCK_PROFILE
+        long long start = wait_begin(m);
+        int ret = pthread_cond_wait(&m_cond, m.get());
+        wait_end(m, start);
+        return ret == 0;
+#else
+        return pthread_cond_wait(&m_cond, m.get()) == 0;
+#endif
+    }
+    bool timewait(locker &m, struct timespec t)
+    {
+#ifdef LOCK_PROFILE
+        long long start = wait_begin(m);
+        int ret = pthread_cond_timedwait(&m_cond, m.get(), &t);
+        wait_end(m, start);
+        return ret == 0;
+#else
+        return pthread_cond_timedwait(&m_cond, m.get(), &t) == 0;
+#endif
+    }
     bool signal()
     {
         return pthread_cond_signal(&m_cond) == 0;
     }
     bool broadcast()
     {
-        return pthread_cond_broadcast(&m_cond) == 0; 
+        return pthread_cond_broadcast(&m_cond) == 0;
+    }
+
+private:
+#ifdef LOCK_PROFILE
+    long long wait_begin(locker &m)
+    {
+        m.released();
+        m_site->acquire();
+        return lock_profile_now();
+    }
+    // 醒来时已重新获得锁，从此刻开始计算持有时间
+    void wait_end(locker &m, long long start)
+    {
+        long long now = lock_profile_now();
+        m_site->wait(now - start, false);
+        m.m_locked_ns = now;
     }
+#endif
 
 private:
     // static pthread_mutex_t m_mutex;
     pthread_cond_t m_cond;
+#ifdef LOCK_PROFILE
+    lock_site *m_site;
+#endif
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,216 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "access_log.h"
+
+// 线程退出时关闭缓冲区，由写入线程写完后释放
+struct access_local {
+    log_buffer *buf;
+    access_local() : buf(NULL) {}
+    ~access_local()
+    {
+        if(buf) {
+            buf->close();
+        }
+    }
+};
+
+access_log::access_log() : m_mutex("access_log"), m_cond("access_log")
+{
+    m_format = ACCESS_OFF;
+    m_thread_buf_size = 0;
+    m_flush_ms = 1000;
+    m_stop = false;
+    m_started = false;
+    m_dropped.store(0, std::memory_order_relaxed);
+}
+
+access_log::~access_log()
+{
+    // 通知写入线程写完剩余的记录后退出
+    if(m_started) {
+        m_mutex.lock();
+        m_stop = true;
+        m_cond.signal();
+        m_mutex.unlock();
+        pthread_join(m_tid, NULL);
+    }
+}
+
+bool access_log::init(const char *file_name, int format, int thread_buf_kb, int flush_ms,
+    long long split_bytes, bool compress, int keep_files, long long keep_bytes)
+{
+    if(format != ACCESS_TSV && format != ACCESS_BINARY) {
+        return false;
+    }
+
+    const char *p = strrchr(file_name, '/');
+    std::string dir = p ? std::string(file_name, p - file_name + 1) : "";
+    std::string name = p ? p + 1 : file_name;
+    name += format == ACCESS_BINARY ? ".bin" : ".tsv";
+    if(!m_file.init(dir.c_str(), name.c_str(), 0, split_bytes, compress, keep_files, keep_bytes)) {
+        return false;
+    }
+
+    m_thread_buf_size = (size_t)(thread_buf_kb > 0 ? thread_buf_kb : 256) * 1024;
+    m_flush_ms = flush_ms > 0 ? flush_ms : 1000;
+    m_format = format;
+
+    // 新文件以表头或魔数开头
+    if(m_file.size() == 0) {
+        const char *head = m_format == ACCESS_BINARY ? ACCESS_LOG_MAGIC : access_tsv_header();
+        m_file.rotate(time(NULL), 0, strlen(head));
+        write_fd(head, strlen(head));
+    }
+
+    if(pthread_create(&m_tid, NULL, worker, this) != 0) {
+        m_format = ACCESS_OFF;
+        return false;
+    }
+    m_started = true;
+    return true;
+}
+
+log_buffer *access_log::local()
+{
+    static thread_local access_local t;
+    if(t.buf == NULL) {
+        t.buf = new log_buffer(m_thread_buf_size);
+        m_mutex.lock();
+        m_bufs.push_back(t.buf);
+        m_mutex.unlock();
+    }
+    return t.buf;
+}
+
+void access_log::write(const access_rec &rec, const char *path)
+{
+    if(m_format == ACCESS_OFF) {
+        return;
+    }
+
+    // 记录和路径拼在一起一次追加，写入线程不会看到半条记录
+    char data[sizeof(access_rec) + 512];
+    size_t len = path ? strlen(path) : 0;
+    if(len > sizeof(data) - sizeof(access_rec)) {
+        len = sizeof(data) - sizeof(access_rec);
+    }
+    access_rec r = rec;
+    r.path_len = len;
+    memcpy(data, &r, sizeof(r));
+    memcpy(data + sizeof(r), path, len);
+
+    if(!local()->append(data, sizeof(r) + len)) {
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void *access_log::worker(void *arg)
+{
+    pthread_setname_np(pthread_self(), "access_log");
+    access_log *log = (access_log *)arg;
+    log->run();
+    return NULL;
+}
+
+void access_log::run()
+{
+    while(true) {
+        m_mutex.lock();
+        if(!m_stop) {
+            struct timeval now = {0, 0};
+            gettimeofday(&now, NULL);
+            long long us = now.tv_sec * 1000000LL + now.tv_usec + m_flush_ms * 1000LL;
+            struct timespec t;
+            t.tv_sec = us / 1000000;
+            t.tv_nsec = (us % 1000000) * 1000;
+            m_cond.timewait(m_mutex, t);
+        }
+        bool stop = m_stop;
+        m_mutex.unlock();
+
+        drain();
+
+        if(stop) {
+            break;
+        }
+    }
+}
+
+void access_log::drain()
+{
+    m_mutex.lock();
+    std::vector<log_buffer *> bufs = m_bufs;
+    m_mutex.unlock();
+
+    // 记录可能跨越环形缓冲区的末尾，先复制成连续的一段再处理
+    std::string raw;
+    std::string out;
+    for(size_t i = 0; i < bufs.size(); ++i) {
+        struct iovec iov[2];
+        size_t len;
+        int segs = bufs[i]->peek(iov, &len);
+        if(segs == 0) {
+            continue;
+        }
+        raw.clear();
+        for(int j = 0; j < segs; ++j) {
+            raw.append((const char *)iov[j].iov_base, iov[j].iov_len);
+        }
+        bufs[i]->consume(len);
+
+        if(m_format == ACCESS_BINARY) {
+            out += raw;
+            continue;
+        }
+        size_t pos = 0;
+        while(pos + sizeof(access_rec) <= raw.size()) {
+            access_rec rec;
+            memcpy(&rec, raw.data() + pos, sizeof(rec));
+            access_format_tsv(out, rec, raw.data() + pos + sizeof(rec));
+            pos += sizeof(rec) + rec.path_len;
+        }
+    }
+
+    if(!out.empty()) {
+        // 切换到新文件时先写表头或魔数
+        const char *head = m_format == ACCESS_BINARY ? ACCESS_LOG_MAGIC : access_tsv_header();
+        if(m_file.rotate(time(NULL), 0, out.size())) {
+            write_fd(head, strlen(head));
+        }
+        write_fd(out.data(), out.size());
+    }
+
+    // 释放所属线程已退出且已写完的缓冲区
+    m_mutex.lock();
+    for(size_t i = 0; i < m_bufs.size(); ) {
+        if(m_bufs[i]->closed() && m_bufs[i]->empty()) {
+            delete m_bufs[i];
+            m_bufs[i] = m_bufs.back();
+            m_bufs.pop_back();
+        }
+        else {
+            ++i;
+        }
+    }
+    m_mutex.unlock();
+}
+
+void access_log::write_fd(const char *data, size_t len)
+{
+    while(len > 0) {
+        ssize_t n = ::write(m_file.fd(), data, len);
+        if(n < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        data += n;
+        len -= n;
+    }
+}
@@ -0,0 +1,133 @@
+/**访问日志
+ * 每个响应一条结构化记录：客户端地址、方法、路径、状态码、字节数、请求延迟、排队时间
+ * - 记录响应的线程只把定长的二进制记录和路径复制到自己的线程缓冲区（log_buffer），不加锁、不格式化
+ * - 后台写入线程定时收集所有线程缓冲区，按配置写成 TSV 文本或原样写入二进制文件
+ * - 缓冲区满时直接丢弃并计数，不阻塞事件循环
+ * - 文件的切分、压缩、清理与普通日志相同（log_file.h）
+ *
+ * 二进制文件以 8 字节魔数 "WSACCESS" 开头，之后是连续的 access_rec + 路径，可用 logdecode 转为 TSV
+ */
+
+#ifndef ACCESS_LOG_H
+#define ACCESS_LOG_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <arpa/inet.h>
+#include "../lock/locker.h"
+#include "log_buffer.h"
+#include "log_file.h"
+
+#define ACCESS_LOG_MAGIC "WSACCESS"
+
+#pragma pack(push, 1)
+struct access_rec {
+    uint64_t time_us;       // 响应完成的时间（微秒，UNIX 时间）
+    uint32_t addr;          // 客户端 IPv4 地址，网络字节序
+    uint16_t port;          // 客户端端口，网络字节序
+    uint8_t method;         // http_conn::METHOD
+    uint8_t complete;       // 1 为响应发送完成，0 为发送中途出错
+    uint16_t status;        // 状态码
+    uint16_t path_len;      // 其后路径的长度
+    uint64_t bytes;         // 已发送的字节数
+    uint32_t latency_us;    // 从读到请求到响应发送完成
+    uint32_t queue_us;      // 在线程池队列中等待的时间
+};
+#pragma pack(pop)
+
+/* TSV 格式，写入线程和 logdecode 共用 */
+inline const char *access_tsv_header()
+{
+    return "time\tclient\tmethod\tpath\tstatus\tbytes\tlatency_us\tqueue_us\tcomplete\n";
+}
+
+inline void access_format_tsv(std::string &out, const access_rec &rec, const char *path)
+{
+    // 与 http_conn::METHOD 的顺序一致
+    static const char *methods[] = {"GET", "POST", "HEAD", "PUT", "DELETE", "TRACE", "OPTIONS", "CONNECT", "PATCH"};
+
+    time_t sec = rec.time_us / 1000000;
+    struct tm my_tm;
+    localtime_r(&sec, &my_tm);
+    char addr[INET_ADDRSTRLEN];
+    struct in_addr in;
+    in.s_addr = rec.addr;
+    inet_ntop(AF_INET, &in, addr, sizeof(addr));
+
+    char buf[256];
+    int n = snprintf(buf, sizeof(buf), "%d-%02d-%02d %02d:%02d:%02d.%06ld\t%s:%u\t%s\t",
+        my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday, my_tm.tm_hour, my_tm.tm_min, my_tm.tm_sec,
+        (long)(rec.time_us % 1000000), addr, (unsigned)ntohs(rec.port),
+        rec.method < sizeof(methods) / sizeof(methods[0]) ? methods[rec.method] : "-");
+    out.append(buf, n);
+
+    // 路径中的控制字符替换为 '?'，保证一条记录一行
+    for(uint16_t i = 0; i < rec.path_len; ++i) {
+        unsigned char c = path[i];
+        out += (c < 0x20 || c == 0x7f) ? '?' : (char)c;
+    }
+
+    n = snprintf(buf, sizeof(buf), "\t%u\t%llu\t%u\t%u\t%u\n", (unsigned)rec.status,
+        (unsigned long long)rec.bytes, rec.latency_us, rec.queue_us, (unsigned)rec.complete);
+    out.append(buf, n);
+}
+
+class access_log {
+public:
+    // 访问日志的格式
+    enum FORMAT
+    {
+        ACCESS_OFF = 0,
+        ACCESS_TSV,
+        ACCESS_BINARY
+    };
+
+    static access_log *get_instance()
+    {
+        static access_log instance;
+        return &instance;
+    }
+
+    // file_name 为路径和文件名前缀，其余参数与 Log::init 相同
+    bool init(const char *file_name, int format, int thread_buf_kb = 256, int flush_ms = 1000,
+        long long split_bytes = 0, bool compress = false, int keep_files = 0, long long keep_bytes = 0);
+
+    bool enabled() const { return m_format != ACCESS_OFF; }
+
+    // 记录一个响应，由发送响应的线程调用
+    void write(const access_rec &rec, const char *path);
+
+    // 因缓冲区满被丢弃的记录数
+    long long dropped() const { return m_dropped.load(std::memory_order_relaxed); }
+
+private:
+    access_log();
+    ~access_log();
+
+    static void *worker(void *arg);
+    void run();
+    void drain();
+    log_buffer *local();
+    void write_fd(const char *data, size_t len);
+
+private:
+    int m_format;
+    size_t m_thread_buf_size;
+    int m_flush_ms;
+    log_file m_file;
+
+    locker m_mutex;                     // 保护 m_bufs、m_stop
+    cond m_cond;
+    std::vector<log_buffer *> m_bufs;   // 所有线程的缓冲区
+    bool m_stop;
+    pthread_t m_tid;
+    bool m_started;
+    std::atomic<long long> m_dropped;
+};
+
+#endif
@@ -15,7 +15,7 @@ template <class T>
 class block_queue {
 public:
     // 默认构造
-    block_queue(int max_size = 1000)
+    block_queue(int max_size = 1000) : m_mutex("block_queue"), m_cond("block_queue")
     {
         if(max_size <= 0) {
             exit(-1);
@@ -148,7 +148,7 @@ public:
         // 多个消费者，使用 while() 循环争抢资源
         while(m_size <= 0) {
             // 当重新抢到互斥锁，wait() 返回为 0
-            if(!m_cond.wait(m_mutex.get())) {
+            if(!m_cond.wait(m_mutex)) {
                 m_mutex.unlock();
                 return false;
             }
@@ -173,7 +173,7 @@ public:
         if(m_size <= 0) {
             t.tv_sec = now.tv_sec + ms_timeout / 1000;
             t.tv_nsec = (ms_timeout % 1000) * 1000;
-            if(!m_cond.timewait(m_mutex.get(), t)) {
+            if(!m_cond.timewait(m_mutex, t)) {
                 m_mutex.unlock();
                 return false;
             }
@@ -2,176 +2,547 @@
 #include <stdarg.h>
 #include <pthread.h>
 #include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
 #include <sys/time.h>
+#include <sys/uio.h>
+#include <atomic>
 
 #include "log.h"
 
+// 格式字符串注册表：只追加，写入线程不加锁读取已发布的部分
+static const int MAX_FORMATS = 8192;
+static const char *s_formats[MAX_FORMATS];
+static unsigned char s_levels[MAX_FORMATS];
+static std::atomic<int> s_format_count(0);
+static locker s_format_lock("log.format");
 
-Log::Log()
+std::atomic<int> Log::s_level(0);
+
+// 日志分级的前缀
+static const char *level_tag(int level)
+{
+    switch (level)
+    {
+    case 0:
+        return "[debug]:";
+    case 1:
+        return "[info]:";
+    case 2:
+        return "[warn]:";
+    case 3:
+        return "[erro]:";
+    default:
+        return "[info]:";
+    }
+}
+
+// 计算 ms 毫秒之后的绝对时间
+static struct timespec deadline_after(int ms)
+{
+    struct timeval now = {0, 0};
+    gettimeofday(&now, NULL);
+    long long us = now.tv_sec * 1000000LL + now.tv_usec + ms * 1000LL;
+    struct timespec t;
+    t.tv_sec = us / 1000000;
+    t.tv_nsec = (us % 1000000) * 1000;
+    return t;
+}
+
+// 测量时钟计数与纳秒的比例
+static double calibrate_ticks()
+{
+    struct timespec a, b;
+    clock_gettime(CLOCK_MONOTONIC, &a);
+    uint64_t t0 = log_clock();
+    usleep(10000);
+    clock_gettime(CLOCK_MONOTONIC, &b);
+    uint64_t t1 = log_clock();
+    double ns = (b.tv_sec - a.tv_sec) * 1e9 + (b.tv_nsec - a.tv_nsec);
+    return ns > 0 && t1 > t0 ? (t1 - t0) / ns : 1.0;
+}
+
+// 同一时刻的时钟计数和墙上时间
+static void clock_anchor(uint64_t *tsc, uint64_t *ns)
 {
-    m_count = 0;
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    *tsc = log_clock();
+    *ns = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+Log::Log() : m_mutex("log"), m_cond("log.flush"), m_drained("log.drained")
+{
+    m_close_log = 0;
+    m_log_buf_size = 8192;
     m_is_async = false; // 默认同步
+    m_thread_buf_size = 0;
+    m_flush_ms = 1000;
+    m_stop = false;
+    m_wakeup = false;
+    m_rounds = 0;
+    m_binary = false;
+    m_ticks_per_ns = 1.0;
+    m_formats_written = 0;
+    m_overflow = OVERFLOW_DROP_LOW;
+    m_block_ms = 10;
+    for(int i = 0; i < 4; ++i) {
+        m_dropped[i].store(0, std::memory_order_relaxed);
+        m_reported[i] = 0;
+    }
+    m_last_summary = 0;
 }
 
 Log::~Log()
 {
-    if(m_fp != NULL) {
-        fclose(m_fp);
+    // 通知写入线程写完剩余的日志后退出
+    if(m_is_async) {
+        m_mutex.lock();
+        m_stop = true;
+        m_cond.signal();
+        m_mutex.unlock();
+        pthread_join(m_tid, NULL);
     }
 }
 
-// 异步写入需要设置阻塞队列的长度，同步不需要设置
-bool Log::init(const char *file_name, int close_log, int log_buf_size,
-    int split_lines, int max_queue_size)
+Log::thread_log::~thread_log()
 {
-    // 如果设置了max_queue_size，则设置为异步
-    if(max_queue_size >= 1) {
-        // 设置异步写入标志
-        m_is_async = true;
-        // 创建并设置阻塞队列长度
-        m_log_queue = new block_queue<std::string>(max_queue_size);
+    // 缓冲区中可能还有未写入的日志，交给写入线程释放
+    if(buf) {
+        buf->close();
+    }
+    delete[] line;
+}
 
-        // flush_log_thread为线程工作函数，表示创建线程异步写日志
-        pthread_t tid;
-        pthread_create(&tid, NULL, flush_log_thread, NULL);
+Log::thread_log *Log::local()
+{
+    static thread_local thread_log t;
+    if(t.line == NULL) {
+        t.line = new char[m_log_buf_size];
+        if(m_is_async) {
+            t.buf = new log_buffer(m_thread_buf_size);
+            m_mutex.lock();
+            m_bufs.push_back(t.buf);
+            m_mutex.unlock();
+        }
     }
+    return &t;
+}
 
+// 线程缓冲区大小不为 0 时异步写入
+bool Log::init(const char *file_name, int close_log, int log_buf_size,
+    int split_lines, int thread_buf_kb, int flush_ms, bool binary, int overflow, int block_ms,
+    long long split_bytes, bool compress, int keep_files, long long keep_bytes)
+{
+    m_overflow = overflow;
+    m_block_ms = block_ms;
     m_close_log = close_log;
+    m_binary = binary;
+    if(m_binary) {
+        m_ticks_per_ns = calibrate_ticks();
+    }
 
-    // 输出内容
-    m_log_buf_size = log_buf_size;
-    m_buf = new char[m_log_buf_size];
-    memset(m_buf, '\0', m_log_buf_size);
+    // 每行日志的最大长度，至少能放下时间前缀
+    m_log_buf_size = log_buf_size < 128 ? 128 : log_buf_size;
 
-    // 日志的最大长度
-    m_split_lines = split_lines;
+    // 从后向前找到第一个 '/' 的位置，分出目录和日志名
+    const char *p = strrchr(file_name, '/');
+    std::string dir = p ? std::string(file_name, p - file_name + 1) : "";
+    std::string name = p ? p + 1 : file_name;
 
-    time_t t = time(NULL);
-    struct tm *sys_tm = localtime(&t);
-    struct tm my_tm = *sys_tm;
+    // 二进制日志使用单独的文件名
+    if(m_binary) {
+        name += ".bin";
+    }
 
-    // 从后向前找到第一个 '/' 的位置
-    const char *p = strrchr(file_name, '/');
-    char log_full_name[256] = {0};
+    if(!m_file.init(dir.c_str(), name.c_str(), m_binary ? 0 : split_lines, split_bytes,
+        compress, keep_files, keep_bytes)) {
+        return false;
+    }
+    start_session();
 
-    // 自定义日志名
-    if(p == NULL) {
-        snprintf(log_full_name, 255, "%d_%02d_%02d_%s", my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday, file_name);
+    // 设置了线程缓冲区大小，则设置为异步
+    if(thread_buf_kb >= 1) {
+        m_thread_buf_size = (size_t)thread_buf_kb * 1024;
+        m_flush_ms = flush_ms > 0 ? flush_ms : 1000;
+        // flush_log_thread为线程工作函数，表示创建线程异步写日志
+        if(pthread_create(&m_tid, NULL, flush_log_thread, NULL) == 0) {
+            m_is_async = true;
+        }
     }
-    else {
-        strcpy(log_name, p + 1);
-        strncpy(dir_name, file_name, p - file_name + 1);
-        snprintf(log_full_name, 255, "%s%d_%02d_%02d_%s", dir_name, my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday, log_name);
+
+    return true;
+}
+
+void Log::start_session()
+{
+    // 二进制日志每个文件都以会话头开始，格式定义需要重新写入
+    if(m_binary) {
+        log_session_rec rec;
+        rec.type = 'H';
+        memcpy(rec.magic, LOG_BIN_MAGIC, sizeof(rec.magic));
+        rec.version = LOG_BIN_VERSION;
+        rec.ticks_per_ns = m_ticks_per_ns;
+        clock_anchor(&rec.tsc, &rec.ns);
+        struct iovec iov = {&rec, sizeof(rec)};
+        write_fd(&iov, 1);
+        m_formats_written = 0;
     }
+}
 
-    m_today = my_tm.tm_mday;
+void Log::set_level(int level)
+{
+    if(level < 0) {
+        level = 0;
+    }
+    else if(level > 3) {
+        level = 3;
+    }
+    s_level.store(level, std::memory_order_relaxed);
+}
 
-    m_fp = fopen(log_full_name, "a");
-    if(m_fp == NULL) {
-        return false;
+int Log::register_format(int level, const char *format)
+{
+    s_format_lock.lock();
+    int id = s_format_count.load(std::memory_order_relaxed);
+    if(id < MAX_FORMATS) {
+        s_formats[id] = format;
+        s_levels[id] = level;
+        s_format_count.store(id + 1, std::memory_order_release);
+    }
+    else {
+        id = -1;
     }
+    s_format_lock.unlock();
+    return id;
+}
 
-    return true;
+void Log::pending_formats(std::string &meta)
+{
+    int count = s_format_count.load(std::memory_order_acquire);
+    for(; m_formats_written < count; ++m_formats_written) {
+        const char *format = s_formats[m_formats_written];
+        size_t len = strlen(format);
+        log_format_rec rec;
+        rec.type = 'F';
+        rec.id = m_formats_written;
+        rec.level = s_levels[m_formats_written];
+        rec.len = len < 65535 ? len : 65535;
+        meta.append((const char *)&rec, sizeof(rec));
+        meta.append(format, rec.len);
+    }
 }
 
 void Log::write_log(int level, const char *format, ...)
 {
+    thread_log *t = local();
+
     struct timeval now = {0, 0};
     gettimeofday(&now, NULL);
-    time_t t = now.tv_sec;
-    struct tm *sys_tm = localtime(&t);
-    struct tm my_tm = *sys_tm;
-    char s[16] = {0};
 
-    // 日志分级
-    switch (level)
-    {
-    case 0:
-        strcpy(s, "[debug]:");
-        break;
-    case 1:
-        strcpy(s, "[info]:");
-        break;
-    case 2:
-        strcpy(s, "[warn]:");
-        break;
-    case 3:
-        strcpy(s, "[erro]:");
-        break;                    
-    default:
-        strcpy(s, "[info]:");
-        break;
+    // 时间前缀精确到秒的部分每秒只格式化一次
+    if(now.tv_sec != t->second) {
+        time_t sec = now.tv_sec;
+        struct tm my_tm;
+        localtime_r(&sec, &my_tm);
+        strftime(t->prefix, sizeof(t->prefix), "%Y-%m-%d %H:%M:%S.", &my_tm);
+        t->second = now.tv_sec;
     }
 
-    m_mutex.lock();
+    // 写入内容格式：时间 + 内容
+    char *buf = t->line;
+    int n = snprintf(buf, m_log_buf_size, "%s%06ld %s", t->prefix, (long)now.tv_usec, level_tag(level));
 
-    // 更新行数
-    m_count++;
+    va_list valst;
+    // 将传入的format参数赋给valst，便于格式化输出
+    va_start(valst, format);
+    // 内容格式化，超长时截断，留出换行符的位置
+    int avail = m_log_buf_size - n - 1;
+    int m = vsnprintf(buf + n, avail, format, valst);
+    va_end(valst);
+    if(m < 0) {
+        m = 0;
+    }
+    else if(m >= avail) {
+        m = avail - 1;
+    }
+    buf[n + m] = '\n';
+    size_t len = n + m + 1;
 
-    // 日志不是今天，或者写入的日志行数是最大行的倍数
-    if(m_today != my_tm.tm_mday || m_count % m_split_lines == 0) {
-        char new_log[256] = {0};
-        fflush(m_fp);
-        fclose(m_fp);
-        char tail[16] = {0};
+    emit(t, level, buf, len);
+}
 
-        // 格式化日志名中的时间部分
-        snprintf(tail, 16, "%d_%02d_%02d_", my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday);
+void Log::emit(thread_log *t, int level, const char *data, size_t len)
+{
+    // 同步，则加锁向文件中写入
+    if(!m_is_async) {
+        struct iovec iov[2];
+        int cnt = 0;
+        std::string meta;
+        time_t now = time(NULL);
+        m_mutex.lock();
+        rotate(now, m_binary ? 0 : 1, len);
+        if(m_binary) {
+            pending_formats(meta);
+            if(!meta.empty()) {
+                iov[cnt].iov_base = (void *)meta.data();
+                iov[cnt++].iov_len = meta.size();
+            }
+        }
+        iov[cnt].iov_base = (void *)data;
+        iov[cnt++].iov_len = len;
+        write_fd(iov, cnt);
+        m_mutex.unlock();
+        return;
+    }
 
-        // 如果时间不是今天，创建今天的日志，更新m_today和m_count
-        if(m_today != my_tm.tm_mday) {
-            snprintf(new_log, 255, "%s%s%s", dir_name, tail, log_name);
-            m_today = my_tm.tm_mday;
-            m_count = 0;
+    // 异步，追加到线程缓冲区；空间不足时按溢出策略等待或丢弃，不会回退到同步写入
+    bool low = level < 2;
+    if(m_overflow == OVERFLOW_DROP_LOW && low && t->buf->free_space() < t->buf->capacity() / 4 + len) {
+        m_dropped[level & 3].fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    if(!t->buf->append(data, len)) {
+        if(!wait_space(t, level, len)) {
+            m_dropped[level & 3].fetch_add(1, std::memory_order_relaxed);
+            return;
         }
-        else {
-            // 超过了最大行，在之前的日志名基础上添加后缀
-            snprintf(new_log, 255, "%s%s%s.%lld", dir_name, tail, log_name, m_count / m_split_lines);
+        t->buf->append(data, len);
+    }
+
+    // 缓冲区过半时提前唤醒写入线程，不必等到刷新周期，每次过半只唤醒一次
+    if(t->buf->free_space() < t->buf->capacity() / 2) {
+        if(!t->woke) {
+            t->woke = true;
+            m_mutex.lock();
+            m_wakeup = true;
+            m_cond.signal();
+            m_mutex.unlock();
         }
+    }
+    else {
+        t->woke = false;
+    }
+}
 
-        m_fp = fopen(new_log, "a");
+bool Log::wait_space(thread_log *t, int level, size_t len)
+{
+    // 丢弃时不加锁：缓冲区越过一半时已经唤醒过写入线程
+    if(m_overflow == OVERFLOW_DROP || (m_overflow == OVERFLOW_DROP_LOW && level < 2)) {
+        return false;
     }
 
+    // 唤醒写入线程，等到有足够空间或超时
+    struct timespec end = deadline_after(m_block_ms);
+    bool ok = true;
+    m_mutex.lock();
+    while(true) {
+        if(m_stop) {
+            ok = false;
+            break;
+        }
+        m_wakeup = true;
+        m_cond.signal();
+        m_drained.timewait(m_mutex, m_block_ms <= 0 ? deadline_after(10) : end);
+        if(t->buf->free_space() >= len) {
+            break;
+        }
+        struct timeval now = {0, 0};
+        gettimeofday(&now, NULL);
+        if(m_block_ms > 0 && (now.tv_sec > end.tv_sec || (now.tv_sec == end.tv_sec && now.tv_usec * 1000 >= end.tv_nsec))) {
+            ok = false;
+            break;
+        }
+    }
     m_mutex.unlock();
+    return ok;
+}
 
-    va_list valst;
-    // 将传入的format参数赋给valst，便于格式化输出
-    va_start(valst, format);
+void Log::flush(void)
+{
+    if(!m_is_async) {
+        // 同步写入直接调用 write，没有用户态缓冲
+        return;
+    }
 
-    std::string log_str;
+    // 等待一轮完整的写入，该轮开始于本次调用之后
     m_mutex.lock();
+    long long target = m_rounds + 2;
+    m_wakeup = true;
+    m_cond.signal();
+    while(m_rounds < target && !m_stop) {
+        m_drained.timewait(m_mutex, deadline_after(100));
+    }
+    m_mutex.unlock();
+}
 
-    // 写入内容格式：时间 + 内容
-    // 时间格式化，返回写入的字符个数，不包括结尾的终止符
-    int n = snprintf(m_buf, 48, "%d-%02d-%02d %02d:%02d:%02d.%06ld %s",
-        my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday,
-        my_tm.tm_hour, my_tm.tm_min, my_tm.tm_sec, now.tv_usec, s);
-    // 内容格式化，返回写入的字符个数，不包括结尾的终止符
-    int m = vsnprintf(m_buf + n, m_log_buf_size - 1, format, valst);
-    m_buf[n + m] = '\n';
-    m_buf[n + m + 1] = '\0';
-    log_str = m_buf;
+void Log::async_write_log()
+{
+    while(true) {
+        m_mutex.lock();
+        if(!m_wakeup && !m_stop) {
+            m_cond.timewait(m_mutex, deadline_after(m_flush_ms));
+        }
+        m_wakeup = false;
+        bool stop = m_stop;
+        m_mutex.unlock();
 
-    m_mutex.unlock();
+        drain();
 
-    // m_is_async 为 true 表示异步，默认为同步
-    // 异步，则将日志信息加入阻塞队列；同步，则加锁向文件中写入
-    if(m_is_async && !m_log_queue->full()) {
-        m_log_queue->push(log_str);
-    }
-    else {
         m_mutex.lock();
-        fputs(log_str.c_str(), m_fp);
+        m_rounds++;
+        m_drained.broadcast();
         m_mutex.unlock();
-    }
 
-    va_end(valst);
+        if(stop) {
+            break;
+        }
+    }
 }
 
-void Log::flush(void)
+void Log::drain()
 {
     m_mutex.lock();
-    // 强制刷新写入流缓冲区       
-    fflush(m_fp);
+    std::vector<log_buffer *> bufs = m_bufs;
+    m_mutex.unlock();
+
+    // 收集所有线程缓冲区中的日志，一次 writev 写入，第一段留给二进制日志的格式定义、时钟锚点和丢弃汇总
+    std::vector<struct iovec> iov(bufs.size() * 2 + 1);
+    std::vector<size_t> lens(bufs.size());
+    int cnt = 1;
+    long long lines = 0;
+    for(size_t i = 0; i < bufs.size(); ++i) {
+        int segs = bufs[i]->peek(&iov[cnt], &lens[i]);
+        for(int j = 0; j < segs && !m_binary; ++j) {
+            const char *p = (const char *)iov[cnt + j].iov_base;
+            const char *end = p + iov[cnt + j].iov_len;
+            while((p = (const char *)memchr(p, '\n', end - p)) != NULL) {
+                ++lines;
+                ++p;
+            }
+        }
+        cnt += segs;
+    }
+
+    std::string summary;
+    lines += overflow_summary(summary);
+
+    if(cnt > 1 || !summary.empty()) {
+        size_t bytes = summary.size();
+        for(int i = 1; i < cnt; ++i) {
+            bytes += iov[i].iov_len;
+        }
+        rotate(time(NULL), lines, bytes);
+        std::string meta;
+        if(m_binary) {
+            // 格式定义在读取缓冲区位置之后取得，保证覆盖本轮所有日志引用的格式
+            pending_formats(meta);
+            log_anchor_rec rec;
+            rec.type = 'A';
+            clock_anchor(&rec.tsc, &rec.ns);
+            meta.append((const char *)&rec, sizeof(rec));
+        }
+        meta += summary;
+        iov[0].iov_base = (void *)meta.data();
+        iov[0].iov_len = meta.size();
+        write_fd(&iov[0], cnt);
+    }
+
+    for(size_t i = 0; i < bufs.size(); ++i) {
+        bufs[i]->consume(lens[i]);
+    }
+
+    // 释放所属线程已退出且已写完的缓冲区
+    m_mutex.lock();
+    for(size_t i = 0; i < m_bufs.size(); ) {
+        if(m_bufs[i]->closed() && m_bufs[i]->empty()) {
+            delete m_bufs[i];
+            m_bufs[i] = m_bufs.back();
+            m_bufs.pop_back();
+        }
+        else {
+            ++i;
+        }
+    }
     m_mutex.unlock();
 }
+
+int Log::overflow_summary(std::string &out)
+{
+    long long d[4];
+    long long total = 0;
+    for(int i = 0; i < 4; ++i) {
+        d[i] = m_dropped[i].load(std::memory_order_relaxed) - m_reported[i];
+        total += d[i];
+    }
+    time_t now = time(NULL);
+    if(total == 0 || now == m_last_summary) {
+        return 0;
+    }
+    m_last_summary = now;
+    for(int i = 0; i < 4; ++i) {
+        m_reported[i] += d[i];
+    }
+
+    char buf[256];
+    if(m_binary) {
+        static const int id = register_format(2, "log overflow: %lld messages dropped (debug %lld, info %lld, warn %lld, erro %lld)");
+        log_entry_rec rec;
+        char *p = buf + sizeof(rec);
+        log_put_args(p, buf + sizeof(buf), total, d[0], d[1], d[2], d[3]);
+        rec.type = 'L';
+        rec.id = id;
+        rec.tsc = log_clock();
+        rec.len = p - buf - sizeof(rec);
+        memcpy(buf, &rec, sizeof(rec));
+        out.append(buf, p - buf);
+        return 1;
+    }
+
+    struct timeval tv = {0, 0};
+    gettimeofday(&tv, NULL);
+    time_t sec = tv.tv_sec;
+    struct tm my_tm;
+    localtime_r(&sec, &my_tm);
+    int n = snprintf(buf, sizeof(buf), "%d-%02d-%02d %02d:%02d:%02d.%06ld %s"
+        "log overflow: %lld messages dropped (debug %lld, info %lld, warn %lld, erro %lld)\n",
+        my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday, my_tm.tm_hour, my_tm.tm_min, my_tm.tm_sec,
+        (long)tv.tv_usec, level_tag(2), total, d[0], d[1], d[2], d[3]);
+    out.append(buf, n);
+    return 1;
+}
+
+void Log::write_fd(struct iovec *iov, int cnt)
+{
+    while(cnt > 0) {
+        int batch = cnt < IOV_MAX ? cnt : IOV_MAX;
+        ssize_t n = writev(m_file.fd(), iov, batch);
+        if(n < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        // 跳过已写入的部分，处理部分写入
+        while(batch > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            ++iov;
+            --cnt;
+            --batch;
+        }
+        if(batch > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+}
+
+void Log::rotate(time_t now, long long lines, size_t bytes)
+{
+    // 按天、行数、大小切分，切换到新文件后重新写入二进制日志的会话头
+    if(m_file.rotate(now, lines, bytes)) {
+        start_session();
+    }
+}
@@ -1,11 +1,18 @@
 /**同步/异步日志系统
- * 主要涉及两个模块，日志模块+阻塞队列模块
- * 加入阻塞队列模块主要是解决异步写入日志做准备
- * - 自定义阻塞队列
+ * 主要涉及两个模块，日志模块+线程缓冲区模块
  * - 单例模式创建日志
- * - 同步日志
- * - 异步日志
- * - 实现按天、超行分类
+ * - 同步日志：在调用线程中格式化后直接写入文件
+ * - 异步日志：每个线程格式化后追加到自己的缓冲区（log_buffer），快路径上不加锁
+ *   后台写入线程定时（或缓冲区过半时被唤醒）收集所有线程的缓冲区，用一次 writev 写入文件
+ *   不再每行 fflush，日志最多延迟一个刷新周期落到内核
+ * - 按天、行数、大小切分文件，由写入文件的线程完成；下一个文件提前打开，
+ *   旧文件的关闭、压缩和过期清理在低优先级的维护线程中进行（log_file.h）
+ * - 缓冲区满时按溢出策略处理：直接丢弃、先丢低级别（debug、info）、或限时等待，
+ *   丢弃的条数按级别计数，写入线程每秒最多输出一行汇总
+ * - 级别过滤：编译期最低级别（LOG_MIN_LEVEL）去掉低级别的调用点，运行时级别可随时修改，
+ *   被过滤的日志不会取参数、不会格式化；请求路径上的调用点可按调用点限流或采样
+ * - 二进制模式：调用点的格式字符串只注册一次，之后只记录编号、时钟计数和原始参数，
+ *   不在请求线程中格式化，由 logdecode 离线还原为文本，格式见 log_format.h
 */
 
 #ifndef LOG_H
@@ -14,12 +21,35 @@
 #include <stdio.h>
 #include <iostream>
 #include <string>
+#include <vector>
 #include <stdarg.h>
 #include <pthread.h>
-#include "block_queue.h"
+#include <atomic>
+#include "../lock/locker.h"
+#include "log_buffer.h"
+#include "log_format.h"
+#include "log_file.h"
+
+// 编译期最低日志级别：0 debug、1 info、2 warn、3 erro，低于它的调用点在编译时整体去掉
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL 0
+#endif
+
+// 请求路径上的调用点每秒最多输出的条数
+#ifndef LOG_REQUEST_RATE
+#define LOG_REQUEST_RATE 100
+#endif
 
 class Log {
 public:
+    // 线程缓冲区满时的处理策略
+    enum OVERFLOW_POLICY
+    {
+        OVERFLOW_BLOCK = 0,     // 等待写入线程腾出空间，最多等待 block_ms，超时后丢弃
+        OVERFLOW_DROP,          // 直接丢弃
+        OVERFLOW_DROP_LOW       // 缓冲区超过 3/4 时丢弃 debug、info，warn、erro 按 OVERFLOW_BLOCK 处理
+    };
+
     // 局部变量懒汉单例模式，C++11后不用加锁也线程安全
     static Log *get_instance()
     {
@@ -30,17 +60,60 @@ public:
     // 异步写入日志方法，调用私有方法 async_write_log
     static void *flush_log_thread(void *args)
     {
+        pthread_setname_np(pthread_self(), "log_writer");
         Log::get_instance()->async_write_log();
+        return NULL;
     }
 
-    // 可选参数：日志文件、日志缓冲区的大小、最大行数、阻塞队列长度
-    bool init(const char *file_name, int close_log, int log_buf_size = 8192, 
-        int split_lines = 5000000, int max_queue_size = 0);
+    // 可选参数：日志文件、每行日志的最大长度、最大行数、
+    // 每个线程缓冲区的大小（KB，为 0 时同步写入）、异步写入的刷新周期（毫秒）、是否写二进制日志、
+    // 缓冲区满时的处理策略、最长等待时间（毫秒，不大于 0 时一直等待）、
+    // 每个文件的最大字节数（0 为不限）、是否压缩旧文件、最多保留的文件数和总字节数（0 为不限）
+    bool init(const char *file_name, int close_log, int log_buf_size = 8192,
+        int split_lines = 5000000, int thread_buf_kb = 0, int flush_ms = 1000, bool binary = false,
+        int overflow = OVERFLOW_DROP_LOW, int block_ms = 10,
+        long long split_bytes = 0, bool compress = false, int keep_files = 0, long long keep_bytes = 0);
 
     // 将输出内容按标准格式整理
     void write_log(int level, const char *format, ...);
 
-    // 强制刷新缓冲区
+    // 运行时日志级别，低于它的日志直接跳过
+    static bool enabled(int level) { return level >= s_level.load(std::memory_order_relaxed); }
+    static void set_level(int level);
+    static int get_level() { return s_level.load(std::memory_order_relaxed); }
+
+    // 注册调用点的格式字符串，返回其编号，format 须为字符串常量
+    static int register_format(int level, const char *format);
+
+    // 二进制模式只记录格式编号和原始参数，文本模式同 write_log
+    template <typename... Args>
+    void write_fmt(int id, int level, const char *format, Args... args)
+    {
+        if(!m_binary) {
+            write_log(level, format, args...);
+            return;
+        }
+        if(id < 0) {
+            return;
+        }
+        thread_log *t = local();
+        log_entry_rec rec;
+        char *p = t->line + sizeof(rec);
+        char *end = t->line + (m_log_buf_size < 65535 ? m_log_buf_size : 65535);
+        // 空间不足时丢弃后面的参数，解码时显示为缺失
+        log_put_args(p, end, args...);
+        rec.type = 'L';
+        rec.id = id;
+        rec.tsc = log_clock();
+        rec.len = p - t->line - sizeof(rec);
+        memcpy(t->line, &rec, sizeof(rec));
+        emit(t, level, t->line, p - t->line);
+    }
+
+    // 因缓冲区满被丢弃的日志条数
+    long long dropped(int level) const { return m_dropped[level & 3].load(std::memory_order_relaxed); }
+
+    // 强制刷新：异步时等待写入线程写完此前所有线程缓冲区中的日志
     void flush(void);
 
 
@@ -48,39 +121,129 @@ private:
     Log();
     virtual ~Log();
 
+    // 每个线程的格式化状态和缓冲区
+    struct thread_log {
+        log_buffer *buf;        // 异步时的线程缓冲区，由写入线程释放
+        char *line;             // 格式化一行日志的空间
+        long long second;       // 缓存的时间前缀对应的秒
+        char prefix[32];        // 缓存的时间前缀 "YYYY-MM-DD HH:MM:SS."
+        bool woke;              // 缓冲区过半后已唤醒过写入线程
+        thread_log() : buf(NULL), line(NULL), second(-1), woke(false) { prefix[0] = '\0'; }
+        ~thread_log();
+    };
+    thread_log *local();
+    // 将一条日志交给文件：同步时直接写入，异步时追加到线程缓冲区
+    void emit(thread_log *t, int level, const char *data, size_t len);
+    // 缓冲区空间不足时按溢出策略等待，返回 false 表示丢弃
+    bool wait_space(thread_log *t, int level, size_t len);
+
     // 异步写日志方法
-    void *async_write_log()
-    {
-        std::string single_log;
-        // 从阻塞队列中取出一个日志内容，写入文件
-        while(m_log_queue->pop(single_log)) {
-            m_mutex.lock();
-            fputs(single_log.c_str(), m_fp);
-            m_mutex.unlock();
-        }
-    }
+    void async_write_log();
+    // 将所有线程缓冲区中的日志写入文件，只由写入线程调用
+    void drain();
+    // 写入 lines 行、bytes 字节之前检查是否切分文件，调用者保证只有一个线程写文件
+    void rotate(time_t now, long long lines, size_t bytes);
+    // 新文件的开头：二进制日志写入会话头
+    void start_session();
+    void write_fd(struct iovec *iov, int cnt);
+    // 距上次汇总有新的丢弃时生成一行汇总，每秒最多一次，返回生成的行数
+    int overflow_summary(std::string &out);
+    // 二进制模式下尚未写入当前文件的格式定义
+    void pending_formats(std::string &meta);
 
 private:
-    char dir_name[128];     // 路径名
-    char log_name[128];     // 日志文件名
-    int m_split_lines;      // 日志最大行数
+    static std::atomic<int> s_level;    // 运行时日志级别
+
+    log_file m_file;        // 日志文件及其切分
     int m_log_buf_size;     // 日志缓冲区大小
-    long long m_count;      // 日志行数记录
-    int m_today;            // 当前时间，按天分类日志
-    FILE *m_fp;             // 打开日志的文件指针
-    char *m_buf;            // 输出的内容
     int m_close_log;        // 关闭日志
-    locker m_mutex;         // 互斥锁
+    locker m_mutex;         // 同步写入文件、注册线程缓冲区
     bool m_is_async;        // 同步异步标志位
-    block_queue<std::string> *m_log_queue;  // 阻塞队列
+
+    size_t m_thread_buf_size;           // 每个线程缓冲区的大小
+    int m_flush_ms;                     // 刷新周期
+    std::vector<log_buffer *> m_bufs;   // 所有线程的缓冲区，受 m_mutex 保护
+    pthread_t m_tid;                    // 写入线程
+    bool m_stop;                        // 通知写入线程退出
+    bool m_wakeup;                      // 唤醒写入线程立即写入
+    cond m_cond;                        // 唤醒写入线程
+    cond m_drained;                     // 写入线程完成一轮写入
+    long long m_rounds;                 // 写入线程完成的轮数
+
+    bool m_binary;              // 二进制日志
+    double m_ticks_per_ns;      // 时钟频率，初始化时测得
+    int m_formats_written;      // 已写入当前文件的格式定义数
+
+    int m_overflow;                         // 溢出策略
+    int m_block_ms;                         // 溢出时最长等待时间
+    std::atomic<long long> m_dropped[4];    // 各级别丢弃的条数
+    long long m_reported[4];                // 已汇总的丢弃条数，只由写入线程访问
+    time_t m_last_summary;                  // 上次汇总的时间
+};
+
+// 调用点限流：每秒最多放行 limit 条，新的一秒开始时取回上一秒丢弃的条数
+class log_rate {
+public:
+    log_rate() : m_second(0), m_count(0), m_dropped(0) {}
+
+    bool allow(int limit, long long *dropped)
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+        long long now = ts.tv_sec;
+        long long sec = m_second.load(std::memory_order_relaxed);
+        *dropped = 0;
+        if(now != sec && m_second.compare_exchange_strong(sec, now, std::memory_order_relaxed)) {
+            m_count.store(0, std::memory_order_relaxed);
+            *dropped = m_dropped.exchange(0, std::memory_order_relaxed);
+        }
+        if(m_count.fetch_add(1, std::memory_order_relaxed) < limit) {
+            return true;
+        }
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+private:
+    std::atomic<long long> m_second;
+    std::atomic<int> m_count;
+    std::atomic<long long> m_dropped;
 };
 
 
 // 宏定义，用于不同类型的日志输出
 // 宏定义提供其他程序调用的方法，日志类中的方法不会被直接调用
-#define LOG_DEBUG(format, ...) if(0 == m_close_log) { Log::get_instance()->write_log(0, format, ##__VA_ARGS__); Log::get_instance()->flush(); }
-#define LOG_INFO(format, ...) if(0 == m_close_log) { Log::get_instance()->write_log(1, format, ##__VA_ARGS__); Log::get_instance()->flush(); }
-#define LOG_WARN(format, ...) if(0 == m_close_log) { Log::get_instance()->write_log(2, format, ##__VA_ARGS__); Log::get_instance()->flush(); }
-#define LOG_ERROR(format, ...) if(0 == m_close_log) { Log::get_instance()->write_log(3, format, ##__VA_ARGS__); Log::get_instance()->flush(); }
+// 级别判断在取参数之前，编译期被去掉的级别整个调用点都不会生成代码
+#define LOG_ON(level) ((level) >= LOG_MIN_LEVEL && 0 == m_close_log && Log::enabled(level))
+// 每个调用点第一次执行时注册格式字符串，编号保存在局部静态变量中
+#define LOG_EMIT(level, format, ...) { \
+    static const int log_fmt_id = Log::register_format(level, format); \
+    Log::get_instance()->write_fmt(log_fmt_id, level, format, ##__VA_ARGS__); }
+#define LOG_BASE(level, format, ...) if(LOG_ON(level)) LOG_EMIT(level, format, ##__VA_ARGS__)
+#define LOG_DEBUG(format, ...) LOG_BASE(0, format, ##__VA_ARGS__)
+#define LOG_INFO(format, ...) LOG_BASE(1, format, ##__VA_ARGS__)
+#define LOG_WARN(format, ...) LOG_BASE(2, format, ##__VA_ARGS__)
+#define LOG_ERROR(format, ...) LOG_BASE(3, format, ##__VA_ARGS__)
+
+// 限流：每个调用点每秒最多输出 limit 条，被丢弃的条数在下一秒的第一条之前输出
+#define LOG_RATE_BASE(level, limit, format, ...) if(LOG_ON(level)) { \
+    static log_rate log_site_rate; \
+    long long log_dropped; \
+    bool log_pass = log_site_rate.allow(limit, &log_dropped); \
+    if(log_dropped > 0) LOG_EMIT(level, "%lld messages suppressed: %s", log_dropped, format) \
+    if(log_pass) LOG_EMIT(level, format, ##__VA_ARGS__) }
+#define LOG_DEBUG_RATE(limit, format, ...) LOG_RATE_BASE(0, limit, format, ##__VA_ARGS__)
+#define LOG_INFO_RATE(limit, format, ...) LOG_RATE_BASE(1, limit, format, ##__VA_ARGS__)
+#define LOG_WARN_RATE(limit, format, ...) LOG_RATE_BASE(2, limit, format, ##__VA_ARGS__)
+#define LOG_ERROR_RATE(limit, format, ...) LOG_RATE_BASE(3, limit, format, ##__VA_ARGS__)
+
+// 采样：每个线程在每个调用点每 n 次输出 1 次
+#define LOG_SAMPLE_BASE(level, n, format, ...) if(LOG_ON(level)) { \
+    static thread_local unsigned log_site_n = 0; \
+    if(log_site_n++ % (n) == 0) LOG_EMIT(level, format, ##__VA_ARGS__) }
+#define LOG_DEBUG_EVERY(n, format, ...) LOG_SAMPLE_BASE(0, n, format, ##__VA_ARGS__)
+#define LOG_INFO_EVERY(n, format, ...) LOG_SAMPLE_BASE(1, n, format, ##__VA_ARGS__)
+#define LOG_WARN_EVERY(n, format, ...) LOG_SAMPLE_BASE(2, n, format, ##__VA_ARGS__)
+#define LOG_ERROR_EVERY(n, format, ...) LOG_SAMPLE_BASE(3, n, format, ##__VA_ARGS__)
 
-#endif
\ No newline at end of file
+#endif
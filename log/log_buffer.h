@@ -0,0 +1,103 @@
+/**日志线程缓冲区
+ * 单生产者单消费者的字节环形缓冲区，每个写日志的线程独占一个：
+ * - 生产者（写日志的线程）只移动写位置，消费者（后台写入线程）只移动读位置
+ * - 两个位置都是单调递增的原子变量，写入和读取都不需要加锁
+ * - 消费者每次取出两个位置之间的全部数据，用一次 writev 写入文件
+ */
+
+#ifndef LOG_BUFFER_H
+#define LOG_BUFFER_H
+
+#include <stddef.h>
+#include <string.h>
+#include <atomic>
+#include <sys/uio.h>
+
+class log_buffer {
+public:
+    // size 向上取整为 2 的幂
+    explicit log_buffer(size_t size)
+    {
+        m_size = 1;
+        while(m_size < size) {
+            m_size <<= 1;
+        }
+        m_data = new char[m_size];
+        m_head.store(0, std::memory_order_relaxed);
+        m_tail.store(0, std::memory_order_relaxed);
+        m_closed.store(false, std::memory_order_relaxed);
+    }
+
+    ~log_buffer()
+    {
+        delete[] m_data;
+    }
+
+    size_t capacity() const { return m_size; }
+
+    // 生产者：剩余空间
+    size_t free_space() const
+    {
+        return m_size - (m_head.load(std::memory_order_relaxed) - m_tail.load(std::memory_order_acquire));
+    }
+
+    // 生产者：追加 len 字节，空间不足时返回 false，不写入任何内容
+    bool append(const char *data, size_t len)
+    {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        if(len > m_size - (head - m_tail.load(std::memory_order_acquire))) {
+            return false;
+        }
+        size_t pos = head & (m_size - 1);
+        size_t first = len < m_size - pos ? len : m_size - pos;
+        memcpy(m_data + pos, data, first);
+        memcpy(m_data, data + first, len - first);
+        m_head.store(head + len, std::memory_order_release);
+        return true;
+    }
+
+    // 消费者：取出可读的数据，最多两段，返回段数；consume 之前数据保持有效
+    int peek(struct iovec *iov, size_t *len) const
+    {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        size_t head = m_head.load(std::memory_order_acquire);
+        *len = head - tail;
+        if(*len == 0) {
+            return 0;
+        }
+        size_t pos = tail & (m_size - 1);
+        size_t first = *len < m_size - pos ? *len : m_size - pos;
+        iov[0].iov_base = m_data + pos;
+        iov[0].iov_len = first;
+        if(first == *len) {
+            return 1;
+        }
+        iov[1].iov_base = m_data;
+        iov[1].iov_len = *len - first;
+        return 2;
+    }
+
+    // 消费者：释放已写入文件的 len 字节
+    void consume(size_t len)
+    {
+        m_tail.store(m_tail.load(std::memory_order_relaxed) + len, std::memory_order_release);
+    }
+
+    bool empty() const
+    {
+        return m_head.load(std::memory_order_acquire) == m_tail.load(std::memory_order_relaxed);
+    }
+
+    // 所属线程退出后标记关闭，消费者写完剩余数据后释放
+    void close() { m_closed.store(true, std::memory_order_release); }
+    bool closed() const { return m_closed.load(std::memory_order_acquire); }
+
+private:
+    char *m_data;
+    size_t m_size;
+    alignas(64) std::atomic<size_t> m_head;     // 写位置，只由生产者修改
+    alignas(64) std::atomic<size_t> m_tail;     // 读位置，只由消费者修改，与写位置分属不同缓存行
+    std::atomic<bool> m_closed;
+};
+
+#endif
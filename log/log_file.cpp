@@ -0,0 +1,412 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <algorithm>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#ifdef USE_ZLIB
+#include <zlib.h>
+#endif
+
+#include "log_file.h"
+
+static bool file_exists(const char *path)
+{
+    struct stat st;
+    return stat(path, &st) == 0;
+}
+
+static int open_log(const char *path)
+{
+    return open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+}
+
+log_file::log_file() : m_lock("log_file"), m_cond("log_file")
+{
+    m_split_lines = 0;
+    m_split_bytes = 0;
+    m_compress = false;
+    m_keep_files = 0;
+    m_keep_bytes = 0;
+    m_fd = -1;
+    m_lines = 0;
+    m_bytes = 0;
+    m_segment = 0;
+    m_today = 0;
+    m_sec = -1;
+    memset(&m_tm, 0, sizeof(m_tm));
+    m_next_fd = -1;
+    m_stop = false;
+    m_started = false;
+}
+
+log_file::~log_file()
+{
+    // 维护线程处理完已交给它的文件后退出
+    if(m_started) {
+        m_lock.lock();
+        m_stop = true;
+        m_cond.signal();
+        m_lock.unlock();
+        pthread_join(m_tid, NULL);
+    }
+    if(m_next_fd != -1) {
+        segment s = {m_next_fd, m_next, false};
+        release(s);
+    }
+    if(m_fd != -1) {
+        close(m_fd);
+    }
+}
+
+void log_file::segment_name(char *out, const struct tm &date, int seg) const
+{
+    if(seg == 0) {
+        snprintf(out, 256, "%s%d_%02d_%02d_%s", m_dir.c_str(),
+            date.tm_year + 1900, date.tm_mon + 1, date.tm_mday, m_name.c_str());
+    }
+    else {
+        snprintf(out, 256, "%s%d_%02d_%02d_%s.%d", m_dir.c_str(),
+            date.tm_year + 1900, date.tm_mon + 1, date.tm_mday, m_name.c_str(), seg);
+    }
+}
+
+bool log_file::init(const char *dir, const char *name, int split_lines, long long split_bytes,
+    bool compress, int keep_files, long long keep_bytes)
+{
+    m_dir = dir;
+    m_name = name;
+    m_split_lines = split_lines;
+    m_split_bytes = split_bytes;
+    m_compress = compress;
+    m_keep_files = keep_files;
+    m_keep_bytes = keep_bytes;
+
+    m_sec = time(NULL);
+    localtime_r(&m_sec, &m_tm);
+    m_today = m_tm.tm_mday;
+
+    // 重启后接着写今天最后一个分段，已压缩的分段不再追加
+    char path[256];
+    char gz[264];
+    m_segment = 0;
+    while(true) {
+        segment_name(path, m_tm, m_segment + 1);
+        snprintf(gz, sizeof(gz), "%s.gz", path);
+        if(!file_exists(path) && !file_exists(gz)) {
+            break;
+        }
+        ++m_segment;
+    }
+    segment_name(path, m_tm, m_segment);
+    snprintf(gz, sizeof(gz), "%s.gz", path);
+    if(file_exists(gz)) {
+        segment_name(path, m_tm, ++m_segment);
+    }
+
+    m_fd = open_log(path);
+    if(m_fd < 0) {
+        return false;
+    }
+    struct stat st;
+    m_bytes = fstat(m_fd, &st) == 0 ? st.st_size : 0;
+    m_lines = 0;
+    m_path = path;
+    m_current = path;
+
+    if(pthread_create(&m_tid, NULL, worker, this) == 0) {
+        m_started = true;
+    }
+    return true;
+}
+
+bool log_file::rotate(time_t now, long long lines, size_t bytes)
+{
+    if(now != m_sec) {
+        localtime_r(&now, &m_tm);
+        m_sec = now;
+    }
+
+    // 日期变化，或写入后会超过最大行数、最大字节数
+    bool switched = false;
+    if(m_tm.tm_mday != m_today) {
+        switched = switch_to(0);
+    }
+    else if((m_split_lines > 0 && m_lines > 0 && m_lines + lines > m_split_lines) ||
+        (m_split_bytes > 0 && m_bytes > 0 && m_bytes + (long long)bytes > m_split_bytes)) {
+        switched = switch_to(m_segment + 1);
+    }
+    m_lines += lines;
+    m_bytes += bytes;
+
+    if(m_started) {
+        prepare_next();
+    }
+    return switched;
+}
+
+bool log_file::switch_to(int seg)
+{
+    char path[256];
+    segment_name(path, m_tm, seg);
+
+    // 优先使用维护线程预先打开的文件
+    int fd = -1;
+    m_lock.lock();
+    if(m_next_fd != -1 && m_next == path) {
+        fd = m_next_fd;
+        m_next_fd = -1;
+        m_next.clear();
+    }
+    m_lock.unlock();
+    if(fd == -1) {
+        fd = open_log(path);
+        if(fd < 0) {
+            return false;
+        }
+    }
+
+    // 旧文件交给维护线程关闭、压缩
+    segment old = {m_fd, m_path, true};
+    m_fd = fd;
+    m_path = path;
+    m_today = m_tm.tm_mday;
+    m_segment = seg;
+    m_lines = 0;
+    m_bytes = 0;
+    if(m_started) {
+        m_lock.lock();
+        m_pending.push_back(old);
+        m_current = m_path;
+        m_cond.signal();
+        m_lock.unlock();
+    }
+    else {
+        close(old.fd);
+    }
+    return true;
+}
+
+void log_file::prepare_next()
+{
+    char path[256];
+    path[0] = '\0';
+    if((m_split_lines > 0 && m_lines >= m_split_lines / 4 * 3) ||
+        (m_split_bytes > 0 && m_bytes >= m_split_bytes / 4 * 3)) {
+        segment_name(path, m_tm, m_segment + 1);
+    }
+    else if(m_tm.tm_hour == 23 && m_tm.tm_min == 59) {
+        // 最后一分钟打开明天的文件
+        time_t later = m_sec + 60;
+        struct tm tomorrow;
+        localtime_r(&later, &tomorrow);
+        if(tomorrow.tm_mday != m_today) {
+            segment_name(path, tomorrow, 0);
+        }
+    }
+    if(path[0] == '\0' || m_want == path) {
+        return;
+    }
+    m_want = path;
+    m_lock.lock();
+    m_open = path;
+    m_cond.signal();
+    m_lock.unlock();
+}
+
+void *log_file::worker(void *arg)
+{
+    pthread_setname_np(pthread_self(), "log_maintain");
+    log_file *file = (log_file *)arg;
+    file->run();
+    return NULL;
+}
+
+void log_file::run()
+{
+    // 维护线程降低 CPU 和磁盘 IO 优先级，不与请求线程、写入线程竞争
+    setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19);
+#ifdef SYS_ioprio_set
+    syscall(SYS_ioprio_set, 1, 0, 3 << 13);     // IOPRIO_WHO_PROCESS，当前线程，IOPRIO_CLASS_IDLE
+#endif
+
+    while(true) {
+        m_lock.lock();
+        while(!m_stop && m_open.empty() && m_pending.empty()) {
+            m_cond.wait(m_lock);
+        }
+        std::string open_path;
+        open_path.swap(m_open);
+        std::vector<segment> pending;
+        pending.swap(m_pending);
+        bool stop = m_stop;
+        m_lock.unlock();
+
+        if(!open_path.empty()) {
+            int fd = open_log(open_path.c_str());
+            segment old = {-1, "", false};
+            m_lock.lock();
+            if(fd >= 0) {
+                old.fd = m_next_fd;
+                old.name = m_next;
+                m_next_fd = fd;
+                m_next = open_path;
+            }
+            m_lock.unlock();
+            if(old.fd != -1) {
+                release(old);
+            }
+        }
+
+        for(size_t i = 0; i < pending.size(); ++i) {
+            release(pending[i]);
+        }
+        if(!pending.empty() && (m_keep_files > 0 || m_keep_bytes > 0)) {
+            retain();
+        }
+
+        if(stop) {
+            m_lock.lock();
+            bool idle = m_pending.empty();
+            m_lock.unlock();
+            if(idle) {
+                break;
+            }
+        }
+    }
+}
+
+void log_file::release(const segment &s)
+{
+    if(!s.retired) {
+        // 没有用上的预先打开的文件，为空时删除
+        struct stat st;
+        if(fstat(s.fd, &st) == 0 && st.st_size == 0) {
+            unlink(s.name.c_str());
+        }
+        close(s.fd);
+        return;
+    }
+    close(s.fd);
+    if(m_compress) {
+        compress(s.name);
+    }
+}
+
+void log_file::compress(const std::string &name)
+{
+#ifdef USE_ZLIB
+    int src = open(name.c_str(), O_RDONLY | O_CLOEXEC);
+    if(src < 0) {
+        return;
+    }
+    std::string gz = name + ".gz";
+    std::string tmp = gz + ".tmp";
+    gzFile out = gzopen(tmp.c_str(), "wb6");
+    bool ok = out != NULL;
+    char buf[65536];
+    while(ok) {
+        ssize_t n = read(src, buf, sizeof(buf));
+        if(n < 0 && errno == EINTR) {
+            continue;
+        }
+        if(n <= 0) {
+            ok = n == 0;
+            break;
+        }
+        ok = gzwrite(out, buf, n) == n;
+    }
+    close(src);
+    if(out != NULL && gzclose(out) != Z_OK) {
+        ok = false;
+    }
+    // 压缩完整后再替换，中途失败保留原文件
+    if(ok && rename(tmp.c_str(), gz.c_str()) == 0) {
+        unlink(name.c_str());
+    }
+    else {
+        unlink(tmp.c_str());
+    }
+#endif
+}
+
+// 属于本日志的文件："年_月_日_名称"，可带 ".序号"、".gz" 后缀
+bool log_file::matches(const char *file) const
+{
+    size_t len = strlen(file);
+    if(len < 11 + m_name.size()) {
+        return false;
+    }
+    for(int i = 0; i < 10; ++i) {
+        bool sep = i == 4 || i == 7;
+        if(sep ? file[i] != '_' : (file[i] < '0' || file[i] > '9')) {
+            return false;
+        }
+    }
+    if(file[10] != '_' || strncmp(file + 11, m_name.c_str(), m_name.size()) != 0) {
+        return false;
+    }
+    const char *p = file + 11 + m_name.size();
+    if(*p == '.' && p[1] >= '0' && p[1] <= '9') {
+        ++p;
+        while(*p >= '0' && *p <= '9') {
+            ++p;
+        }
+    }
+    return *p == '\0' || strcmp(p, ".gz") == 0;
+}
+
+void log_file::retain()
+{
+    m_lock.lock();
+    std::string current = m_current;
+    std::string next = m_next;
+    m_lock.unlock();
+
+    std::string dir = m_dir.empty() ? "./" : m_dir;
+    DIR *d = opendir(dir.c_str());
+    if(!d) {
+        return;
+    }
+
+    // 按文件名中的日期和分段序号从旧到新排列，当前文件和预先打开的文件不删除，但计入数量和大小
+    std::vector<std::pair<std::pair<std::string, int>, std::pair<std::string, long long> > > files;
+    int count = 0;
+    long long total = 0;
+    struct dirent *ent;
+    while((ent = readdir(d)) != NULL) {
+        if(!matches(ent->d_name)) {
+            continue;
+        }
+        std::string path = m_dir + ent->d_name;
+        struct stat st;
+        if(stat(path.c_str(), &st) != 0) {
+            continue;
+        }
+        ++count;
+        total += st.st_size;
+        if(path != current && path != next) {
+            const char *seg = ent->d_name + 11 + m_name.size();
+            int n = *seg == '.' ? atoi(seg + 1) : 0;
+            files.push_back(std::make_pair(std::make_pair(std::string(ent->d_name, 10), n),
+                std::make_pair(path, (long long)st.st_size)));
+        }
+    }
+    closedir(d);
+    std::sort(files.begin(), files.end());
+
+    for(size_t i = 0; i < files.size(); ++i) {
+        if((m_keep_files <= 0 || count <= m_keep_files) && (m_keep_bytes <= 0 || total <= m_keep_bytes)) {
+            break;
+        }
+        if(unlink(files[i].second.first.c_str()) == 0) {
+            --count;
+            total -= files[i].second.second;
+        }
+    }
+}
@@ -0,0 +1,87 @@
+/**日志文件切分
+ * 管理日志文件的各个分段，由写文件的线程（异步时为写入线程）在每次写入前调用 rotate：
+ * - 按天、行数、大小切分，文件名为 "年_月_日_名称"，同一天的后续分段加后缀 ".1"、".2" ...
+ * - 接近切分条件（行数或大小超过 3/4、距午夜不到一分钟）时由维护线程提前打开下一个文件，
+ *   切分时只需替换文件描述符
+ * - 旧分段的关闭、压缩（gzip）和按数量、总大小清理都在低优先级的维护线程中完成
+ */
+
+#ifndef LOG_FILE_H
+#define LOG_FILE_H
+
+#include <time.h>
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include "../lock/locker.h"
+
+class log_file {
+public:
+    log_file();
+    ~log_file();
+
+    // dir 为目录（以 '/' 结尾，可为空），name 为文件名；
+    // 每段最大行数、最大字节数（0 为不限）、是否压缩旧分段、最多保留的文件数和总字节数（0 为不限）
+    bool init(const char *dir, const char *name, int split_lines, long long split_bytes,
+        bool compress, int keep_files, long long keep_bytes);
+
+    // 写入 lines 行、bytes 字节之前调用，返回 true 表示切换到了新文件
+    bool rotate(time_t now, long long lines, size_t bytes);
+
+    int fd() const { return m_fd; }
+    // 当前文件的字节数
+    long long size() const { return m_bytes; }
+
+private:
+    // 旧分段或未使用的预先打开的文件，交给维护线程关闭
+    struct segment {
+        int fd;
+        std::string name;
+        bool retired;       // true 为写完的旧分段，false 为未使用的预先打开的文件
+    };
+
+    static void *worker(void *arg);
+    void run();
+    void segment_name(char *out, const struct tm &date, int seg) const;
+    bool switch_to(int seg);
+    void prepare_next();
+    void release(const segment &s);
+    void compress(const std::string &name);
+    bool matches(const char *file) const;
+    void retain();
+
+private:
+    std::string m_dir;
+    std::string m_name;
+    int m_split_lines;
+    long long m_split_bytes;
+    bool m_compress;
+    int m_keep_files;
+    long long m_keep_bytes;
+
+    /* 只由写文件的线程访问 */
+    int m_fd;
+    std::string m_path;     // 当前文件
+    long long m_lines;      // 当前分段的行数
+    long long m_bytes;      // 当前分段的字节数
+    int m_segment;          // 当前分段的序号
+    int m_today;            // 当前分段的日期
+    time_t m_sec;           // m_tm 对应的秒
+    struct tm m_tm;
+    std::string m_want;     // 最近一次请求预先打开的文件
+
+    /* 与维护线程共享，受 m_lock 保护 */
+    locker m_lock;
+    cond m_cond;
+    std::string m_open;             // 请求预先打开的文件
+    int m_next_fd;                  // 已预先打开的文件
+    std::string m_next;
+    std::vector<segment> m_pending; // 待关闭的文件
+    std::string m_current;          // 当前文件，清理时跳过
+    bool m_stop;
+
+    pthread_t m_tid;
+    bool m_started;
+};
+
+#endif
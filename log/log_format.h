@@ -0,0 +1,130 @@
+/**二进制日志格式
+ * 二进制模式下，请求线程不再格式化日志：每个调用点的格式字符串只注册一次，得到固定编号，
+ * 之后每条日志只记录编号、时钟计数和原始参数，由离线工具 logdecode 还原为文本格式
+ *
+ * 文件由以下记录依次组成（本机字节序，不对齐）：
+ * - 'H' 会话头：魔数、版本、时钟频率、时钟锚点，每次打开文件时写入，解码器遇到后清空格式表
+ * - 'A' 时钟锚点：时钟计数与墙上时间的对应关系，写入线程每轮写入前更新
+ * - 'F' 格式定义：编号、级别、格式字符串，在第一条引用它的日志之前写入
+ * - 'L' 日志：编号、时钟计数、参数长度、参数
+ * 参数以类型标签开头：'i' 有符号整数 8B，'u' 无符号整数 8B，'d' 浮点数 8B，
+ * 'p' 指针 8B，'s' 字符串 [长度 2B][内容]
+ */
+
+#ifndef LOG_FORMAT_H
+#define LOG_FORMAT_H
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define LOG_BIN_MAGIC "WSLOGBIN"
+#define LOG_BIN_VERSION 1
+
+#pragma pack(push, 1)
+struct log_session_rec {
+    char type;                  // 'H'
+    char magic[8];
+    uint32_t version;
+    double ticks_per_ns;        // 时钟频率
+    uint64_t tsc;               // 锚点：时钟计数
+    uint64_t ns;                // 锚点：墙上时间（纳秒）
+};
+
+struct log_anchor_rec {
+    char type;                  // 'A'
+    uint64_t tsc;
+    uint64_t ns;
+};
+
+struct log_format_rec {
+    char type;                  // 'F'
+    uint32_t id;
+    uint8_t level;
+    uint16_t len;               // 其后格式字符串的长度
+};
+
+struct log_entry_rec {
+    char type;                  // 'L'
+    uint32_t id;
+    uint64_t tsc;
+    uint16_t len;               // 其后参数的长度
+};
+#pragma pack(pop)
+
+// 读取时钟计数：x86 上为 TSC，其他平台为单调时钟的纳秒数
+inline uint64_t log_clock()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+/* 参数编码，空间不足时返回 false，字符串截断到剩余空间 */
+inline bool log_put_raw(char *&p, char *end, char tag, const void *v)
+{
+    if(end - p < 9) {
+        return false;
+    }
+    *p++ = tag;
+    memcpy(p, v, 8);
+    p += 8;
+    return true;
+}
+
+inline bool log_put(char *&p, char *end, long long v) { return log_put_raw(p, end, 'i', &v); }
+inline bool log_put(char *&p, char *end, unsigned long long v) { return log_put_raw(p, end, 'u', &v); }
+inline bool log_put(char *&p, char *end, int v) { return log_put(p, end, (long long)v); }
+inline bool log_put(char *&p, char *end, long v) { return log_put(p, end, (long long)v); }
+inline bool log_put(char *&p, char *end, short v) { return log_put(p, end, (long long)v); }
+inline bool log_put(char *&p, char *end, char v) { return log_put(p, end, (long long)v); }
+inline bool log_put(char *&p, char *end, signed char v) { return log_put(p, end, (long long)v); }
+inline bool log_put(char *&p, char *end, bool v) { return log_put(p, end, (long long)v); }
+inline bool log_put(char *&p, char *end, unsigned int v) { return log_put(p, end, (unsigned long long)v); }
+inline bool log_put(char *&p, char *end, unsigned long v) { return log_put(p, end, (unsigned long long)v); }
+inline bool log_put(char *&p, char *end, unsigned short v) { return log_put(p, end, (unsigned long long)v); }
+inline bool log_put(char *&p, char *end, unsigned char v) { return log_put(p, end, (unsigned long long)v); }
+inline bool log_put(char *&p, char *end, double v) { return log_put_raw(p, end, 'd', &v); }
+inline bool log_put(char *&p, char *end, float v) { return log_put(p, end, (double)v); }
+inline bool log_put(char *&p, char *end, const void *v)
+{
+    uint64_t u = (uint64_t)(uintptr_t)v;
+    return log_put_raw(p, end, 'p', &u);
+}
+inline bool log_put(char *&p, char *end, const char *s)
+{
+    if(end - p < 3) {
+        return false;
+    }
+    size_t len = s ? strlen(s) : 0;
+    if(len > (size_t)(end - p - 3)) {
+        len = end - p - 3;
+    }
+    if(len > 65535) {
+        len = 65535;
+    }
+    uint16_t n = len;
+    *p++ = 's';
+    memcpy(p, &n, 2);
+    memcpy(p + 2, s, len);
+    p += 2 + len;
+    return true;
+}
+inline bool log_put(char *&p, char *end, char *s) { return log_put(p, end, (const char *)s); }
+
+inline bool log_put_args(char *& /*p*/, char * /*end*/) { return true; }
+
+template <typename T, typename... Rest>
+inline bool log_put_args(char *&p, char *end, T v, Rest... rest)
+{
+    return log_put(p, end, v) && log_put_args(p, end, rest...);
+}
+
+#endif
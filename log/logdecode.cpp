@@ -0,0 +1,407 @@
+/**二进制日志解码工具
+ * 将二进制模式写出的日志文件还原为文本日志的格式：
+ * "YYYY-MM-DD HH:MM:SS.uuuuuu [级别]:内容"
+ * 二进制访问日志（以 "WSACCESS" 开头）还原为与 TSV 模式相同的表头和各行
+ * 用法：./logdecode 日志文件... ，结果输出到标准输出
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <vector>
+
+#include "log_format.h"
+#include "access_log.h"
+
+static const char *level_tag(int level)
+{
+    switch (level)
+    {
+    case 0:
+        return "[debug]:";
+    case 1:
+        return "[info]:";
+    case 2:
+        return "[warn]:";
+    case 3:
+        return "[erro]:";
+    default:
+        return "[info]:";
+    }
+}
+
+// 解析后的一个参数
+struct log_arg {
+    char tag;
+    int64_t i;
+    uint64_t u;
+    double d;
+    std::string s;
+};
+
+struct log_format {
+    int level;
+    std::string format;
+    bool valid;
+    log_format() : level(1), valid(false) {}
+};
+
+// 当前会话的时钟锚点
+struct log_clock_state {
+    double ticks_per_ns;
+    uint64_t tsc;
+    uint64_t ns;
+};
+
+static bool parse_args(const char *p, size_t len, std::vector<log_arg> &args)
+{
+    const char *end = p + len;
+    while(p < end) {
+        log_arg a;
+        a.tag = *p++;
+        a.i = 0;
+        a.u = 0;
+        a.d = 0;
+        if(a.tag == 's') {
+            uint16_t n;
+            if(end - p < 2) {
+                return false;
+            }
+            memcpy(&n, p, 2);
+            p += 2;
+            if(end - p < n) {
+                return false;
+            }
+            a.s.assign(p, n);
+            p += n;
+        }
+        else {
+            if(end - p < 8) {
+                return false;
+            }
+            memcpy(&a.u, p, 8);
+            memcpy(&a.i, p, 8);
+            memcpy(&a.d, p, 8);
+            p += 8;
+        }
+        args.push_back(a);
+    }
+    return true;
+}
+
+template <typename T>
+static void append_format(std::string &out, const std::string &spec, T value)
+{
+    char buf[256];
+    int n = snprintf(buf, sizeof(buf), spec.c_str(), value);
+    if(n < 0) {
+        return;
+    }
+    if((size_t)n < sizeof(buf)) {
+        out.append(buf, n);
+        return;
+    }
+    std::vector<char> big(n + 1);
+    snprintf(&big[0], big.size(), spec.c_str(), value);
+    out.append(&big[0], n);
+}
+
+// 取下一个整数参数，用于 '*' 宽度和精度
+static bool next_int(const std::vector<log_arg> &args, size_t &k, long long *v)
+{
+    if(k >= args.size() || (args[k].tag != 'i' && args[k].tag != 'u')) {
+        return false;
+    }
+    *v = args[k++].i;
+    return true;
+}
+
+// 按 printf 的规则用参数展开格式字符串，参数缺失或类型不符时输出 <?>
+static void format_entry(std::string &out, const std::string &format, const std::vector<log_arg> &args)
+{
+    const char *f = format.c_str();
+    size_t k = 0;
+    while(*f) {
+        if(*f != '%') {
+            out += *f++;
+            continue;
+        }
+        const char *start = f++;
+        if(*f == '%') {
+            out += '%';
+            ++f;
+            continue;
+        }
+
+        // 标志、宽度、精度，'*' 替换为对应的参数
+        std::string spec = "%";
+        bool bad = false;
+        while(*f && strchr("-+ #0'", *f)) {
+            spec += *f++;
+        }
+        if(*f == '*') {
+            long long w = 0;
+            bad |= !next_int(args, k, &w);
+            spec += std::to_string(w);
+            ++f;
+        }
+        while(*f >= '0' && *f <= '9') {
+            spec += *f++;
+        }
+        if(*f == '.') {
+            spec += *f++;
+            if(*f == '*') {
+                long long w = 0;
+                bad |= !next_int(args, k, &w);
+                spec += std::to_string(w);
+                ++f;
+            }
+            while(*f >= '0' && *f <= '9') {
+                spec += *f++;
+            }
+        }
+        // 长度修饰符由参数的实际类型决定，这里跳过
+        while(*f && strchr("hlLqjzt", *f)) {
+            ++f;
+        }
+        char conv = *f;
+        if(conv == '\0') {
+            out.append(start);
+            break;
+        }
+        ++f;
+
+        if(conv == 'n') {
+            continue;
+        }
+        if(!strchr("diouxXcfFeEgGaAsp", conv)) {
+            out.append(start, f - start);
+            continue;
+        }
+        if(bad || k >= args.size()) {
+            out += "<?>";
+            continue;
+        }
+        const log_arg &a = args[k++];
+        switch (conv)
+        {
+        case 'd':
+        case 'i':
+            if(a.tag != 'i' && a.tag != 'u') {
+                out += "<?>";
+                break;
+            }
+            append_format(out, spec + "lld", (long long)a.i);
+            break;
+        case 'o':
+        case 'u':
+        case 'x':
+        case 'X':
+            if(a.tag != 'i' && a.tag != 'u') {
+                out += "<?>";
+                break;
+            }
+            append_format(out, spec + "ll" + conv, (unsigned long long)a.u);
+            break;
+        case 'c':
+            if(a.tag != 'i' && a.tag != 'u') {
+                out += "<?>";
+                break;
+            }
+            append_format(out, spec + "c", (int)a.i);
+            break;
+        case 's':
+            if(a.tag != 's') {
+                out += "<?>";
+                break;
+            }
+            append_format(out, spec + "s", a.s.c_str());
+            break;
+        case 'p':
+            if(a.tag != 'p') {
+                out += "<?>";
+                break;
+            }
+            append_format(out, spec + "p", (void *)(uintptr_t)a.u);
+            break;
+        default:
+            if(a.tag != 'd') {
+                out += "<?>";
+                break;
+            }
+            append_format(out, spec + conv, a.d);
+            break;
+        }
+    }
+}
+
+// 将时钟计数换算为墙上时间，按文本日志的格式输出时间前缀
+static void format_time(std::string &out, const log_clock_state &c, uint64_t tsc)
+{
+    double delta = ((double)(int64_t)(tsc - c.tsc)) / c.ticks_per_ns;
+    uint64_t ns = c.ns + (int64_t)delta;
+    time_t sec = ns / 1000000000ULL;
+    struct tm my_tm;
+    localtime_r(&sec, &my_tm);
+    char buf[64];
+    int n = snprintf(buf, sizeof(buf), "%d-%02d-%02d %02d:%02d:%02d.%06ld ",
+        my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday,
+        my_tm.tm_hour, my_tm.tm_min, my_tm.tm_sec, (long)(ns % 1000000000ULL / 1000));
+    out.append(buf, n);
+}
+
+static bool read_exact(FILE *fp, void *buf, size_t len)
+{
+    return len == 0 || fread(buf, 1, len, fp) == len;
+}
+
+// 访问日志：魔数之后是连续的 access_rec + 路径
+static int decode_access(FILE *fp, const char *path)
+{
+    std::string out = access_tsv_header();
+    std::vector<char> buf;
+    access_rec rec;
+    int ret = 0;
+    while(fread(&rec, 1, sizeof(rec), fp) == sizeof(rec)) {
+        buf.resize(rec.path_len + 1);
+        if(!read_exact(fp, &buf[0], rec.path_len)) {
+            fprintf(stderr, "logdecode: %s: truncated record\n", path);
+            ret = 1;
+            break;
+        }
+        access_format_tsv(out, rec, &buf[0]);
+        if(out.size() >= 65536) {
+            fwrite(out.data(), 1, out.size(), stdout);
+            out.clear();
+        }
+    }
+    fwrite(out.data(), 1, out.size(), stdout);
+    fclose(fp);
+    return ret;
+}
+
+static int decode(const char *path)
+{
+    FILE *fp = fopen(path, "rb");
+    if(!fp) {
+        fprintf(stderr, "logdecode: cannot open %s\n", path);
+        return 1;
+    }
+
+    char magic[sizeof(ACCESS_LOG_MAGIC) - 1];
+    if(fread(magic, 1, sizeof(magic), fp) == sizeof(magic) && memcmp(magic, ACCESS_LOG_MAGIC, sizeof(magic)) == 0) {
+        return decode_access(fp, path);
+    }
+    rewind(fp);
+
+    std::vector<log_format> formats;
+    log_clock_state clock = {1.0, 0, 0};
+    bool session = false;
+    std::string out;
+    std::vector<char> payload;
+    std::vector<log_arg> args;
+    int ret = 0;
+    int type;
+    while((type = fgetc(fp)) != EOF) {
+        bool ok = true;
+        if(type == 'H') {
+            log_session_rec rec;
+            ok = read_exact(fp, (char *)&rec + 1, sizeof(rec) - 1);
+            if(ok && (memcmp(rec.magic, LOG_BIN_MAGIC, sizeof(rec.magic)) != 0 || rec.version != LOG_BIN_VERSION)) {
+                fprintf(stderr, "logdecode: %s: unsupported format\n", path);
+                ret = 1;
+                break;
+            }
+            // 新的会话，格式编号重新分配
+            formats.clear();
+            clock.ticks_per_ns = rec.ticks_per_ns > 0 ? rec.ticks_per_ns : 1.0;
+            clock.tsc = rec.tsc;
+            clock.ns = rec.ns;
+            session = true;
+        }
+        else if(!session) {
+            fprintf(stderr, "logdecode: %s: not a binary log\n", path);
+            ret = 1;
+            break;
+        }
+        else if(type == 'A') {
+            log_anchor_rec rec;
+            ok = read_exact(fp, (char *)&rec + 1, sizeof(rec) - 1);
+            if(ok) {
+                clock.tsc = rec.tsc;
+                clock.ns = rec.ns;
+            }
+        }
+        else if(type == 'F') {
+            log_format_rec rec;
+            ok = read_exact(fp, (char *)&rec + 1, sizeof(rec) - 1);
+            if(ok) {
+                std::string format(rec.len, '\0');
+                ok = read_exact(fp, &format[0], rec.len);
+                if(rec.id >= (1u << 20)) {
+                    fprintf(stderr, "logdecode: %s: bad format id %u\n", path, rec.id);
+                    ret = 1;
+                    break;
+                }
+                if(formats.size() <= rec.id) {
+                    formats.resize(rec.id + 1);
+                }
+                formats[rec.id].level = rec.level;
+                formats[rec.id].format.swap(format);
+                formats[rec.id].valid = true;
+            }
+        }
+        else if(type == 'L') {
+            log_entry_rec rec;
+            ok = read_exact(fp, (char *)&rec + 1, sizeof(rec) - 1);
+            if(ok) {
+                payload.resize(rec.len);
+                ok = read_exact(fp, payload.data(), rec.len);
+            }
+            if(ok) {
+                out.clear();
+                args.clear();
+                format_time(out, clock, rec.tsc);
+                if(rec.id < formats.size() && formats[rec.id].valid) {
+                    out += level_tag(formats[rec.id].level);
+                    if(!parse_args(payload.data(), payload.size(), args)) {
+                        out += "<bad arguments> ";
+                    }
+                    format_entry(out, formats[rec.id].format, args);
+                }
+                else {
+                    out += "[info]:<unknown format " + std::to_string(rec.id) + ">";
+                }
+                out += '\n';
+                fwrite(out.data(), 1, out.size(), stdout);
+            }
+        }
+        else {
+            fprintf(stderr, "logdecode: %s: bad record type 0x%02x at offset %ld\n", path, type, ftell(fp) - 1);
+            ret = 1;
+            break;
+        }
+        if(!ok) {
+            // 进程退出前未写完的最后一条记录
+            fprintf(stderr, "logdecode: %s: truncated record at end of file\n", path);
+            break;
+        }
+    }
+    fclose(fp);
+    return ret;
+}
+
+int main(int argc, char *argv[])
+{
+    if(argc < 2) {
+        fprintf(stderr, "usage: %s binary_log...\n", argv[0]);
+        return 2;
+    }
+    int ret = 0;
+    for(int i = 1; i < argc; ++i) {
+        ret |= decode(argv[i]);
+    }
+    return ret;
+}
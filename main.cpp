@@ -1,35 +1,158 @@
 #include "webserver.h"
 
+// 读取环境变量，未设置时使用默认值
+static std::string getenv_or(const char *name, const char *def)
+{
+    const char *value = getenv(name);
+    return value ? value : def;
+}
 
 int main(int argc, char *argv[])
 {
-    /* 数据库信息，必须修改！！！*/
-    std::string user = "JIN";           // 数据库登录用户名
-    std::string password = "123456";    // 数据库登录密码
-    std::string dbname = "webserv";     // 使用的数据库名称
+    server_config config;
+
+    /* 数据库信息，从环境变量读取，不再写在代码中 */
+    config.db_host = getenv_or("WEBSERV_DB_HOST", "localhost");             // 数据库主机地址
+    config.db_port = atoi(getenv_or("WEBSERV_DB_PORT", "3306").c_str());    // 数据库端口号
+    config.user = getenv_or("WEBSERV_DB_USER", "root");                     // 数据库登录用户名
+    config.password = getenv_or("WEBSERV_DB_PASSWORD", "");                 // 数据库登录密码
+    config.dbname = getenv_or("WEBSERV_DB_NAME", "webserv");                // 使用的数据库名称
 
     /* 默认设置 */
-    int port = 9190;    // 默认端口9190
-    int thread_num = 8; // 默认线程池线程数量8
-    int close_log = 0;  // 默认开启日志
-    int sql_num = 8;    // 默认数据库连接池数量8       
+    config.port = 9190;                 // 默认端口9190
+    config.thread_num = 8;              // 默认线程池线程数量8
+    config.close_log = 0;               // 默认开启日志
+    config.log_binary = 0;              // 默认写文本日志
+    config.log_level = 0;               // 默认输出所有级别的日志
+    config.log_overflow = "droplow";    // 默认日志缓冲区满时先丢弃 debug、info
+    config.log_split_mb = 0;            // 默认日志文件只按天和行数切分
+    config.log_compress = 0;            // 默认不压缩旧日志文件
+    config.log_keep = "0";              // 默认保留所有日志文件
+    config.access = 0;                  // 默认关闭访问日志
+    config.expose = 1;                  // 默认只向本机提供 /metrics
+    config.trace = "0";                 // 默认关闭请求追踪
+    config.stall_ms = 100;              // 默认事件循环一轮超过100ms时记录调用栈
+    config.profile_hz = 0;              // 默认关闭 CPU 分析器
+    config.tcp_sample_ms = 0;           // 默认不采样 TCP_INFO
+    config.notsent_lowat = 0;           // 默认使用系统的 TCP_NOTSENT_LOWAT
+    config.ip_conn_cap = 0;             // 默认不限制单 IP 的连接数
+    config.io = "epoll";                // 默认使用 epoll 处理连接 I/O
+    config.sql_num = 8;                 // 默认数据库连接池最大连接数量8
+    config.sql_min = 2;                 // 默认数据库连接池最小连接数量2
+    config.async_num = 4;               // 默认非阻塞数据库连接数量4，0为关闭
+    config.batch_num = 64;              // 默认注册组提交每批最多64行，0为关闭
+    config.load_num = 4;                // 默认启动时4个线程并行加载用户表
+    config.snapshot = "";               // 默认不使用用户表快照
+#ifdef USE_MYSQL
+    config.storage = "mysql";           // 默认使用 MySQL 存储用户
+#else
+    config.storage = "memory";          // 没有 MySQL 客户端库时默认使用内存存储
+#endif
 
     /* 解析命令行参数，自定义配置信息 */
     int opt;
-    const char *str = "p:t:c:";
+    const char *str = "p:t:c:g:v:o:r:z:k:x:e:q:w:i:n:u:j:y:s:m:a:b:l:f:d:";
     while((opt = getopt(argc, argv, str)) != -1) {
         switch (opt)
         {
         case 'p': {
-            port = atoi(optarg);
+            config.port = atoi(optarg);
             break;
         }
         case 't': {
-            thread_num = atoi(optarg);
+            config.thread_num = atoi(optarg);
             break;
         }
         case 'c': {
-            close_log = atoi(optarg);
+            config.close_log = atoi(optarg);
+            break;
+        }
+        case 'g': {
+            config.log_binary = atoi(optarg);
+            break;
+        }
+        case 'v': {
+            config.log_level = atoi(optarg);
+            break;
+        }
+        case 'o': {
+            config.log_overflow = optarg;
+            break;
+        }
+        case 'r': {
+            config.log_split_mb = atoi(optarg);
+            break;
+        }
+        case 'z': {
+            config.log_compress = atoi(optarg);
+            break;
+        }
+        case 'k': {
+            config.log_keep = optarg;
+            break;
+        }
+        case 'x': {
+            config.access = atoi(optarg);
+            break;
+        }
+        case 'e': {
+            config.expose = atoi(optarg);
+            break;
+        }
+        case 'q': {
+            config.trace = optarg;
+            break;
+        }
+        case 'w': {
+            config.stall_ms = atoi(optarg);
+            break;
+        }
+        case 'i': {
+            config.profile_hz = atoi(optarg);
+            break;
+        }
+        case 'n': {
+            config.tcp_sample_ms = atoi(optarg);
+            break;
+        }
+        case 'u': {
+            config.notsent_lowat = atoi(optarg);
+            break;
+        }
+        case 'j': {
+            config.ip_conn_cap = atoi(optarg);
+            break;
+        }
+        case 'y': {
+            config.io = optarg;
+            break;
+        }
+        case 's': {
+            config.sql_num = atoi(optarg);
+            break;
+        }
+        case 'm': {
+            config.sql_min = atoi(optarg);
+            break;
+        }
+        case 'a': {
+            config.async_num = atoi(optarg);
+            break;
+        }
+        case 'b': {
+            config.batch_num = atoi(optarg);
+            break;
+        }
+        case 'l': {
+            config.load_num = atoi(optarg);
+            break;
+        }
+        case 'f': {
+            config.snapshot = optarg;
+            break;
+        }
+        case 'd': {
+            config.storage = optarg;
             break;
         }
         default:
@@ -41,13 +164,13 @@ int main(int argc, char *argv[])
     WebServer server;
      
     // 初始化
-    server.init(port, thread_num, close_log, sql_num, user, password, dbname);
+    server.init(config);
     
     // 日志 
     server.log_write(); 
 
-    // 数据库
-    server.sql_pool();
+    // 凭据存储
+    server.user_store();
     
     // 线程池
     server.thread_pool();
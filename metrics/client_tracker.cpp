@@ -0,0 +1,219 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <algorithm>
+
+#include "client_tracker.h"
+
+static void append(std::string &out, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+static void append(std::string &out, const char *format, ...)
+{
+    char buf[512];
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    if(n > 0) {
+        out.append(buf, n < (int)sizeof(buf) ? n : sizeof(buf) - 1);
+    }
+}
+
+static uint64_t splitmix64(uint64_t &state)
+{
+    uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+template <typename T>
+count_min<T>::count_min()
+{
+    memset(m_seeds, 0, sizeof(m_seeds));
+    memset(m_rows, 0, sizeof(m_rows));
+}
+
+template <typename T>
+void count_min<T>::seed(uint64_t seed)
+{
+    for(int i = 0; i < DEPTH; ++i) {
+        m_seeds[i] = splitmix64(seed);
+    }
+}
+
+template <typename T>
+T count_min<T>::add(uint32_t key, T n)
+{
+    T min = 0;
+    for(int i = 0; i < DEPTH; ++i) {
+        T &c = m_rows[i][index(i, key)];
+        c += n;
+        if(i == 0 || c < min) {
+            min = c;
+        }
+    }
+    return min;
+}
+
+template <typename T>
+void count_min<T>::sub(uint32_t key, T n)
+{
+    for(int i = 0; i < DEPTH; ++i) {
+        T &c = m_rows[i][index(i, key)];
+        c = c > n ? c - n : 0;
+    }
+}
+
+template <typename T>
+T count_min<T>::estimate(uint32_t key) const
+{
+    T min = m_rows[0][index(0, key)];
+    for(int i = 1; i < DEPTH; ++i) {
+        T c = m_rows[i][index(i, key)];
+        if(c < min) {
+            min = c;
+        }
+    }
+    return min;
+}
+
+template <typename T>
+void count_min<T>::halve()
+{
+    for(int i = 0; i < DEPTH; ++i) {
+        for(int j = 0; j < WIDTH; ++j) {
+            m_rows[i][j] >>= 1;
+        }
+    }
+}
+
+template class count_min<uint32_t>;
+template class count_min<uint64_t>;
+
+client_tracker::client_tracker() : m_conn_cap(0), m_decayed(time(NULL)), m_lock("client_tracker")
+{
+    // 哈希种子每次启动不同，客户端无法构造固定碰撞的地址
+    uint64_t seed = ((uint64_t)time(NULL) * 1000003) ^ ((uint64_t)getpid() << 32) ^ (uint64_t)(uintptr_t)this;
+    m_active.seed(splitmix64(seed));
+    for(int m = 0; m < HH_NUM; ++m) {
+        m_sketch[m].seed(splitmix64(seed));
+        m_top_count[m] = 0;
+    }
+}
+
+void client_tracker::init(int conn_cap)
+{
+    m_conn_cap = conn_cap > 0 ? conn_cap : 0;
+}
+
+bool client_tracker::on_accept(uint32_t ip)
+{
+    m_lock.lock();
+    update(HH_CONNS, ip, 1);
+    if(m_conn_cap > 0 && m_active.estimate(ip) >= (uint32_t)m_conn_cap) {
+        m_lock.unlock();
+        return false;
+    }
+    m_active.add(ip, 1);
+    m_lock.unlock();
+    return true;
+}
+
+void client_tracker::on_close(uint32_t ip)
+{
+    m_lock.lock();
+    m_active.sub(ip, 1);
+    m_lock.unlock();
+}
+
+void client_tracker::on_request(uint32_t ip, uint64_t bytes)
+{
+    m_lock.lock();
+    update(HH_REQUESTS, ip, 1);
+    if(bytes > 0) {
+        update(HH_BYTES, ip, bytes);
+    }
+    m_lock.unlock();
+}
+
+void client_tracker::update(int metric, uint32_t ip, uint64_t n)
+{
+    uint64_t count = m_sketch[metric].add(ip, n);
+    hitter *top = m_top[metric];
+    int &size = m_top_count[metric];
+
+    int min = 0;
+    for(int i = 0; i < size; ++i) {
+        if(top[i].ip == ip) {
+            top[i].count = count;
+            return;
+        }
+        if(top[i].count < top[min].count) {
+            min = i;
+        }
+    }
+    if(size < TOP_K) {
+        top[size].ip = ip;
+        top[size].count = count;
+        ++size;
+    }
+    else if(count > top[min].count) {
+        top[min].ip = ip;
+        top[min].count = count;
+    }
+}
+
+void client_tracker::tick(time_t now)
+{
+    if(now - m_decayed < DECAY_SECONDS) {
+        return;
+    }
+    m_decayed = now;
+    m_lock.lock();
+    for(int m = 0; m < HH_NUM; ++m) {
+        m_sketch[m].halve();
+        for(int i = 0; i < m_top_count[m]; ++i) {
+            m_top[m][i].count >>= 1;
+        }
+    }
+    m_lock.unlock();
+}
+
+static bool by_count(const std::pair<uint64_t, uint32_t> &a, const std::pair<uint64_t, uint32_t> &b)
+{
+    return a.first > b.first;
+}
+
+void client_tracker::render(std::string &out)
+{
+    static const char *names[HH_NUM] = {"connections", "requests", "bytes"};
+
+    append(out, "# top clients, count-min estimates (upper bounds) halved every %ds", DECAY_SECONDS);
+    if(m_conn_cap > 0) {
+        append(out, ", per-IP connection cap %d", m_conn_cap);
+    }
+    out += "\n";
+    m_lock.lock();
+    for(int m = 0; m < HH_NUM; ++m) {
+        std::pair<uint64_t, uint32_t> order[TOP_K];
+        for(int i = 0; i < m_top_count[m]; ++i) {
+            // 列表中的计数只在该 IP 出现时更新，输出时取 sketch 中的最新估计
+            order[i] = std::make_pair(m_sketch[m].estimate(m_top[m][i].ip), m_top[m][i].ip);
+        }
+        std::sort(order, order + m_top_count[m], by_count);
+
+        append(out, "\n%-16s %16s %10s\n", names[m], "count", "active");
+        for(int i = 0; i < m_top_count[m]; ++i) {
+            char ip[INET_ADDRSTRLEN];
+            struct in_addr in;
+            in.s_addr = order[i].second;
+            inet_ntop(AF_INET, &in, ip, sizeof(ip));
+            append(out, "%-16s %16llu %10u\n", ip, (unsigned long long)order[i].first,
+                m_active.estimate(order[i].second));
+        }
+    }
+    m_lock.unlock();
+}
@@ -0,0 +1,101 @@
+/**按客户端 IP 统计的热点（heavy hitter）
+ * 内存固定，与客户端数量无关：
+ * - 每项指标（连接数、请求数、发送字节数）一个 count-min sketch，估计值只会偏大，
+ *   旁边保留估计值最大的 TOP_K 个 IP；每分钟减半，反映最近几分钟的热点
+ * - 当前连接数也用一个 count-min sketch 计数（接受时加、关闭时减），
+ *   设置单 IP 连接上限时在 accept 后检查，估计值偏大只会让上限提前生效
+ * accept、定时器关闭连接在主线程中，长连接的响应可能由工作线程直接发送（先写），更新时加锁
+ */
+
+#ifndef CLIENT_TRACKER_H
+#define CLIENT_TRACKER_H
+
+#include <stdint.h>
+#include <time.h>
+#include <string>
+
+#include "../lock/locker.h"
+
+// 固定大小的 count-min sketch，DEPTH 行、每行 WIDTH 个计数器，每行使用不同的哈希
+template <typename T>
+class count_min {
+public:
+    static const int DEPTH = 4;
+    static const int WIDTH_BITS = 12;
+    static const int WIDTH = 1 << WIDTH_BITS;
+
+    count_min();
+
+    void seed(uint64_t seed);
+    T add(uint32_t key, T n);
+    void sub(uint32_t key, T n);
+    T estimate(uint32_t key) const;
+    void halve();
+
+private:
+    uint32_t index(int row, uint32_t key) const
+    {
+        return (uint32_t)(((key ^ m_seeds[row]) * 0x9E3779B97F4A7C15ULL) >> (64 - WIDTH_BITS));
+    }
+
+private:
+    uint64_t m_seeds[DEPTH];
+    T m_rows[DEPTH][WIDTH];
+};
+
+class client_tracker {
+public:
+    static const int TOP_K = 16;
+    static const int DECAY_SECONDS = 60;
+
+    // 统计的指标
+    enum HH_METRIC
+    {
+        HH_CONNS = 0,   // 接受的连接
+        HH_REQUESTS,    // 完成的请求
+        HH_BYTES,       // 发送的字节
+        HH_NUM
+    };
+
+    static client_tracker *get_instance()
+    {
+        static client_tracker instance;
+        return &instance;
+    }
+
+    // 单 IP 的最大并发连接数，0 为不限制
+    void init(int conn_cap);
+
+    // 接受连接后调用，超过单 IP 连接上限时返回 false，此时不计入当前连接数
+    bool on_accept(uint32_t ip);
+    // 关闭连接时调用，与成功的 on_accept 成对
+    void on_close(uint32_t ip);
+    // 一个请求的响应结束
+    void on_request(uint32_t ip, uint64_t bytes);
+    // 定时器周期调用，每 DECAY_SECONDS 秒将计数减半
+    void tick(time_t now);
+
+    // 输出各项指标的热点 IP
+    void render(std::string &out);
+
+private:
+    struct hitter {
+        uint32_t ip;
+        uint64_t count;
+    };
+
+    client_tracker();
+
+    void update(int metric, uint32_t ip, uint64_t n);
+
+private:
+    int m_conn_cap;
+    time_t m_decayed;                       // 上次减半的时间
+    count_min<uint32_t> m_active;           // 当前连接数
+    count_min<uint64_t> m_sketch[HH_NUM];
+    hitter m_top[HH_NUM][TOP_K];            // 无序，满时替换最小的一项
+    int m_top_count[HH_NUM];
+    locker m_lock;
+};
+
+#endif
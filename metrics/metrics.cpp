@@ -0,0 +1,209 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <arpa/inet.h>
+
+#include "metrics.h"
+
+// 计数器的名称、说明，按状态码分类的响应共用一个名称
+static const struct {
+    const char *name;
+    const char *label;
+    const char *help;
+} counter_info[M_COUNTER_NUM] = {
+    {"webserver_accepts_total", NULL, "Accepted connections."},
+    {"webserver_accept_errors_total", NULL, "Failed accept calls."},
+    {"webserver_rejected_connections_total", NULL, "Connections rejected because the server is full."},
+    {"webserver_responses_total", "code=\"2xx\"", "Responses by status class."},
+    {"webserver_responses_total", "code=\"4xx\"", NULL},
+    {"webserver_responses_total", "code=\"5xx\"", NULL},
+    {"webserver_write_errors_total", NULL, "Responses aborted by a write error."},
+    {"webserver_sent_bytes_total", NULL, "Bytes of responses sent."},
+    {"webserver_loop_stalls_total", NULL, "Event loop iterations longer than the stall threshold."},
+    {"webserver_write_stalls_total", NULL, "Response writes that found the socket send buffer full."},
+    {"webserver_tcp_retransmits_total", NULL, "Retransmitted segments seen on sampled connections."},
+    {"webserver_ip_rejected_connections_total", NULL, "Connections rejected by the per-IP connection cap."},
+    {"webserver_uring_submitted_total", NULL, "Requests submitted to the io_uring backend."},
+    {"webserver_uring_completions_total", NULL, "Completions reaped from the io_uring backend."},
+    {"webserver_syscalls_total", "call=\"epoll_wait\"", "System calls made by the event loop and on connections, by call."},
+    {"webserver_syscalls_total", "call=\"epoll_ctl\"", NULL},
+    {"webserver_syscalls_total", "call=\"io_uring_enter\"", NULL},
+    {"webserver_syscalls_total", "call=\"accept\"", NULL},
+    {"webserver_syscalls_total", "call=\"getpeername\"", NULL},
+    {"webserver_syscalls_total", "call=\"recv\"", NULL},
+    {"webserver_syscalls_total", "call=\"writev\"", NULL},
+    {"webserver_syscalls_total", "call=\"eventfd\"", NULL},
+    {"webserver_syscalls_total", "call=\"shutdown\"", NULL},
+    {"webserver_syscalls_total", "call=\"close\"", NULL},
+};
+
+// unit 为 NULL 时以微秒记录、以秒输出，否则输出原始值
+static const struct {
+    const char *name;
+    const char *help;
+    const char *unit;
+} hist_info[H_HIST_NUM] = {
+    {"parse", "Time a worker spends parsing and routing a request."},
+    {"queue_wait", "Time a request waits in the thread pool queue."},
+    {"db_wait", "Time waiting for a database connection."},
+    {"db_query", "Time of a credential store query or insert, submit to callback when asynchronous."},
+    {"write", "Time from a response being ready to its last byte being sent."},
+    {"request", "Time from reading a request to its last response byte being sent."},
+    {"loop_iteration", "Event loop busy time per iteration, from epoll_wait returning to the next call."},
+    {"loop_events", "Time an event loop iteration spends handling epoll events."},
+    {"loop_timers", "Time an event loop iteration spends on timers and periodic tasks."},
+    {"tcp_rtt", "Smoothed RTT of connections sampled while a response write is blocked."},
+    {"tcp_cwnd", "Congestion window of sampled connections.", "segments"},
+    {"tcp_unacked", "Unacknowledged segments of sampled connections.", "segments"},
+    {"tcp_notsent", "Bytes queued in the kernel but not yet sent on sampled connections.", "bytes"},
+    {"request", "System calls made on a connection for one request: receives, event registrations, sends.", "syscalls"},
+};
+
+// 输出的直方图边界为 2^k - 1 微秒（15us ~ 16.7s），非时间的直方图为 0 ~ 2^24 - 1。
+// 记录的是整数，不超过 2^k - 1 即小于 2^k，恰好是 bucket(2^k) 之前的桶，累计值没有误差
+static const int LE_MIN_BITS = 4;
+static const int LE_MAX_BITS = 24;
+
+static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+
+static void append(std::string &out, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+static void append(std::string &out, const char *format, ...)
+{
+    char buf[512];
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    if(n > 0) {
+        out.append(buf, n < (int)sizeof(buf) ? n : sizeof(buf) - 1);
+    }
+}
+
+void metrics_gauge(std::string &out, const char *name, const char *help, double value)
+{
+    append(out, "# HELP %s %s\n# TYPE %s gauge\n%s %.17g\n", name, help, name, name, value);
+}
+
+void metrics_counter(std::string &out, const char *name, const char *help, double value)
+{
+    append(out, "# HELP %s %s\n# TYPE %s counter\n%s %.17g\n", name, help, name, name, value);
+}
+
+void metrics_log2_histogram(std::string &out, const char *name, const char *help, const long long *buckets, int n,
+    double sum, double scale)
+{
+    append(out, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+    // 前 i + 1 个桶恰好是不超过 2^(i+1) - 1 的值
+    long long total = 0;
+    for(int i = 0; i < n; ++i) {
+        total += buckets[i];
+        if(i + 1 < n) {
+            append(out, "%s_bucket{le=\"%.9g\"} %lld\n", name, (double)((1LL << (i + 1)) - 1) * scale, total);
+        }
+    }
+    append(out, "%s_bucket{le=\"+Inf\"} %lld\n", name, total);
+    append(out, "%s_sum %.9g\n", name, sum * scale);
+    append(out, "%s_count %lld\n", name, total);
+}
+
+bool metrics::allowed(const sockaddr_in &addr) const
+{
+    if(m_expose == EXPOSE_ALL) {
+        return true;
+    }
+    return m_expose == EXPOSE_LOCAL && (ntohl(addr.sin_addr.s_addr) >> 24) == 127;
+}
+
+metrics::shard *metrics::create_shard()
+{
+    shard *s = new shard;
+    memset((void *)s, 0, sizeof(*s));
+    m_lock.lock();
+    m_shards.push_back(s);
+    m_lock.unlock();
+    return s;
+}
+
+void metrics::render(std::string &out)
+{
+    m_lock.lock();
+    std::vector<shard *> shards = m_shards;
+    m_lock.unlock();
+
+    // 汇总各线程的分片
+    std::vector<uint64_t> counters(M_COUNTER_NUM, 0);
+    std::vector<uint64_t> buckets(H_HIST_NUM * BUCKETS, 0);
+    std::vector<uint64_t> sums(H_HIST_NUM, 0);
+    for(size_t i = 0; i < shards.size(); ++i) {
+        for(int c = 0; c < M_COUNTER_NUM; ++c) {
+            counters[c] += shards[i]->counters[c].load(std::memory_order_relaxed);
+        }
+        for(int h = 0; h < H_HIST_NUM; ++h) {
+            const shard::hist &src = shards[i]->hists[h];
+            for(int b = 0; b < BUCKETS; ++b) {
+                buckets[h * BUCKETS + b] += src.buckets[b].load(std::memory_order_relaxed);
+            }
+            sums[h] += src.sum.load(std::memory_order_relaxed);
+        }
+    }
+
+    for(int c = 0; c < M_COUNTER_NUM; ++c) {
+        if(counter_info[c].help) {
+            append(out, "# HELP %s %s\n# TYPE %s counter\n", counter_info[c].name, counter_info[c].help,
+                counter_info[c].name);
+        }
+        if(counter_info[c].label) {
+            append(out, "%s{%s} %llu\n", counter_info[c].name, counter_info[c].label, (unsigned long long)counters[c]);
+        }
+        else {
+            append(out, "%s %llu\n", counter_info[c].name, (unsigned long long)counters[c]);
+        }
+    }
+
+    for(int h = 0; h < H_HIST_NUM; ++h) {
+        const uint64_t *hb = &buckets[h * BUCKETS];
+        const char *name = hist_info[h].name;
+        const char *unit = hist_info[h].unit ? hist_info[h].unit : "seconds";
+        double scale = hist_info[h].unit ? 1 : 1e-6;
+        int le_min = hist_info[h].unit ? 0 : LE_MIN_BITS;
+
+        // 累计分布，总数取各桶之和，与 _bucket{le="+Inf"} 一致
+        append(out, "# HELP webserver_%s_%s %s\n# TYPE webserver_%s_%s histogram\n", name, unit, hist_info[h].help,
+            name, unit);
+        uint64_t total = 0;
+        int b = 0;
+        for(int bits = le_min; bits <= LE_MAX_BITS; ++bits) {
+            int end = bucket(1ULL << bits);
+            for(; b < end; ++b) {
+                total += hb[b];
+            }
+            append(out, "webserver_%s_%s_bucket{le=\"%.9g\"} %llu\n", name, unit,
+                (double)((1ULL << bits) - 1) * scale, (unsigned long long)total);
+        }
+        for(; b < BUCKETS; ++b) {
+            total += hb[b];
+        }
+        append(out, "webserver_%s_%s_bucket{le=\"+Inf\"} %llu\n", name, unit, (unsigned long long)total);
+        append(out, "webserver_%s_%s_sum %.6f\n", name, unit, (double)sums[h] * scale);
+        append(out, "webserver_%s_%s_count %llu\n", name, unit, (unsigned long long)total);
+
+        // 从细分的桶计算分位数，取桶的上界
+        append(out, "# HELP webserver_%s_quantile_%s Quantiles of webserver_%s_%s from the full-resolution histogram.\n"
+            "# TYPE webserver_%s_quantile_%s gauge\n", name, unit, name, unit, name, unit);
+        for(size_t q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); ++q) {
+            uint64_t rank = (uint64_t)(quantiles[q] * total + 0.5);
+            uint64_t seen = 0;
+            uint64_t value = 0;
+            for(int i = 0; total > 0 && i < BUCKETS; ++i) {
+                seen += hb[i];
+                if(seen >= rank && seen > 0) {
+                    value = i + 1 < BUCKETS ? bucket_low(i + 1) - 1 : bucket_low(i);
+                    break;
+                }
+            }
+            append(out, "webserver_%s_quantile_%s{quantile=\"%g\"} %.6f\n", name, unit, quantiles[q],
+                (double)value * scale);
+        }
+    }
+}
@@ -0,0 +1,168 @@
+/**运行指标
+ * 计数器和延迟直方图按线程分片：
+ * - 每个线程第一次记录时分配自己的分片，之后只写自己的分片，不加锁，也不需要原子的读改写
+ *   （每个分片只有一个写者，relaxed 的读、写即可）
+ * - 读取 /metrics 时汇总所有分片，读到的是近似一致的快照
+ * 直方图为 HDR 风格的对数线性分桶：延迟以微秒计（TCP 窗口、字节数等记录原始值），小于 16 的值各占一个桶，
+ * 之后每个 2 的幂区间再等分为 8 个子桶，相对误差不超过 12.5%，最大约 70 分钟
+ * 输出为 Prometheus 文本格式（text/plain; version=0.0.4）
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <netinet/in.h>
+#include "../lock/locker.h"
+
+// 计数器
+enum METRIC_COUNTER {
+    M_ACCEPTS = 0,      // 接受的连接
+    M_ACCEPT_ERRORS,    // accept 出错
+    M_REJECTS,          // 连接数达到上限而拒绝的连接
+    M_RESPONSES_2XX,    // 按状态码分类的响应数
+    M_RESPONSES_4XX,
+    M_RESPONSES_5XX,
+    M_WRITE_ERRORS,     // 发送响应中途出错
+    M_BYTES_SENT,       // 发送的字节数
+    M_LOOP_STALLS,      // 事件循环一轮超过卡顿阈值
+    M_WRITE_STALLS,     // 发送响应时 TCP 发送缓冲区已满（EAGAIN）
+    M_TCP_RETRANS,      // 采样到的重传段数
+    M_IP_REJECTS,       // 超过单 IP 连接上限而拒绝的连接
+    M_URING_SQES,       // io_uring 后端：提交的请求数
+    M_URING_CQES,       // 收割的完成事件数
+    M_SYS_EPOLL_WAIT,   // 以下为事件循环和连接上的系统调用次数，按类型
+    M_SYS_EPOLL_CTL,
+    M_SYS_URING_ENTER,
+    M_SYS_ACCEPT,
+    M_SYS_GETPEERNAME,
+    M_SYS_RECV,
+    M_SYS_WRITEV,
+    M_SYS_EVENTFD,
+    M_SYS_SHUTDOWN,
+    M_SYS_CLOSE,
+    M_COUNTER_NUM
+};
+
+// 延迟直方图
+enum METRIC_HIST {
+    H_PARSE = 0,        // 工作线程解析请求并定位资源
+    H_QUEUE,            // 在线程池队列中等待
+    H_DB_WAIT,          // 等待数据库连接
+    H_DB_QUERY,         // 存储的查询、插入，异步时为提交到回调
+    H_WRITE,            // 响应就绪到发送完成
+    H_REQUEST,          // 读到请求到响应发送完成
+    H_LOOP,             // 事件循环一轮：epoll_wait 返回到下一次调用
+    H_LOOP_EVENTS,      // 其中处理 epoll 事件的时间
+    H_LOOP_TIMERS,      // 其中处理定时器和周期任务的时间
+    H_TCP_RTT,          // 发送受阻连接的平滑 RTT
+    H_TCP_CWND,         // 以下为原始值：拥塞窗口（段）
+    H_TCP_UNACKED,      // 已发送未确认的段数
+    H_TCP_NOTSENT,      // 内核中尚未发送的字节数
+    H_SYSCALLS,         // 一个请求在连接上的系统调用次数（接收、注册事件、发送）
+    H_HIST_NUM
+};
+
+class metrics {
+public:
+    static const int SUB_BITS = 3;
+    static const int SUB_COUNT = 1 << SUB_BITS;
+    static const int BUCKETS = (32 - SUB_BITS + 1) * SUB_COUNT;
+
+    // /metrics 的访问范围
+    enum EXPOSE
+    {
+        EXPOSE_OFF = 0,
+        EXPOSE_LOCAL,       // 只允许本机
+        EXPOSE_ALL
+    };
+
+    static metrics *get_instance()
+    {
+        static metrics instance;
+        return &instance;
+    }
+
+    void init(int expose) { m_expose = expose; }
+
+    // 是否向该客户端提供 /metrics
+    bool allowed(const sockaddr_in &addr) const;
+
+    void add(int counter, uint64_t n = 1)
+    {
+        std::atomic<uint64_t> &c = local()->counters[counter];
+        c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    // 记录一次耗时（微秒），非时间的直方图记录原始值
+    void record(int hist, uint64_t us)
+    {
+        shard::hist &h = local()->hists[hist];
+        std::atomic<uint64_t> &b = h.buckets[bucket(us)];
+        b.store(b.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        h.sum.store(h.sum.load(std::memory_order_relaxed) + us, std::memory_order_relaxed);
+    }
+
+    // 追加所有计数器和直方图
+    void render(std::string &out);
+
+    // 值所在的桶，以及桶的下界
+    static int bucket(uint64_t v)
+    {
+        if(v < 2 * SUB_COUNT) {
+            return v;
+        }
+        int msb = 63 - __builtin_clzll(v);
+        int shift = msb - SUB_BITS;
+        int b = (shift + 1) * SUB_COUNT + (int)((v >> shift) - SUB_COUNT);
+        return b < BUCKETS ? b : BUCKETS - 1;
+    }
+    static uint64_t bucket_low(int b)
+    {
+        if(b < 2 * SUB_COUNT) {
+            return b;
+        }
+        int shift = b / SUB_COUNT - 1;
+        return (uint64_t)(b % SUB_COUNT + SUB_COUNT) << shift;
+    }
+
+private:
+    // 一个线程的指标，只由该线程写入
+    struct shard {
+        struct hist {
+            std::atomic<uint64_t> buckets[BUCKETS];
+            std::atomic<uint64_t> sum;
+        };
+        std::atomic<uint64_t> counters[M_COUNTER_NUM];
+        hist hists[H_HIST_NUM];
+    };
+
+    metrics() : m_expose(EXPOSE_LOCAL), m_lock("metrics") {}
+
+    shard *local()
+    {
+        static thread_local shard *t = NULL;
+        if(t == NULL) {
+            t = create_shard();
+        }
+        return t;
+    }
+    shard *create_shard();
+
+private:
+    int m_expose;
+    locker m_lock;                  // 保护 m_shards
+    std::vector<shard *> m_shards;  // 所有线程的分片，线程退出后保留，计数不回退
+};
+
+/* Prometheus 文本格式的辅助函数 */
+void metrics_gauge(std::string &out, const char *name, const char *help, double value);
+void metrics_counter(std::string &out, const char *name, const char *help, double value);
+// buckets[i] 统计 [2^i, 2^(i+1)) 的整数值（第 0 个桶含 0，最后一个桶没有上界），sum 和边界乘以 scale 后输出
+void metrics_log2_histogram(std::string &out, const char *name, const char *help, const long long *buckets, int n,
+    double sum, double scale);
+
+#endif
@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <linux/tcp.h>  // glibc 的 struct tcp_info 没有 tcpi_notsent_bytes
+#include <stddef.h>
+#include <algorithm>
+
+#include "tcp_stats.h"
+#include "metrics.h"
+
+long long tcp_stats::s_interval_ns = 0;
+
+static void append(std::string &out, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+static void append(std::string &out, const char *format, ...)
+{
+    char buf[512];
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    if(n > 0) {
+        out.append(buf, n < (int)sizeof(buf) ? n : sizeof(buf) - 1);
+    }
+}
+
+void tcp_stats::init(int interval_ms)
+{
+    s_interval_ns = interval_ms > 0 ? interval_ms * 1000000LL : 0;
+}
+
+bool tcp_stats::sample(int fd, const sockaddr_in &addr, uint64_t sent, uint64_t left, long long elapsed_ns,
+    uint32_t &retrans)
+{
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+    memset(&info, 0, sizeof(info));
+    if(getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len) != 0) {
+        return false;
+    }
+
+    metrics *m = metrics::get_instance();
+    m->record(H_TCP_RTT, info.tcpi_rtt);
+    m->record(H_TCP_CWND, info.tcpi_snd_cwnd);
+    m->record(H_TCP_UNACKED, info.tcpi_unacked);
+    // 4.6 之前的内核不返回该字段
+    bool has_notsent = len >= offsetof(struct tcp_info, tcpi_notsent_bytes) + sizeof(info.tcpi_notsent_bytes);
+    if(has_notsent) {
+        m->record(H_TCP_NOTSENT, info.tcpi_notsent_bytes);
+    }
+    if(info.tcpi_total_retrans > retrans) {
+        m->add(M_TCP_RETRANS, info.tcpi_total_retrans - retrans);
+    }
+    retrans = info.tcpi_total_retrans;
+
+    client c;
+    c.addr = addr.sin_addr.s_addr;
+    c.port = addr.sin_port;
+    c.fd = fd;
+    c.rtt_us = info.tcpi_rtt;
+    c.rttvar_us = info.tcpi_rttvar;
+    c.cwnd = info.tcpi_snd_cwnd;
+    c.unacked = info.tcpi_unacked;
+    c.notsent = has_notsent ? info.tcpi_notsent_bytes : 0;
+    c.retrans = info.tcpi_total_retrans;
+    c.sent = sent;
+    c.left = left;
+    c.elapsed_ns = elapsed_ns;
+    c.rate = elapsed_ns > 0 ? sent * 1e9 / elapsed_ns : 0;
+    c.time = time(NULL);
+    update_top(c);
+    return true;
+}
+
+void tcp_stats::update_top(const client &c)
+{
+    // 同一连接更新原有的一项
+    for(int i = 0; i < m_count; ++i) {
+        if(m_top[i].addr == c.addr && m_top[i].port == c.port) {
+            m_top[i] = c;
+            return;
+        }
+    }
+    if(m_count < TOP_N) {
+        m_top[m_count++] = c;
+        return;
+    }
+    int fastest = 0;
+    for(int i = 1; i < m_count; ++i) {
+        if(m_top[i].rate > m_top[fastest].rate) {
+            fastest = i;
+        }
+    }
+    if(c.rate < m_top[fastest].rate) {
+        m_top[fastest] = c;
+    }
+}
+
+static bool by_rate(const std::pair<double, int> &a, const std::pair<double, int> &b)
+{
+    return a.first < b.first;
+}
+
+void tcp_stats::render(std::string &out)
+{
+    std::pair<double, int> order[TOP_N];
+    for(int i = 0; i < m_count; ++i) {
+        order[i] = std::make_pair(m_top[i].rate, i);
+    }
+    std::sort(order, order + m_count, by_rate);
+
+    time_t now = time(NULL);
+    append(out, "# slowest clients by send rate, sampled when a response write hits EAGAIN\n");
+    append(out, "%-21s %5s %10s %9s %9s %6s %8s %10s %7s %12s %12s %10s %6s\n", "client", "fd", "rate_kBps", "rtt_ms",
+        "rttvar_ms", "cwnd", "unacked", "notsent", "retrans", "sent", "left", "elapsed_ms", "age_s");
+    for(int i = 0; i < m_count; ++i) {
+        const client &c = m_top[order[i].second];
+        char ip[INET_ADDRSTRLEN];
+        struct in_addr in;
+        in.s_addr = c.addr;
+        inet_ntop(AF_INET, &in, ip, sizeof(ip));
+        char peer[32];
+        snprintf(peer, sizeof(peer), "%s:%u", ip, ntohs(c.port));
+        append(out, "%-21s %5d %10.1f %9.3f %9.3f %6u %8u %10u %7u %12llu %12llu %10lld %6ld\n", peer, c.fd,
+            c.rate / 1000, c.rtt_us / 1000.0, c.rttvar_us / 1000.0, c.cwnd, c.unacked, c.notsent, c.retrans,
+            (unsigned long long)c.sent, (unsigned long long)c.left, c.elapsed_ns / 1000000, (long)(now - c.time));
+    }
+}
@@ -0,0 +1,67 @@
+/**发送受阻连接的 TCP_INFO 采样
+ * 响应写到 EAGAIN 时（以及定时器周期检查仍未发完的连接时）用 getsockopt(TCP_INFO) 采样，
+ * 同一连接两次采样至少间隔设定的时间：
+ * - RTT、拥塞窗口、未确认的段数、未发送的字节数记入 /metrics 的直方图，重传次数记入计数器
+ * - 按发送速率（已发送字节 / 响应就绪以来的时间）保留最慢的 TOP_N 个客户端，由 /tcp 输出
+ * 只在主线程中调用（发送由主线程完成），不加锁
+ */
+
+#ifndef TCP_STATS_H
+#define TCP_STATS_H
+
+#include <stdint.h>
+#include <string>
+#include <netinet/in.h>
+
+class tcp_stats {
+public:
+    static const int TOP_N = 20;
+
+    static tcp_stats *get_instance()
+    {
+        static tcp_stats instance;
+        return &instance;
+    }
+
+    // 同一连接两次采样的最小间隔（毫秒），为 0 时关闭
+    void init(int interval_ms);
+    static bool enabled() { return s_interval_ns > 0; }
+    static long long interval_ns() { return s_interval_ns; }
+
+    // 采样一个连接：已发送 sent 字节、剩余 left 字节、响应就绪已 elapsed_ns；
+    // retrans 为该连接上次采样时的累计重传次数，返回时更新
+    bool sample(int fd, const sockaddr_in &addr, uint64_t sent, uint64_t left, long long elapsed_ns,
+        uint32_t &retrans);
+
+    // 输出最慢的客户端，按发送速率升序
+    void render(std::string &out);
+
+private:
+    struct client {
+        uint32_t addr;
+        uint16_t port;
+        int fd;
+        uint32_t rtt_us;
+        uint32_t rttvar_us;
+        uint32_t cwnd;
+        uint32_t unacked;
+        uint32_t notsent;
+        uint32_t retrans;
+        uint64_t sent;
+        uint64_t left;
+        long long elapsed_ns;
+        double rate;            // 字节/秒
+        time_t time;            // 采样时间
+    };
+
+    tcp_stats() : m_count(0) {}
+
+    void update_top(const client &c);
+
+private:
+    static long long s_interval_ns;
+    client m_top[TOP_N];        // 无序，满时替换最快的一项
+    int m_count;
+};
+
+#endif
@@ -0,0 +1,231 @@
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <vector>
+
+#include "file_store.h"
+
+static const size_t RECORD_HEADER = 6;  // 校验和 4B + 名长 1B + 密码长 1B
+
+// 校验和覆盖名长、密码长和内容
+static uint32_t record_checksum(const char *data, size_t len)
+{
+    return (uint32_t)User_table::hash(data, len);
+}
+
+File_store::File_store(const std::string &path, bool sync, int close_log) : m_lock("file_store")
+{
+    m_path = path;
+    m_index_path = path + ".idx";
+    m_sync = sync;
+    m_close_log = close_log;
+    m_fd = -1;
+    m_table = NULL;
+    m_log_end = 0;
+    m_indexed = 0;
+    m_records = 0;
+    m_logged_records = 0;
+    m_checkpointing = false;
+    m_checkpoint_joinable = false;
+}
+
+File_store::~File_store()
+{
+    if(m_checkpoint_joinable) {
+        pthread_join(m_checkpoint_tid, NULL);
+    }
+    if(m_fd != -1) {
+        close(m_fd);
+    }
+}
+
+bool File_store::load(User_table *table)
+{
+    m_table = table;
+
+    m_fd = open(m_path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if(m_fd < 0) {
+        LOG_ERROR("open %s error: %s", m_path.c_str(), strerror(errno));
+        return false;
+    }
+
+    // 索引只在覆盖的长度不超过日志长度时可信，否则从头重放
+    struct stat st;
+    fstat(m_fd, &st);
+    uint64_t from = 0;
+    if(m_index.open(m_index_path.c_str())) {
+        if(m_index.max_id() <= (uint64_t)st.st_size) {
+            from = m_index.max_id();
+            table->attach(&m_index);
+        }
+        else {
+            m_index.close();
+        }
+    }
+    m_indexed = from;
+
+    m_log_end = replay(from);
+    if(m_log_end < (uint64_t)st.st_size) {
+        // 截掉上次崩溃时写了一半的记录
+        LOG_WARN("truncate %s from %lld to %lld bytes", m_path.c_str(),
+            (long long)st.st_size, (long long)m_log_end);
+        if(ftruncate(m_fd, m_log_end) != 0) {
+            return false;
+        }
+    }
+    table->reclaim();
+
+    LOG_INFO("loaded %llu users from %s index, %llu log bytes replayed",
+        (unsigned long long)m_index.size(), m_index_path.c_str(),
+        (unsigned long long)(m_log_end - from));
+
+    if(m_log_end - m_indexed >= CHECKPOINT_BYTES) {
+        m_lock.lock();
+        start_checkpoint();
+        m_lock.unlock();
+    }
+    return true;
+}
+
+uint64_t File_store::replay(uint64_t from)
+{
+    struct stat st;
+    if(fstat(m_fd, &st) != 0 || (uint64_t)st.st_size <= from) {
+        return from;
+    }
+
+    size_t size = st.st_size;
+    char *base = (char *)mmap(NULL, size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+    if(base == MAP_FAILED) {
+        return from;
+    }
+    madvise(base, size, MADV_SEQUENTIAL);
+
+    uint64_t off = from;
+    std::string name, password;
+    while(off + RECORD_HEADER <= size) {
+        const char *rec = base + off;
+        size_t name_len = (unsigned char)rec[4];
+        size_t pw_len = (unsigned char)rec[5];
+        size_t len = RECORD_HEADER + name_len + pw_len;
+        if(off + len > size) {
+            break;
+        }
+        uint32_t checksum;
+        memcpy(&checksum, rec, sizeof(checksum));
+        if(checksum != record_checksum(rec + 4, len - 4)) {
+            break;
+        }
+
+        name.assign(rec + RECORD_HEADER, name_len);
+        password.assign(rec + RECORD_HEADER + name_len, pw_len);
+        m_table->upsert(name, password);
+        off += len;
+    }
+
+    munmap(base, size);
+    return off;
+}
+
+int File_store::insert(const char *name, const char *password)
+{
+    size_t name_len = strlen(name);
+    size_t pw_len = strlen(password);
+    if(m_fd < 0 || name_len > User_table::MAX_FIELD_LEN || pw_len > User_table::MAX_FIELD_LEN) {
+        return -1;
+    }
+
+    char buf[RECORD_HEADER + 2 * User_table::MAX_FIELD_LEN];
+    buf[4] = (char)name_len;
+    buf[5] = (char)pw_len;
+    memcpy(buf + RECORD_HEADER, name, name_len);
+    memcpy(buf + RECORD_HEADER + name_len, password, pw_len);
+    size_t len = RECORD_HEADER + name_len + pw_len;
+    uint32_t checksum = record_checksum(buf + 4, len - 4);
+    memcpy(buf, &checksum, sizeof(checksum));
+
+    // 查重、追加和发布到缓存在同一把锁内完成，同名的并发注册只有一个成功
+    m_lock.lock();
+    std::string existing;
+    if(m_table->find(name, name_len, existing)) {
+        m_lock.unlock();
+        return 1;
+    }
+
+    ssize_t n = write(m_fd, buf, len);
+    if(n != (ssize_t)len || (m_sync && fdatasync(m_fd) != 0)) {
+        LOG_ERROR("append %s error: %s", m_path.c_str(), strerror(errno));
+        // 丢弃写了一半的记录，保持日志可以完整重放
+        if(ftruncate(m_fd, m_log_end) != 0) {
+            LOG_ERROR("truncate %s error: %s", m_path.c_str(), strerror(errno));
+        }
+        m_lock.unlock();
+        return -1;
+    }
+    m_log_end += len;
+    m_records++;
+    m_table->insert(name, password);
+
+    if(m_log_end - m_indexed >= CHECKPOINT_BYTES) {
+        start_checkpoint();
+    }
+    m_lock.unlock();
+    return 0;
+}
+
+void File_store::log_stats()
+{
+    m_lock.lock();
+    uint64_t records = m_records;
+    uint64_t log_end = m_log_end;
+    uint64_t indexed = m_indexed;
+    m_lock.unlock();
+
+    if(records == m_logged_records) {
+        return;
+    }
+    m_logged_records = records;
+    LOG_INFO("file store appended: %llu, log bytes: %llu, indexed bytes: %llu",
+        (unsigned long long)records, (unsigned long long)log_end, (unsigned long long)indexed);
+}
+
+// 调用者持有 m_lock
+void File_store::start_checkpoint()
+{
+    if(m_checkpointing) {
+        return;
+    }
+    if(m_checkpoint_joinable) {
+        pthread_join(m_checkpoint_tid, NULL);
+        m_checkpoint_joinable = false;
+    }
+    if(pthread_create(&m_checkpoint_tid, NULL, checkpoint_worker, this) == 0) {
+        m_checkpointing = true;
+        m_checkpoint_joinable = true;
+    }
+}
+
+void *File_store::checkpoint_worker(void *arg)
+{
+    File_store *store = (File_store *)arg;
+
+    store->m_lock.lock();
+    uint64_t end = store->m_log_end;
+    store->m_lock.unlock();
+
+    // 索引覆盖的日志必须先落盘，之后写入缓存的用户即使也进入索引，重放时覆盖写入也是幂等的
+    bool ok = (store->m_sync || fdatasync(store->m_fd) == 0)
+        && User_snapshot::write(store->m_index_path.c_str(),
+            store->m_index.loaded() ? &store->m_index : NULL, *store->m_table, end);
+
+    store->m_lock.lock();
+    if(ok) {
+        store->m_indexed = end;
+    }
+    store->m_checkpointing = false;
+    store->m_lock.unlock();
+    return store;
+}
@@ -0,0 +1,66 @@
+/**嵌入式的文件凭据存储
+ * - 日志文件：注册的用户以记录的形式追加写入，不做原地修改
+ *   记录格式：[校验和 4B][名长 1B][密码长 1B][用户名][密码]，启动时截掉末尾不完整或校验失败的记录
+ * - 索引文件：日志前缀的用户表快照（User_snapshot），文件头记录所覆盖的日志长度
+ *   启动时映射索引并只重放其后的日志，日志增长超过阈值后在后台重新生成索引
+ * - sync 为 true 时每次注册都 fdatasync，返回成功的用户在掉电后不会丢失
+ */
+
+#ifndef FILE_STORE_H
+#define FILE_STORE_H
+
+#include <stdint.h>
+#include <string>
+#include <pthread.h>
+
+#include "../lock/locker.h"
+#include "../log/log.h"
+#include "user_store.h"
+#include "user_snapshot.h"
+
+class File_store : public User_store
+{
+public:
+    File_store(const std::string &path, bool sync, int close_log);
+    ~File_store();
+
+    const char *name() const { return "file"; }
+
+    bool load(User_table *table);
+
+    // 缓存包含了全部用户，未命中说明用户不存在
+    int lookup(const char * /*name*/, std::string & /*password*/) { return 0; }
+
+    int insert(const char *name, const char *password);
+
+    void log_stats();
+
+private:
+    static const uint64_t CHECKPOINT_BYTES = 4 << 20;   // 索引之后的日志超过 4MB 时重新生成索引
+
+    // 重放日志中 [from, 文件末尾) 的记录，返回最后一条完整记录的结束位置
+    uint64_t replay(uint64_t from);
+    void start_checkpoint();
+    static void *checkpoint_worker(void *arg);
+
+private:
+    std::string m_path;         // 日志文件路径
+    std::string m_index_path;   // 索引文件路径
+    bool m_sync;
+    int m_close_log;
+    int m_fd;
+    User_table *m_table;
+    User_snapshot m_index;
+
+    locker m_lock;              // 串行化追加写
+    uint64_t m_log_end;         // 日志的有效长度
+    uint64_t m_indexed;         // 索引覆盖的日志长度
+    uint64_t m_records;         // 启动后追加的记录数
+    uint64_t m_logged_records;  // 上次输出指标时的记录数
+
+    pthread_t m_checkpoint_tid;
+    bool m_checkpointing;       // 后台正在生成索引
+    bool m_checkpoint_joinable; // 生成索引的线程尚未回收
+};
+
+#endif
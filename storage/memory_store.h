@@ -0,0 +1,36 @@
+/**纯内存的凭据存储
+ * 用户只保存在缓存的用户表中，注册时在表上原子地查重和插入
+ * 没有任何 I/O，用于在没有数据库的机器上压测完整的请求路径，衡量数据库之外的开销
+ */
+
+#ifndef MEMORY_STORE_H
+#define MEMORY_STORE_H
+
+#include "user_store.h"
+
+class Memory_store : public User_store
+{
+public:
+    Memory_store() : m_table(NULL) {}
+
+    const char *name() const { return "memory"; }
+
+    bool load(User_table *table)
+    {
+        m_table = table;
+        return true;
+    }
+
+    // 缓存即全部数据，未命中说明用户不存在
+    int lookup(const char * /*name*/, std::string & /*password*/) { return 0; }
+
+    int insert(const char *name, const char *password)
+    {
+        return m_table && m_table->insert(name, password) ? 0 : 1;
+    }
+
+private:
+    User_table *m_table;
+};
+
+#endif
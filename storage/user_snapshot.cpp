@@ -0,0 +1,247 @@
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <vector>
+
+#include "user_snapshot.h"
+
+static const char SNAPSHOT_MAGIC[8] = {'U', 'S', 'E', 'R', 'S', 'N', 'A', 'P'};
+static const int TAG_SHIFT = 48;                                    // 桶的高 16 位为哈希标签
+static const uint64_t OFFSET_MASK = ((uint64_t)1 << TAG_SHIFT) - 1; // 低 48 位为记录偏移 + 1
+
+User_snapshot::User_snapshot()
+{
+    m_base = NULL;
+    m_size = 0;
+    m_buckets = NULL;
+    m_records = NULL;
+    m_mask = 0;
+    m_count = 0;
+    m_max_id = 0;
+}
+
+User_snapshot::~User_snapshot()
+{
+    close();
+}
+
+bool User_snapshot::open(const char *path)
+{
+    close();
+
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if(fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(header)) {
+        ::close(fd);
+        return false;
+    }
+
+    void *base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if(base == MAP_FAILED) {
+        return false;
+    }
+
+    // 校验文件头，各区域必须落在文件范围内
+    const header *h = (const header *)base;
+    uint64_t buckets_end = sizeof(header) + h->bucket_count * sizeof(uint64_t);
+    if(memcmp(h->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0 || h->version != VERSION
+        || h->file_size != (uint64_t)st.st_size || h->bucket_count == 0
+        || (h->bucket_count & (h->bucket_count - 1)) != 0
+        || h->bucket_count > (uint64_t)st.st_size / sizeof(uint64_t)
+        || h->records_offset < buckets_end || h->records_offset > h->file_size) {
+        munmap(base, st.st_size);
+        return false;
+    }
+
+    // 查找是随机访问，不需要预读
+    madvise(base, st.st_size, MADV_RANDOM);
+
+    m_base = (char *)base;
+    m_size = st.st_size;
+    m_buckets = (const uint64_t *)(m_base + sizeof(header));
+    m_records = m_base + h->records_offset;
+    m_mask = h->bucket_count - 1;
+    m_count = h->count;
+    m_max_id = h->max_id;
+    return true;
+}
+
+void User_snapshot::close()
+{
+    if(m_base) {
+        munmap(m_base, m_size);
+    }
+    m_base = NULL;
+    m_size = 0;
+    m_buckets = NULL;
+    m_records = NULL;
+    m_mask = 0;
+    m_count = 0;
+    m_max_id = 0;
+}
+
+bool User_snapshot::find(const char *name, size_t name_len, std::string &password) const
+{
+    if(m_base == NULL || name_len > User_table::MAX_FIELD_LEN) {
+        return false;
+    }
+
+    uint64_t h = User_table::hash(name, name_len);
+    uint64_t tag = h >> TAG_SHIFT;
+    size_t records_size = m_size - (m_records - m_base);
+    for(uint64_t i = h & m_mask, n = 0; n <= m_mask; i = (i + 1) & m_mask, ++n) {
+        uint64_t v = m_buckets[i];
+        if(v == 0) {
+            return false;
+        }
+        if((v >> TAG_SHIFT) != tag) {
+            continue;
+        }
+
+        uint64_t off = (v & OFFSET_MASK) - 1;
+        if(off + 2 > records_size) {
+            return false;
+        }
+        const char *rec = m_records + off;
+        size_t len = (unsigned char)rec[0];
+        size_t pw_len = (unsigned char)rec[1];
+        if(off + 2 + len + pw_len > records_size) {
+            return false;
+        }
+        if(len == name_len && memcmp(rec + 2, name, name_len) == 0) {
+            password.assign(rec + 2 + len, pw_len);
+            return true;
+        }
+    }
+    return false;
+}
+
+void User_snapshot::for_each(user_visitor fn, void *arg) const
+{
+    if(m_base == NULL) {
+        return;
+    }
+    for(uint64_t i = 0; i <= m_mask; ++i) {
+        uint64_t v = m_buckets[i];
+        if(v == 0) {
+            continue;
+        }
+        const char *rec = m_records + (v & OFFSET_MASK) - 1;
+        size_t len = (unsigned char)rec[0];
+        fn(arg, rec + 2, len, rec + 2 + len, (unsigned char)rec[1]);
+    }
+}
+
+namespace {
+
+// 构建中的快照：桶数组和记录区都在内存中，写完后一次性落盘
+struct snapshot_builder {
+    std::vector<uint64_t> buckets;
+    std::vector<char> records;
+    uint64_t count;
+
+    bool contains(const char *name, size_t name_len, uint64_t h, uint64_t *slot)
+    {
+        uint64_t mask = buckets.size() - 1;
+        for(uint64_t i = h & mask; ; i = (i + 1) & mask) {
+            uint64_t v = buckets[i];
+            if(v == 0) {
+                *slot = i;
+                return false;
+            }
+            if((v >> TAG_SHIFT) != (h >> TAG_SHIFT)) {
+                continue;
+            }
+            const char *rec = &records[(v & OFFSET_MASK) - 1];
+            if((size_t)(unsigned char)rec[0] == name_len && memcmp(rec + 2, name, name_len) == 0) {
+                return true;
+            }
+        }
+    }
+
+    static void add(void *arg, const char *name, size_t name_len, const char *password, size_t password_len)
+    {
+        snapshot_builder *b = (snapshot_builder *)arg;
+        uint64_t h = User_table::hash(name, name_len);
+        uint64_t slot;
+        if(b->contains(name, name_len, h, &slot)) {
+            return;
+        }
+
+        uint64_t off = b->records.size();
+        b->records.push_back((char)name_len);
+        b->records.push_back((char)password_len);
+        b->records.insert(b->records.end(), name, name + name_len);
+        b->records.insert(b->records.end(), password, password + password_len);
+        b->buckets[slot] = ((h >> TAG_SHIFT) << TAG_SHIFT) | (off + 1);
+        b->count++;
+    }
+};
+
+bool write_all(int fd, const char *data, size_t len)
+{
+    while(len > 0) {
+        ssize_t n = ::write(fd, data, len);
+        if(n < 0) {
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+}
+
+bool User_snapshot::write(const char *path, const User_snapshot *base,
+    const User_table &table, uint64_t max_id)
+{
+    // 装载因子不超过 0.5，保证探测序列较短
+    uint64_t upper = table.size() + (base ? base->size() : 0);
+    uint64_t bucket_count = 16;
+    while(bucket_count < upper * 2) {
+        bucket_count <<= 1;
+    }
+
+    snapshot_builder builder;
+    builder.buckets.assign(bucket_count, 0);
+    builder.count = 0;
+    table.for_each(snapshot_builder::add, &builder);
+    if(base) {
+        base->for_each(snapshot_builder::add, &builder);
+    }
+
+    header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    h.version = VERSION;
+    h.count = builder.count;
+    h.max_id = max_id;
+    h.bucket_count = bucket_count;
+    h.records_offset = sizeof(header) + bucket_count * sizeof(uint64_t);
+    h.file_size = h.records_offset + builder.records.size();
+
+    std::string tmp = std::string(path) + ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd < 0) {
+        return false;
+    }
+    bool ok = write_all(fd, (const char *)&h, sizeof(h))
+        && write_all(fd, (const char *)&builder.buckets[0], bucket_count * sizeof(uint64_t))
+        && (builder.records.empty() || write_all(fd, &builder.records[0], builder.records.size()))
+        && fsync(fd) == 0;
+    ::close(fd);
+
+    if(!ok || rename(tmp.c_str(), path) != 0) {
+        unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,66 @@
+/**用户表快照文件
+ * - 启动时 mmap 只读映射，无需逐行读取和插入即可立即提供查找，页面按需由内核换入
+ * - 文件布局：文件头 | 哈希桶数组 | 记录区
+ *   哈希桶为 8 字节：高 16 位哈希标签 + 低 48 位记录偏移（+1，0 表示空桶），线性探测
+ *   记录格式与 User_table 相同：[名长 1B][密码长 1B][用户名][密码]
+ * - 文件头记录生成快照时数据库中最大的用户 id，启动后只需加载 id 更大的新用户
+ * - 写入时先写临时文件再 rename，已映射旧快照的进程不受影响
+ */
+
+#ifndef USER_SNAPSHOT_H
+#define USER_SNAPSHOT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+#include "user_table.h"
+
+class User_snapshot
+{
+public:
+    User_snapshot();
+    ~User_snapshot();
+
+    // 映射快照文件，文件不存在或格式不符时返回 false
+    bool open(const char *path);
+    void close();
+
+    bool find(const char *name, size_t name_len, std::string &password) const;
+
+    // 遍历快照中的所有用户
+    void for_each(user_visitor fn, void *arg) const;
+
+    bool loaded() const { return m_base != NULL; }
+    uint64_t size() const { return m_count; }
+    uint64_t max_id() const { return m_max_id; }
+
+    // 将快照 base（可为 NULL）与 table 合并写入 path，table 中的用户优先
+    static bool write(const char *path, const User_snapshot *base,
+        const User_table &table, uint64_t max_id);
+
+private:
+    struct header {
+        char magic[8];
+        uint32_t version;
+        uint32_t reserved;
+        uint64_t count;             // 用户数
+        uint64_t max_id;            // 生成快照时的最大用户 id
+        uint64_t bucket_count;      // 桶数，2 的幂
+        uint64_t records_offset;    // 记录区在文件中的偏移
+        uint64_t file_size;
+    };
+
+    static const uint32_t VERSION = 1;
+
+private:
+    char *m_base;
+    size_t m_size;
+    const uint64_t *m_buckets;
+    const char *m_records;
+    uint64_t m_mask;
+    uint64_t m_count;
+    uint64_t m_max_id;
+};
+
+#endif
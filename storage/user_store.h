@@ -0,0 +1,58 @@
+/**用户凭据存储接口
+ * 登录、注册的处理只依赖该接口，不再直接使用 MySQL 连接，后端在启动时选择：
+ * - mysql   MySQL 数据库（连接池、非阻塞查询、组提交、流式加载和快照）
+ * - memory  纯内存，进程退出后数据丢失，用于在没有数据库的机器上压测完整的请求路径
+ * - file    嵌入式存储，追加写的日志文件 + 索引文件，数据持久化在本地
+ * 所有后端都以分片用户表（User_table）作为内存中的缓存，登录优先在缓存中查找
+ */
+
+#ifndef USER_STORE_H
+#define USER_STORE_H
+
+#include <stdint.h>
+#include <string>
+
+#include "user_table.h"
+
+// 异步操作完成回调：token 为提交时传入的值，原样带回；result 为 0 表示成功
+typedef void (*store_cb)(void *arg, uint32_t token, int result);
+
+class User_store
+{
+public:
+    virtual ~User_store() {}
+
+    virtual const char *name() const = 0;
+
+    // 启动时将已有用户加载到缓存 table，之后的新用户也由调用者写入 table
+    virtual bool load(User_table *table) = 0;
+
+    // 缓存未命中时查询用户密码，找到返回 1，不存在返回 0，出错返回 -1
+    virtual int lookup(const char *name, std::string &password) = 0;
+
+    // 同步插入用户，成功返回 0，用户已存在或出错返回非 0
+    virtual int insert(const char *name, const char *password) = 0;
+
+    // 异步插入用户，完成后调用 cb(arg, token, result)；不支持异步时返回 false，调用者改用 insert
+    virtual bool submit(const char * /*name*/, const char * /*password*/, store_cb /*cb*/, void * /*arg*/,
+        uint32_t /*token*/)
+    {
+        return false;
+    }
+
+    // 服务器退出时、释放连接对象和线程池之前调用：写完已提交的操作后停止后台线程，之后不再回调
+    virtual void stop() {}
+
+    // 后端自己的 fd（如非阻塞数据库连接）与客户连接共用主线程的 epoll
+    virtual void add_to_epoll(int /*epollfd*/) {}
+    virtual bool owns(int /*fd*/) { return false; }
+    virtual void handle_event(int /*fd*/, unsigned int /*events*/) {}
+
+    // 定时输出后端的运行指标
+    virtual void log_stats() {}
+
+    // 以 Prometheus 文本格式追加后端的运行指标，由 /metrics 调用
+    virtual void export_metrics(std::string & /*out*/) {}
+};
+
+#endif
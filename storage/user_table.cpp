@@ -0,0 +1,319 @@
+#include "user_table.h"
+#include "user_snapshot.h"
+
+User_table::User_table(int shard_bits)
+{
+    m_shard_bits = shard_bits;
+    m_snapshot = NULL;
+    m_shards = new shard[(size_t)1 << m_shard_bits];
+
+    for(size_t i = 0; i < ((size_t)1 << m_shard_bits); ++i) {
+        shard &s = m_shards[i];
+        s.slots.store(NULL);
+        s.count = 0;
+        for(int j = 0; j < MAX_BLOCKS; ++j) {
+            s.blocks[j].store(NULL);
+        }
+        s.used = 0;
+        s.retired_bytes = 0;
+        grow(s, 16);
+    }
+}
+
+User_table::~User_table()
+{
+    for(size_t i = 0; i < ((size_t)1 << m_shard_bits); ++i) {
+        shard &s = m_shards[i];
+        delete[] s.slots.load();
+        for(size_t j = 0; j < s.retired.size(); ++j) {
+            delete[] s.retired[j];
+        }
+        for(int j = 0; j < MAX_BLOCKS; ++j) {
+            delete[] s.blocks[j].load();
+        }
+    }
+    delete[] m_shards;
+}
+
+// 按 8 字节分组的乘法混合哈希
+uint64_t User_table::hash(const char *data, size_t len)
+{
+    uint64_t h = 0x9E3779B97F4A7C15ULL ^ len;
+    uint64_t w;
+    while(len >= 8) {
+        memcpy(&w, data, 8);
+        h = (h ^ w) * 0xBF58476D1CE4E5B9ULL;
+        h ^= h >> 31;
+        data += 8;
+        len -= 8;
+    }
+    w = 0;
+    memcpy(&w, data, len);
+    h = (h ^ w) * 0x94D049BB133111EBULL;
+    h ^= h >> 29;
+    h *= 0xBF58476D1CE4E5B9ULL;
+    h ^= h >> 32;
+    return h;
+}
+
+// 记录格式：[用户名长度 1 字节][密码长度 1 字节][用户名][密码]
+const char *User_table::record(const shard &s, uint64_t slot) const
+{
+    uint32_t offset = (uint32_t)slot - 1;
+    size_t b = block_index(offset);
+    const char *block = s.blocks[b].load(std::memory_order_acquire);
+    return block + (offset - block_start(b));
+}
+
+bool User_table::find(const char *name, size_t name_len, std::string &password) const
+{
+    if(find_local(name, name_len, password)) {
+        return true;
+    }
+    return m_snapshot && m_snapshot->find(name, name_len, password);
+}
+
+bool User_table::find_local(const char *name, size_t name_len, std::string &password) const
+{
+    uint64_t h = hash(name, name_len);
+    const shard &s = shard_of(h);
+    uint32_t tag = (uint32_t)(h >> 32);
+
+    const std::atomic<uint64_t> *slots = s.slots.load(std::memory_order_acquire);
+    size_t mask = slots[0].load(std::memory_order_relaxed);
+
+    for(size_t i = h & mask; ; i = (i + 1) & mask) {
+        uint64_t v = slots[i + 1].load(std::memory_order_acquire);
+        if(v == 0) {
+            return false;
+        }
+        if((uint32_t)(v >> 32) != tag) {
+            continue;
+        }
+        const char *rec = record(s, v);
+        size_t len = (unsigned char)rec[0];
+        if(len == name_len && memcmp(rec + 2, name, name_len) == 0) {
+            password.assign(rec + 2 + len, (unsigned char)rec[1]);
+            return true;
+        }
+    }
+}
+
+bool User_table::insert(const std::string &name, const std::string &password)
+{
+    return put(name, password, false);
+}
+
+bool User_table::upsert(const std::string &name, const std::string &password)
+{
+    return put(name, password, true);
+}
+
+bool User_table::put(const std::string &name, const std::string &password, bool overwrite)
+{
+    if(name.size() > MAX_FIELD_LEN || password.size() > MAX_FIELD_LEN) {
+        return false;
+    }
+    if(!overwrite && m_snapshot) {
+        std::string existing;
+        if(m_snapshot->find(name.data(), name.size(), existing)) {
+            return false;
+        }
+    }
+
+    uint64_t h = hash(name.data(), name.size());
+    shard &s = shard_of(h);
+    uint32_t tag = (uint32_t)(h >> 32);
+
+    s.lock.lock();
+
+    std::atomic<uint64_t> *slots = s.slots.load(std::memory_order_relaxed);
+    size_t mask = slots[0].load(std::memory_order_relaxed);
+
+    // 装载因子超过 3/4 时扩容
+    if((s.count + 1) * 4 > (mask + 1) * 3) {
+        grow(s, (mask + 1) * 2);
+        slots = s.slots.load(std::memory_order_relaxed);
+        mask = slots[0].load(std::memory_order_relaxed);
+    }
+
+    size_t i = h & mask;
+    for(; ; i = (i + 1) & mask) {
+        uint64_t v = slots[i + 1].load(std::memory_order_relaxed);
+        if(v == 0) {
+            break;
+        }
+        if((uint32_t)(v >> 32) != tag) {
+            continue;
+        }
+        const char *rec = record(s, v);
+        if((unsigned char)rec[0] == name.size() && memcmp(rec + 2, name.data(), name.size()) == 0) {
+            if(!overwrite) {
+                s.lock.unlock();
+                return false;
+            }
+            break;
+        }
+    }
+
+    uint32_t offset = append(s, name, password);
+    if(offset == 0) {
+        s.lock.unlock();
+        return false;
+    }
+
+    // 记录写完后再以 release 语义发布槽，读者看到槽时一定能看到完整的记录
+    if(slots[i + 1].load(std::memory_order_relaxed) == 0) {
+        ++s.count;
+    }
+    slots[i + 1].store(((uint64_t)tag << 32) | offset, std::memory_order_release);
+
+    s.lock.unlock();
+    return true;
+}
+
+// 在分片的内存块中追加一条记录，返回偏移 + 1，失败返回 0
+uint32_t User_table::append(shard &s, const std::string &name, const std::string &password)
+{
+    size_t len = 2 + name.size() + password.size();
+
+    // 记录不跨越内存块，最长的记录也小于第一个内存块
+    size_t b = block_index(s.used);
+    if(s.used + len > block_start(b + 1)) {
+        s.used = block_start(++b);
+    }
+    if(s.used + len >= block_start(MAX_BLOCKS)) {
+        return 0;
+    }
+
+    char *block = s.blocks[b].load(std::memory_order_relaxed);
+    if(block == NULL) {
+        block = new char[block_start(b + 1) - block_start(b)];
+        s.blocks[b].store(block, std::memory_order_release);
+    }
+
+    char *rec = block + (s.used - block_start(b));
+    rec[0] = (char)name.size();
+    rec[1] = (char)password.size();
+    memcpy(rec + 2, name.data(), name.size());
+    memcpy(rec + 2 + name.size(), password.data(), password.size());
+
+    uint32_t offset = (uint32_t)s.used + 1;
+    s.used += len;
+    return offset;
+}
+
+// 构建新的槽数组并原子替换，调用者持有分片的锁（构造时除外）
+void User_table::grow(shard &s, size_t capacity)
+{
+    std::atomic<uint64_t> *slots = new std::atomic<uint64_t>[capacity + 1];
+    slots[0].store(capacity - 1, std::memory_order_relaxed);
+    for(size_t i = 1; i <= capacity; ++i) {
+        slots[i].store(0, std::memory_order_relaxed);
+    }
+
+    std::atomic<uint64_t> *old = s.slots.load(std::memory_order_relaxed);
+    if(old) {
+        size_t old_mask = old[0].load(std::memory_order_relaxed);
+        for(size_t i = 1; i <= old_mask + 1; ++i) {
+            uint64_t v = old[i].load(std::memory_order_relaxed);
+            if(v == 0) {
+                continue;
+            }
+            const char *rec = record(s, v);
+            uint64_t h = hash(rec + 2, (unsigned char)rec[0]);
+            size_t j = h & (capacity - 1);
+            while(slots[j + 1].load(std::memory_order_relaxed) != 0) {
+                j = (j + 1) & (capacity - 1);
+            }
+            slots[j + 1].store(v, std::memory_order_relaxed);
+        }
+        s.retired.push_back(old);
+        s.retired_bytes += (old_mask + 2) * sizeof(uint64_t);
+    }
+
+    s.slots.store(slots, std::memory_order_release);
+}
+
+void User_table::reserve(size_t n)
+{
+    size_t per_shard = n >> m_shard_bits;
+    size_t capacity = 16;
+    while(capacity * 3 < per_shard * 4) {
+        capacity <<= 1;
+    }
+
+    for(size_t i = 0; i < ((size_t)1 << m_shard_bits); ++i) {
+        shard &s = m_shards[i];
+        s.lock.lock();
+        if(s.slots.load()[0].load() + 1 < capacity) {
+            grow(s, capacity);
+        }
+        s.lock.unlock();
+    }
+}
+
+void User_table::for_each(user_visitor fn, void *arg) const
+{
+    for(size_t i = 0; i < ((size_t)1 << m_shard_bits); ++i) {
+        shard &s = m_shards[i];
+        s.lock.lock();
+        std::atomic<uint64_t> *slots = s.slots.load(std::memory_order_relaxed);
+        size_t mask = slots[0].load(std::memory_order_relaxed);
+        for(size_t j = 1; j <= mask + 1; ++j) {
+            uint64_t v = slots[j].load(std::memory_order_relaxed);
+            if(v == 0) {
+                continue;
+            }
+            const char *rec = record(s, v);
+            size_t name_len = (unsigned char)rec[0];
+            fn(arg, rec + 2, name_len, rec + 2 + name_len, (unsigned char)rec[1]);
+        }
+        s.lock.unlock();
+    }
+}
+
+void User_table::reclaim()
+{
+    for(size_t i = 0; i < ((size_t)1 << m_shard_bits); ++i) {
+        shard &s = m_shards[i];
+        s.lock.lock();
+        for(size_t j = 0; j < s.retired.size(); ++j) {
+            delete[] s.retired[j];
+        }
+        s.retired.clear();
+        s.retired_bytes = 0;
+        s.lock.unlock();
+    }
+}
+
+size_t User_table::size() const
+{
+    size_t n = 0;
+    for(size_t i = 0; i < ((size_t)1 << m_shard_bits); ++i) {
+        m_shards[i].lock.lock();
+        n += m_shards[i].count;
+        m_shards[i].lock.unlock();
+    }
+    return n;
+}
+
+void User_table::memory_usage(size_t *used, size_t *reserved) const
+{
+    size_t fixed = sizeof(shard) << m_shard_bits;
+    size_t records = 0;
+    size_t capacity = 0;
+    for(size_t i = 0; i < ((size_t)1 << m_shard_bits); ++i) {
+        shard &s = m_shards[i];
+        s.lock.lock();
+        fixed += (s.slots.load()[0].load() + 2) * sizeof(uint64_t);
+        fixed += s.retired_bytes;
+        records += s.used;
+        if(s.used > 0) {
+            capacity += block_start(block_index(s.used - 1) + 1);
+        }
+        s.lock.unlock();
+    }
+    *used = fixed + records;
+    *reserved = fixed + capacity;
+}
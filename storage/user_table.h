@@ -0,0 +1,125 @@
+/**分片的并发用户表，保存用户名到密码的映射
+ * - 按哈希值分为多个分片，每个分片是一张开放寻址（线性探测）哈希表
+ * - 用户名和密码连续存放在分片的内存块（arena）中，哈希槽只保存 8 字节：32 位哈希标签 + 32 位记录偏移
+ *   相比 std::map 每个结点约 100 字节的额外开销，每个用户只多占用约 10~16 字节
+ * - 读多写少，读者不加锁（RCU 方式）：记录写入后不再修改，槽以原子操作发布
+ *   扩容时构建新的槽数组后原子替换，旧数组延迟到没有读者的静止点（reclaim）或析构时释放
+ * - 写者之间通过分片的互斥锁同步，insert 的查重和插入是原子的
+ * - 可以挂接一个只读的快照（User_snapshot），表中没有的用户再到快照中查找
+ */
+
+#ifndef USER_TABLE_H
+#define USER_TABLE_H
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <atomic>
+
+#include "../lock/locker.h"
+
+class User_snapshot;
+
+// 遍历用户的回调
+typedef void (*user_visitor)(void *arg, const char *name, size_t name_len,
+    const char *password, size_t password_len);
+
+class User_table
+{
+public:
+    static const size_t MAX_FIELD_LEN = 255;    // 用户名和密码的最大长度
+
+    User_table(int shard_bits = 6);
+    ~User_table();
+
+    // 哈希函数，快照文件使用同一函数，结果需要在不同版本之间保持稳定
+    static uint64_t hash(const char *data, size_t len);
+
+    // 挂接只读快照，需在开始服务之前调用；快照的生命周期由调用者管理
+    void attach(const User_snapshot *snapshot) { m_snapshot = snapshot; }
+    const User_snapshot *snapshot() const { return m_snapshot; }
+
+    // 遍历表中（不含快照）的所有用户
+    void for_each(user_visitor fn, void *arg) const;
+
+    // 查找用户，存在时将密码写入 password
+    bool find(const char *name, size_t name_len, std::string &password) const;
+    bool find(const std::string &name, std::string &password) const
+    {
+        return find(name.data(), name.size(), password);
+    }
+    bool contains(const std::string &name) const
+    {
+        std::string password;
+        return find(name, password);
+    }
+
+    // 插入用户，表或快照中已存在时返回 false
+    bool insert(const std::string &name, const std::string &password);
+    // 插入或覆盖用户
+    bool upsert(const std::string &name, const std::string &password);
+
+    // 预留容量，批量加载前调用可避免反复扩容
+    void reserve(size_t n);
+
+    // 释放扩容替换下来的旧槽数组，只能在没有并发读者时调用（如加载完成、开始服务之前）
+    void reclaim();
+
+    size_t size() const;                // 表中的用户数，不含快照
+    // 占用的字节数，包括哈希槽和记录：used 只计已写入的记录，reserved 计已分配内存块的全部容量
+    void memory_usage(size_t *used, size_t *reserved) const;
+
+private:
+    // 内存块从 4KB 开始按 2 倍增长，到 1MB 后每块固定 1MB，用户很少的分片不会占用整块内存
+    static const int MIN_BLOCK_BITS = 12;               // 第一个内存块 4KB
+    static const int BLOCK_BITS = 20;                   // 最大的内存块 1MB
+    static const size_t BLOCK_SIZE = (size_t)1 << BLOCK_BITS;
+    static const int GROW_BLOCKS = BLOCK_BITS - MIN_BLOCK_BITS + 1;    // 前 9 块合计 1MB
+    static const int MAX_BLOCKS = 4096;                 // 每个分片最多约 4GB 记录
+
+    // 第 0 块为 [0, 4KB)，第 b 块（b < GROW_BLOCKS）为 [4KB << (b - 1), 4KB << b)，之后每块 1MB
+    static size_t block_index(size_t offset)
+    {
+        if(offset >= BLOCK_SIZE) {
+            return GROW_BLOCKS + ((offset - BLOCK_SIZE) >> BLOCK_BITS);
+        }
+        size_t k = offset >> MIN_BLOCK_BITS;
+        return k == 0 ? 0 : 64 - __builtin_clzll(k);
+    }
+    static size_t block_start(size_t b)
+    {
+        if(b >= (size_t)GROW_BLOCKS) {
+            return BLOCK_SIZE + ((b - GROW_BLOCKS) << BLOCK_BITS);
+        }
+        return b == 0 ? 0 : (size_t)1 << (MIN_BLOCK_BITS + b - 1);
+    }
+
+    // 槽数组的第 0 个元素保存槽数 - 1，读者一次原子读取即可得到一致的数组和大小
+    struct shard {
+        std::atomic<std::atomic<uint64_t> *> slots;     // 哈希槽数组
+        size_t count;                                   // 已用槽数
+        std::atomic<char *> blocks[MAX_BLOCKS];         // 记录所在的内存块
+        size_t used;                                    // 已分配的记录字节数
+        std::vector<std::atomic<uint64_t> *> retired;   // 扩容后替换下来的槽数组
+        size_t retired_bytes;
+        locker lock;                                    // 写者互斥
+
+        shard() : lock("user_table.shard") {}
+    };
+
+    shard &shard_of(uint64_t h) const { return m_shards[h >> (64 - m_shard_bits)]; }
+
+    bool put(const std::string &name, const std::string &password, bool overwrite);
+    bool find_local(const char *name, size_t name_len, std::string &password) const;
+    const char *record(const shard &s, uint64_t slot) const;
+    uint32_t append(shard &s, const std::string &name, const std::string &password);
+    void grow(shard &s, size_t capacity);
+
+private:
+    int m_shard_bits;
+    shard *m_shards;
+    const User_snapshot *m_snapshot;
+};
+
+#endif
@@ -9,18 +9,24 @@
 #include <list>
 #include <cstdio>
 #include <exception>
+#include <atomic>
 #include <pthread.h>
 #include "../lock/locker.h"
-#include "../CGImysql/sql_conn_pool.h"
+#include "../trace/probes.h"
 
 template <typename T>
 class threadpool
 {
 public:
-    threadpool(Connection_pool *conn_pool, int thread_num = 8, int max_requests = 10000);
+    threadpool(int thread_num = 8, int max_requests = 10000);
     ~threadpool();
     bool append_p(T *request);      // 向请求队列中添加任务
 
+    /* 运行指标，不加锁读取 */
+    int queue_size() const { return m_queue_size.load(std::memory_order_relaxed); }  // 排队的任务数
+    int busy() const { return m_busy.load(std::memory_order_relaxed); }              // 正在处理任务的线程数
+    int thread_num() const { return m_thread_num; }
+
 private:
     /* 工作线程运行的主函数，不断从工作队列中获取任务并执行 */
     static void *worker(void *arg); // 需要设置成静态成员函数
@@ -33,14 +39,16 @@ private:
     std::list<T *> m_workqueue;     // 请求队列
     locker m_queuelocker;           // 互斥锁，保护请求队列
     sem m_queuestat;                // 信号量，是否有任务需要处理
+    std::atomic<int> m_queue_size;  // 请求队列的长度，在锁内修改，供指标无锁读取
+    std::atomic<int> m_busy;        // 正在处理任务的线程数
     // bool m_stop;                 // 是否结束线程
-    Connection_pool *m_conn_pool;   // 数据库
 };
 
 /* 构造函数，创建线程并加入线程池数组m_threads[] */
 template <typename T>
-threadpool<T>::threadpool(Connection_pool *conn_pool, int thread_num, int max_requests)
-    : m_conn_pool(conn_pool), m_thread_num(thread_num), m_max_requests(max_requests), m_threads(NULL)
+threadpool<T>::threadpool(int thread_num, int max_requests)
+    : m_thread_num(thread_num), m_max_requests(max_requests), m_threads(NULL), m_queuelocker("threadpool.queue"),
+      m_queuestat("threadpool.queue"), m_queue_size(0), m_busy(0)
 {
     if(thread_num <= 0 || max_requests <= 0) {
         throw std::exception();
@@ -84,7 +92,9 @@ bool threadpool<T>::append_p(T *request)
     }
     // 添加任务
     m_workqueue.push_back(request);
+    m_queue_size.store(m_workqueue.size(), std::memory_order_relaxed);
     m_queuelocker.unlock();
+    WS_PROBE2(enqueue, request, m_queue_size.load(std::memory_order_relaxed));
 
     // 信号量提醒有任务要处理
     m_queuestat.post();
@@ -95,6 +105,8 @@ bool threadpool<T>::append_p(T *request)
 template <typename T>
 void *threadpool<T>::worker(void *arg)
 {
+    // 线程名出现在 CPU 分析结果和 top -H 中
+    pthread_setname_np(pthread_self(), "worker");
     // 将参数强转为线程池类，调用私有成员方法
     threadpool *pool = (threadpool *)arg;
     pool->run();
@@ -119,12 +131,16 @@ void threadpool<T>::run()
         // 从请求队列中取出一个任务
         T *request = m_workqueue.front();
         m_workqueue.pop_front();
+        m_queue_size.store(m_workqueue.size(), std::memory_order_relaxed);
         m_queuelocker.unlock();
         if(!request) continue;
+        WS_PROBE2(dequeue, request, m_queue_size.load(std::memory_order_relaxed));
         
-        connectionRAII mysql_conn(&request->mysql, m_conn_pool);
-        // http类中的方法
+        // http类中的方法，需要数据库时由请求自行从连接池获取连接
+        m_busy.fetch_add(1, std::memory_order_relaxed);
         request->process();
+        m_busy.fetch_sub(1, std::memory_order_relaxed);
+        WS_PROBE1(process_done, request);
     }
 }
 
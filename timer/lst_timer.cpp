@@ -1,5 +1,6 @@
 #include "lst_timer.h"
 #include "../http/http_conn.h"
+#include "../trace/probes.h"
 
 sort_timer_lst::sort_timer_lst()
 {
@@ -136,6 +137,7 @@ void sort_timer_lst::tick()
             break;
         }
         // 当前定时器到期，调用回调函数，执行定时事件
+        WS_PROBE2(timer_expire, tmp->user_data ? tmp->user_data->sockfd : -1, cur - tmp->expire);
         tmp->cb_func(tmp->user_data);
 
         // 将处理完的定时器从链表容器中删除，重置头结点
@@ -219,12 +221,18 @@ int Utils::u_epollfd = 0;
 class Utils;
 void cb_func(client_data *user_data)
 {
-    // 删除非活动连接在socket上的注册事件
-    epoll_ctl(Utils::u_epollfd, EPOLL_CTL_DEL, user_data->sockfd, 0);
     assert(user_data);
-    // 关闭文件描述符
+    // 连接上未完成的异步数据库操作的结果随之失效
+    user_data->conn->release();
+    // io_uring 后端先结束该连接上未完成的请求
+    if(uring::active()) {
+        uring::get_instance()->close(user_data->sockfd);
+    }
+    // 关闭文件描述符；描述符没有被复制，关闭时内核自动将其移出epoll，不再单独 EPOLL_CTL_DEL
     close(user_data->sockfd);
+    metrics::get_instance()->add(M_SYS_CLOSE);
     // 减少连接数
     http_conn::m_user_count--;
+    client_tracker::get_instance()->on_close(user_data->address.sin_addr.s_addr);
 }
 
@@ -33,10 +33,12 @@
 
 // 连接资源结构体
 class util_timer;
+class http_conn;
 struct client_data {
     int sockfd;             // socket文件描述符
     sockaddr_in address;    // 客户端socket地址
     util_timer *timer;      // 定时器
+    http_conn *conn;        // 对应的HTTP连接
 };
 
 // 定时器类
@@ -0,0 +1,31 @@
+/**USDT 静态探针
+ * 在接受连接、读写事件、线程池入队出队、请求路由、数据库连接池、定时器到期处放置 sys/sdt.h 探针，
+ * 未挂载时每个探针只是一条 nop 指令，挂载后可用 bpftrace、perf 在运行中的服务器上统计排队、连接池等待等
+ * - 提供者名为 webserver，列出探针：bpftrace -l 'usdt:./server:webserver:*'
+ * - 没有 sys/sdt.h（systemtap-sdt-dev）或编译时定义 NO_USDT（make USDT=0）时探针为空
+ */
+
+#ifndef PROBES_H
+#define PROBES_H
+
+#if !defined(NO_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define WS_USDT 1
+#endif
+#endif
+
+#ifdef WS_USDT
+#define WS_PROBE0(name) DTRACE_PROBE(webserver, name)
+#define WS_PROBE1(name, a1) DTRACE_PROBE1(webserver, name, a1)
+#define WS_PROBE2(name, a1, a2) DTRACE_PROBE2(webserver, name, a1, a2)
+#define WS_PROBE3(name, a1, a2, a3) DTRACE_PROBE3(webserver, name, a1, a2, a3)
+#else
+// 参数不求值，只避免只用于探针的变量产生未使用的警告
+#define WS_PROBE0(name) do {} while(0)
+#define WS_PROBE1(name, a1) do { if(0) { (void)(a1); } } while(0)
+#define WS_PROBE2(name, a1, a2) do { if(0) { (void)(a1); (void)(a2); } } while(0)
+#define WS_PROBE3(name, a1, a2, a3) do { if(0) { (void)(a1); (void)(a2); (void)(a3); } } while(0)
+#endif
+
+#endif
@@ -0,0 +1,235 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <execinfo.h>
+#include <sys/syscall.h>
+#include <map>
+
+#include "profiler.h"
+#include "stack.h"
+#include "../log/log.h"
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+// 调用栈开头的信号处理函数和信号返回帧
+static const int SKIP_FRAMES = 2;
+
+// 线程的 CPU 时钟，与内核 MAKE_THREAD_CPUCLOCK(tid, CPUCLOCK_SCHED) 相同
+static clockid_t thread_cpu_clock(pid_t tid)
+{
+    return (~(clockid_t)tid << 3) | 6;
+}
+
+static pid_t gettid_()
+{
+    return syscall(SYS_gettid);
+}
+
+cpu_profiler::cpu_profiler()
+    : m_hz(0), m_close_log(1), m_seconds(0), m_running(false), m_sampling(false),
+      m_samples(NULL), m_capacity(0), m_count(0)
+{
+}
+
+cpu_profiler::~cpu_profiler()
+{
+    // 进程退出时可能仍在采样，样本数组不释放
+}
+
+void cpu_profiler::init(int hz, int close_log)
+{
+    m_hz = hz > 0 ? (hz < 1000 ? hz : 1000) : 0;
+    m_close_log = close_log;
+    if(m_hz > 0) {
+        stack_prepare();
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = sample_handler;
+        sa.sa_flags = SA_RESTART;
+        sigfillset(&sa.sa_mask);
+        sigaction(SIGPROF, &sa, NULL);
+    }
+}
+
+void cpu_profiler::sample_handler(int sig)
+{
+    int saved_errno = errno;
+    cpu_profiler *p = get_instance();
+    if(p->m_sampling.load(std::memory_order_acquire)) {
+        int i = p->m_count.fetch_add(1, std::memory_order_relaxed);
+        if(i < p->m_capacity) {
+            sample &s = p->m_samples[i];
+            s.tid = gettid_();
+            s.depth = backtrace(s.frames, MAX_DEPTH);
+        }
+    }
+    errno = saved_errno;
+}
+
+bool cpu_profiler::start(int &seconds, std::string &file)
+{
+    if(!enabled()) {
+        return false;
+    }
+    bool expected = false;
+    if(!m_running.compare_exchange_strong(expected, true)) {
+        return false;
+    }
+    m_seconds = seconds > 0 ? (seconds < MAX_SECONDS ? seconds : MAX_SECONDS) : 10;
+    seconds = m_seconds;
+
+    char name[64];
+    time_t t = time(NULL);
+    struct tm my_tm;
+    localtime_r(&t, &my_tm);
+    strftime(name, sizeof(name), "./logs/profile_%Y%m%d_%H%M%S.folded", &my_tm);
+    m_file = name;
+    file = m_file;
+
+    pthread_t tid;
+    if(pthread_create(&tid, NULL, worker, this) != 0) {
+        m_running.store(false);
+        return false;
+    }
+    pthread_detach(tid);
+    return true;
+}
+
+void *cpu_profiler::worker(void *arg)
+{
+    pthread_setname_np(pthread_self(), "profiler");
+    cpu_profiler *p = (cpu_profiler *)arg;
+    p->run();
+    p->m_running.store(false);
+    return NULL;
+}
+
+void cpu_profiler::run()
+{
+    // 列出进程内的线程，不包括分析线程自己
+    m_tids.clear();
+    m_names.clear();
+    pid_t self = gettid_();
+    DIR *dir = opendir("/proc/self/task");
+    if(!dir) {
+        LOG_ERROR("%s", "profiler: open /proc/self/task error");
+        return;
+    }
+    struct dirent *entry;
+    while((entry = readdir(dir)) != NULL) {
+        pid_t tid = atoi(entry->d_name);
+        if(tid <= 0 || tid == self) {
+            continue;
+        }
+        char path[64];
+        char comm[32] = "?";
+        snprintf(path, sizeof(path), "/proc/self/task/%d/comm", tid);
+        FILE *fp = fopen(path, "r");
+        if(fp) {
+            if(fgets(comm, sizeof(comm), fp)) {
+                comm[strcspn(comm, "\n")] = '\0';
+            }
+            fclose(fp);
+        }
+        m_tids.push_back(tid);
+        m_names.push_back(comm);
+    }
+    closedir(dir);
+
+    // 样本数按所有线程满负荷估计，最多 64K 个（约 25MB），超出的样本丢弃并计数
+    long long capacity = (long long)m_hz * m_seconds * m_tids.size() + 1024;
+    m_capacity = capacity < 65536 ? capacity : 65536;
+    m_samples = new sample[m_capacity];
+    m_count.store(0, std::memory_order_relaxed);
+    m_sampling.store(true, std::memory_order_release);
+
+    std::vector<timer_t> timers;
+    struct itimerspec its;
+    its.it_interval.tv_sec = 0;
+    its.it_interval.tv_nsec = 1000000000 / m_hz;
+    its.it_value = its.it_interval;
+    for(size_t i = 0; i < m_tids.size(); ++i) {
+        struct sigevent sev;
+        memset(&sev, 0, sizeof(sev));
+        sev.sigev_notify = SIGEV_THREAD_ID;
+        sev.sigev_signo = SIGPROF;
+        sev.sigev_notify_thread_id = m_tids[i];
+        timer_t timer;
+        // 线程可能已退出
+        if(timer_create(thread_cpu_clock(m_tids[i]), &sev, &timer) != 0) {
+            continue;
+        }
+        if(timer_settime(timer, 0, &its, NULL) != 0) {
+            timer_delete(timer);
+            continue;
+        }
+        timers.push_back(timer);
+    }
+    LOG_INFO("profiler: sampling %d threads at %dHz for %ds", (int)timers.size(), m_hz, m_seconds);
+
+    sleep(m_seconds);
+
+    for(size_t i = 0; i < timers.size(); ++i) {
+        timer_delete(timers[i]);
+    }
+    m_sampling.store(false, std::memory_order_release);
+    // 等待已进入信号处理函数的采样完成
+    struct timespec t = {0, 50000000};
+    nanosleep(&t, NULL);
+
+    write_folded();
+    delete[] m_samples;
+    m_samples = NULL;
+    m_capacity = 0;
+}
+
+void cpu_profiler::write_folded()
+{
+    int count = m_count.load(std::memory_order_relaxed);
+    int dropped = count > m_capacity ? count - m_capacity : 0;
+    if(count > m_capacity) {
+        count = m_capacity;
+    }
+
+    std::map<pid_t, std::string> names;
+    for(size_t i = 0; i < m_tids.size(); ++i) {
+        names[m_tids[i]] = m_names[i];
+    }
+
+    // 相同的地址只符号化一次；返回地址减一，落在调用指令所在的函数内
+    std::map<void *, std::string> symbols;
+    std::map<std::string, long> folded;
+    std::string line;
+    for(int i = 0; i < count; ++i) {
+        const sample &s = m_samples[i];
+        line = names.count(s.tid) ? names[s.tid] : "?";
+        for(int j = s.depth - 1; j >= SKIP_FRAMES; --j) {
+            void *pc = j == SKIP_FRAMES ? s.frames[j] : (char *)s.frames[j] - 1;
+            std::map<void *, std::string>::iterator it = symbols.find(pc);
+            if(it == symbols.end()) {
+                it = symbols.insert(std::make_pair(pc, stack_symbol(pc))).first;
+            }
+            line += ';';
+            line += it->second;
+        }
+        ++folded[line];
+    }
+
+    FILE *fp = fopen(m_file.c_str(), "w");
+    if(!fp) {
+        LOG_ERROR("profiler: open %s error", m_file.c_str());
+        return;
+    }
+    for(std::map<std::string, long>::iterator it = folded.begin(); it != folded.end(); ++it) {
+        fprintf(fp, "%s %ld\n", it->first.c_str(), it->second);
+    }
+    fclose(fp);
+    LOG_INFO("profiler: %d samples (%d dropped) written to %s", count, dropped, m_file.c_str());
+}
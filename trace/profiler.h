@@ -0,0 +1,73 @@
+/**进程内的采样 CPU 分析器
+ * 不需要 perf 的权限，由 /profile 或信号触发，采样指定秒数后写出火焰图使用的折叠栈（folded stacks）
+ * - 开始时为进程内的每个线程创建一个按该线程 CPU 时间计时的 timer_create 定时器，
+ *   到期时向该线程发送 SIGPROF，只在线程实际运行时采样，事件循环、工作线程、日志线程都能被采到
+ * - 信号处理函数用 backtrace() 采集调用栈，写入预先分配的样本数组，不加锁、不分配内存
+ * - 结束后由分析线程符号化、按 线程名;调用者;...;被调用者 聚合计数，写入 logs/profile_时间.folded
+ * 用 flamegraph.pl logs/profile_*.folded > profile.svg 生成火焰图
+ */
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <pthread.h>
+#include <sys/types.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <signal.h>
+
+// 触发一次 CPU 分析的信号，SIGRTMIN 由事件循环监测使用
+#define PROFILE_SIGNAL (SIGRTMIN + 1)
+
+class cpu_profiler {
+public:
+    static const int MAX_DEPTH = 48;
+    static const int MAX_SECONDS = 300;
+
+    static cpu_profiler *get_instance()
+    {
+        static cpu_profiler instance;
+        return &instance;
+    }
+
+    // 每个线程每 CPU 秒采样 hz 次，为 0 时关闭
+    void init(int hz, int close_log);
+    bool enabled() const { return m_hz > 0; }
+    int hz() const { return m_hz; }
+
+    // 在后台采样 seconds 秒（不大于 0 时为 10 秒，最多 MAX_SECONDS），seconds、file 返回实际的秒数和输出文件；
+    // 已在采样时返回 false
+    bool start(int &seconds, std::string &file);
+
+private:
+    struct sample {
+        pid_t tid;
+        int depth;
+        void *frames[MAX_DEPTH];
+    };
+
+    cpu_profiler();
+    ~cpu_profiler();
+
+    static void *worker(void *arg);
+    void run();
+    static void sample_handler(int sig);
+    void write_folded();
+
+private:
+    int m_hz;
+    int m_close_log;
+    int m_seconds;
+    std::string m_file;
+    std::atomic<bool> m_running;    // 正在采样（含写出结果）
+    std::atomic<bool> m_sampling;   // 信号处理函数是否记录样本
+
+    std::vector<pid_t> m_tids;      // 开始时进程内的线程
+    std::vector<std::string> m_names;
+    sample *m_samples;              // 预先分配的样本
+    int m_capacity;
+    std::atomic<int> m_count;       // 已占用的样本数，可能超过 m_capacity
+};
+
+#endif
@@ -0,0 +1,39 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <cxxabi.h>
+
+#include "stack.h"
+
+std::string stack_symbol(void *pc)
+{
+    Dl_info info;
+    if(!dladdr(pc, &info)) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%p", pc);
+        return buf;
+    }
+    if(info.dli_sname) {
+        int status = 0;
+        char *name = abi::__cxa_demangle(info.dli_sname, NULL, NULL, &status);
+        std::string out = status == 0 && name ? name : info.dli_sname;
+        free(name);
+        return out;
+    }
+
+    // 没有导出的符号，输出模块名和模块内的偏移
+    const char *module = info.dli_fname ? info.dli_fname : "?";
+    const char *slash = strrchr(module, '/');
+    char buf[256];
+    snprintf(buf, sizeof(buf), "%s+0x%lx", slash ? slash + 1 : module,
+        (unsigned long)((char *)pc - (char *)info.dli_fbase));
+    return buf;
+}
+
+void stack_prepare()
+{
+    void *frames[4];
+    backtrace(frames, 4);
+}
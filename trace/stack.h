@@ -0,0 +1,18 @@
+/**调用栈的符号化
+ * 栈由 backtrace() 在信号处理函数中采集，只保存返回地址；符号化在普通线程中进行
+ * - 通过 dladdr 查找所在的函数，再还原 C++ 名称
+ * - 可执行文件需要以 -rdynamic 链接才能查到自身的函数名，查不到时输出 模块+偏移，可用 addr2line 还原
+ */
+
+#ifndef STACK_H
+#define STACK_H
+
+#include <string>
+
+// 返回地址对应的函数名，不包含函数内的偏移，同一函数内的地址得到相同的名称；查不到函数名时为 模块+偏移
+std::string stack_symbol(void *pc);
+
+// 在第一次采集前调用，让 backtrace() 提前完成动态加载，之后在信号处理函数中调用不再分配内存
+void stack_prepare();
+
+#endif
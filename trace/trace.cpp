@@ -0,0 +1,195 @@
+#include <stdio.h>
+#include <stdarg.h>
+
+#include "trace.h"
+
+bool tracer::s_enabled = false;
+thread_local trace_span *trace_span::current = NULL;
+
+// 以阶段的结束边界命名区间，例如 T_DEQUEUE 结束的区间是在队列中等待
+static const char *phase_names[T_STAGE_NUM] = {
+    "accept", "recv", "dispatch", "queue", "parse", "db_acquire", "db_query", "respond", "send"
+};
+
+// 与 http_conn::METHOD 的顺序一致
+static const char *methods[] = {"GET", "POST", "HEAD", "PUT", "DELETE", "TRACE", "OPTIONS", "CONNECT", "PATCH"};
+
+static void append(std::string &out, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+static void append(std::string &out, const char *format, ...)
+{
+    char buf[512];
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    if(n > 0) {
+        out.append(buf, n < (int)sizeof(buf) ? n : sizeof(buf) - 1);
+    }
+}
+
+// 路径来自客户端，输出为 JSON 字符串前转义
+static void append_escaped(std::string &out, const char *s)
+{
+    for(; *s; ++s) {
+        unsigned char c = *s;
+        if(c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        }
+        else if(c < 0x20 || c >= 0x7f) {
+            append(out, "\\u%04x", c);
+        }
+        else {
+            out += c;
+        }
+    }
+}
+
+void tracer::init(int sample, int slow_ms)
+{
+    m_sample = sample > 0 ? sample : 0;
+    m_slow_ns = slow_ms > 0 ? slow_ms * 1000000LL : 0;
+    s_enabled = m_sample > 0 || m_slow_ns > 0;
+}
+
+tracer::ring *tracer::local()
+{
+    static thread_local ring *t = NULL;
+    if(t == NULL) {
+        t = new ring;
+        t->head.store(0, std::memory_order_relaxed);
+        for(int i = 0; i < RING_SIZE; ++i) {
+            t->slots[i].seq.store(0, std::memory_order_relaxed);
+        }
+        m_lock.lock();
+        m_rings.push_back(t);
+        m_lock.unlock();
+    }
+    return t;
+}
+
+void tracer::commit(const trace_span &span, int fd, int method, int status, bool complete,
+    long long bytes, const char *path)
+{
+    if(!s_enabled) {
+        return;
+    }
+
+    // 请求的起点：第一个有时间戳的阶段
+    long long start = 0;
+    long long end = 0;
+    for(int i = 0; i < T_STAGE_NUM; ++i) {
+        if(span.ns[i] != 0) {
+            if(start == 0) {
+                start = span.ns[i];
+            }
+            end = span.ns[i];
+        }
+    }
+    if(start == 0) {
+        return;
+    }
+
+    // 每个线程独立计数采样，不需要同步
+    static thread_local unsigned int count = 0;
+    bool keep = m_sample > 0 && ++count % m_sample == 0;
+    if(!keep && !(m_slow_ns > 0 && end - start >= m_slow_ns)) {
+        return;
+    }
+
+    ring *r = local();
+    uint64_t head = r->head.load(std::memory_order_relaxed);
+    ring::slot &s = r->slots[head % RING_SIZE];
+    uint32_t seq = s.seq.load(std::memory_order_relaxed);
+    s.seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    trace_rec &rec = s.rec;
+    rec.id = m_next_id.fetch_add(1, std::memory_order_relaxed) + 1;
+    memcpy(rec.ns, span.ns, sizeof(rec.ns));
+    rec.fd = fd;
+    rec.method = method;
+    rec.status = status;
+    rec.complete = complete ? 1 : 0;
+    rec.bytes = bytes;
+    snprintf(rec.path, sizeof(rec.path), "%s", path && path[0] ? path : "-");
+
+    s.seq.store(seq + 2, std::memory_order_release);
+    r->head.store(head + 1, std::memory_order_release);
+}
+
+void tracer::render(std::string &out)
+{
+    m_lock.lock();
+    std::vector<ring *> rings = m_rings;
+    m_lock.unlock();
+
+    // 复制出完整的记录，跳过正在写入或复制期间被覆盖的槽位
+    std::vector<trace_rec> recs;
+    for(size_t i = 0; i < rings.size(); ++i) {
+        ring *r = rings[i];
+        uint64_t head = r->head.load(std::memory_order_acquire);
+        uint64_t first = head > (uint64_t)RING_SIZE ? head - RING_SIZE : 0;
+        for(uint64_t j = first; j < head; ++j) {
+            ring::slot &s = r->slots[j % RING_SIZE];
+            uint32_t before = s.seq.load(std::memory_order_acquire);
+            if(before & 1) {
+                continue;
+            }
+            trace_rec rec;
+            memcpy(&rec, &s.rec, sizeof(rec));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if(s.seq.load(std::memory_order_relaxed) != before) {
+                continue;
+            }
+            recs.push_back(rec);
+        }
+    }
+
+    // 每个请求一条轨道：整个请求一个区间，各阶段为其中嵌套的区间，时间单位为微秒
+    out += "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+    bool first_event = true;
+    for(size_t i = 0; i < recs.size(); ++i) {
+        const trace_rec &rec = recs[i];
+        const char *method = rec.method >= 0 && rec.method < (int)(sizeof(methods) / sizeof(methods[0]))
+            ? methods[rec.method] : "-";
+
+        long long start = 0;
+        long long end = 0;
+        for(int k = 0; k < T_STAGE_NUM; ++k) {
+            if(rec.ns[k] != 0) {
+                if(start == 0) {
+                    start = rec.ns[k];
+                }
+                end = rec.ns[k];
+            }
+        }
+
+        append(out, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":%llu,\"args\":{\"name\":\"#%llu %s ",
+            first_event ? "" : ",\n", (unsigned long long)rec.id, (unsigned long long)rec.id, method);
+        append_escaped(out, rec.path);
+        out += "\"}}";
+        first_event = false;
+
+        append(out, ",\n{\"ph\":\"X\",\"name\":\"%s ", method);
+        append_escaped(out, rec.path);
+        append(out, "\",\"cat\":\"request\",\"pid\":1,\"tid\":%llu,\"ts\":%.3f,\"dur\":%.3f,"
+            "\"args\":{\"fd\":%d,\"status\":%d,\"bytes\":%lld,\"complete\":%d}}",
+            (unsigned long long)rec.id, start / 1000.0, (end - start) / 1000.0,
+            rec.fd, rec.status, rec.bytes, rec.complete);
+
+        // 相邻两个有时间戳的阶段之间为一个区间，以结束阶段命名
+        long long prev = start;
+        for(int k = 0; k < T_STAGE_NUM; ++k) {
+            if(rec.ns[k] == 0 || rec.ns[k] == start) {
+                continue;
+            }
+            long long t = rec.ns[k] > prev ? rec.ns[k] : prev;
+            append(out, ",\n{\"ph\":\"X\",\"name\":\"%s\",\"cat\":\"stage\",\"pid\":1,\"tid\":%llu,\"ts\":%.3f,\"dur\":%.3f}",
+                phase_names[k], (unsigned long long)rec.id, prev / 1000.0, (t - prev) / 1000.0);
+            prev = t;
+        }
+    }
+    out += "\n]}\n";
+}
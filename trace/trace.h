@@ -0,0 +1,143 @@
+/**请求追踪
+ * 每个请求在各阶段的边界记录单调时钟的时间戳：接受连接、读完请求、放入线程池、被取出、解析完成、
+ * 获得数据库连接、数据库操作完成、发出第一个字节、发出最后一个字节
+ * - 时间戳记在连接对象自己的 trace_span 中，不加锁；数据库连接池通过线程局部的当前请求记录时间戳
+ * - 请求结束时按采样率或慢请求阈值决定是否保留，保留的请求写入结束线程自己的环形缓冲区，写满后覆盖最旧的
+ * - 环形缓冲区的每个槽位带序号（seqlock），导出时跳过正在被覆盖的槽位，写入方不需要等待
+ * - 导出为 Chrome trace JSON，可在 chrome://tracing 或 Perfetto 中打开，每个请求一条轨道
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include "../lock/locker.h"
+
+// 请求的阶段边界
+enum TRACE_STAGE {
+    T_ACCEPT = 0,       // 接受连接，只有连接上的第一个请求有
+    T_READ,             // 读到完整的请求
+    T_ENQUEUE,          // 放入线程池队列
+    T_DEQUEUE,          // 工作线程取出
+    T_PARSE,            // 请求行、请求头解析完成
+    T_DB_ACQUIRED,      // 获得数据库连接，异步时为提交
+    T_DB_DONE,          // 数据库操作完成
+    T_FIRST_BYTE,       // 发出响应的第一个字节
+    T_LAST_BYTE,        // 发出响应的最后一个字节
+    T_STAGE_NUM
+};
+
+// 单调时钟的纳秒数
+inline long long trace_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+class tracer;
+
+// 一个请求的时间戳，每个阶段只记录第一次（异步数据库操作后重新排队不覆盖）
+struct trace_span {
+    long long ns[T_STAGE_NUM];
+
+    void clear() { memset(ns, 0, sizeof(ns)); }
+    inline void stamp(int stage);
+    void set(int stage, long long t)
+    {
+        if(ns[stage] == 0) {
+            ns[stage] = t;
+        }
+    }
+
+    // 当前线程正在处理的请求，供不持有连接对象的模块（数据库连接池）记录时间戳
+    static thread_local trace_span *current;
+};
+
+// 在作用域内将 span 设为当前线程正在处理的请求
+class trace_scope {
+public:
+    explicit trace_scope(trace_span *span) { trace_span::current = span; }
+    ~trace_scope() { trace_span::current = NULL; }
+};
+
+// 保留下来的请求
+struct trace_rec {
+    uint64_t id;
+    long long ns[T_STAGE_NUM];
+    int fd;
+    int method;             // http_conn::METHOD
+    int status;
+    int complete;           // 1 为响应发送完成
+    long long bytes;
+    char path[64];
+};
+
+class tracer {
+public:
+    static const int RING_SIZE = 1024;  // 每个线程保留的请求数
+
+    static tracer *get_instance()
+    {
+        static tracer instance;
+        return &instance;
+    }
+
+    // 每 sample 个请求保留一个，超过 slow_ms 的请求总是保留，都为 0 时关闭
+    void init(int sample, int slow_ms);
+
+    // 在启动工作线程之前设置，之后只读
+    static bool enabled() { return s_enabled; }
+
+    // 请求结束时调用，决定是否保留
+    void commit(const trace_span &span, int fd, int method, int status, bool complete,
+        long long bytes, const char *path);
+
+    // 追加所有线程保留的请求，Chrome trace JSON 格式
+    void render(std::string &out);
+
+    // 当前线程正在处理的请求到达某个阶段
+    static void stamp_current(int stage)
+    {
+        if(s_enabled && trace_span::current) {
+            trace_span::current->stamp(stage);
+        }
+    }
+
+private:
+    // 一个线程的环形缓冲区，只由该线程写入
+    struct ring {
+        struct slot {
+            std::atomic<uint32_t> seq;  // 奇数表示正在写入
+            trace_rec rec;
+        };
+        std::atomic<uint64_t> head;     // 已写入的总数
+        slot slots[RING_SIZE];
+    };
+
+    tracer() : m_sample(0), m_slow_ns(0), m_next_id(0), m_lock("tracer") {}
+
+    ring *local();
+
+private:
+    static bool s_enabled;
+    int m_sample;
+    long long m_slow_ns;
+    std::atomic<uint64_t> m_next_id;
+    locker m_lock;              // 保护 m_rings
+    std::vector<ring *> m_rings;
+};
+
+inline void trace_span::stamp(int stage)
+{
+    if(tracer::enabled() && ns[stage] == 0) {
+        ns[stage] = trace_now();
+    }
+}
+
+#endif
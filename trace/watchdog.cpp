@@ -0,0 +1,133 @@
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <execinfo.h>
+
+#include "watchdog.h"
+#include "stack.h"
+#include "../log/log.h"
+#include "../metrics/metrics.h"
+
+// 采集调用栈的信号，主线程其余的信号由管道统一处理
+#define WATCHDOG_SIGNAL (SIGRTMIN)
+
+// 调用栈开头的信号处理函数和信号返回帧
+static const int SKIP_FRAMES = 2;
+
+static const char *phase_names[] = {"events", "timers"};
+
+static long long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+loop_watchdog::loop_watchdog()
+    : m_close_log(1), m_stall_ns(0), m_started(false), m_stop(false), m_start_ns(0), m_iteration(0),
+      m_phase(PHASE_EVENTS), m_depth(0), m_sampled(false)
+{
+}
+
+loop_watchdog::~loop_watchdog()
+{
+    if(m_started) {
+        m_stop.store(true);
+        pthread_join(m_tid, NULL);
+    }
+}
+
+bool loop_watchdog::init(int stall_ms, int close_log)
+{
+    m_close_log = close_log;
+    m_loop_tid = pthread_self();
+    if(stall_ms <= 0) {
+        return true;
+    }
+    m_stall_ns = stall_ms * 1000000LL;
+
+    // 被中断的系统调用自动重启，不影响主线程上的 recv、writev
+    stack_prepare();
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = sample_handler;
+    sa.sa_flags = SA_RESTART;
+    sigfillset(&sa.sa_mask);
+    if(sigaction(WATCHDOG_SIGNAL, &sa, NULL) != 0) {
+        return false;
+    }
+
+    if(pthread_create(&m_tid, NULL, worker, this) != 0) {
+        return false;
+    }
+    m_started = true;
+    return true;
+}
+
+void loop_watchdog::sample_handler(int sig)
+{
+    int saved_errno = errno;
+    loop_watchdog *w = get_instance();
+    w->m_depth = backtrace(w->m_frames, MAX_FRAMES);
+    w->m_sampled.store(true, std::memory_order_release);
+    errno = saved_errno;
+}
+
+void *loop_watchdog::worker(void *arg)
+{
+    pthread_setname_np(pthread_self(), "watchdog");
+    loop_watchdog *w = (loop_watchdog *)arg;
+    w->run();
+    return NULL;
+}
+
+void loop_watchdog::run()
+{
+    // 检查周期为阈值的 1/4，卡顿最多晚 1/4 个阈值被发现
+    long long period_ns = m_stall_ns / 4 > 1000000 ? m_stall_ns / 4 : 1000000;
+    struct timespec period;
+    period.tv_sec = period_ns / 1000000000;
+    period.tv_nsec = period_ns % 1000000000;
+
+    unsigned long long reported = 0;
+    while(!m_stop.load(std::memory_order_relaxed)) {
+        nanosleep(&period, NULL);
+
+        long long start = m_start_ns.load(std::memory_order_acquire);
+        unsigned long long iteration = m_iteration.load(std::memory_order_relaxed);
+        if(start == 0 || iteration == reported) {
+            continue;
+        }
+        long long stalled = now_ns() - start;
+        if(stalled < m_stall_ns) {
+            continue;
+        }
+        reported = iteration;
+        report(stalled, m_phase.load(std::memory_order_relaxed));
+    }
+}
+
+void loop_watchdog::report(long long stalled_ns, int phase)
+{
+    metrics::get_instance()->add(M_LOOP_STALLS);
+
+    // 采集主线程的调用栈，最多等待 100ms
+    m_sampled.store(false, std::memory_order_relaxed);
+    int depth = 0;
+    if(pthread_kill(m_loop_tid, WATCHDOG_SIGNAL) == 0) {
+        for(int i = 0; i < 100 && !m_sampled.load(std::memory_order_acquire); ++i) {
+            struct timespec t = {0, 1000000};
+            nanosleep(&t, NULL);
+        }
+        if(m_sampled.load(std::memory_order_acquire)) {
+            depth = m_depth;
+        }
+    }
+
+    LOG_WARN("event loop stalled for %lld ms in %s", stalled_ns / 1000000, phase_names[phase & 1]);
+    for(int i = SKIP_FRAMES; i < depth; ++i) {
+        std::string name = stack_symbol(m_frames[i]);
+        LOG_WARN("  #%d %p %s", i - SKIP_FRAMES, m_frames[i], name.c_str());
+    }
+}
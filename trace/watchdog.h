@@ -0,0 +1,72 @@
+/**事件循环卡顿监测
+ * 主线程在每轮 epoll_wait 返回时记录开始时间，处理完本轮事件、进入下一次 epoll_wait 前清零
+ * 监测线程周期性检查，本轮处理时间超过阈值时：
+ * - 向主线程发送信号，在信号处理函数中用 backtrace() 采集主线程此刻的调用栈
+ * - 由监测线程符号化并写入日志：卡顿时长、所在阶段（处理事件或定时器）、调用栈
+ * 每轮最多报告一次；主线程只做两次原子写，不加锁
+ */
+
+#ifndef WATCHDOG_H
+#define WATCHDOG_H
+
+#include <pthread.h>
+#include <atomic>
+
+class loop_watchdog {
+public:
+    static const int MAX_FRAMES = 32;
+
+    // 事件循环的阶段
+    enum PHASE
+    {
+        PHASE_EVENTS = 0,   // 处理 epoll 事件
+        PHASE_TIMERS        // 处理定时器和周期任务
+    };
+
+    static loop_watchdog *get_instance()
+    {
+        static loop_watchdog instance;
+        return &instance;
+    }
+
+    // 在主线程中调用，stall_ms 为 0 时不启动监测线程
+    bool init(int stall_ms, int close_log);
+
+    /* 主线程调用 */
+    void begin(long long now_ns)
+    {
+        m_phase.store(PHASE_EVENTS, std::memory_order_relaxed);
+        m_iteration.store(m_iteration.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        m_start_ns.store(now_ns, std::memory_order_release);
+    }
+    void phase(int phase) { m_phase.store(phase, std::memory_order_relaxed); }
+    void end() { m_start_ns.store(0, std::memory_order_release); }
+
+private:
+    loop_watchdog();
+    ~loop_watchdog();
+
+    static void *worker(void *arg);
+    void run();
+    static void sample_handler(int sig);
+    void report(long long stalled_ns, int phase);
+
+private:
+    int m_close_log;
+    long long m_stall_ns;
+    pthread_t m_loop_tid;               // 事件循环所在的线程
+    pthread_t m_tid;
+    bool m_started;
+    std::atomic<bool> m_stop;
+
+    std::atomic<long long> m_start_ns;  // 本轮开始的时间，0 表示正在 epoll_wait
+    std::atomic<unsigned long long> m_iteration;
+    std::atomic<int> m_phase;
+
+    // 信号处理函数写入的调用栈
+    void *m_frames[MAX_FRAMES];
+    int m_depth;
+    std::atomic<bool> m_sampled;
+};
+
+#endif
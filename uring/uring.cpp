@@ -0,0 +1,424 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+
+#include "uring.h"
+#include "../log/log.h"
+#include "../metrics/metrics.h"
+
+bool uring::s_active = false;
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+uring::uring() : m_close_log(0), m_ring_fd(-1), m_event_fd(-1), m_event_val(0), m_sq_local(0), m_sqes(NULL),
+    m_sq_ring(MAP_FAILED), m_cq_ring(MAP_FAILED), m_buf_ring(NULL), m_buf_ring_ok(false), m_bufs(NULL),
+    m_conns(NULL), m_max_fd(0), m_lock("uring.notice")
+{
+}
+
+uring::~uring()
+{
+    cleanup();
+}
+
+/* 关闭环并解除所有映射，init 失败时和析构时调用，可重复调用 */
+void uring::cleanup()
+{
+    // 先关闭环，内核随之注销缓冲区环，再解除用户空间的映射
+    if(m_ring_fd != -1) {
+        ::close(m_ring_fd);
+        m_ring_fd = -1;
+    }
+    if(m_sqes) {
+        munmap(m_sqes, m_sqes_size);
+        m_sqes = NULL;
+    }
+    if(m_cq_ring != MAP_FAILED && m_cq_ring != m_sq_ring) {
+        munmap(m_cq_ring, m_cq_ring_size);
+    }
+    m_cq_ring = MAP_FAILED;
+    if(m_sq_ring != MAP_FAILED) {
+        munmap(m_sq_ring, m_sq_ring_size);
+        m_sq_ring = MAP_FAILED;
+    }
+    if(m_buf_ring) {
+        munmap(m_buf_ring, BUF_COUNT * sizeof(struct io_uring_buf));
+        m_buf_ring = NULL;
+    }
+    if(m_event_fd != -1) {
+        ::close(m_event_fd);
+        m_event_fd = -1;
+    }
+    delete[] m_conns;
+    m_conns = NULL;
+    delete[] m_bufs;
+    m_bufs = NULL;
+}
+
+bool uring::init(int max_fd, int close_log)
+{
+    m_close_log = close_log;
+
+    // 只有主线程提交，完成事件在主线程调用 io_uring_enter 时才处理；旧内核不支持时去掉这两个标志
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+    p.cq_entries = CQ_ENTRIES;
+    m_ring_fd = sys_io_uring_setup(SQ_ENTRIES, &p);
+    if(m_ring_fd < 0 && errno == EINVAL) {
+        memset(&p, 0, sizeof(p));
+        p.flags = IORING_SETUP_CQSIZE;
+        p.cq_entries = CQ_ENTRIES;
+        m_ring_fd = sys_io_uring_setup(SQ_ENTRIES, &p);
+    }
+    if(m_ring_fd < 0) {
+        LOG_ERROR("io_uring_setup failed, errno is %d", errno);
+        cleanup();
+        return false;
+    }
+
+    // 环形队列映射到用户空间，新内核上提交和完成队列共用一次映射
+    m_sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    m_cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if(single && m_cq_ring_size > m_sq_ring_size) {
+        m_sq_ring_size = m_cq_ring_size;
+    }
+    m_sq_ring = mmap(NULL, m_sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd,
+        IORING_OFF_SQ_RING);
+    if(m_sq_ring == MAP_FAILED) {
+        LOG_ERROR("mmap io_uring sq ring failed, errno is %d", errno);
+        cleanup();
+        return false;
+    }
+    m_cq_ring = single ? m_sq_ring : mmap(NULL, m_cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        m_ring_fd, IORING_OFF_CQ_RING);
+    if(m_cq_ring == MAP_FAILED) {
+        LOG_ERROR("mmap io_uring cq ring failed, errno is %d", errno);
+        cleanup();
+        return false;
+    }
+    m_sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    void *sqes = mmap(NULL, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd,
+        IORING_OFF_SQES);
+    if(sqes == MAP_FAILED) {
+        LOG_ERROR("mmap io_uring sqes failed, errno is %d", errno);
+        cleanup();
+        return false;
+    }
+    m_sqes = (struct io_uring_sqe *)sqes;
+
+    char *sq = (char *)m_sq_ring;
+    m_sq_head = (unsigned *)(sq + p.sq_off.head);
+    m_sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    m_sq_mask = *(unsigned *)(sq + p.sq_off.ring_mask);
+    m_sq_entries = *(unsigned *)(sq + p.sq_off.ring_entries);
+    m_sq_local = *m_sq_tail;
+    // 提交队列的下标数组固定为恒等映射
+    unsigned *array = (unsigned *)(sq + p.sq_off.array);
+    for(unsigned i = 0; i < m_sq_entries; ++i) {
+        array[i] = i;
+    }
+    char *cq = (char *)m_cq_ring;
+    m_cq_head = (unsigned *)(cq + p.cq_off.head);
+    m_cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    m_cq_mask = *(unsigned *)(cq + p.cq_off.ring_mask);
+    m_cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    // 提供的接收缓冲区：环本身按页对齐，缓冲区连续分配，下标即缓冲区编号
+    size_t ring_size = BUF_COUNT * sizeof(struct io_uring_buf);
+    void *ring = mmap(NULL, ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(ring == MAP_FAILED) {
+        LOG_ERROR("mmap io_uring buffer ring failed, errno is %d", errno);
+        cleanup();
+        return false;
+    }
+    m_buf_ring = (struct io_uring_buf_ring *)ring;
+    memset(ring, 0, ring_size);
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)ring;
+    reg.ring_entries = BUF_COUNT;
+    reg.bgid = BUF_GROUP;
+    if(sys_io_uring_register(m_ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        LOG_ERROR("register io_uring buffer ring failed, errno is %d", errno);
+        cleanup();
+        return false;
+    }
+    m_bufs = new char[BUF_COUNT * BUF_SIZE];
+    for(int i = 0; i < BUF_COUNT; ++i) {
+        struct io_uring_buf *buf = ring_buf(i);
+        buf->addr = (uint64_t)(uintptr_t)(m_bufs + i * BUF_SIZE);
+        buf->len = BUF_SIZE;
+        buf->bid = i;
+    }
+    __atomic_store_n(&m_buf_ring->tail, (uint16_t)BUF_COUNT, __ATOMIC_RELEASE);
+
+    // 有的内核上注册成功但选不到缓冲区，先接收一次检查；不可用时改为逐个提供缓冲区（PROVIDE_BUFFERS）
+    m_buf_ring_ok = true;
+    if(!probe_buf_ring()) {
+        m_buf_ring_ok = false;
+        sys_io_uring_register(m_ring_fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+        provide(0, BUF_COUNT);
+    }
+
+    m_event_fd = eventfd(0, EFD_CLOEXEC);
+    if(m_event_fd < 0) {
+        LOG_ERROR("eventfd failed, errno is %d", errno);
+        cleanup();
+        return false;
+    }
+
+    m_max_fd = max_fd;
+    m_conns = new conn_io[max_fd];
+    for(int i = 0; i < max_fd; ++i) {
+        m_conns[i].gen = 0;
+        m_conns[i].open = false;
+    }
+    m_owner = pthread_self();
+    s_active = true;
+    arm_notify();
+    LOG_INFO("io_uring backend: %u sq entries, %u cq entries, %d receive buffers of %d bytes in a %s%s", p.sq_entries,
+        p.cq_entries, BUF_COUNT, BUF_SIZE, m_buf_ring_ok ? "buffer ring" : "provided buffer group",
+        (p.flags & IORING_SETUP_DEFER_TASKRUN) ? ", deferred task run" : "");
+    return true;
+}
+
+/* 用一对本地 socket 接收一个字节，检查缓冲区环能否选出缓冲区 */
+bool uring::probe_buf_ring()
+{
+    int sv[2];
+    if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0) {
+        return false;
+    }
+    bool ok = false;
+    if(::write(sv[1], "x", 1) == 1) {
+        struct io_uring_sqe *sqe = get_sqe();
+        sqe->opcode = IORING_OP_RECV;
+        sqe->fd = sv[0];
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = BUF_GROUP;
+        struct io_uring_cqe cqe;
+        if(wait(true) == 0 && next(cqe)) {
+            ok = cqe.res == 1;
+            recycle(cqe);
+        }
+    }
+    ::close(sv[0]);
+    ::close(sv[1]);
+    return ok;
+}
+
+/* 取一个空闲的提交项，队列已满时先提交已准备的请求 */
+struct io_uring_sqe *uring::get_sqe()
+{
+    while(m_sq_local - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE) >= m_sq_entries) {
+        __atomic_store_n(m_sq_tail, m_sq_local, __ATOMIC_RELEASE);
+        int ret = sys_io_uring_enter(m_ring_fd, m_sq_entries, 0, IORING_ENTER_GETEVENTS);
+        metrics::get_instance()->add(M_SYS_URING_ENTER);
+        if(ret > 0) {
+            metrics::get_instance()->add(M_URING_SQES, ret);
+        }
+    }
+    struct io_uring_sqe *sqe = &m_sqes[m_sq_local & m_sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    ++m_sq_local;
+    return sqe;
+}
+
+void uring::accept(int listenfd)
+{
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listenfd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    // 与 epoll 后端的 accept4 相同，接受时即设置非阻塞
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->user_data = data(OP_ACCEPT, listenfd, 0);
+}
+
+void uring::recv(int fd)
+{
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUF_GROUP;
+    sqe->user_data = data(OP_RECV, fd, m_conns[fd].gen);
+    m_conns[fd].recving = true;
+}
+
+void uring::send(int fd, struct iovec *iov, int count)
+{
+    conn_io &c = m_conns[fd];
+    memset(&c.msg, 0, sizeof(c.msg));
+    c.msg.msg_iov = iov;
+    c.msg.msg_iovlen = count;
+
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)&c.msg;
+    sqe->len = 1;
+    // 发送缓冲区满时由内核等待并继续发送，只在出错或全部发完时完成
+    sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+    sqe->user_data = data(OP_SEND, fd, c.gen);
+}
+
+void uring::poll(int fd)
+{
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = POLLIN;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = data(OP_POLL, fd, 0);
+}
+
+void uring::arm_notify()
+{
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = m_event_fd;
+    sqe->addr = (uint64_t)(uintptr_t)&m_event_val;
+    sqe->len = sizeof(m_event_val);
+    sqe->user_data = data(OP_NOTIFY, m_event_fd, 0);
+}
+
+int uring::wait(bool block)
+{
+    unsigned to_submit = m_sq_local - *m_sq_tail;
+    __atomic_store_n(m_sq_tail, m_sq_local, __ATOMIC_RELEASE);
+    int ret = sys_io_uring_enter(m_ring_fd, to_submit, block ? 1 : 0, IORING_ENTER_GETEVENTS);
+    metrics *m = metrics::get_instance();
+    m->add(M_SYS_URING_ENTER);
+    if(ret > 0) {
+        m->add(M_URING_SQES, ret);
+    }
+    // 被信号中断时请求已提交，返回后由信号管道处理
+    if(ret < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+        return -1;
+    }
+    return 0;
+}
+
+bool uring::next(struct io_uring_cqe &cqe)
+{
+    unsigned head = *m_cq_head;
+    if(head == __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+    cqe = m_cqes[head & m_cq_mask];
+    __atomic_store_n(m_cq_head, head + 1, __ATOMIC_RELEASE);
+    metrics::get_instance()->add(M_URING_CQES);
+    return true;
+}
+
+void uring::provide(int bid, int count)
+{
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+    sqe->fd = count;
+    sqe->addr = (uint64_t)(uintptr_t)(m_bufs + bid * BUF_SIZE);
+    sqe->len = BUF_SIZE;
+    sqe->off = bid;
+    sqe->buf_group = BUF_GROUP;
+    // 成功时不产生完成事件
+    sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+    sqe->user_data = data(OP_PROVIDE, 0, 0);
+}
+
+void uring::recycle(const struct io_uring_cqe &cqe)
+{
+    if(!(cqe.flags & IORING_CQE_F_BUFFER)) {
+        return;
+    }
+    uint16_t bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+    if(!m_buf_ring_ok) {
+        provide(bid, 1);
+        return;
+    }
+    uint16_t tail = m_buf_ring->tail;
+    struct io_uring_buf *buf = ring_buf(tail & (BUF_COUNT - 1));
+    buf->addr = (uint64_t)(uintptr_t)(m_bufs + bid * BUF_SIZE);
+    buf->len = BUF_SIZE;
+    buf->bid = bid;
+    __atomic_store_n(&m_buf_ring->tail, (uint16_t)(tail + 1), __ATOMIC_RELEASE);
+}
+
+void uring::open(int fd)
+{
+    conn_io &c = m_conns[fd];
+    ++c.gen;
+    c.open = true;
+    c.busy = false;
+    c.recving = false;
+    c.ready = false;
+    c.stash.clear();
+}
+
+void uring::close(int fd)
+{
+    conn_io &c = m_conns[fd];
+    if(!c.open) {
+        return;
+    }
+    ++c.gen;
+    c.open = false;
+    c.recving = false;
+    c.ready = false;
+    std::string().swap(c.stash);
+    shutdown(fd, SHUT_RDWR);
+    metrics::get_instance()->add(M_SYS_SHUTDOWN);
+}
+
+void uring::post(int fd, int ev)
+{
+    // close_conn() 之后的 modfd() 传入的是 -1
+    if(fd < 0 || fd >= m_max_fd) {
+        return;
+    }
+    notice n;
+    n.fd = fd;
+    n.ev = ev;
+    m_lock.lock();
+    bool wake = m_notices.empty();
+    m_notices.push_back(n);
+    m_lock.unlock();
+    // 主线程每轮等待前都会取完队列，只有队列由空变为非空时才需要唤醒
+    if(wake && !pthread_equal(pthread_self(), m_owner)) {
+        uint64_t one = 1;
+        metrics::get_instance()->add(M_SYS_EVENTFD);
+        if(::write(m_event_fd, &one, sizeof(one)) < 0) {
+            LOG_ERROR("write eventfd failed, errno is %d", errno);
+        }
+    }
+}
+
+bool uring::take(std::vector<notice> &out)
+{
+    out.clear();
+    m_lock.lock();
+    out.swap(m_notices);
+    m_lock.unlock();
+    return !out.empty();
+}
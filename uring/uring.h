@@ -0,0 +1,164 @@
+/**io_uring 连接 I/O 后端
+ * 启动时选择（-y uring），创建失败时回退到 epoll；只替换客户连接的 I/O，其余不变：
+ * - 监听 socket 上一个多次 accept（multishot），每个连接一个多次接收（multishot recv），
+ *   数据放入内核从提供的缓冲区环（provided buffer ring）中选出的缓冲区，复制到连接的读缓冲后立即归还；
+ *   缓冲区环不可用的内核上改用 PROVIDE_BUFFERS 提供同一组缓冲区
+ * - 响应的头部和映射的文件用一个 SENDMSG 发送（MSG_WAITALL，由内核重试到发完）
+ * - 信号管道和存储后端的 socket 仍注册在原来的 epoll 上，由一个多次 poll 监听该 epoll
+ * - 工作线程通过 modfd()/removefd() 投递的事件放入队列，用 eventfd 唤醒主线程
+ * 本轮产生的提交请求在下一次 io_uring_enter 时一起提交，并同时等待完成
+ * 环只由主线程提交和收割（SINGLE_ISSUER、DEFER_TASKRUN），只有 post() 可在工作线程中调用
+ * 不依赖 liburing，直接使用系统调用
+ */
+
+#ifndef URING_H
+#define URING_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+#include "../lock/locker.h"
+
+class uring {
+public:
+    static const unsigned SQ_ENTRIES = 1024;
+    static const unsigned CQ_ENTRIES = 8192;
+    static const int BUF_COUNT = 1024;      // 提供给内核的接收缓冲区个数，2 的幂
+    static const int BUF_SIZE = 2048;       // 每个接收缓冲区的大小，与连接的读缓冲区相同
+    static const int BUF_GROUP = 0;
+
+    // user_data 的高 8 位为请求类型，中间 24 位为连接的代数，低 32 位为描述符
+    enum OP {
+        OP_ACCEPT = 1,  // 监听 socket 上的多次 accept
+        OP_RECV,        // 连接上的多次接收
+        OP_SEND,        // 发送响应
+        OP_NOTIFY,      // 读 eventfd，工作线程投递了事件
+        OP_POLL,        // 原 epoll 可读
+        OP_PROVIDE      // 归还接收缓冲区，只在出错时完成
+    };
+
+    // 主线程中每个连接的 I/O 状态
+    struct conn_io {
+        uint32_t gen;           // 每次接受、关闭时加一，丢弃旧连接的完成事件
+        bool open;
+        bool busy;              // 请求已交给工作线程或正在发送响应，收到的数据先暂存
+        bool recving;           // 多次接收仍有效
+        bool ready;             // 读缓冲中有新数据，本轮结束时投递
+        std::string stash;      // busy 期间收到的数据
+        struct msghdr msg;      // 发送中的响应
+    };
+
+    // 工作线程投递的事件，ev 为 EPOLLIN、EPOLLOUT，0 表示关闭连接
+    struct notice {
+        int fd;
+        int ev;
+    };
+
+    static uring *get_instance()
+    {
+        static uring instance;
+        return &instance;
+    }
+
+    // 创建环、注册接收缓冲区和 eventfd，失败时返回 false，此时仍使用 epoll
+    bool init(int max_fd, int close_log);
+    static bool active() { return s_active; }
+
+    /* 准备提交请求，在下一次 wait() 时一起提交 */
+    void accept(int listenfd);
+    void recv(int fd);
+    void send(int fd, struct iovec *iov, int count);
+    void poll(int fd);
+    void arm_notify();
+
+    // 提交所有准备好的请求，block 为 true 时等待至少一个完成
+    int wait(bool block);
+    // 取出下一个完成事件，没有时返回 false
+    bool next(struct io_uring_cqe &cqe);
+
+    static int op_of(uint64_t data) { return (int)(data >> 56); }
+    static uint32_t gen_of(uint64_t data) { return (uint32_t)(data >> 32) & 0xFFFFFF; }
+    static int fd_of(uint64_t data) { return (int)(uint32_t)data; }
+
+    // 完成事件是否属于该连接当前的代数
+    bool current(const struct io_uring_cqe &cqe) const
+    {
+        const conn_io &c = m_conns[fd_of(cqe.user_data)];
+        return c.open && (c.gen & 0xFFFFFF) == gen_of(cqe.user_data);
+    }
+
+    // 接收完成事件选中的缓冲区，用完后归还
+    char *buffer(const struct io_uring_cqe &cqe) { return m_bufs + (cqe.flags >> IORING_CQE_BUFFER_SHIFT) * BUF_SIZE; }
+    void recycle(const struct io_uring_cqe &cqe);
+
+    /* 连接 */
+    conn_io &conn(int fd) { return m_conns[fd]; }
+    void open(int fd);
+    // 关闭前调用：shutdown 结束未完成的接收、发送，否则环仍持有 socket，关闭后不会发出 FIN
+    void close(int fd);
+
+    /* 工作线程投递事件，任意线程可调用 */
+    void post(int fd, int ev);
+    // 取出所有投递的事件，没有时返回 false
+    bool take(std::vector<notice> &out);
+
+private:
+    uring();
+    ~uring();
+
+    void cleanup();
+    // 缓冲区环的第 i 项。C++ 中 __DECLARE_FLEX_ARRAY 展开后 bufs 的偏移为 8 而不是 0，不能用 m_buf_ring->bufs
+    struct io_uring_buf *ring_buf(int i) { return (struct io_uring_buf *)m_buf_ring + i; }
+    struct io_uring_sqe *get_sqe();
+    bool probe_buf_ring();
+    void provide(int bid, int count);
+    static uint64_t data(int op, int fd, uint32_t gen)
+    {
+        return ((uint64_t)op << 56) | ((uint64_t)(gen & 0xFFFFFF) << 32) | (uint32_t)fd;
+    }
+
+private:
+    static bool s_active;
+    int m_close_log;
+    int m_ring_fd;
+    int m_event_fd;
+    uint64_t m_event_val;       // OP_NOTIFY 读入的计数
+
+    /* 提交队列 */
+    unsigned *m_sq_head;
+    unsigned *m_sq_tail;
+    unsigned m_sq_mask;
+    unsigned m_sq_entries;
+    unsigned m_sq_local;        // 已准备的尾部，提交时写入 m_sq_tail
+    struct io_uring_sqe *m_sqes;
+
+    /* 完成队列 */
+    unsigned *m_cq_head;
+    unsigned *m_cq_tail;
+    unsigned m_cq_mask;
+    struct io_uring_cqe *m_cqes;
+
+    void *m_sq_ring;
+    void *m_cq_ring;
+    size_t m_sq_ring_size;
+    size_t m_cq_ring_size;
+    size_t m_sqes_size;
+
+    /* 提供的接收缓冲区 */
+    struct io_uring_buf_ring *m_buf_ring;
+    bool m_buf_ring_ok;         // 缓冲区环可用，否则用 PROVIDE_BUFFERS
+    char *m_bufs;
+
+    conn_io *m_conns;
+    int m_max_fd;
+
+    locker m_lock;                  // 保护 m_notices
+    std::vector<notice> m_notices;
+    pthread_t m_owner;              // 主线程，投递时不需要唤醒
+};
+
+#endif
@@ -15,10 +15,22 @@ WebServer::WebServer()
 
     // 定时器
     users_timer = new client_data[MAX_FD];
+
+    m_store = NULL;
+    m_db_done_fd = -1;
+    m_uring = false;
+    m_epoll_ready = false;
+    m_now = time(NULL);
 }
 
 WebServer::~WebServer()
 {
+    // 先停止存储后端的写入线程，其回调引用的连接对象和线程池在下面释放
+    if(m_store) {
+        m_store->stop();
+    }
+    http_conn::m_threadpool = NULL;
+
     close(m_epollfd);
     close(m_listenfd);
     close(m_pipefd[1]);
@@ -26,42 +38,128 @@ WebServer::~WebServer()
     delete[] users;
     delete[] users_timer;
     delete m_pool;
+    delete m_store;
 }
 
-void WebServer::init(int port, int thread_num, int close_log, int sql_num,
-    std::string user, std::string password, std::string dbname)
+void WebServer::init(const server_config &config)
 {
-    m_port = port;
-    m_user = user;
-    m_password = password;
-    m_dbname = dbname;
-    m_sql_num =  sql_num;
-    m_thread_num = thread_num;
-    m_close_log = close_log;
+    m_port = config.port;
+    m_storage = config.storage;
+    m_db_host = config.db_host;
+    m_db_port = config.db_port;
+    m_user = config.user;
+    m_password = config.password;
+    m_dbname = config.dbname;
+    m_sql_num = config.sql_num;
+    m_sql_min = config.sql_min;
+    m_async_num = config.async_num;
+    m_batch_num = config.batch_num;
+    m_load_num = config.load_num;
+    m_snapshot = config.snapshot;
+    m_thread_num = config.thread_num;
+    m_close_log = config.close_log;
+    m_log_binary = config.log_binary;
+    m_log_level = config.log_level;
+    m_log_overflow = config.log_overflow;
+    m_log_split_mb = config.log_split_mb;
+    m_log_compress = config.log_compress;
+    m_log_keep = config.log_keep;
+    m_access = config.access;
+    m_stall_ms = config.stall_ms;
+    m_profile_hz = config.profile_hz;
+    m_notsent_lowat = config.notsent_lowat;
+    m_io = config.io;
+    metrics::get_instance()->init(config.expose);
+
+    // 采样率，冒号后为慢请求阈值（毫秒）
+    const std::string &trace = config.trace;
+    int slow_ms = 0;
+    if(trace.find(':') != std::string::npos) {
+        slow_ms = atoi(trace.c_str() + trace.find(':') + 1);
+    }
+    tracer::get_instance()->init(atoi(trace.c_str()), slow_ms);
+    cpu_profiler::get_instance()->init(config.profile_hz, config.close_log);
+    tcp_stats::get_instance()->init(config.tcp_sample_ms);
+    client_tracker::get_instance()->init(config.ip_conn_cap);
 }
 
 void WebServer::log_write()
 {
+    // 保留的文件数，冒号后为总大小（MB），与访问日志共用
+    int keep_files = atoi(m_log_keep.c_str());
+    long long keep_mb = 0;
+    if(m_log_keep.find(':') != std::string::npos) {
+        keep_mb = atoll(m_log_keep.c_str() + m_log_keep.find(':') + 1);
+    }
+
     if (0 == m_close_log) {
-        // 初始化日志，异步写入
-        Log::get_instance()->init("./logs/ServerLog", m_close_log, 2000, 800000, 800);
+        // 缓冲区满时的策略，冒号后为最长等待时间
+        int overflow = Log::OVERFLOW_DROP_LOW;
+        int block_ms = 10;
+        std::string policy = m_log_overflow.substr(0, m_log_overflow.find(':'));
+        if(policy == "block") {
+            overflow = Log::OVERFLOW_BLOCK;
+        }
+        else if(policy == "drop") {
+            overflow = Log::OVERFLOW_DROP;
+        }
+        if(m_log_overflow.find(':') != std::string::npos) {
+            block_ms = atoi(m_log_overflow.c_str() + m_log_overflow.find(':') + 1);
+        }
+
+        // 初始化日志，异步写入，每个线程 1MB 缓冲区，每秒刷新
+        Log::get_instance()->init("./logs/ServerLog", m_close_log, 2000, 800000, 1024, 1000, m_log_binary == 1,
+            overflow, block_ms, m_log_split_mb * 1024LL * 1024, m_log_compress == 1, keep_files, keep_mb * 1024 * 1024);
+        Log::set_level(m_log_level);
+        if(policy != "block" && policy != "drop" && policy != "droplow") {
+            LOG_ERROR("unsupported log overflow policy %s, use droplow", m_log_overflow.c_str());
+        }
+    }
+
+    // 访问日志，每个线程 256KB 缓冲区，每秒写入
+    if(m_access != access_log::ACCESS_OFF) {
+        if(!access_log::get_instance()->init("./logs/access", m_access, 256, 1000,
+            m_log_split_mb * 1024LL * 1024, m_log_compress == 1, keep_files, keep_mb * 1024 * 1024)) {
+            LOG_ERROR("%s", "open access log error");
+        }
     }
 }
 
-void WebServer::sql_pool()
+void WebServer::user_store()
 {
-    // 初始化数据库连接池
-    m_conn_pool = Connection_pool::GetInstance();
-    m_conn_pool->init("localhost", m_user, m_password, m_dbname, 3306, m_sql_num, m_close_log);
+    // 初始化凭据存储
+    if(m_storage == "memory") {
+        m_store = new Memory_store();
+    }
+    else if(m_storage == "file" || m_storage.compare(0, 5, "file:") == 0) {
+        // file:路径，默认为当前目录下的 users.log，每次注册都落盘
+        std::string path = m_storage.size() > 5 ? m_storage.substr(5) : "./users.log";
+        m_store = new File_store(path, true, m_close_log);
+    }
+#ifdef USE_MYSQL
+    else if(m_storage == "mysql") {
+        Mysql_store *store = new Mysql_store();
+        store->init(m_db_host, m_user, m_password, m_dbname, m_db_port, m_sql_min, m_sql_num,
+            m_async_num, m_batch_num, m_load_num, m_snapshot, m_close_log);
+        m_store = store;
+    }
+#endif
+    else {
+        LOG_ERROR("unsupported storage %s, fall back to memory", m_storage.c_str());
+        m_store = new Memory_store();
+    }
 
-    // 初始化数据库读取表
-    users->init_mysql_res(m_conn_pool);
+    // 加载已有用户到缓存
+    if(!http_conn::init_store(m_store)) {
+        LOG_ERROR("load users from %s storage error", m_store->name());
+    }
 }
 
 void WebServer::thread_pool()
 {
     // 线程池
-    m_pool = new threadpool<http_conn>( m_conn_pool, m_thread_num);
+    m_pool = new threadpool<http_conn>(m_thread_num);
+    http_conn::m_threadpool = m_pool;
 }
 
 void WebServer::event_listen()
@@ -83,6 +181,12 @@ void WebServer::event_listen()
     // 端口复用，允许新建的连接使用time-wait状态的端口号
     int reuse = 1;
     setsockopt(m_listenfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    // 限制内核中未发送的数据量，接受的连接继承该选项；接收慢的客户端不会把大文件全部缓冲进内核
+    if(m_notsent_lowat > 0) {
+        int lowat = m_notsent_lowat * 1024;
+        setsockopt(m_listenfd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &lowat, sizeof(lowat));
+    }
     
     ret = bind(m_listenfd, (struct sockaddr*)&address, sizeof(address));
     assert(ret >= 0);
@@ -96,17 +200,50 @@ void WebServer::event_listen()
     m_epollfd = epoll_create(5);
     assert(m_epollfd != -1);
 
-    utils.addfd(m_epollfd, m_listenfd, false);
     http_conn::m_epollfd = m_epollfd;
 
+    // 连接 I/O 后端，io_uring 创建失败时回退到 epoll
+    if(m_io == "uring") {
+        m_uring = uring::get_instance()->init(MAX_FD, m_close_log);
+        if(!m_uring) {
+            LOG_ERROR("%s", "io_uring is not available, fall back to epoll");
+        }
+    }
+    else if(m_io != "epoll") {
+        LOG_ERROR("unsupported io backend %s, use epoll", m_io.c_str());
+    }
+    if(m_uring) {
+        // 监听 socket 由多次 accept 处理；信号管道和存储后端仍在 epoll 上，由环监听该 epoll
+        uring::get_instance()->accept(m_listenfd);
+        uring::get_instance()->poll(m_epollfd);
+    }
+    else {
+        utils.addfd(m_epollfd, m_listenfd, false);
+    }
+
     ret = socketpair(PF_UNIX, SOCK_STREAM, 0, m_pipefd);
     assert(ret != -1);;
     utils.setnonblocking(m_pipefd[1]);
     utils.addfd(m_epollfd, m_pipefd[0], false);
 
+    // 存储后端的 socket（如非阻塞数据库连接）与客户连接共用同一个 epoll
+    m_store->add_to_epoll(m_epollfd);
+
+    // 异步数据库操作在写入线程等中完成，经 eventfd 交回主线程恢复请求
+    m_db_done_fd = http_conn::init_db_done();
+    assert(m_db_done_fd != -1);
+    utils.addfd(m_epollfd, m_db_done_fd, false);
+
     utils.addsig(SIGPIPE, SIG_IGN);
     utils.addsig(SIGALRM, utils.sig_handler, false);
     utils.addsig(SIGTERM, utils.sig_handler, false);
+    // 运行中调整日志级别：SIGUSR1 输出更多，SIGUSR2 输出更少
+    utils.addsig(SIGUSR1, utils.sig_handler, false);
+    utils.addsig(SIGUSR2, utils.sig_handler, false);
+    // 触发一次 10 秒的 CPU 分析
+    if(m_profile_hz > 0) {
+        utils.addsig(PROFILE_SIGNAL, utils.sig_handler, false);
+    }
 
     alarm(TIMESLOT);
 
@@ -126,11 +263,11 @@ void WebServer::timer(int connfd, struct sockaddr_in client_address)
     // 创建定时器，设置回调函数和超时时间，绑定用户数据，将定时器添加到链表中
     users_timer[connfd].address = client_address;
     users_timer[connfd].sockfd = connfd;
+    users_timer[connfd].conn = users + connfd;
     util_timer *timer = new util_timer;
     timer->user_data = &users_timer[connfd];
     timer->cb_func = cb_func;
-    time_t cur = time(NULL);
-    timer->expire = cur + 3 * TIMESLOT;
+    timer->expire = m_now + 3 * TIMESLOT;
     users_timer[connfd].timer = timer;
     utils.m_timer_lst.add_timer(timer);
 }
@@ -139,11 +276,10 @@ void WebServer::timer(int connfd, struct sockaddr_in client_address)
 /* 对新的定时器在链表上的位置进行调整 */
 void WebServer::adjust_timer(util_timer *timer)
 {
-    time_t cur = time(NULL);
-    timer->expire = cur + 3 * TIMESLOT;
+    timer->expire = m_now + 3 * TIMESLOT;
     utils.m_timer_lst.adjust_timer(timer);
 
-    LOG_INFO("%s", "adjust timer once");
+    LOG_INFO_RATE(LOG_REQUEST_RATE, "%s", "adjust timer once");
 }
 
 void WebServer::deal_timer(util_timer *timer, int sockfd)
@@ -153,7 +289,7 @@ void WebServer::deal_timer(util_timer *timer, int sockfd)
         utils.m_timer_lst.del_timer(timer);
     }
 
-    LOG_INFO("close fd %d", users_timer[sockfd].sockfd);
+    LOG_INFO_RATE(LOG_REQUEST_RATE, "close fd %d", users_timer[sockfd].sockfd);
 }
 
 bool WebServer::deal_client_data()
@@ -161,23 +297,50 @@ bool WebServer::deal_client_data()
     struct sockaddr_in client_address;
     socklen_t client_addrlen = sizeof(client_address);
     
-    // 边缘触发
+    // 边缘触发；接受时即设置非阻塞，省去两次 fcntl
     while(true) {
-        int connfd = accept(m_listenfd, (struct sockaddr*)&client_address, &client_addrlen);
+        int connfd = accept4(m_listenfd, (struct sockaddr*)&client_address, &client_addrlen, SOCK_NONBLOCK);
+        metrics::get_instance()->add(M_SYS_ACCEPT);
         if(connfd < 0) {
-            LOG_ERROR("%s: errno is %d", "accept error", errno);
+            if(errno != EAGAIN && errno != EWOULDBLOCK) {
+                metrics::get_instance()->add(M_ACCEPT_ERRORS);
+            }
+            LOG_ERROR_RATE(LOG_REQUEST_RATE, "%s: errno is %d", "accept error", errno);
             break;
         }
-        if(http_conn::m_user_count >= MAX_FD) {
-            utils.show_error(connfd, "Internal server busy");
-            LOG_ERROR("%s", "Internal server busy");
+        if(accept_conn(connfd, client_address) < 0) {
             break;
         }
-        timer(connfd, client_address);
     }
     return false;
 }
 
+/* 检查连接上限并初始化新连接，返回 1 为已接受，0 为超过单 IP 上限而拒绝，-1 为连接数已满 */
+int WebServer::accept_conn(int connfd, struct sockaddr_in &client_address)
+{
+    WS_PROBE2(accept, connfd, client_address.sin_addr.s_addr);
+    if(http_conn::m_user_count >= MAX_FD) {
+        WS_PROBE1(reject, connfd);
+        metrics::get_instance()->add(M_REJECTS);
+        utils.show_error(connfd, "Internal server busy");
+        LOG_ERROR("%s", "Internal server busy");
+        return -1;
+    }
+    metrics::get_instance()->add(M_ACCEPTS);
+    // 单 IP 连接数超过上限时拒绝，继续接受其他客户端的连接
+    if(!client_tracker::get_instance()->on_accept(client_address.sin_addr.s_addr)) {
+        WS_PROBE1(reject, connfd);
+        metrics::get_instance()->add(M_IP_REJECTS);
+        utils.show_error(connfd, "Too many connections from this address");
+        char addr[INET_ADDRSTRLEN];
+        LOG_WARN_RATE(LOG_REQUEST_RATE, "too many connections from %s",
+            inet_ntop(AF_INET, &client_address.sin_addr, addr, sizeof(addr)));
+        return 0;
+    }
+    timer(connfd, client_address);
+    return 1;
+}
+
 bool WebServer::deal_signal(bool &timeout, bool &stop_server)
 {
     int ret = 0;
@@ -201,7 +364,26 @@ bool WebServer::deal_signal(bool &timeout, bool &stop_server)
                     stop_server = true;
                     break;
                 }
-
+                case SIGUSR1:
+                case SIGUSR2: {
+                    Log::set_level(Log::get_level() + (signals[i] == SIGUSR1 ? -1 : 1));
+                    LOG_WARN("log level set to %d", Log::get_level());
+                    break;
+                }
+                default: {
+                    // SIGRTMIN 不是常量，不能作为 case 标签
+                    if(signals[i] == PROFILE_SIGNAL) {
+                        int seconds = 10;
+                        std::string file;
+                        if(cpu_profiler::get_instance()->start(seconds, file)) {
+                            LOG_WARN("profiling %ds, folded stacks will be written to %s", seconds, file.c_str());
+                        }
+                        else {
+                            LOG_WARN("%s", "a profile is already running");
+                        }
+                    }
+                    break;
+                }
             }
         }
     }
@@ -212,37 +394,136 @@ void WebServer::deal_read(int sockfd)
 {
     // 创建定时器临时变量，将该连接的定时器取出来
     util_timer *timer = users_timer[sockfd].timer;
+    WS_PROBE1(deal_read, sockfd);
 
     /* Proactor */
     if(users[sockfd].read()) {
-        LOG_INFO("deal with the client(%s)", inet_ntoa(users[sockfd].get_address()->sin_addr));
+        deal_request(sockfd);
+        WS_PROBE2(deal_read_return, sockfd, 1);
+    }
+    else {
+        deal_timer(timer, sockfd);
+        WS_PROBE2(deal_read_return, sockfd, 0);
+    }
+}
 
-        // 若监测到读事件，将该事件放入请求队列
+/* 读缓冲中已有新数据，投递请求 */
+void WebServer::deal_request(int sockfd)
+{
+    util_timer *timer = users_timer[sockfd].timer;
+    char addr[INET_ADDRSTRLEN];
+    LOG_INFO_RATE(LOG_REQUEST_RATE, "deal with the client(%s)",
+        inet_ntop(AF_INET, &users[sockfd].get_address()->sin_addr, addr, sizeof(addr)));
+
+    // 内部路由（/metrics、/trace）在主线程处理，其余请求放入请求队列
+    if(!users[sockfd].process_internal()) {
+        users[sockfd].m_span.stamp(T_ENQUEUE);
         m_pool->append_p(users + sockfd);
+    }
 
-        if(timer) {
-            adjust_timer(timer);
+    if(timer) {
+        adjust_timer(timer);
+    }
+}
+
+/* 异步数据库操作完成，将请求重新投递到线程池；队列已满时关闭连接，不在主线程中处理请求 */
+void WebServer::deal_db_done()
+{
+    http_conn::take_db_done(m_db_done);
+    for(size_t i = 0; i < m_db_done.size(); ++i) {
+        int sockfd = m_db_done[i] - users;
+        if(!m_pool->append_p(m_db_done[i])) {
+            LOG_ERROR("request queue full, close fd %d", sockfd);
+            deal_timer(users_timer[sockfd].timer, sockfd);
         }
     }
-    else {
-        deal_timer(timer, sockfd);
+    m_db_done.clear();
+}
+
+/* 采样仍在等待 EPOLLOUT 的连接，发送窗口长时间为 0 的连接不会再写到 EAGAIN */
+void WebServer::sample_stalled()
+{
+    // 工作线程先写时受阻的连接
+    std::vector<int> stalled;
+    http_conn::take_stalled(stalled);
+    m_stalled.insert(stalled.begin(), stalled.end());
+
+    long long now = trace_now();
+    for(std::set<int>::iterator it = m_stalled.begin(); it != m_stalled.end();) {
+        if(users[*it].write_stalled()) {
+            users[*it].sample_tcp(now);
+            ++it;
+        }
+        else {
+            m_stalled.erase(it++);
+        }
     }
 }
 
 void WebServer::deal_write(int sockfd)
 {
     util_timer *timer = users_timer[sockfd].timer;
+    WS_PROBE1(deal_write, sockfd);
 
     /* Proactor */
     if(users[sockfd].write()) {
-        LOG_INFO("send data to the client(%s)", inet_ntoa(users[sockfd].get_address()->sin_addr));
+        if(tcp_stats::enabled() && users[sockfd].write_stalled()) {
+            m_stalled.insert(sockfd);
+        }
+        char addr[INET_ADDRSTRLEN];
+        LOG_INFO_RATE(LOG_REQUEST_RATE, "send data to the client(%s)",
+            inet_ntop(AF_INET, &users[sockfd].get_address()->sin_addr, addr, sizeof(addr)));
 
         if(timer) {
             adjust_timer(timer);
         }
+        WS_PROBE2(deal_write_return, sockfd, 1);
     }
     else {
         deal_timer(timer, sockfd);
+        WS_PROBE2(deal_write_return, sockfd, 0);
+    }
+}
+
+void WebServer::deal_events(int number, bool &timeout, bool &stop_server)
+{
+    for(int i = 0; i < number; i++) {
+        int sockfd = events[i].data.fd;
+
+        // 处理新到的客户连接
+        if(sockfd == m_listenfd) {
+            bool flag = deal_client_data();
+            if(false == flag) {
+                continue;
+            }
+        }
+        // 处理存储后端（非阻塞数据库连接）上的事件
+        else if(m_store->owns(sockfd)) {
+            m_store->handle_event(sockfd, events[i].events);
+        }
+        // 异步数据库操作完成，恢复等待的请求
+        else if(sockfd == m_db_done_fd) {
+            deal_db_done();
+        }
+        // 处理异常事件。服务器端关闭连接，移除对应的定时器
+        else if(events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+            util_timer *timer = users_timer[sockfd].timer;
+            deal_timer(timer, sockfd);
+        }
+        // 处理定时器信号
+        else if((sockfd == m_pipefd[0]) && (events[i].events & EPOLLIN)) {
+            bool flag = deal_signal(timeout, stop_server);
+            if(false == flag) {
+                LOG_ERROR("%s", "deal client data failure");
+            }
+        }
+        // 处理客户连接上接收到的数据
+        else if(events[i].events & EPOLLIN) {
+            deal_read(sockfd);
+        }
+        else if(events[i].events & EPOLLOUT) {
+            deal_write(sockfd);
+        }
     }
 }
 
@@ -251,53 +532,292 @@ void WebServer::event_loop()
     bool timeout = false;
     bool stop_server = false;
 
+    metrics *m = metrics::get_instance();
+    loop_watchdog *watchdog = loop_watchdog::get_instance();
+    if(!watchdog->init(m_stall_ms, m_close_log)) {
+        LOG_ERROR("%s", "start event loop watchdog error");
+    }
+
     while(!stop_server) {
-        int number = epoll_wait(m_epollfd, events, MAX_EVENT_NUMBER, -1);
-        if(number < 0 && errno != EINTR) {
-            LOG_ERROR("%s", "epoll failure");
-            break;
+        int number = 0;
+        if(m_uring) {
+            // 提交本轮准备的请求并等待完成；epoll 上可能还有事件时不等待
+            if(uring::get_instance()->wait(!m_epoll_ready) < 0) {
+                LOG_ERROR("%s", "io_uring failure");
+                break;
+            }
+        }
+        else {
+            number = epoll_wait(m_epollfd, events, MAX_EVENT_NUMBER, -1);
+            m->add(M_SYS_EPOLL_WAIT);
+            if(number < 0 && errno != EINTR) {
+                LOG_ERROR("%s", "epoll failure");
+                break;
+            }
         }
 
-        for(int i = 0; i < number; i++) {
-            int sockfd = events[i].data.fd;
+        // 本轮开始，由监测线程检查是否卡顿；定时器使用的秒级时间每轮只取一次
+        long long start = trace_now();
+        m_now = time(NULL);
+        watchdog->begin(start);
 
-            // 处理新到的客户连接
-            if(sockfd == m_listenfd) {
-                bool flag = deal_client_data();
-                if(false == flag) {
-                    continue;
-                }
-            }
-            // 处理异常事件。服务器端关闭连接，移除对应的定时器
-            else if(events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
-                util_timer *timer = users_timer[sockfd].timer;
-                deal_timer(timer, sockfd);
-            }
-            // 处理定时器信号
-            else if((sockfd == m_pipefd[0]) && (events[i].events & EPOLLIN)) {
-                bool flag = deal_signal(timeout, stop_server);
-                if(false == flag) {
-                    LOG_ERROR("%s", "deal client data failure");
-                }
-            }
-            // 处理客户连接上接收到的数据
-            else if(events[i].events & EPOLLIN) {
-                deal_read(sockfd);
-            }
-            else if(events[i].events & EPOLLOUT) {
-                deal_write(sockfd);
-            }
+        if(m_uring) {
+            deal_completions(timeout, stop_server);
+        }
+        else {
+            deal_events(number, timeout, stop_server);
         }
 
+        long long events_end = trace_now();
+        m->record(H_LOOP_EVENTS, (events_end - start) / 1000);
+
         // 处理定时器为非必须事件，收到信号并不是立马处理
         // 完成读写事件后，再进行处理
+        long long end = events_end;
         if(timeout) {
+            watchdog->phase(loop_watchdog::PHASE_TIMERS);
             utils.timer_handler();
 
             LOG_INFO("%s", "timer tick");
+            m_store->log_stats();
+            sample_stalled();
+            client_tracker::get_instance()->tick(m_now);
 
             timeout = false;
+            end = trace_now();
+            m->record(H_LOOP_TIMERS, (end - events_end) / 1000);
+        }
+
+        watchdog->end();
+        m->record(H_LOOP, (end - start) / 1000);
+    }
+}
+
+
+/* io_uring 后端：处理本轮的完成事件，再处理投递的事件，最后投递读到数据的连接 */
+void WebServer::deal_completions(bool &timeout, bool &stop_server)
+{
+    uring *ring = uring::get_instance();
+    struct io_uring_cqe cqe;
+    while(ring->next(cqe)) {
+        switch(uring::op_of(cqe.user_data)) {
+            case uring::OP_ACCEPT: {
+                uring_accept(cqe);
+                break;
+            }
+            case uring::OP_RECV: {
+                uring_recv(cqe);
+                break;
+            }
+            case uring::OP_SEND: {
+                uring_send(cqe);
+                break;
+            }
+            case uring::OP_NOTIFY: {
+                ring->arm_notify();
+                break;
+            }
+            case uring::OP_POLL: {
+                if(!(cqe.flags & IORING_CQE_F_MORE)) {
+                    ring->poll(m_epollfd);
+                }
+                m_epoll_ready = true;
+                break;
+            }
+            case uring::OP_PROVIDE: {
+                LOG_ERROR("provide receive buffers failed, errno is %d", -cqe.res);
+                break;
+            }
+        }
+    }
+
+    // 信号管道和存储后端；水平触发的描述符不会再次唤醒 poll，取到 epoll 为空为止
+    if(m_epoll_ready) {
+        int number = epoll_wait(m_epollfd, events, MAX_EVENT_NUMBER, 0);
+        metrics::get_instance()->add(M_SYS_EPOLL_WAIT);
+        m_epoll_ready = number > 0;
+        deal_events(number, timeout, stop_server);
+    }
+
+    // 投递请求、处理投递的事件都可能产生新的事件，直到两者都为空
+    while(true) {
+        for(size_t i = 0; i < m_ready.size(); ++i) {
+            uring_ready(m_ready[i]);
+        }
+        m_ready.clear();
+        if(!ring->take(m_notices)) {
+            break;
+        }
+        for(size_t i = 0; i < m_notices.size(); ++i) {
+            uring_notice(m_notices[i]);
+        }
+    }
+}
+
+void WebServer::uring_accept(const struct io_uring_cqe &cqe)
+{
+    uring *ring = uring::get_instance();
+    // 出错等原因结束了多次 accept，重新提交
+    if(!(cqe.flags & IORING_CQE_F_MORE)) {
+        ring->accept(m_listenfd);
+    }
+    if(cqe.res < 0) {
+        if(cqe.res != -EAGAIN && cqe.res != -ECANCELED) {
+            metrics::get_instance()->add(M_ACCEPT_ERRORS);
+        }
+        LOG_ERROR_RATE(LOG_REQUEST_RATE, "%s: errno is %d", "accept error", -cqe.res);
+        return;
+    }
+
+    int connfd = cqe.res;
+    // 多次 accept 的各次完成共用一个地址缓冲区，从 socket 取对端地址
+    struct sockaddr_in client_address;
+    socklen_t client_addrlen = sizeof(client_address);
+    memset(&client_address, 0, sizeof(client_address));
+    getpeername(connfd, (struct sockaddr *)&client_address, &client_addrlen);
+    metrics::get_instance()->add(M_SYS_GETPEERNAME);
+    if(accept_conn(connfd, client_address) > 0) {
+        ring->open(connfd);
+        ring->recv(connfd);
+    }
+}
+
+void WebServer::uring_recv(const struct io_uring_cqe &cqe)
+{
+    uring *ring = uring::get_instance();
+    int sockfd = uring::fd_of(cqe.user_data);
+    // 连接已关闭，完成事件属于旧连接
+    if(!ring->current(cqe)) {
+        ring->recycle(cqe);
+        return;
+    }
+    uring::conn_io &c = ring->conn(sockfd);
+    if(!(cqe.flags & IORING_CQE_F_MORE)) {
+        c.recving = false;
+    }
+
+    if(cqe.res > 0) {
+        const char *buf = ring->buffer(cqe);
+        int n = 0;
+        if(!c.busy) {
+            n = users[sockfd].feed(buf, cqe.res);
+            if(n > 0 && !c.ready) {
+                c.ready = true;
+                m_ready.push_back(sockfd);
+            }
+        }
+        // 请求处理中收到的数据先暂存，同一时刻只处理一个请求，最多暂存一个读缓冲区
+        if(n >= 0 && n < cqe.res) {
+            c.stash.append(buf + n, cqe.res - n);
+        }
+        ring->recycle(cqe);
+        if(n < 0 || c.stash.size() > http_conn::READ_BUFFER_SIZE) {
+            deal_timer(users_timer[sockfd].timer, sockfd);
+            return;
+        }
+        if(!c.recving) {
+            ring->recv(sockfd);
         }
+        return;
     }
+    // 接收缓冲区暂时用完，重新提交
+    if(cqe.res == -ENOBUFS) {
+        ring->recv(sockfd);
+        return;
+    }
+    // 对方关闭连接或出错
+    deal_timer(users_timer[sockfd].timer, sockfd);
 }
 
+void WebServer::uring_send(const struct io_uring_cqe &cqe)
+{
+    uring *ring = uring::get_instance();
+    int sockfd = uring::fd_of(cqe.user_data);
+    if(!ring->current(cqe)) {
+        return;
+    }
+    util_timer *timer = users_timer[sockfd].timer;
+    if(cqe.res < 0) {
+        users[sockfd].send_failed();
+        deal_timer(timer, sockfd);
+        return;
+    }
+
+    bool done;
+    if(!users[sockfd].sent(cqe.res, done)) {
+        deal_timer(timer, sockfd);
+        return;
+    }
+    // 发送被信号等中断，继续发送剩余部分
+    if(!done) {
+        struct iovec *iov;
+        int count = users[sockfd].send_iov(&iov);
+        ring->send(sockfd, iov, count);
+    }
+    char addr[INET_ADDRSTRLEN];
+    LOG_INFO_RATE(LOG_REQUEST_RATE, "send data to the client(%s)",
+        inet_ntop(AF_INET, &users[sockfd].get_address()->sin_addr, addr, sizeof(addr)));
+    if(timer) {
+        adjust_timer(timer);
+    }
+}
+
+void WebServer::uring_notice(const uring::notice &n)
+{
+    uring *ring = uring::get_instance();
+    uring::conn_io &c = ring->conn(n.fd);
+    if(!c.open) {
+        return;
+    }
+    if(n.ev == 0) {
+        deal_timer(users_timer[n.fd].timer, n.fd);
+        return;
+    }
+    // 不在处理请求的连接不会有 EPOLLIN、EPOLLOUT，是关闭前的旧连接投递的
+    if(!c.busy) {
+        return;
+    }
+
+    if(n.ev & EPOLLOUT) {
+        struct iovec *iov;
+        int count = users[n.fd].send_iov(&iov);
+        if(count > 0) {
+            ring->send(n.fd, iov, count);
+        }
+        // 没有待发送的数据，与 epoll 后端相同，由 write() 结束响应
+        else if(!users[n.fd].write()) {
+            deal_timer(users_timer[n.fd].timer, n.fd);
+        }
+        return;
+    }
+
+    // 请求处理完或需要更多数据，处理暂存的数据
+    c.busy = false;
+    if(!c.stash.empty()) {
+        int fed = users[n.fd].feed(c.stash.data(), c.stash.size());
+        if(fed < 0) {
+            deal_timer(users_timer[n.fd].timer, n.fd);
+            return;
+        }
+        c.stash.erase(0, fed);
+        if(!c.ready) {
+            c.ready = true;
+            m_ready.push_back(n.fd);
+        }
+    }
+    if(!c.recving) {
+        ring->recv(n.fd);
+    }
+}
+
+void WebServer::uring_ready(int sockfd)
+{
+    uring::conn_io &c = uring::get_instance()->conn(sockfd);
+    // 投递前连接已关闭
+    if(!c.open || !c.ready) {
+        return;
+    }
+    c.ready = false;
+    c.busy = true;
+    deal_request(sockfd);
+}
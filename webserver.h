@@ -10,35 +10,92 @@
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <sys/epoll.h>
+#include <netinet/tcp.h>
+#include <set>
+#include <vector>
 
 #include "./threadpool/threadpool.h"
+#include "./storage/memory_store.h"
+#include "./storage/file_store.h"
+#ifdef USE_MYSQL
+#include "./CGImysql/sql_user_store.h"
+#endif
 #include "./http/http_conn.h"
+#include "./trace/probes.h"
+#include "./trace/watchdog.h"
+#include "./trace/profiler.h"
 
 const int MAX_FD = 65536;           // 最大文件描述符
 const int MAX_EVENT_NUMBER = 10000; // 最大事件数
 const int TIMESLOT = 5;             // 最小超时单位
 
+// 服务器配置，由 main 根据环境变量和命令行参数填写
+struct server_config {
+    int port;                   // 端口号
+    int thread_num;             // 线程池线程数量
+    int close_log;              // 是否关闭日志
+    int log_binary;             // 是否写二进制日志
+    int log_level;              // 输出的最低日志级别
+    std::string log_overflow;   // 日志缓冲区满时的策略，冒号后为最长等待时间
+    int log_split_mb;           // 日志文件按大小切分（MB），0 为不按大小切分
+    int log_compress;           // 是否压缩旧日志文件
+    std::string log_keep;       // 保留的日志文件数，冒号后为总大小（MB）
+    int access;                 // 访问日志格式，0 为关闭
+    int expose;                 // /metrics 的访问范围
+    std::string trace;          // 请求追踪采样率，冒号后为慢请求阈值（毫秒）
+    int stall_ms;               // 事件循环卡顿阈值（毫秒）
+    int profile_hz;             // CPU 分析器采样频率，0 为关闭
+    int tcp_sample_ms;          // TCP_INFO 采样间隔（毫秒），0 为关闭
+    int notsent_lowat;          // TCP_NOTSENT_LOWAT，0 为系统默认
+    int ip_conn_cap;            // 单 IP 连接上限，0 为不限制
+    std::string io;             // epoll 或 uring
+    int sql_num;                // 数据库连接池最大连接数量
+    int sql_min;                // 数据库连接池最小连接数量
+    int async_num;              // 非阻塞数据库连接数量，0 为关闭
+    int batch_num;              // 注册组提交每批最多行数，0 为关闭
+    int load_num;               // 启动时并行加载用户表的线程数
+    std::string snapshot;       // 用户表快照文件，空为不使用
+    std::string storage;        // 用户存储：mysql、memory、file 或 file:<路径>
+    std::string db_host;        // 数据库主机地址
+    int db_port;                // 数据库端口号
+    std::string user;           // 数据库登录用户名
+    std::string password;       // 数据库登录密码
+    std::string dbname;         // 使用的数据库名称
+};
+
 class WebServer {
 public:
     WebServer();
     ~WebServer();
 
-    void init(int port, int thread_num, int close_log, int sql_num, 
-        std::string user, std::string password, std::string dbname);
+    void init(const server_config &config);
 
     void thread_pool();
     void log_write();
-    void sql_pool();
+    void user_store();
     void event_listen();
     void event_loop();
     bool deal_client_data();
+    int accept_conn(int connfd, struct sockaddr_in &client_address);
+    void deal_events(int number, bool &timeout, bool &stop_server);
     bool deal_signal(bool &timeout, bool &stop_server);
     void deal_read(int sockfd);
+    void deal_request(int sockfd);
+    void deal_db_done();
     void deal_write(int sockfd);
+    void sample_stalled();
     void timer(int connfd, struct sockaddr_in client_address);
     void adjust_timer(util_timer *timer);
     void deal_timer(util_timer *timer, int sockfd);
 
+    /* io_uring 后端 */
+    void deal_completions(bool &timeout, bool &stop_server);
+    void uring_accept(const struct io_uring_cqe &cqe);
+    void uring_recv(const struct io_uring_cqe &cqe);
+    void uring_send(const struct io_uring_cqe &cqe);
+    void uring_notice(const uring::notice &n);
+    void uring_ready(int sockfd);
+
 public:
     /* 基础连接 */
     int m_port;     // 端口号
@@ -49,13 +106,34 @@ public:
 
     /* 日志 */
     int m_close_log;
+    int m_log_binary;   // 写二进制日志，由 logdecode 还原
+    int m_log_level;    // 启动时的日志级别，运行中由 SIGUSR1/SIGUSR2 调整
+    std::string m_log_overflow; // 日志缓冲区满时的策略：block[:毫秒]、drop 或 droplow[:毫秒]
+    int m_log_split_mb;         // 每个日志文件的最大大小（MB），0 为不限
+    int m_log_compress;         // 压缩切分出的旧日志文件
+    std::string m_log_keep;     // 最多保留的日志文件数[:总大小 MB]，0 为不限
+    int m_access;               // 访问日志：0 关闭，1 TSV，2 二进制
+    int m_stall_ms;             // 事件循环卡顿阈值（毫秒），0 为不监测
+    int m_profile_hz;           // CPU 分析器的采样频率，0 为关闭
+    int m_notsent_lowat;        // TCP_NOTSENT_LOWAT（KB），0 为使用系统设置
+    std::set<int> m_stalled;    // 发送受阻的连接，定时器周期采样 TCP_INFO
+    int m_db_done_fd;           // 异步数据库操作完成时唤醒主线程
+    std::vector<http_conn *> m_db_done; // 本轮完成、待重新投递的连接
 
-    /* 数据库相关 */
-    Connection_pool *m_conn_pool;
+    /* 凭据存储相关 */
+    User_store *m_store;        // 凭据存储
+    std::string m_storage;      // 存储后端：mysql、memory 或 file[:路径]
+    std::string m_db_host;      // 数据库主机地址
+    int m_db_port;              // 数据库端口号
     std::string m_user;         // 登录数据库用户名 
     std::string m_password;     // 登录数据库密码
     std::string m_dbname;       // 数据库名
-    int m_sql_num;              // 数据库连接数量
+    int m_sql_num;              // 数据库连接池最大连接数量
+    int m_sql_min;              // 数据库连接池最小连接数量
+    int m_async_num;            // 非阻塞数据库连接数量，0为关闭
+    int m_batch_num;            // 注册组提交的最大行数，0为关闭
+    int m_load_num;             // 启动时并行加载用户表的线程数
+    std::string m_snapshot;     // 用户表快照文件路径，空为关闭
 
     /* 线程池 */
     int m_thread_num;               // 线程数量，默认设为8
@@ -65,10 +143,18 @@ public:
     int m_epollfd;
     int m_listenfd;
     epoll_event events[MAX_EVENT_NUMBER];
+
+    /* 连接 I/O 后端 */
+    std::string m_io;               // epoll 或 uring
+    bool m_uring;                   // io_uring 后端是否创建成功
+    bool m_epoll_ready;             // io_uring 后端：信号管道、存储后端的 epoll 上可能还有事件
+    std::vector<uring::notice> m_notices;   // 本轮取出的工作线程事件
+    std::vector<int> m_ready;       // 本轮读到数据、待投递的连接
     
     /* 定时器相关 */
     client_data *users_timer;
     Utils utils;
+    time_t m_now;                   // 本轮开始时的时间，设置、调整定时器时使用
 };
 
 #endif
\ No newline at end of file